@@ -0,0 +1,51 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+#include "smp.h"
+
+typedef struct {
+    char signature[8];                  // "RSD PTR "
+    uint8 checksum;
+    char oem_id[6];
+    uint8 revision;
+    uint32 rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32 length;
+    uint8 revision;
+    uint8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32 oem_revision;
+    uint32 creator_id;
+    uint32 creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/* MADT entry types */
+#define MADT_LOCAL_APIC     0
+#define MADT_IO_APIC        1
+#define MADT_ISO            2           // ISA interrupt source override
+#define MADT_LAPIC_ENABLED  0x01
+
+#define ISA_IRQS            16
+
+/* What the MADT told us, with identity ISA routing where it said nothing */
+typedef struct {
+    uint32 lapic_phys;
+    uint32 cpu_count;
+    uint8 cpu_apic_ids[MAX_CPUS];
+    uint32 ioapic_phys;                 // 0 if there is none
+    uint32 ioapic_gsi_base;
+    uint32 isa_gsi[ISA_IRQS];
+    uint16 isa_flags[ISA_IRQS];         // MPS polarity (bits 0-1) and trigger (bits 2-3)
+} acpi_madt_info_t;
+
+/* Functions implemented in acpi.c */
+bool acpi_init();
+acpi_header_t *acpi_find_table(const char *signature);
+const acpi_madt_info_t *acpi_madt();
+
+#endif
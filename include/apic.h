@@ -0,0 +1,29 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+
+/* Vectors above the ISA range for inter-processor interrupts */
+#define IPI_RESCHEDULE      0xF0
+#define IPI_HALT            0xF1
+#define IPI_BENCH           0xF2            // self-IPI for the bench irq round trip
+#define IPI_PROFILE         0xF3            // start or stop the profiler's timer
+#define PROFILE_TIMER       0xF4            // local APIC timer, for the profiler
+#define APIC_SPURIOUS       0xFF
+
+/* Functions implemented in apic.c */
+bool apic_init();
+void lapic_init();
+bool apic_active();
+uint32 lapic_id();
+void lapic_eoi();
+void lapic_send_ipi(uint32 apic_id, uint8 vector);
+void lapic_send_ipi_others(uint8 vector);
+void lapic_send_nmi_others();
+bool lapic_timer_start(uint8 vector, uint32 hz);
+void lapic_timer_stop();
+bool lapic_start_ap(uint32 apic_id, uint32 trampoline_phys, volatile bool *started);
+void ioapic_mask(uint8 irq);
+void ioapic_unmask(uint8 irq);
+
+#endif
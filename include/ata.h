@@ -0,0 +1,29 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "types.h"
+
+#define ATA_PRIMARY_IO      0x1F0
+#define ATA_PRIMARY_CTRL    0x3F6
+#define ATA_PRIMARY_IRQ     14
+#define ATA_SECONDARY_IO    0x170
+#define ATA_SECONDARY_CTRL  0x376
+#define ATA_SECONDARY_IRQ   15
+#define ATA_TIMEOUT_MS      5000            // a command that has not finished by then failed
+#define ATA_FLUSH_TIMEOUT_MS 30000          // a cache flush may take this long
+#define ATA_PRD_ENTRIES     128
+
+typedef struct {
+    uint32 dma_transfers;
+    uint32 pio_transfers;
+    uint32 flushes;
+    uint32 timeouts;
+    uint32 resets;                          // of a channel, after a timeout
+    uint32 deferred;                        // waited for the other drive on the channel
+} ata_stats_t;
+
+/* Functions implemented in ata.c */
+void ata_init();
+const ata_stats_t *ata_stats();
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+#include "blk.h"
+
+#define BCACHE_BLOCK        4096            // bytes, one page
+#define BCACHE_SECTORS      (BCACHE_BLOCK / BLK_SECTOR_SIZE)
+#define BCACHE_ORDER        8               // 2^8 pages of buffers, 1 MiB
+#define BCACHE_BUFFERS      (1 << BCACHE_ORDER)
+#define BCACHE_BUCKETS      128             // a power of two
+#define BCACHE_READAHEAD    8               // blocks queued behind a miss
+#define BCACHE_FLUSH_MS     5000            // dirty buffers are written back at least this often
+
+#define BUF_VALID   0x01
+#define BUF_DIRTY   0x02
+#define BUF_IO      0x04                    // a read or write is in flight
+#define BUF_ERROR   0x08
+
+typedef struct buf {
+    blk_device_t *dev;
+    uint32 block;
+    uint8 *data;
+    volatile uint32 flags;
+    uint32 refs;
+    struct buf *hash_next;
+    struct buf *lru_prev;                   // most recently used at the head
+    struct buf *lru_next;
+    blk_request_t req;
+} buf_t;
+
+typedef struct {
+    uint32 hits;
+    uint32 misses;
+    uint32 readahead;                       // blocks read before they were asked for
+    uint32 readahead_hits;
+    uint32 writebacks;
+    uint32 evictions;
+} bcache_stats_t;
+
+/*
+ * Functions implemented in bcache.c, from threads only. bread returns the
+ * block held, or 0 on a read error; change it, bdirty it and brelse it.
+ */
+void bcache_init();
+buf_t *bread(blk_device_t *dev, uint32 block);
+void bdirty(buf_t *buf);
+void brelse(buf_t *buf);
+void bsync(bool wait);
+const bcache_stats_t *bcache_stats();
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+#include "pmu.h"
+
+#define BENCH_SAMPLES   200                 // timed samples, enough for a p99
+#define BENCH_WARMUP    20                  // untimed samples run first
+#define BENCH_SYSCALL_BATCH 100             // null system calls per sample, from user/sysbench.c
+
+/*
+ * One benchmark. A sample times run(batch, arg) and divides by batch,
+ * so batch is sized to make a sample long enough for rdtsc to resolve.
+ * setup runs once before the warmup and may refuse, teardown runs once
+ * after the last sample. A benchmark without run is measured from user
+ * space: setup starts the program, which hands its samples back through
+ * bench_user_samples.
+ */
+typedef struct {
+    const char *name;
+    const char *what;
+    uint32 batch;
+    uint32 arg;
+    bool (*setup)(uint32 arg);
+    void (*run)(uint32 n, uint32 arg);
+    void (*teardown)();
+} bench_t;
+
+typedef struct {
+    uint32 min;                             // cycles per operation
+    uint32 median;
+    uint32 p99;
+    uint32 max;
+    bool counted;                           // pmc holds the timed samples' counts
+    pmu_counts_t pmc;
+} bench_result_t;
+
+/* Functions implemented in bench.c */
+void bench_list();
+bool bench_run(const char *name);
+void bench_all();
+void bench_user_samples(const uint32 *v, uint32 n);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include "types.h"
+#include "spinlock.h"
+
+#define BLK_SECTOR_SIZE     512
+#define BLK_MAX_SECTORS     256             // per transfer, also the LBA28 limit
+#define BLK_MAX_SEGMENTS    32              // requests merged into one transfer
+#define BLK_MAX_DEVICES     8
+
+#define BLK_PENDING         1
+#define BLK_OK              0
+#define BLK_ERROR           (-1)
+
+/*
+ * A request reads or writes count sectors at lba to or from buf, which
+ * must sit in the direct map, or with flush has the device write back
+ * its cache and uses none of them. done, if set, is called once status
+ * is final, possibly from interrupt context.
+ */
+typedef struct blk_request {
+    uint32 lba;
+    uint32 count;
+    uint8 *buf;
+    bool write;
+    bool flush;
+    volatile int status;
+    void (*done)(struct blk_request *req);
+    void *private;
+    struct blk_request *next;
+} blk_request_t;
+
+typedef struct {
+    uint32 requests;
+    uint32 merged;                          // requests that rode along in another's transfer
+    uint32 transfers;
+    uint32 sectors;
+    uint32 errors;
+} blk_stats_t;
+
+/*
+ * A driver fills in name, sectors and start. start is called with the
+ * queue lock held whenever requests are waiting and the device is idle.
+ * It takes a transfer with blk_next_transfer, sets busy and hands the
+ * requests to blk_complete when they are done, which may be before it
+ * returns. The layer then calls it again for the next transfer. A
+ * driver that cannot start yet sets busy without taking anything and
+ * calls blk_restart once it can.
+ */
+typedef struct blk_device {
+    char name[8];
+    const char *desc;                       // model and transfer mode, for the disks command
+    uint32 sectors;
+    void (*start)(struct blk_device *dev);
+    void *driver;
+
+    spinlock_t lock;
+    blk_request_t *queue;                   // in C-LOOK order from position
+    uint32 position;                        // the sector after the last transfer
+    bool busy;
+    bool running;                           // inside the start loop
+    blk_stats_t stats;
+} blk_device_t;
+
+/* Functions implemented in blk.c */
+void blk_register(blk_device_t *dev);
+uint32 blk_count();
+blk_device_t *blk_device(uint32 index);
+blk_device_t *blk_find(const char *name);
+void blk_submit(blk_device_t *dev, blk_request_t *reqs);
+blk_request_t *blk_next_transfer(blk_device_t *dev, uint32 *lba, uint32 *count);
+void blk_complete(blk_device_t *dev, blk_request_t *reqs, int status);
+void blk_restart(blk_device_t *dev);
+int blk_rw(blk_device_t *dev, uint32 lba, uint32 count, void *buf, bool write);
+int blk_flush(blk_device_t *dev);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+#include "types.h"
+
+#define BOOTPROF_PHASES 64
+
+typedef struct {
+    const char *name;
+    uint64 tsc;                             // when the phase ended
+} bootprof_mark_t;
+
+/* TSC read by start in kernel.asm, before paging is on */
+extern uint64 boot_tsc;
+
+/*
+ * Functions implemented in bootprof.c. bootprof_mark ends the phase it
+ * names, which began at the previous mark (or at start). Marks past
+ * BOOTPROF_PHASES are ignored.
+ */
+void bootprof_mark(const char *name);
+uint32 bootprof_count();
+const bootprof_mark_t *bootprof_marks();
+
+#endif
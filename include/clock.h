@@ -0,0 +1,24 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+#define HZ              1000            // system tick rate
+#define PIT_FREQUENCY   1193182
+#define NSEC_PER_USEC   1000
+#define NSEC_PER_MSEC   1000000
+#define NSEC_PER_TICK   (1000000000 / HZ)
+
+#define CLOCK_NOT_ARMED 0xFFFFFFFFFFFFFFFFULL
+
+/* Functions implemented in clock.c */
+void clock_init();
+uint64 ktime_ns();
+uint64 clock_ticks();
+uint64 tsc_to_ns(uint64 cycles);
+uint32 tsc_khz();
+void clock_delay_us(uint32 us);
+void clock_set_next_event(uint64 tick);
+bool clock_tickless();
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "types.h"
+#include "vm.h"
+
+#define ELF_MAGIC       0x464C457F          // "\x7FELF" read as a little endian word
+#define ELF_CLASS32     1
+#define ELF_DATA_LSB    1
+#define ELF_TYPE_EXEC   2
+#define ELF_MACHINE_386 3
+#define ELF_PT_LOAD     1
+#define ELF_PF_X        0x1
+#define ELF_PF_W        0x2
+#define ELF_PF_R        0x4
+
+typedef struct {
+    uint32 magic;
+    uint8 class;
+    uint8 data;
+    uint8 version;
+    uint8 pad[9];
+    uint16 type;
+    uint16 machine;
+    uint32 version2;
+    uint32 entry;
+    uint32 phoff;
+    uint32 shoff;
+    uint32 flags;
+    uint16 ehsize;
+    uint16 phentsize;
+    uint16 phnum;
+    uint16 shentsize;
+    uint16 shnum;
+    uint16 shstrndx;
+} __attribute__((packed)) elf_header_t;
+
+typedef struct {
+    uint32 type;
+    uint32 offset;
+    uint32 vaddr;
+    uint32 paddr;
+    uint32 filesz;
+    uint32 memsz;
+    uint32 flags;
+    uint32 align;
+} __attribute__((packed)) elf_phdr_t;
+
+/*
+ * Functions implemented in elf.c. The image must stay in memory for as
+ * long as mm lives (the initrd does): its segments are only mapped, and
+ * read from it a page at a time as they fault in.
+ */
+bool elf_load(mm_t *mm, const uint8 *image, uint32 size, uint32 *entry, uint32 *end);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define FONT_WIDTH          8
+#define FONT_HEIGHT         16              // font8x8 rows drawn twice
+#define FBCON_GLYPH_CACHE   256             // rasterized (character, attribute) pairs
+#define FBCON_DIRTY_RECTS   8
+
+typedef struct {
+    uint32 glyph_hits;
+    uint32 glyph_misses;
+    uint32 flushes;
+    uint32 rects;
+    uint32 bytes;                           // written to the framebuffer
+    uint32 scrolls;
+} fbcon_stats_t;
+
+/*
+ * Functions implemented in fbcon.c. Cells use the VGA text layout,
+ * character in the low byte and attribute in the high byte. Callers
+ * serialize, screen.c holds its console lock around all of them.
+ */
+bool fbcon_init(multiboot_info_t *mbi);
+bool fbcon_active();
+uint32 fbcon_cols();
+uint32 fbcon_rows();
+void fbcon_putcell(uint32 x, uint32 y, uint16 cell);
+void fbcon_cursor(uint32 x, uint32 y);
+void fbcon_scroll(uint16 blank);
+void fbcon_flush();
+void fbcon_mode(uint32 *width, uint32 *height, uint32 *bpp);
+const fbcon_stats_t *fbcon_stats();
+
+#endif
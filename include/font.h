@@ -0,0 +1,14 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include "types.h"
+
+#define FONT_FIRST  0x20
+#define FONT_GLYPHS 95                  // 0x20 - 0x7E
+
+extern const uint8 font8x8[FONT_GLYPHS + 1][8];
+
+/* Functions implemented in font.c */
+const uint8 *font_glyph(uint8 c);
+
+#endif
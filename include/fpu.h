@@ -0,0 +1,14 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "sched.h"
+
+#define MXCSR_DEFAULT 0x1F80                // all SIMD exceptions masked
+
+/* Functions implemented in fpu.c */
+void fpu_init();
+void fpu_switch_out(thread_t *prev);
+bool fpu_sse();
+
+#endif
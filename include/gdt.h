@@ -0,0 +1,52 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "types.h"
+
+/* Selectors, the same on every cpu. Each cpu loads its own GDT, whose
+   percpu segment is based at that cpu's cpu_t and is in %gs whenever
+   the kernel runs, and its own TSS for the stack of ring 3 entries. */
+#define SEG_KERNEL_CODE 0x08
+#define SEG_KERNEL_DATA 0x10
+#define SEG_USER_CODE   0x1B                // RPL 3; SYSEXIT wants these two right after the kernel's
+#define SEG_USER_DATA   0x23
+#define SEG_PERCPU      0x28
+#define SEG_TSS         0x30
+
+#define GDT_ENTRIES     8
+
+typedef struct {
+    uint16 limit_low;
+    uint16 base_low;
+    uint8 base_mid;
+    uint8 access;
+    uint8 granularity;                  // flags in the high nibble, limit 19:16 in the low one
+    uint8 base_high;
+} __attribute__((packed)) gdt_entry_t;
+
+typedef struct {
+    uint16 limit;
+    uint32 base;
+} __attribute__((packed)) gdt_register_t;
+
+/* Only ss0:esp0 is used, the stack a ring 3 interrupt or trap lands on */
+typedef struct {
+    uint32 link;
+    uint32 esp0, ss0;
+    uint32 esp1, ss1;
+    uint32 esp2, ss2;
+    uint32 cr3, eip, eflags;
+    uint32 eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32 es, cs, ss, ds, fs, gs;
+    uint32 ldt;
+    uint16 trap;
+    uint16 iomap_base;                  // past the limit: no I/O bitmap, ring 3 gets no ports
+} __attribute__((packed)) tss_t;
+
+/* Functions implemented in gdt.c */
+void gdt_init_cpu(uint32 cpu, void *percpu, uint32 percpu_size);
+void gdt_set_entry(uint32 cpu, uint32 index, uint32 base, uint32 limit, uint8 access, uint8 flags);
+void gdt_set_kernel_stack(uint32 cpu, uint32 esp0);
+tss_t *gdt_tss(uint32 cpu);
+
+#endif
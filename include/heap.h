@@ -0,0 +1,33 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "types.h"
+
+/* Small allocations come from power-of-two classes HEAP_MIN_CLASS..HEAP_MAX_CLASS
+   bytes (header included); anything larger is page-backed by the frame allocator. */
+#define HEAP_MIN_SHIFT  4
+#define HEAP_MAX_SHIFT  11
+#define HEAP_CLASSES    (HEAP_MAX_SHIFT - HEAP_MIN_SHIFT + 1)
+#define HEAP_MIN_CLASS  (1 << HEAP_MIN_SHIFT)
+#define HEAP_MAX_CLASS  (1 << HEAP_MAX_SHIFT)
+
+typedef struct {
+    uint32 bytes_in_use;        // bytes callers asked for, still live
+    uint32 bytes_allocated;     // class or page size backing those requests
+    uint32 bytes_free_listed;   // freed small blocks parked on class lists
+    uint32 arena_bytes;         // bytes taken from the frame allocator for small classes
+    uint32 large_bytes;         // bytes handed out through the page path
+    uint32 allocs;
+    uint32 frees;
+    uint32 class_in_use[HEAP_CLASSES];
+    uint32 class_free[HEAP_CLASSES];
+} heap_stats_t;
+
+/* Functions implemented in heap.c */
+void heap_init();
+void *kmalloc(uint32 size);
+void *kzalloc(uint32 size);
+void kfree(void *ptr);
+const heap_stats_t *heap_stats();
+
+#endif
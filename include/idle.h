@@ -0,0 +1,13 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "types.h"
+
+/* Functions implemented in idle.c. cpu_idle is entered with interrupts
+   disabled and returns with them enabled, after the waking IRQ ran. */
+void cpu_idle();
+void idle_exit();
+uint64 idle_ns();
+uint32 idle_wakeups();
+
+#endif
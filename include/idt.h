@@ -19,12 +19,13 @@ typedef struct {
 } __attribute__((packed)) idt_register_t;
 
 #define IDT_ENTRIES 256
-idt_gate_t idt[IDT_ENTRIES];
-idt_register_t idt_reg;
+extern idt_gate_t idt[IDT_ENTRIES];
+extern idt_register_t idt_reg;
 
 
 /* Functions implemented in idt.c */
 void set_idt_gate(int n, uint32 handler);
+void set_idt_user_gate(int n, uint32 handler);
 void set_idt();
 
 #endif
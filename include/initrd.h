@@ -0,0 +1,30 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define INITRD_FILE 0
+#define INITRD_DIR  1
+
+/* One tar member. data points into the module itself and is not copied. */
+typedef struct initrd_file {
+    const char *name;                       // no leading "/" or "./", no trailing "/"
+    const uint8 *data;
+    uint32 size;
+    uint8 type;
+    struct initrd_file *next;               // same hash bucket
+} initrd_file_t;
+
+/*
+ * Functions implemented in initrd.c. Paths may start with "/" and
+ * directories may end with one. The index is built once and never
+ * changes, so lookups take no lock.
+ */
+bool initrd_init(multiboot_info_t *mbi);
+const initrd_file_t *initrd_lookup(const char *path);
+const void *initrd_data(const char *path, uint32 *size);
+uint32 initrd_count();
+const initrd_file_t *initrd_file(uint32 index);
+
+#endif
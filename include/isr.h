@@ -3,7 +3,22 @@
 
 #include "types.h"
 
-/* ISRs reserved for CPU exceptions */
+/* Register frame built by the common entry in interrupt.asm */
+typedef struct {
+    uint32 gs;
+    uint32 ds;
+    uint32 edi, esi, ebp, esp, ebx, edx, ecx, eax;     // pusha
+    uint32 int_no, err_code;
+    uint32 eip, cs, eflags, useresp, ss;                // pushed by the cpu
+} registers_t;
+
+typedef void (*isr_t)(registers_t *regs);
+
+/* Hardware IRQs 0-15 are remapped to vectors 32-47 */
+#define IRQ_BASE 32
+#define IRQ_COUNT 16
+
+/* ISRs reserved for CPU exceptions (stubs in interrupt.asm) */
 void isr0();
 void isr1();
 void isr2();
@@ -37,9 +52,45 @@ void isr29();
 void isr30();
 void isr31();
 
+/* Hardware IRQ stubs */
+void irq0();
+void irq1();
+void irq2();
+void irq3();
+void irq4();
+void irq5();
+void irq6();
+void irq7();
+void irq8();
+void irq9();
+void irq10();
+void irq11();
+void irq12();
+void irq13();
+void irq14();
+void irq15();
+
+/* Local APIC vector stubs */
+void ipi_reschedule();
+void ipi_halt_entry();
+void ipi_bench();
+void ipi_profile();
+void profile_timer();
+void apic_spurious();
+
+/* Implemented in interrupt.asm */
+void user_return(registers_t *regs);
+
 
-string exception_messages[32];
+extern string exception_messages[32];
 
 void isr_install();
+void isr_handler(registers_t *regs);
+void irq_handler(registers_t *regs);
+void apic_handler(registers_t *regs);
+void isr_register_handler(int n, isr_t handler);
+void irq_register_handler(int irq, isr_t handler);
+void irq_unregister_handler(int irq);
+uint32 irq_count(int irq);
 
 #endif
@@ -3,6 +3,14 @@
 #include "screen.h"
 #include "util.h"
 
+#define KB_LINE_MAX 200
+#define KB_RING_SIZE 256                // power of two
+
+void kb_init();
+char kb_getchar();
+void kb_input(char c);
+uint32 kb_dropped();
 string readStr();
+void freeStr(string str);
 
 #endif
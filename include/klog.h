@@ -0,0 +1,51 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdarg.h>
+#include "types.h"
+
+/* Message levels, lower is more severe */
+#define KLOG_ERR    3
+#define KLOG_WARN   4
+#define KLOG_INFO   6
+#define KLOG_DEBUG  7
+
+#define KLOG_RECORDS    1024                // a power of two
+#define KLOG_TEXT       108
+#define KLOG_LINE       (KLOG_TEXT + 24)    // text plus timestamp and newline
+
+typedef struct {
+    volatile uint32 seq;                    // sequence + 1 once written, 0 while being written
+    uint8 level;
+    uint8 cpu;
+    uint16 len;
+    uint64 ns;                              // ktime_ns() when logged
+    char text[KLOG_TEXT];
+} klog_record_t;
+
+/*
+ * A sink gets every record at or below max_level as one formatted line,
+ * from the drain worker. It starts at the oldest record still in the
+ * ring, so a sink registered late still sees the boot log.
+ */
+typedef struct klog_sink {
+    const char *name;
+    void (*write)(const char *line, uint32 len);
+    uint8 max_level;
+    uint32 next;                            // next sequence number to deliver
+    uint32 dropped;                         // overwritten before it was delivered
+    struct klog_sink *next_sink;
+} klog_sink_t;
+
+/* Functions implemented in klog.c */
+void klog_init();
+void klog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void vklog(int level, const char *fmt, va_list args);
+void klog_register_sink(klog_sink_t *sink);
+void klog_flush();
+uint32 klog_oldest();
+uint32 klog_head();
+bool klog_read(uint32 seq, klog_record_t *out);
+uint32 klog_format(const klog_record_t *record, char *line, uint32 size);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdarg.h>
+#include "types.h"
+
+#define KPRINTF_BUFFER 256                  // kprintf's stack buffer, one console write per fill
+
+/*
+ * Functions implemented in kprintf.c. Conversions: %d %i %u %x %X %p %s
+ * %c %%, with - and 0 flags, a field width and a precision for %s (either
+ * can be *) and
+ * the l and ll length modifiers. ksnprintf always terminates the buffer
+ * and returns the length the whole output would have had.
+ */
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+int kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include "types.h"
+
+#define KSYM_NONE   0xFFFFFFFF
+
+/*
+ * Functions implemented in ksyms.c. A symbol is found by index, in
+ * address order; an address belongs to the last symbol at or below it,
+ * and to none outside the kernel's code.
+ */
+uint32 ksym_count();
+uint32 ksym_index(uint32 addr);
+const char *ksym_name(uint32 index);
+uint32 ksym_addr(uint32 index);
+const char *ksym_lookup(uint32 addr, uint32 *offset);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "types.h"
+
+/*
+ * Copies and fills at least this long bypass the caches with
+ * non-temporal stores, the data would only evict what is in use
+ */
+#define MEMORY_NT_THRESHOLD (256 * 1024)
+
+/* Functions implemented in memory.c */
+void memory_init();
+const char *memory_variant();
+void *memcpy(void *dest, const void *src, uint32 n);
+void *memmove(void *dest, const void *src, uint32 n);
+void *memset(void *dest, int c, uint32 n);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+/* Value GRUB leaves in EAX when it hands control to start */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* multiboot_info_t.flags: which of the fields below are valid */
+#define MULTIBOOT_INFO_MEMORY    0x00000001
+#define MULTIBOOT_INFO_CMDLINE   0x00000004
+#define MULTIBOOT_INFO_MODS      0x00000008
+#define MULTIBOOT_INFO_MEM_MAP   0x00000040
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x00001000
+
+/* multiboot_info_t.framebuffer_type */
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED  0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB      1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT 2
+
+/* multiboot_mmap_entry_t.type */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct {
+    uint32 flags;
+    uint32 mem_lower;
+    uint32 mem_upper;
+    uint32 boot_device;
+    uint32 cmdline;
+    uint32 mods_count;
+    uint32 mods_addr;
+    uint32 syms[4];
+    uint32 mmap_length;
+    uint32 mmap_addr;
+    uint32 drives_length;
+    uint32 drives_addr;
+    uint32 config_table;
+    uint32 boot_loader_name;
+    uint32 apm_table;
+    uint32 vbe_control_info;
+    uint32 vbe_mode_info;
+    uint16 vbe_mode;
+    uint16 vbe_interface_seg;
+    uint16 vbe_interface_off;
+    uint16 vbe_interface_len;
+    uint64 framebuffer_addr;
+    uint32 framebuffer_pitch;
+    uint32 framebuffer_width;
+    uint32 framebuffer_height;
+    uint8 framebuffer_bpp;
+    uint8 framebuffer_type;
+    uint8 framebuffer_red_field_position;       // RGB type only
+    uint8 framebuffer_red_mask_size;
+    uint8 framebuffer_green_field_position;
+    uint8 framebuffer_green_mask_size;
+    uint8 framebuffer_blue_field_position;
+    uint8 framebuffer_blue_mask_size;
+} __attribute__((packed)) multiboot_info_t;
+
+/* One memory map entry; "size" does not count itself */
+typedef struct {
+    uint32 size;
+    uint64 addr;
+    uint64 len;
+    uint32 type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+typedef struct {
+    uint32 mod_start;
+    uint32 mod_end;
+    uint32 string;
+    uint32 reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+#endif
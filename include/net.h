@@ -0,0 +1,48 @@
+#ifndef NET_H
+#define NET_H
+
+#include "types.h"
+
+#define ETH_ALEN            6
+#define ETH_HLEN            14
+#define ETH_FRAME_MAX       1514            // without the FCS
+#define ETH_TYPE_ARP        0x0806
+#define NET_MAX_DEVICES     4
+#define NET_ARPING_MS       1000
+
+typedef struct {
+    uint32 rx_packets;
+    uint32 rx_bytes;
+    uint32 rx_dropped;                      // no buffer, or too short
+    uint32 tx_packets;
+    uint32 tx_bytes;
+    uint32 tx_dropped;                      // the ring was full
+} net_stats_t;
+
+/*
+ * A network interface. send queues one frame and may refuse when the
+ * device is full; flush hands everything queued to the device at once.
+ * The driver calls net_receive for every frame that arrives, from its
+ * receive work, not from the interrupt.
+ */
+typedef struct net_device {
+    char name[8];
+    const char *desc;
+    uint8 mac[ETH_ALEN];
+    bool (*send)(struct net_device *dev, const void *frame, uint32 len);
+    void (*flush)(struct net_device *dev);
+    void *driver;
+    net_stats_t stats;
+} net_device_t;
+
+/* Functions implemented in net.c */
+void net_register(net_device_t *dev);
+uint32 net_count();
+net_device_t *net_device(uint32 index);
+net_device_t *net_find(const char *name);
+bool net_send(net_device_t *dev, const void *frame, uint32 len);
+void net_flush(net_device_t *dev);
+void net_receive(net_device_t *dev, const uint8 *frame, uint32 len);
+bool net_arping(net_device_t *dev, uint32 src_ip, uint32 dst_ip, uint8 *mac, uint32 *us);
+
+#endif
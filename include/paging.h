@@ -0,0 +1,62 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "types.h"
+#include "pmm.h"
+
+/*
+ * Virtual layout:
+ *   0x00000000 - 0xBFFFFFFF   user space
+ *   0xC0000000 - 0xF7FFFFFF   direct map of physical 0 - 896 MiB, 4 MiB pages,
+ *                             the kernel image sits at 0xC0100000 inside it
+ *   0xF8000000 - 0xFFFFFFFF   4 KiB mappings made with map_page()/ioremap(),
+ *                             the last pages are kmap_atomic() slots
+ *
+ * Every page directory shares the kernel's page tables from 0xC0000000
+ * up, so the kernel half of one is copied once and never changes.
+ */
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define DIRECT_MAP_SIZE     0x38000000
+#define VMAP_START          (KERNEL_VIRTUAL_BASE + DIRECT_MAP_SIZE)
+#define VMAP_END            0xFFFFF000
+#define USER_END            KERNEL_VIRTUAL_BASE
+#define KMAP_SLOTS          2               // per cpu
+
+#define PHYS_TO_VIRT(addr)  ((void *)((uint32)(addr) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(addr)  ((uint32)(addr) - KERNEL_VIRTUAL_BASE)
+
+#define LARGE_PAGE_SIZE     0x400000
+#define LARGE_PAGE_SHIFT    22
+
+/* Page directory / table entry bits */
+#define PTE_PRESENT   0x001
+#define PTE_WRITE     0x002
+#define PTE_USER      0x004
+#define PTE_PWT       0x008
+#define PTE_PCD       0x010
+#define PTE_ACCESSED  0x020
+#define PTE_DIRTY     0x040
+#define PTE_LARGE     0x080             // PDE only: 4 MiB page
+#define PTE_GLOBAL    0x100
+#define PTE_FRAME     0xFFFFF000
+
+/* PAT entry 1 (PWT alone) is write-combining once pat_init() ran */
+#define PTE_WC        PTE_PWT
+
+#define PDE_INDEX(virt) ((uint32)(virt) >> LARGE_PAGE_SHIFT)
+#define PTE_INDEX(virt) (((uint32)(virt) >> PAGE_SHIFT) & 0x3FF)
+
+/* Functions implemented in paging.c */
+void paging_init();
+void pat_init();
+uint32 *kernel_page_directory();
+bool map_page(uint32 *dir, uint32 virt, uint32 phys, uint32 flags);
+void unmap_page(uint32 *dir, uint32 virt);
+uint32 virt_to_phys(uint32 *dir, uint32 virt);
+void *ioremap(uint32 phys, uint32 size, uint32 flags);
+uint32 *page_entry(uint32 *dir, uint32 virt);
+uint32 *pagedir_create();
+void *kmap_atomic(uint32 phys, uint32 slot);
+void kunmap_atomic(void *addr);
+
+#endif
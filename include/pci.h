@@ -0,0 +1,77 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "types.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* Configuration space offsets, type 0 header */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_REVISION        0x08
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS           0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_SECONDARY_BUS   0x19            // type 1 header, PCI-to-PCI bridges
+#define PCI_SUBSYSTEM_ID    0x2E
+#define PCI_INTERRUPT_LINE  0x3C
+#define PCI_INTERRUPT_PIN   0x3D
+
+#define PCI_COMMAND_IO      0x0001
+#define PCI_COMMAND_MEMORY  0x0002
+#define PCI_COMMAND_MASTER  0x0004
+#define PCI_BAR_IO          0x00000001
+#define PCI_HEADER_MULTI    0x80
+
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_CLASS_BRIDGE    0x06
+#define PCI_SUBCLASS_PCI    0x04
+
+#define PCI_MAX_DEVICES     64
+#define PCI_NO_IRQ          0xFF
+
+typedef struct {
+    uint8 bus;
+    uint8 slot;
+    uint8 func;
+} pci_addr_t;
+
+/* A function found by pci_init, with the header fields drivers match on */
+typedef struct {
+    pci_addr_t addr;
+    uint16 vendor;
+    uint16 device;
+    uint16 subsystem;
+    uint8 class_code;
+    uint8 subclass;
+    uint8 prog_if;
+    uint8 revision;
+    uint8 irq;                              // ISA line the firmware routed INTx to, or PCI_NO_IRQ
+} pci_device_t;
+
+/*
+ * Functions implemented in pci.c, over configuration mechanism #1.
+ * pci_init walks the buses once, from bus 0 down through the bridges;
+ * the lookups go through the table it builds and never touch the bus.
+ */
+void pci_init();
+uint32 pci_count();
+const pci_device_t *pci_device(uint32 index);
+const pci_device_t *pci_find_device(uint16 vendor, uint16 device, uint32 *index);
+const char *pci_class_name(uint8 class_code, uint8 subclass);
+uint32 pci_read32(pci_addr_t addr, uint8 offset);
+uint16 pci_read16(pci_addr_t addr, uint8 offset);
+uint8 pci_read8(pci_addr_t addr, uint8 offset);
+void pci_write32(pci_addr_t addr, uint8 offset, uint32 value);
+void pci_write16(pci_addr_t addr, uint8 offset, uint16 value);
+void pci_enable(pci_addr_t addr, uint16 command);
+bool pci_find_class(uint8 class_code, uint8 subclass, pci_addr_t *out);
+uint32 pci_bar(pci_addr_t addr, uint32 index);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include "types.h"
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+/* Functions implemented in pic.c */
+void pic_remap(uint8 master_offset, uint8 slave_offset);
+void pic_mask(uint8 irq);
+void pic_unmask(uint8 irq);
+bool pic_spurious(uint8 irq);
+void pic_send_eoi(uint8 irq);
+void pic_disable();
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+
+/* Largest buddy block is 2^PMM_MAX_ORDER frames (4 MiB) */
+#define PMM_MAX_ORDER 10
+
+/* Returned by the allocators when no block is available. Frame 0 is
+   never handed out, it sits in the reserved real-mode area. */
+#define PMM_NO_FRAME 0
+
+/* Kernel image bounds (virtual), provided by src/link.ld */
+extern char kernel_start[];
+extern char kernel_end[];
+
+/* Functions implemented in pmm.c */
+void pmm_init(multiboot_info_t *mbi);
+uint32 pmm_alloc_frames(uint32 order);
+void pmm_free_frames(uint32 addr, uint32 order);
+uint32 pmm_alloc_frame();
+uint32 pmm_alloc_highmem_frame();
+void pmm_free_frame(uint32 addr);
+uint32 pmm_block_order(uint32 addr);
+void pmm_frame_get(uint32 addr);
+void pmm_frame_put(uint32 addr);
+uint32 pmm_frame_refs(uint32 addr);
+bool pmm_frame_used(uint32 addr);
+uint32 pmm_total_frames();
+uint32 pmm_free_frames_count();
+
+#endif
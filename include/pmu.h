@@ -0,0 +1,39 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include "types.h"
+
+#define CPUID_PERFMON           0x0A        // architectural performance monitoring leaf
+
+#define MSR_PERFEVTSEL0         0x186
+#define MSR_PMC0                0x0C1
+#define MSR_PERF_GLOBAL_CTRL    0x38F       // perfmon version 2 and later
+
+#define PERFEVTSEL_USR          (1u << 16)
+#define PERFEVTSEL_OS           (1u << 17)
+#define PERFEVTSEL_EN           (1u << 22)
+
+/* The events counted, in the order they get counters */
+#define PMU_CYCLES              0           // unhalted core cycles, not TSC ticks
+#define PMU_INSTRUCTIONS        1
+#define PMU_LLC_MISSES          2
+#define PMU_BRANCH_MISSES       3
+#define PMU_EVENTS              4
+
+typedef struct {
+    uint64 v[PMU_EVENTS];                   // 0 for events without a counter
+} pmu_counts_t;
+
+/* Functions implemented in pmu.c */
+void pmu_init();
+void pmu_init_cpu();
+bool pmu_active();
+bool pmu_counting(uint32 event);
+const char *pmu_event_name(uint32 event);
+uint32 pmu_version();
+uint32 pmu_counters();
+uint32 pmu_width();
+void pmu_read(pmu_counts_t *counts);
+void pmu_delta(const pmu_counts_t *start, const pmu_counts_t *end, pmu_counts_t *delta);
+
+#endif
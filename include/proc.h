@@ -0,0 +1,40 @@
+#ifndef PROC_H
+#define PROC_H
+
+#include "types.h"
+#include "isr.h"
+#include "sched.h"
+#include "vm.h"
+
+#define PROC_PATH_MAX   128
+#define PROC_KILLED     128                 // exit code of a process killed by exception n: 128 + n
+
+/* A user program: one thread in its own address space */
+typedef struct process {
+    uint32 pid;
+    char name[THREAD_NAME_LEN];
+    mm_t *mm;
+    thread_t *thread;
+    struct process *parent;                 // 0 when started by the kernel or orphaned
+    struct process *next;
+    registers_t start;                      // the frame its thread enters ring 3 through
+    int exit_code;
+    volatile bool zombie;                   // exited, exit_code is set
+    bool detached;                          // nobody will wait, freed when it exits
+} process_t;
+
+/*
+ * Functions implemented in proc.c. proc_spawn runs an initrd executable
+ * for the kernel, which has to proc_wait for it. The rest are for system
+ * calls, on the calling process.
+ */
+process_t *proc_spawn(const char *path);
+int proc_wait(process_t *child);
+int proc_wait_pid(uint32 pid);
+int proc_fork(registers_t *regs);
+int proc_exec(registers_t *regs, const char *path);
+void proc_exit(int code);
+void proc_fault(registers_t *regs);
+process_t *proc_current();
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+#define PROFILE_HZ          997             // off the round periods of the timers we want to see
+#define PROFILE_SAMPLES     16384           // per cpu, 16 s at PROFILE_HZ
+#define PROFILE_TOP         20              // functions perf top shows by default
+
+/*
+ * Functions implemented in profile.c. profile_start samples every cpu
+ * from its own local APIC timer, or with nmi from NMIs the starting
+ * cpu's timer sends the others, which also lands in code running with
+ * interrupts off; the starting cpu is then still sampled by its timer.
+ */
+bool profile_start(bool nmi);
+void profile_stop();
+bool profile_running();
+void profile_top(uint32 n);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "types.h"
+#include "pmm.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "smp.h"
+
+#define THREAD_NAME_LEN     16
+#define THREAD_STACK_ORDER  1               // 8 KiB kernel stacks
+#define THREAD_STACK_SIZE   (PAGE_SIZE << THREAD_STACK_ORDER)
+#define SCHED_SLICE_MS      10
+#define FPU_STATE_SIZE      512             // FXSAVE area
+
+typedef enum {
+    THREAD_RUNNING,
+    THREAD_READY,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state_t;
+
+typedef void (*thread_fn_t)(void *arg);
+
+struct mm;
+struct process;
+
+typedef struct thread {
+    uint32 esp;                             // saved by switch_context, must stay first
+    struct thread *next;                    // run queue, wait queue or zombie list
+    struct thread *all_next;
+    cpu_t *cpu;                             // last ran on, its run queue when ready
+    volatile bool on_cpu;                   // its stack is in use
+    bool pinned;                            // never stolen by another cpu
+    uint32 id;
+    thread_state_t state;
+    char name[THREAD_NAME_LEN];
+    uint8 *stack;
+    thread_fn_t fn;
+    void *arg;
+    ktimer_t sleep_timer;
+    uint64 runtime_ns;
+    uint64 switched_in;                     // ktime_ns() when it last got the cpu
+    uint32 switches;
+    bool fpu_used;                          // fpu_state holds something to restore
+    cpu_t *fpu_cpu;                         // loaded its FPU state last
+    struct mm *mm;                          // user address space, 0 for kernel threads
+    struct process *proc;
+    uint8 fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+} thread_t;
+
+typedef struct {
+    spinlock_t lock;
+    thread_t *head;
+    thread_t *tail;
+} wait_queue_t;
+
+/* Implemented in switch.asm */
+void switch_context(uint32 *save_esp, uint32 next_esp);
+
+/* Functions implemented in sched.c */
+void sched_init();
+void sched_init_cpu();
+thread_t *thread_create(const char *name, thread_fn_t fn, void *arg);
+thread_t *thread_create_on(cpu_t *cpu, const char *name, thread_fn_t fn, void *arg);
+void thread_exit();
+void thread_yield();
+void thread_sleep_ms(uint32 ms);
+void thread_wakeup(thread_t *thread);
+thread_t *thread_current();
+thread_t *thread_first();
+void schedule();
+bool sched_need_resched();
+void sched_idle_loop();
+void wait_queue_sleep(wait_queue_t *wq);
+void wait_queue_wake_all(wait_queue_t *wq);
+
+#endif
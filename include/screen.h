@@ -2,8 +2,8 @@
 #define SCREEN_H
 #include "system.h"
 #include "string.h"
-int cursorX , cursorY;
-const uint8 sw ,sh ,sd ; 
+extern int cursorX , cursorY;
+extern const uint8 sw ,sh ,sd ; 
                                                     
 void clearLine(uint8 from,uint8 to);
 
@@ -16,8 +16,15 @@ void scrollUp(uint8 lineNumber);
 void newLineCheck();
 
 void printch(char c);
+void syncCursor();
+void scrollView(int lines);
+void scrollViewLive();
+void screen_attach_framebuffer();
+void screen_attach_serial();
+bool screen_set_echo(bool on);
 
 void print (string ch);
+void print_local (string ch);
 void printl (string ch);
 void set_screen_color_from_color_code(int color_code);
 void set_screen_color(int text_color,int bg_color);
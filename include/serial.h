@@ -0,0 +1,31 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "types.h"
+
+#define SERIAL_COM1         0x3F8
+#define SERIAL_IRQ          4
+#define SERIAL_BAUD         115200          // the 16550's 1.8432 MHz clock / 16, divisor 1
+#define SERIAL_TX_RING      16384           // a power of two
+
+typedef struct {
+    uint32 fifo;                            // bytes the transmitter takes at once, 1 without FIFOs
+    uint32 tx_bytes;
+    uint32 rx_bytes;
+    uint32 irqs;
+    uint32 tx_kicks;                        // transmission started by a writer, not by the IRQ
+    uint32 tx_waits;                        // writers that slept on a full ring
+    uint32 tx_dropped;                      // bytes lost to a full ring with interrupts off
+    uint32 rx_errors;                       // overrun, parity, framing
+} serial_stats_t;
+
+/*
+ * Functions implemented in serial.c. serial_write may be called from
+ * any context; newlines go out as CR LF and a backspace also erases.
+ */
+bool serial_init();
+bool serial_active();
+void serial_write(const char *s, uint32 len);
+const serial_stats_t *serial_stats();
+
+#endif
@@ -7,9 +7,58 @@
 #include "types.h"
 #include "util.h"
 
+#define SHELL_MAX_ARGS      16              // argv entries, the command name included
+#define SHELL_MAX_COMMANDS  64
+#define SHELL_HASH_BUCKETS  64              // a power of two
+#define SHELL_MAX_DEPTH     8               // nested "shell" levels
+
+typedef void (*shell_fn_t)(int argc, char **argv);
+
+typedef struct shell_command {
+    const char *name;
+    shell_fn_t fn;
+    const char *help;
+    struct shell_command *next;             // same hash bucket
+} shell_command_t;
+
+/* Functions implemented in shell.c. argv points into the input line and
+   is only valid during the call. */
+void shell_init();
+bool shell_register(const char *name, shell_fn_t fn, const char *help);
+shell_command_t *shell_lookup(const char *name);
 void launch_shell(int n);
 void login();
+void crash();
 
-
+/* Built-in commands */
+void meminfo(int argc, char **argv);
+void slabinfo(int argc, char **argv);
+void irqstat(int argc, char **argv);
+void uptime(int argc, char **argv);
+void idle(int argc, char **argv);
+void ps(int argc, char **argv);
+void cpus(int argc, char **argv);
+void workq(int argc, char **argv);
+void fbinfo(int argc, char **argv);
+void dmesg(int argc, char **argv);
+void serial(int argc, char **argv);
+void bootprof(int argc, char **argv);
+void bench(int argc, char **argv);
+void help(int argc, char **argv);
+void about(int argc, char **argv);
+void ls(int argc, char **argv);
+void cat(int argc, char **argv);
+void disks(int argc, char **argv);
+void dd(int argc, char **argv);
+void sync(int argc, char **argv);
+void run(int argc, char **argv);
+void vmstat(int argc, char **argv);
+void syscalls_cmd(int argc, char **argv);
+void perf(int argc, char **argv);
+void pmc(int argc, char **argv);
+void lspci(int argc, char **argv);
+void virtio_cmd(int argc, char **argv);
+void nics(int argc, char **argv);
+void arping(int argc, char **argv);
 
 #endif
@@ -0,0 +1,47 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+#include "spinlock.h"
+
+#define CACHE_LINE_SIZE   64
+#define SLAB_HOT_OBJECTS  16            // per-cache LIFO of recently freed objects
+#define SLAB_NAME_LEN     16
+
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    struct kmem_cache *cache;
+    void *free;                         // LIFO list threaded through free objects
+    uint32 inuse;
+} slab_t;
+
+typedef struct kmem_cache {
+    spinlock_t lock;
+    char name[SLAB_NAME_LEN];
+    uint32 object_size;                 // rounded up to the alignment
+    uint32 order;                       // slab size is 2^order frames
+    uint32 objects_per_slab;
+    uint32 first_offset;                // first object, past the cache-line aligned header
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    void *hot[SLAB_HOT_OBJECTS];
+    uint32 hot_count;
+
+    uint32 active_objects;
+    uint32 total_objects;
+    uint32 slabs;
+    uint32 allocs;
+    uint32 hits;                        // served straight from the hot list
+    uint32 grows;
+    struct kmem_cache *next_cache;
+} kmem_cache_t;
+
+/* Functions implemented in slab.c, align 0 means CACHE_LINE_SIZE */
+kmem_cache_t *kmem_cache_create(const char *name, uint32 size, uint32 align);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+kmem_cache_t *kmem_cache_first();
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define MAX_CPUS        16
+#define AP_TRAMPOLINE   0x7000          // page below 1 MiB the APs start from, SIPI vector 0x07
+
+struct thread;
+
+/* Per-cpu data, reached through %gs (see gdt.c). self must stay first. */
+typedef struct cpu {
+    struct cpu *self;
+    uint32 id;                          // index into the cpu table, 0 is the BSP
+    uint32 apic_id;
+    volatile bool online;
+
+    /* Scheduler state, owned by sched.c */
+    struct thread *current;
+    struct thread *idle;
+    struct thread *prev;                // switched away from, still on its stack until finish_switch
+    spinlock_t rq_lock;
+    struct thread *run_head;
+    struct thread *run_tail;
+    volatile uint32 nr_running;         // queued, not counting current
+    volatile bool need_resched;
+    volatile bool idling;               // in the idle loop, kick with an IPI to get it to steal
+    ktimer_t slice_timer;
+
+    uint32 switches;
+    uint32 steals;
+    uint32 ipis;
+
+    /* Lazy FPU switching, owned by fpu.c */
+    struct thread *fpu_owner;           // whose state the FPU registers hold
+    bool fpu_live;                      // CR0.TS is clear
+    uint32 fpu_traps;
+    uint32 fpu_loads;
+
+    /* Sampling profiler, owned by profile.c */
+    uint32 *prof_samples;               // kernel eips, PROFILE_SAMPLES of them
+    volatile uint32 prof_count;
+    uint32 prof_user;                   // ticks that landed in ring 3
+    uint32 prof_dropped;                // the buffer was full
+} cpu_t;
+
+/* Functions implemented in smp.c */
+void smp_init_bsp();
+void smp_init();
+cpu_t *this_cpu();
+cpu_t *cpu_get(uint32 id);
+uint32 cpu_count();
+void smp_send_reschedule(cpu_t *cpu);
+void smp_halt_others();
+
+#endif
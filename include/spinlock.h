@@ -0,0 +1,23 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "types.h"
+
+/* Ticket lock: waiters are served in arrival order. Only the holder ever
+   writes owner, the atomic is the one fetch-and-add on next. */
+typedef struct {
+    volatile uint16 owner;
+    volatile uint16 next;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0, 0 }
+
+/* Functions implemented in spinlock.c */
+void spin_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+uint32 spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, uint32 flags);
+
+#endif
@@ -2,6 +2,16 @@
 #define STRING_H
 
 #include "types.h"
+
+/* Functions implemented in string.c */
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+int strncmp(const char *s1, const char *s2, size_t n);
+void *memchr(const void *s, int c, size_t n);
+char *strchr(const char *s, int c);
+int memcmp(const void *a, const void *b, size_t n);
+
+/* Older names, now thin wrappers */
 uint16 strlength(string ch);
 
 uint8 strEql(string ch1,string ch2);
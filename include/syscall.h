@@ -0,0 +1,54 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "types.h"
+#include "isr.h"
+
+/*
+ * Programs call the system call page at SYSCALL_PAGE with the number in
+ * eax and arguments in ebx, ecx and edx; the result is back in eax, -1
+ * for an error. The page holds SYSENTER when the cpu has it and int 0x80
+ * otherwise, and int 0x80 always works as well. User programs include
+ * this for the numbers.
+ */
+#define SYSCALL_VECTOR  0x80
+#define SYSCALL_PAGE    0xBFFFF000          // also in interrupt.asm
+
+#define SYS_EXIT        0                   // code
+#define SYS_WRITE       1                   // buffer, length: to the console
+#define SYS_FORK        2
+#define SYS_EXEC        3                   // initrd path
+#define SYS_WAIT        4                   // child pid: its exit code
+#define SYS_GETPID      5
+#define SYS_YIELD       6
+#define SYS_SLEEP       7                   // milliseconds
+#define SYS_BRK         8                   // new heap end, or 0: the heap end
+#define SYS_NULL        9                   // does nothing, to time the way in and out
+#define SYS_BENCH       10                  // samples, count: for the bench command
+#define SYSCALL_COUNT   11
+
+typedef struct {
+    uint32 calls[SYSCALL_COUNT];
+    uint32 sysenter;                        // came in through SYSENTER
+    uint32 int80;
+    uint32 bad;                             // unknown numbers
+} syscall_stats_t;
+
+/* Implemented in interrupt.asm */
+void syscall_entry();
+void sysenter_entry();
+void sysenter_tf_off();
+extern uint8 syscall_stub_int80[], syscall_stub_int80_end[];
+extern uint8 syscall_stub_sysenter[], syscall_stub_sysenter_end[];
+
+/* Functions implemented in syscall.c */
+void syscall_init();
+void syscall_init_cpu();
+void syscall_handler(registers_t *regs);
+bool syscall_debug_trap(registers_t *regs);
+bool syscall_fast();
+const uint8 *syscall_page(uint32 *size);
+const char *syscall_name(uint32 n);
+const syscall_stats_t *syscall_stats();
+
+#endif
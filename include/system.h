@@ -1,8 +1,60 @@
 #ifndef SYSTEM_H
 #define SYSTEM_H
 #include "types.h"
+
+#define CR0_MP   0x00000002
+#define CR0_EM   0x00000004
+#define CR0_TS   0x00000008
+#define CR0_NE   0x00000020
+#define CR0_WP   0x00010000
+#define CR0_PG   0x80000000
+#define EFLAGS_IF 0x00000200
+#define CR4_PSE  0x00000010
+#define CR4_PGE  0x00000080
+#define CR4_OSFXSR     0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+
+#define CPUID_EDX_PSE 0x00000008
+#define CPUID_EDX_TSC 0x00000010
+#define CPUID_EDX_PGE 0x00002000
+#define CPUID_EDX_MSR 0x00000020
+#define CPUID_EDX_APIC 0x00000200
+#define CPUID_EDX_PAT 0x00010000
+#define CPUID_EDX_FPU 0x00000001
+#define CPUID_EDX_FXSR 0x01000000
+#define CPUID_EDX_SSE 0x02000000
+#define CPUID_EDX_SSE2 0x04000000
+
 uint8 inportb (uint16 _port);
 
 void outportb (uint16 _port, uint8 _data);
+uint16 inportw (uint16 _port);
+void outportw (uint16 _port, uint16 _data);
+uint32 inportl (uint16 _port);
+void outportl (uint16 _port, uint32 _data);
+void insw (uint16 _port, void *buf, uint32 count);
+void outsw (uint16 _port, const void *buf, uint32 count);
+void insl (uint16 _port, void *buf, uint32 count);
+void outsl (uint16 _port, const void *buf, uint32 count);
+
+void cpuid(uint32 leaf, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx);
+uint32 read_cr0();
+void write_cr0(uint32 value);
+uint32 read_cr2();
+uint32 read_cr3();
+void write_cr3(uint32 value);
+uint32 read_cr4();
+void write_cr4(uint32 value);
+void invlpg(uint32 addr);
+uint64 rdtsc();
+uint64 rdpmc(uint32 counter);
+uint64 read_msr(uint32 msr);
+void write_msr(uint32 msr, uint64 value);
+void cpu_relax();
+
+void interrupts_enable();
+void interrupts_disable();
+uint32 interrupts_save();
+void interrupts_restore(uint32 flags);
 
 #endif
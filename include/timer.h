@@ -0,0 +1,28 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+typedef void (*timer_fn_t)(void *arg);
+
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer *prev;
+    struct ktimer **slot;               // wheel slot while pending, 0 otherwise
+    uint64 expires;                     // absolute, in clock ticks
+    timer_fn_t fn;
+    void *arg;
+} ktimer_t;
+
+/* Functions implemented in timer.c. Callbacks run from the tick interrupt. */
+void timer_init();
+void timer_setup(ktimer_t *timer, timer_fn_t fn, void *arg);
+void timer_add(ktimer_t *timer, uint64 expires);
+void timer_add_ms(ktimer_t *timer, uint32 ms);
+void timer_cancel(ktimer_t *timer);
+bool timer_pending(ktimer_t *timer);
+void timer_tick();
+uint32 timer_pending_count();
+uint64 timer_next_expiry();
+
+#endif
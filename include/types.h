@@ -15,6 +15,8 @@ typedef unsigned long long uint64;
 
 typedef char* string; 
 
+typedef uint32 size_t;
+
 typedef int bool;
 #define false 0
 #define true  1
@@ -3,20 +3,24 @@
 
 #include "types.h"
 
-//typedef
-typedef unsigned long size_t;
 //void
 void memory_copy(char *source, char *dest, int nbytes);
 void memory_set(uint8 *dest, uint8 val, uint32 len);
 void int_to_ascii(int n, char str[]);  
 void * malloc(int nbytes);      
+void free(void *ptr);
+//uint64 arithmetic without libgcc
+uint64 udiv64(uint64 n, uint32 d, uint32 *rem);
+uint64 mul_u64_u32_shr(uint64 a, uint32 mul, uint32 shift);
 //int
-int strncmp( const char * s1, const char * s2, size_t n );
 int str_to_int(string ch)  ;
 
+//string
+string int_to_string(int n);
+
 
 //char
-char **split(char *string, const char delimiter);
+int tokenize(char *line, char **argv, int max);
 //bool related
 bool StartsWith(const char *a, const char *b);
 
@@ -0,0 +1,22 @@
+#ifndef VIRTBLK_H
+#define VIRTBLK_H
+
+#include "types.h"
+
+#define VIRTIO_BLK_F_SEG_MAX    (1u << 2)
+#define VIRTIO_BLK_F_RO         (1u << 5)
+#define VIRTIO_BLK_F_FLUSH      (1u << 9)
+
+/* Device config */
+#define VIRTIO_BLK_CAPACITY     0           // 64 bit, in 512 byte sectors
+#define VIRTIO_BLK_SEG_MAX      12
+
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_S_OK         0
+
+/* Functions implemented in virtblk.c */
+void virtblk_init();
+
+#endif
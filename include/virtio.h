@@ -0,0 +1,140 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "types.h"
+#include "pci.h"
+
+#define VIRTIO_VENDOR           0x1AF4
+#define VIRTIO_DEVICE_NET       0x1000      // transitional ids, the ones with the legacy I/O BAR
+#define VIRTIO_DEVICE_BLK       0x1001
+
+/* Legacy register block at BAR0 */
+#define VIRTIO_HOST_FEATURES    0x00
+#define VIRTIO_GUEST_FEATURES   0x04
+#define VIRTIO_QUEUE_PFN        0x08
+#define VIRTIO_QUEUE_SIZE       0x0C
+#define VIRTIO_QUEUE_SELECT     0x0E
+#define VIRTIO_QUEUE_NOTIFY     0x10
+#define VIRTIO_STATUS           0x12
+#define VIRTIO_ISR              0x13        // reading it acknowledges the interrupt
+#define VIRTIO_CONFIG           0x14        // device specific, without MSI-X
+
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED    0x80
+
+#define VIRTIO_ISR_QUEUE        0x01
+#define VIRTIO_ISR_CONFIG       0x02
+
+#define VIRTIO_F_EVENT_IDX      (1u << 29)
+
+#define VIRTQ_DESC_NEXT         0x0001
+#define VIRTQ_DESC_WRITE        0x0002      // the device writes this one
+#define VIRTQ_AVAIL_NO_INTERRUPT 0x0001
+#define VIRTQ_USED_NO_NOTIFY    0x0001
+#define VIRTQ_ALIGN             4096
+#define VIRTQ_MAX_SIZE          256
+#define VIRTIO_MAX_DEVICES      8
+#define VIRTIO_MAX_QUEUES       2
+
+typedef struct {
+    uint64 addr;
+    uint32 len;
+    uint16 flags;
+    uint16 next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16 flags;
+    uint16 idx;
+    uint16 ring[];                          // then used_event
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct {
+    uint32 id;
+    uint32 len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct {
+    uint16 flags;
+    uint16 idx;
+    virtq_used_elem_t ring[];               // then avail_event
+} __attribute__((packed)) virtq_used_t;
+
+/* One piece of a buffer chain, by physical address */
+typedef struct {
+    uint32 addr;
+    uint32 len;
+} virtq_buf_t;
+
+typedef struct {
+    uint32 adds;
+    uint32 kicks;                           // batches published
+    uint32 notifies;                        // of those, the ones the device wanted to hear about
+    uint32 completions;
+} virtq_stats_t;
+
+struct virtio_dev;
+
+/*
+ * A split virtqueue in the legacy layout: descriptor table and available
+ * ring, then the used ring on the next VIRTQ_ALIGN boundary, in one
+ * physically contiguous block. Not locked: the driver serializes
+ * everything on a queue.
+ */
+typedef struct {
+    struct virtio_dev *dev;
+    uint16 index;
+    uint16 size;
+    virtq_desc_t *desc;
+    volatile virtq_avail_t *avail;
+    volatile virtq_used_t *used;
+    volatile uint16 *used_event;            // we want an interrupt after this one
+    volatile uint16 *avail_event;           // the device wants a notify after this one
+    void **cookies;                         // per head descriptor
+    uint16 free_head;
+    uint16 num_free;
+    uint16 avail_idx;                       // ahead of avail->idx until the next kick
+    uint16 kicked_idx;                      // avail->idx at the last kick
+    uint16 last_used;
+    uint32 phys;
+    uint32 order;
+    virtq_stats_t stats;
+} virtq_t;
+
+/*
+ * A device on the legacy transport. interrupt runs in the IRQ handler
+ * with the ISR bits that were set; devices on one line share it.
+ */
+typedef struct virtio_dev {
+    char name[8];                           // the block or network device's
+    const pci_device_t *pci;
+    uint16 io;
+    uint32 features;                        // negotiated
+    bool event_idx;
+    void (*interrupt)(struct virtio_dev *dev, uint8 isr);
+    void *driver;
+    struct virtio_dev *next;                // on the same IRQ
+    virtq_t *queues[VIRTIO_MAX_QUEUES];
+    uint32 nqueues;
+    uint32 interrupts;
+} virtio_dev_t;
+
+/* Functions implemented in virtio.c */
+bool virtio_setup(virtio_dev_t *dev, const pci_device_t *pci, uint32 features);
+void virtio_ready(virtio_dev_t *dev);
+void virtio_fail(virtio_dev_t *dev);
+uint8 virtio_config8(virtio_dev_t *dev, uint32 offset);
+uint32 virtio_config32(virtio_dev_t *dev, uint32 offset);
+uint32 virtio_spurious();
+uint32 virtio_count();
+virtio_dev_t *virtio_device(uint32 index);
+virtq_t *virtq_create(virtio_dev_t *dev, uint16 index);
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, uint32 out, uint32 in, void *cookie);
+void virtq_kick(virtq_t *vq);
+void *virtq_get(virtq_t *vq, uint32 *len);
+bool virtq_enable_interrupt(virtq_t *vq, uint16 after);
+void virtq_disable_interrupt(virtq_t *vq);
+
+#endif
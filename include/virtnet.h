@@ -0,0 +1,16 @@
+#ifndef VIRTNET_H
+#define VIRTNET_H
+
+#include "types.h"
+
+#define VIRTIO_NET_F_MAC        (1u << 5)
+
+#define VIRTNET_BUFFERS         64          // per direction, each a 2 KiB slot
+#define VIRTNET_SLOT            2048
+#define VIRTNET_RX_BUDGET       32          // frames per pass of the receive work
+#define VIRTNET_HDR_LEN         10          // the legacy header, without num_buffers
+
+/* Functions implemented in virtnet.c */
+void virtnet_init();
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef VM_H
+#define VM_H
+
+#include "types.h"
+#include "paging.h"
+
+#define USER_STACK_TOP      0xBFFFF000          // right below the system call page
+#define USER_STACK_PAGES    256                 // 1 MiB, touched pages only
+
+#define VM_READ     0x01
+#define VM_WRITE    0x02
+#define VM_EXEC     0x04
+
+/* Page fault error code */
+#define PF_PRESENT  0x01                        // a protection fault, not a missing page
+#define PF_WRITE    0x02
+#define PF_USER     0x04
+
+/*
+ * A range of user space, page aligned. Pages are filled when first
+ * touched: from file, an image that stays in memory (the initrd), for
+ * file_size bytes from file_start, and zeroes everywhere else.
+ */
+typedef struct vm_area {
+    uint32 start;
+    uint32 end;
+    uint32 flags;
+    const uint8 *file;
+    uint32 file_start;
+    uint32 file_size;
+    struct vm_area *next;                       // sorted by address
+} vm_area_t;
+
+typedef struct mm {
+    uint32 *dir;
+    vm_area_t *areas;
+    vm_area_t *heap;                            // grown by vm_brk
+    uint32 pages;                               // present user pages
+} mm_t;
+
+typedef struct {
+    uint32 faults;
+    uint32 zero_fills;
+    uint32 file_fills;
+    uint32 cow_copies;
+    uint32 cow_reuses;                          // the last sharer wrote, nothing to copy
+    uint32 bad_faults;
+} vm_stats_t;
+
+/* Functions implemented in vm.c */
+mm_t *mm_create();
+mm_t *mm_clone(mm_t *mm);
+void mm_destroy(mm_t *mm);
+void mm_activate(mm_t *mm);
+vm_area_t *vm_map(mm_t *mm, uint32 start, uint32 size, uint32 flags, const uint8 *file, uint32 file_size);
+vm_area_t *vm_find(mm_t *mm, uint32 addr);
+bool vm_check(mm_t *mm, uint32 addr, uint32 len, bool write);
+uint32 vm_brk(mm_t *mm, uint32 end);
+bool vm_fault(uint32 addr, uint32 error);
+const vm_stats_t *vm_stats();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "types.h"
+#include "smp.h"
+
+typedef void (*work_fn_t)(void *arg);
+
+typedef struct work {
+    struct work *next;
+    work_fn_t fn;
+    void *arg;
+    volatile uint32 pending;            // queued and not yet started
+} work_t;
+
+typedef struct {
+    uint32 queued;
+    uint32 coalesced;                   // queue calls that found the item already pending
+    uint32 runs;
+    uint32 batches;                     // worker passes, each draining everything queued
+} workqueue_stats_t;
+
+/* Functions implemented in workqueue.c. work_queue is safe from interrupt
+   handlers; the item runs later in the cpu's worker thread. */
+void workqueue_init();
+void work_setup(work_t *work, work_fn_t fn, void *arg);
+bool work_queue(work_t *work);
+bool work_queue_on(cpu_t *cpu, work_t *work);
+const workqueue_stats_t *workqueue_stats(uint32 cpu);
+
+#endif
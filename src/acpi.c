@@ -0,0 +1,133 @@
+//ACPI table discovery
+
+#include "../include/acpi.h"
+#include "../include/paging.h"
+#include "../include/klog.h"
+
+/*
+ * Only as much ACPI as bring-up needs: find the RSDP in the EBDA or the
+ * BIOS area, walk the RSDT, and decode the MADT once into
+ * acpi_madt_info_t so the APIC and SMP code never touch raw tables.
+ * Tables usually sit at the top of RAM; past the direct map they are
+ * ioremap()ed.
+ */
+
+#define BIOS_EBDA_SEGMENT   0x40E
+#define BIOS_AREA_START     0xE0000
+#define BIOS_AREA_END       0x100000
+
+static acpi_header_t *rsdt;
+static acpi_madt_info_t madt_info;
+static bool have_madt;
+
+static void *acpi_map(uint32 phys, uint32 size)
+{
+    if (phys + size <= DIRECT_MAP_SIZE) return PHYS_TO_VIRT(phys);
+    return ioremap(phys, size, 0);
+}
+
+static bool checksum_ok(const void *data, uint32 len)
+{
+    const uint8 *p = (const uint8 *)data;
+    uint8 sum = 0;
+    while (len--) sum += *p++;
+    return sum == 0;
+}
+
+static bool signature_is(const char *a, const char *b, uint32 len)
+{
+    while (len--) if (*a++ != *b++) return false;
+    return true;
+}
+
+static acpi_rsdp_t *scan_rsdp(uint32 start, uint32 end)
+{
+    for (; start + sizeof(acpi_rsdp_t) <= end; start += 16) {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t *)PHYS_TO_VIRT(start);
+        if (signature_is(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, sizeof(acpi_rsdp_t)))
+            return rsdp;
+    }
+    return 0;
+}
+
+/* Maps a table, header first to learn its length */
+static acpi_header_t *map_table(uint32 phys)
+{
+    acpi_header_t *h = (acpi_header_t *)acpi_map(phys, sizeof(acpi_header_t));
+    if (!h) return 0;
+    if (phys + h->length > DIRECT_MAP_SIZE) h = (acpi_header_t *)acpi_map(phys, h->length);
+    if (!h || !checksum_ok(h, h->length)) return 0;
+    return h;
+}
+
+static void parse_madt(acpi_header_t *madt)
+{
+    uint8 *p = (uint8 *)madt + sizeof(acpi_header_t);
+    uint8 *end = (uint8 *)madt + madt->length;
+    uint32 i;
+
+    for (i = 0; i < ISA_IRQS; i++) {
+        madt_info.isa_gsi[i] = i;
+        madt_info.isa_flags[i] = 0;
+    }
+    madt_info.lapic_phys = *(uint32 *)p;
+    p += 8;                             // local APIC address, flags
+
+    while (p + 2 <= end && p[1] >= 2) {
+        switch (p[0]) {
+        case MADT_LOCAL_APIC:           // acpi processor id, apic id, flags
+            if ((*(uint32 *)(p + 4) & MADT_LAPIC_ENABLED) && madt_info.cpu_count < MAX_CPUS)
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = p[3];
+            break;
+        case MADT_IO_APIC:              // id, reserved, address, gsi base; the first one is enough
+            if (!madt_info.ioapic_phys) {
+                madt_info.ioapic_phys = *(uint32 *)(p + 4);
+                madt_info.ioapic_gsi_base = *(uint32 *)(p + 8);
+            }
+            break;
+        case MADT_ISO:                  // bus, source irq, gsi, flags
+            if (p[3] < ISA_IRQS) {
+                madt_info.isa_gsi[p[3]] = *(uint32 *)(p + 4);
+                madt_info.isa_flags[p[3]] = *(uint16 *)(p + 8);
+            }
+            break;
+        }
+        p += p[1];
+    }
+    have_madt = madt_info.cpu_count > 0;
+}
+
+bool acpi_init()
+{
+    uint32 ebda = (uint32)*(uint16 *)PHYS_TO_VIRT(BIOS_EBDA_SEGMENT) << 4;
+    acpi_rsdp_t *rsdp = 0;
+    if (ebda) rsdp = scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp) rsdp = scan_rsdp(BIOS_AREA_START, BIOS_AREA_END);
+    if (!rsdp) return false;
+
+    rsdt = map_table(rsdp->rsdt_address);
+    if (!rsdt) return false;
+    acpi_header_t *madt = acpi_find_table("APIC");
+    if (madt) parse_madt(madt);
+    klog(KLOG_INFO, "acpi: RSDT at 0x%08X, %s", rsdp->rsdt_address, madt ? "MADT found" : "no MADT");
+    return true;
+}
+
+acpi_header_t *acpi_find_table(const char *signature)
+{
+    if (!rsdt) return 0;
+    uint32 entries = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    uint32 *phys = (uint32 *)((uint8 *)rsdt + sizeof(acpi_header_t));
+    uint32 i;
+    for (i = 0; i < entries; i++) {
+        acpi_header_t *h = (acpi_header_t *)acpi_map(phys[i], sizeof(acpi_header_t));
+        if (h && signature_is(h->signature, signature, 4)) return map_table(phys[i]);
+    }
+    return 0;
+}
+
+/* Decoded MADT, or 0 when there is none (uniprocessor, 8259 only) */
+const acpi_madt_info_t *acpi_madt()
+{
+    return have_madt ? &madt_info : 0;
+}
@@ -0,0 +1,254 @@
+//local APIC and IO-APIC
+
+#include "../include/apic.h"
+#include "../include/acpi.h"
+#include "../include/paging.h"
+#include "../include/pic.h"
+#include "../include/isr.h"
+#include "../include/idt.h"
+#include "../include/clock.h"
+#include "../include/system.h"
+
+/*
+ * When the MADT describes an IO-APIC, the 8259s are masked for good and
+ * the ISA lines are routed through the IO-APIC to the same vectors 32-47,
+ * all delivered to the BSP, so drivers keep using irq_register_handler
+ * unchanged. The local APIC of every cpu takes the EOIs and sends the
+ * IPIs. Without an MADT nothing here is touched and the 8259 path stays.
+ */
+
+#define IA32_APIC_BASE_MSR  0x1B
+#define APIC_BASE_ENABLE    0x800
+
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ESR           0x280
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define SVR_ENABLE          0x100
+#define LVT_MASKED          0x10000
+#define LVT_PERIODIC        0x20000
+#define TIMER_DIVIDE_16     0x3
+#define TIMER_CALIBRATE_US  10000
+#define ICR_NMI             0x00000400
+#define ICR_INIT            0x00000500
+#define ICR_STARTUP         0x00000600
+#define ICR_ASSERT          0x00004000
+#define ICR_PENDING         0x00001000
+#define ICR_ALL_BUT_SELF    0x000C0000
+
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_REDIR(n)     (0x10 + (n) * 2)
+#define REDIR_MASKED        0x10000
+#define REDIR_LEVEL         0x08000
+#define REDIR_ACTIVE_LOW    0x02000
+
+static volatile uint32 *lapic;
+static volatile uint32 *ioapic;
+static uint32 bsp_apic_id;
+static const acpi_madt_info_t *madt;
+static uint32 timer_per_ms;             // timer counts per ms at divide 16, the bus clock is shared
+
+static uint32 lapic_read(uint32 reg)
+{
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32 reg, uint32 value)
+{
+    lapic[reg / 4] = value;
+}
+
+static uint32 ioapic_read(uint32 reg)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32 reg, uint32 value)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+/* Redirection entry for an ISA irq, honouring the MADT's overrides */
+static uint32 isa_redirection(uint8 irq)
+{
+    uint32 entry = IRQ_BASE + irq;
+    uint16 flags = madt->isa_flags[irq];
+    if ((flags & 0x3) == 0x3) entry |= REDIR_ACTIVE_LOW;
+    if (((flags >> 2) & 0x3) == 0x3) entry |= REDIR_LEVEL;
+    return entry;
+}
+
+static void ipi_wait()
+{
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) cpu_relax();
+}
+
+static void ipi_halt(registers_t *regs)
+{
+    for (;;) __asm__ __volatile__ ("cli; hlt");
+}
+
+/* Per-cpu part: enable this cpu's local APIC with the timer masked */
+void lapic_init()
+{
+    write_msr(IA32_APIC_BASE_MSR, read_msr(IA32_APIC_BASE_MSR) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+bool apic_init()
+{
+    uint32 eax, ebx, ecx, edx, i;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    madt = acpi_madt();
+    if (!madt || !madt->ioapic_phys || !(edx & CPUID_EDX_APIC) || !(edx & CPUID_EDX_MSR)) {
+        madt = 0;
+        return false;
+    }
+    lapic = (volatile uint32 *)ioremap(madt->lapic_phys, PAGE_SIZE, PTE_PCD | PTE_PWT);
+    ioapic = (volatile uint32 *)ioremap(madt->ioapic_phys, PAGE_SIZE, PTE_PCD | PTE_PWT);
+    if (!lapic || !ioapic) {
+        madt = 0;
+        return false;
+    }
+
+    set_idt_gate(IPI_RESCHEDULE, (uint32)ipi_reschedule);
+    set_idt_gate(IPI_HALT, (uint32)ipi_halt_entry);
+    set_idt_gate(IPI_BENCH, (uint32)ipi_bench);
+    set_idt_gate(IPI_PROFILE, (uint32)ipi_profile);
+    set_idt_gate(PROFILE_TIMER, (uint32)profile_timer);
+    set_idt_gate(APIC_SPURIOUS, (uint32)apic_spurious);
+    isr_register_handler(IPI_HALT, ipi_halt);
+
+    pic_disable();
+    lapic_init();
+    bsp_apic_id = lapic_id();
+
+    uint32 entries = ((ioapic_read(1) >> 16) & 0xFF) + 1;
+    for (i = 0; i < entries; i++) ioapic_write(IOAPIC_REDIR(i), REDIR_MASKED);
+    for (i = 0; i < ISA_IRQS; i++) {
+        uint32 pin = madt->isa_gsi[i] - madt->ioapic_gsi_base;
+        if (pin >= entries) continue;
+        ioapic_write(IOAPIC_REDIR(pin) + 1, bsp_apic_id << 24);
+        ioapic_write(IOAPIC_REDIR(pin), isa_redirection(i) | REDIR_MASKED);
+    }
+    return true;
+}
+
+bool apic_active()
+{
+    return madt != 0;
+}
+
+uint32 lapic_id()
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32 apic_id, uint8 vector)
+{
+    uint32 flags = interrupts_save();
+    ipi_wait();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, vector | ICR_ASSERT);
+    interrupts_restore(flags);
+}
+
+void lapic_send_ipi_others(uint8 vector)
+{
+    uint32 flags = interrupts_save();
+    ipi_wait();
+    lapic_write(LAPIC_ICR_LOW, vector | ICR_ASSERT | ICR_ALL_BUT_SELF);
+    interrupts_restore(flags);
+}
+
+/* Every other cpu at once; NMIs get through with interrupts off */
+void lapic_send_nmi_others()
+{
+    uint32 flags = interrupts_save();
+    ipi_wait();
+    lapic_write(LAPIC_ICR_LOW, ICR_NMI | ICR_ASSERT | ICR_ALL_BUT_SELF);
+    interrupts_restore(flags);
+}
+
+/* This cpu's timer, periodic at hz. Counted against the TSC the first
+   time, which may be with interrupts off; the first call must not race
+   another cpu's. */
+bool lapic_timer_start(uint8 vector, uint32 hz)
+{
+    uint32 count;
+    if (!madt || !hz || (!timer_per_ms && !tsc_khz())) return false;
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    if (!timer_per_ms) {
+        lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+        lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+        clock_delay_us(TIMER_CALIBRATE_US);
+        timer_per_ms = (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT)) / (TIMER_CALIBRATE_US / 1000);
+        if (!timer_per_ms) return false;
+    }
+    count = timer_per_ms * 1000 / hz;
+    lapic_write(LAPIC_LVT_TIMER, vector | LVT_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, count ? count : 1);
+    return true;
+}
+
+void lapic_timer_stop()
+{
+    if (!madt) return;
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+}
+
+/* INIT, then up to two STARTUPs, as the MP spec asks. True once the AP
+   reports in through *started. */
+bool lapic_start_ap(uint32 apic_id, uint32 trampoline_phys, volatile bool *started)
+{
+    uint32 i;
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, ICR_INIT | ICR_ASSERT);
+    ipi_wait();
+    clock_delay_us(10000);
+
+    for (i = 0; i < 2 && !*started; i++) {
+        lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+        lapic_write(LAPIC_ICR_LOW, ICR_STARTUP | (trampoline_phys >> PAGE_SHIFT));
+        ipi_wait();
+        clock_delay_us(200);
+    }
+    for (i = 0; i < 1000 && !*started; i++) clock_delay_us(100);     // up to 100 ms
+    return *started;
+}
+
+void ioapic_mask(uint8 irq)
+{
+    uint32 pin = madt->isa_gsi[irq] - madt->ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDIR(pin), isa_redirection(irq) | REDIR_MASKED);
+}
+
+void ioapic_unmask(uint8 irq)
+{
+    uint32 pin = madt->isa_gsi[irq] - madt->ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDIR(pin), isa_redirection(irq));
+}
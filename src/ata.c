@@ -0,0 +1,509 @@
+//ATA disk driver
+
+#include "../include/ata.h"
+#include "../include/blk.h"
+#include "../include/clock.h"
+#include "../include/isr.h"
+#include "../include/kprintf.h"
+#include "../include/klog.h"
+#include "../include/memory.h"
+#include "../include/paging.h"
+#include "../include/pci.h"
+#include "../include/pmm.h"
+#include "../include/system.h"
+#include "../include/timer.h"
+#include "../include/workqueue.h"
+
+/*
+ * Drives on the two legacy IDE channels, each registered as a block
+ * device. When the PCI IDE function (PIIX and friends) is in
+ * compatibility mode its bus master registers are used for DMA: the
+ * transfer the block layer hands over becomes one READ/WRITE DMA
+ * command whose PRD table has a segment per merged request, split where
+ * a segment would cross a 64 KiB boundary. The channel interrupt
+ * completes it and the block layer starts the next one from there.
+ * A watchdog timer fails a command that never interrupts.
+ *
+ * Without a bus master, or for a drive that does not do DMA, transfers
+ * are PIO: a sector per rep insw/outsw, polled. That is the slow path,
+ * so it is run from deferred work, with interrupts on and no lock held,
+ * while the channel stays claimed and the device busy; a cache flush is
+ * polled the same way. The drive's write cache is only flushed when the
+ * block layer asks for it, not behind every write. Polls are bounded by
+ * time, not spins; a command that times out fails, and the channel gets
+ * a software reset before the next one, from the worker.
+ *
+ * Master and slave share a channel and only one command can be in
+ * flight on it. A drive whose turn it is not marks itself parked; the
+ * drive that owns the channel gives it back and, if the other is
+ * parked, restarts it from deferred work, so no device lock is ever
+ * taken while holding another.
+ */
+
+#define ATA_DATA        0
+#define ATA_ERROR       1
+#define ATA_COUNT       2
+#define ATA_LBA0        3
+#define ATA_LBA1        4
+#define ATA_LBA2        5
+#define ATA_DRIVE       6
+#define ATA_STATUS      7                   // command on write
+
+#define ATA_SR_BSY      0x80
+#define ATA_SR_DRDY     0x40
+#define ATA_SR_DF       0x20
+#define ATA_SR_DRQ      0x08
+#define ATA_SR_ERR      0x01
+#define ATA_CTRL_NIEN   0x02
+#define ATA_CTRL_SRST   0x04
+
+#define ATA_CMD_READ_PIO        0x20
+#define ATA_CMD_READ_PIO_EXT    0x24
+#define ATA_CMD_WRITE_PIO       0x30
+#define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_FLUSH           0xE7
+#define ATA_CMD_FLUSH_EXT       0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+
+#define BM_COMMAND      0
+#define BM_STATUS       2
+#define BM_PRDT         4
+#define BM_CMD_START    0x01
+#define BM_CMD_TO_MEM   0x08                // the device is read
+#define BM_STATUS_ERR   0x02
+#define BM_STATUS_IRQ   0x04
+
+#define PRD_EOT         0x8000
+#define LBA28_LIMIT     0x0FFFFFFF
+
+typedef struct {
+    uint32 addr;
+    uint16 bytes;                           // 0 means 64 KiB
+    uint16 flags;
+} __attribute__((packed)) prd_t;
+
+struct ata_drive;
+
+typedef struct {
+    uint16 io, ctrl, bm;                    // bm 0: no DMA on this channel
+    uint8 irq;
+    volatile uint32 claimed;
+    struct ata_drive *active;               // owns the command in flight
+    blk_request_t *reqs;
+    prd_t *prdt;
+    uint32 prdt_phys;
+    ktimer_t watchdog;
+    uint64 deadline;                        // in clock ticks, for the watchdog
+    work_t restart_work;
+    work_t polled_work;
+    struct ata_drive *polled;               // owns the PIO command or flush in flight
+    uint32 lba, count;
+    bool reset;                             // a command timed out, reset before the next
+    struct ata_drive *drives[2];
+} ata_channel_t;
+
+typedef struct ata_drive {
+    blk_device_t dev;
+    ata_channel_t *chan;
+    uint8 slave;
+    bool lba48;
+    bool dma;
+    volatile bool parked;
+    char desc[48];
+} ata_drive_t;
+
+static ata_channel_t channels[2] = {
+    { .io = ATA_PRIMARY_IO, .ctrl = ATA_PRIMARY_CTRL, .irq = ATA_PRIMARY_IRQ },
+    { .io = ATA_SECONDARY_IO, .ctrl = ATA_SECONDARY_CTRL, .irq = ATA_SECONDARY_IRQ },
+};
+static ata_drive_t drives[4];
+static ata_stats_t stats;
+
+/* Reading the alternate status four times is the 400 ns the spec asks for */
+static void settle(ata_channel_t *chan)
+{
+    inportb(chan->ctrl);
+    inportb(chan->ctrl);
+    inportb(chan->ctrl);
+    inportb(chan->ctrl);
+}
+
+/* The status once BSY clears, or with BSY still set after ms */
+static uint8 wait_not_busy(ata_channel_t *chan, uint32 ms)
+{
+    uint64 deadline = ktime_ns() + (uint64)ms * NSEC_PER_MSEC;
+    uint8 status = inportb(chan->io + ATA_STATUS);
+    while ((status & ATA_SR_BSY) && ktime_ns() < deadline) {
+        cpu_relax();
+        status = inportb(chan->io + ATA_STATUS);
+    }
+    return status;
+}
+
+static bool wait_drq(ata_channel_t *chan)
+{
+    uint64 deadline = ktime_ns() + (uint64)ATA_TIMEOUT_MS * NSEC_PER_MSEC;
+    uint8 status = wait_not_busy(chan, ATA_TIMEOUT_MS);
+    while (!(status & (ATA_SR_BSY | ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF)) && ktime_ns() < deadline)
+        status = inportb(chan->io + ATA_STATUS);
+    return (status & (ATA_SR_BSY | ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF)) == ATA_SR_DRQ;
+}
+
+/* Ends a polled command: BSY still set means it timed out and the drive
+   is stuck in it, ERR or DF that it failed */
+static int poll_status(ata_channel_t *chan, uint8 status)
+{
+    if (status & ATA_SR_BSY) {
+        stats.timeouts++;
+        chan->reset = true;
+        return BLK_ERROR;
+    }
+    return status & (ATA_SR_ERR | ATA_SR_DF) ? BLK_ERROR : BLK_OK;
+}
+
+static uint8 ctrl_bits(ata_channel_t *chan)
+{
+    return chan->bm ? 0 : ATA_CTRL_NIEN;    // interrupts only for DMA
+}
+
+/* SRST: both drives drop whatever they were doing */
+static void reset_channel(ata_channel_t *chan)
+{
+    outportb(chan->ctrl, ctrl_bits(chan) | ATA_CTRL_SRST);
+    clock_delay_us(5);
+    outportb(chan->ctrl, ctrl_bits(chan));
+    clock_delay_us(2000);
+    wait_not_busy(chan, ATA_TIMEOUT_MS);
+    chan->reset = false;
+    stats.resets++;
+}
+
+/* Selects the drive and loads the address registers; LBA48 when needed */
+static bool setup_command(ata_drive_t *drive, uint32 lba, uint32 count)
+{
+    ata_channel_t *chan = drive->chan;
+    bool ext = drive->lba48 && lba + count > LBA28_LIMIT;
+    if (ext) {
+        outportb(chan->io + ATA_DRIVE, 0x40 | (drive->slave << 4));
+        settle(chan);
+        wait_not_busy(chan, ATA_TIMEOUT_MS);
+        outportb(chan->io + ATA_COUNT, count >> 8);
+        outportb(chan->io + ATA_LBA0, lba >> 24);
+        outportb(chan->io + ATA_LBA1, 0);
+        outportb(chan->io + ATA_LBA2, 0);
+    } else {
+        outportb(chan->io + ATA_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        settle(chan);
+        wait_not_busy(chan, ATA_TIMEOUT_MS);
+    }
+    outportb(chan->io + ATA_COUNT, count & 0xFF);   // 256 goes out as 0
+    outportb(chan->io + ATA_LBA0, lba);
+    outportb(chan->io + ATA_LBA1, lba >> 8);
+    outportb(chan->io + ATA_LBA2, lba >> 16);
+    return ext;
+}
+
+static bool claim(ata_drive_t *drive)
+{
+    ata_channel_t *chan = drive->chan;
+    if (!__sync_lock_test_and_set(&chan->claimed, 1)) return true;
+    drive->parked = true;
+    __sync_synchronize();                   // parked out before the second try
+    if (__sync_lock_test_and_set(&chan->claimed, 1)) return false;
+    drive->parked = false;
+    return true;
+}
+
+static void release(ata_drive_t *drive)
+{
+    ata_channel_t *chan = drive->chan;
+    ata_drive_t *other = chan->drives[!drive->slave];
+    __sync_lock_release(&chan->claimed);
+    __sync_synchronize();                   // claimed out before parked is read
+    if (other && other->parked) work_queue(&chan->restart_work);
+}
+
+static void restart_parked(void *arg)
+{
+    ata_channel_t *chan = (ata_channel_t *)arg;
+    uint32 i;
+    for (i = 0; i < 2; i++) {
+        ata_drive_t *drive = chan->drives[i];
+        if (!drive || !drive->parked) continue;
+        drive->parked = false;
+        blk_restart(&drive->dev);
+    }
+}
+
+static int pio_transfer(ata_drive_t *drive, blk_request_t *reqs, uint32 lba, uint32 count)
+{
+    ata_channel_t *chan = drive->chan;
+    bool write = reqs->write;
+    bool ext = setup_command(drive, lba, count);
+    blk_request_t *req;
+    if (write) outportb(chan->io + ATA_STATUS, ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+    else outportb(chan->io + ATA_STATUS, ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+    for (req = reqs; req; req = req->next) {
+        uint8 *buf = req->buf;
+        uint32 n;
+        for (n = 0; n < req->count; n++, buf += BLK_SECTOR_SIZE) {
+            if (!wait_drq(chan)) {
+                poll_status(chan, inportb(chan->io + ATA_STATUS));    // counts a timeout
+                return BLK_ERROR;
+            }
+            if (write) outsw(chan->io + ATA_DATA, buf, BLK_SECTOR_SIZE / 2);
+            else insw(chan->io + ATA_DATA, buf, BLK_SECTOR_SIZE / 2);
+        }
+    }
+    if (write && poll_status(chan, wait_not_busy(chan, ATA_TIMEOUT_MS)) != BLK_OK) return BLK_ERROR;
+    stats.pio_transfers++;
+    return BLK_OK;
+}
+
+static int flush_cache(ata_drive_t *drive)
+{
+    ata_channel_t *chan = drive->chan;
+    outportb(chan->io + ATA_DRIVE, 0xE0 | (drive->slave << 4));
+    settle(chan);
+    wait_not_busy(chan, ATA_TIMEOUT_MS);
+    outportb(chan->io + ATA_STATUS, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+    settle(chan);
+    stats.flushes++;
+    return poll_status(chan, wait_not_busy(chan, ATA_FLUSH_TIMEOUT_MS));
+}
+
+/* The PIO transfer or flush ata_start handed over, from a worker */
+static void polled_worker(void *arg)
+{
+    ata_channel_t *chan = (ata_channel_t *)arg;
+    ata_drive_t *drive = chan->polled;
+    blk_request_t *reqs = chan->reqs;
+    if (chan->reset) reset_channel(chan);
+    int status = reqs->flush ? flush_cache(drive) : pio_transfer(drive, reqs, chan->lba, chan->count);
+    uint32 flags = spin_lock_irqsave(&drive->dev.lock);
+    chan->polled = 0;
+    chan->reqs = 0;
+    release(drive);
+    blk_complete(&drive->dev, reqs, status);
+    spin_unlock_irqrestore(&drive->dev.lock, flags);
+}
+
+/* Fills the PRD table, a segment per request split at 64 KiB boundaries */
+static bool build_prdt(ata_channel_t *chan, blk_request_t *reqs)
+{
+    uint32 n = 0;
+    for (; reqs; reqs = reqs->next) {
+        uint32 addr = VIRT_TO_PHYS(reqs->buf);
+        uint32 len = reqs->count * BLK_SECTOR_SIZE;
+        while (len) {
+            uint32 chunk = 0x10000 - (addr & 0xFFFF);
+            if (chunk > len) chunk = len;
+            if (n == ATA_PRD_ENTRIES) return false;
+            chan->prdt[n].addr = addr;
+            chan->prdt[n].bytes = chunk & 0xFFFF;
+            chan->prdt[n].flags = 0;
+            n++;
+            addr += chunk;
+            len -= chunk;
+        }
+    }
+    chan->prdt[n - 1].flags = PRD_EOT;
+    return true;
+}
+
+static void dma_start(ata_drive_t *drive, blk_request_t *reqs, uint32 lba, uint32 count)
+{
+    ata_channel_t *chan = drive->chan;
+    bool write = reqs->write;
+    outportb(chan->bm + BM_COMMAND, 0);
+    outportl(chan->bm + BM_PRDT, chan->prdt_phys);
+    outportb(chan->bm + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+    outportb(chan->bm + BM_COMMAND, write ? 0 : BM_CMD_TO_MEM);
+    chan->active = drive;
+    chan->reqs = reqs;
+    bool ext = setup_command(drive, lba, count);
+    if (write) outportb(chan->io + ATA_STATUS, ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+    else outportb(chan->io + ATA_STATUS, ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+    outportb(chan->bm + BM_COMMAND, (write ? 0 : BM_CMD_TO_MEM) | BM_CMD_START);
+    chan->deadline = clock_ticks() + (uint64)ATA_TIMEOUT_MS * HZ / 1000;
+    timer_add(&chan->watchdog, chan->deadline);
+    stats.dma_transfers++;
+}
+
+/* Called by the block layer with the device lock held */
+static void ata_start(blk_device_t *dev)
+{
+    ata_drive_t *drive = (ata_drive_t *)dev->driver;
+    blk_request_t *reqs;
+    uint32 lba, count;
+    dev->busy = true;
+    if (!claim(drive)) {
+        stats.deferred++;
+        return;
+    }
+    reqs = blk_next_transfer(dev, &lba, &count);
+    if (!reqs->flush && drive->dma && !drive->chan->reset && build_prdt(drive->chan, reqs)) {
+        dma_start(drive, reqs, lba, count);
+        return;
+    }
+    drive->chan->polled = drive;
+    drive->chan->reqs = reqs;
+    drive->chan->lba = lba;
+    drive->chan->count = count;
+    work_queue(&drive->chan->polled_work);
+}
+
+/* Ends the command in flight; the caller holds the active drive's lock */
+static void dma_finish(ata_channel_t *chan, bool timed_out)
+{
+    ata_drive_t *drive = chan->active;
+    blk_request_t *reqs = chan->reqs;
+    uint8 bm_status = inportb(chan->bm + BM_STATUS);
+    outportb(chan->bm + BM_COMMAND, 0);
+    uint8 status = inportb(chan->io + ATA_STATUS);  // also acknowledges the drive
+    outportb(chan->bm + BM_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+    timer_cancel(&chan->watchdog);
+    chan->active = 0;
+    chan->reqs = 0;
+    release(drive);
+    if (timed_out) chan->reset = true;
+    bool failed = timed_out || (bm_status & BM_STATUS_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF));
+    blk_complete(&drive->dev, reqs, failed ? BLK_ERROR : BLK_OK);
+}
+
+static void channel_irq(ata_channel_t *chan)
+{
+    ata_drive_t *drive = chan->active;
+    if (!drive || !(inportb(chan->bm + BM_STATUS) & BM_STATUS_IRQ)) {
+        inportb(chan->io + ATA_STATUS);    // not a DMA completion, just acknowledge
+        return;
+    }
+    spin_lock(&drive->dev.lock);
+    if (chan->active == drive) dma_finish(chan, false);
+    spin_unlock(&drive->dev.lock);
+}
+
+static void primary_irq(registers_t *regs)
+{
+    channel_irq(&channels[0]);
+}
+
+static void secondary_irq(registers_t *regs)
+{
+    channel_irq(&channels[1]);
+}
+
+static void watchdog(void *arg)
+{
+    ata_channel_t *chan = (ata_channel_t *)arg;
+    ata_drive_t *drive = chan->active;
+    if (!drive) return;
+    spin_lock(&drive->dev.lock);
+    if (chan->active == drive && clock_ticks() >= chan->deadline) {     // not a later command
+        stats.timeouts++;
+        dma_finish(chan, true);
+    }
+    spin_unlock(&drive->dev.lock);
+}
+
+/* Byte-swapped, space-padded ASCII as IDENTIFY returns it */
+static void copy_model(char *dest, const uint16 *words, uint32 nwords)
+{
+    uint32 i, len = 0;
+    for (i = 0; i < nwords; i++) {
+        dest[len++] = words[i] >> 8;
+        dest[len++] = words[i] & 0xFF;
+    }
+    while (len && dest[len - 1] == ' ') len--;
+    dest[len] = 0;
+}
+
+static bool identify(ata_channel_t *chan, uint8 slave, uint16 *id)
+{
+    outportb(chan->io + ATA_DRIVE, 0xA0 | (slave << 4));
+    settle(chan);
+    outportb(chan->io + ATA_COUNT, 0);
+    outportb(chan->io + ATA_LBA0, 0);
+    outportb(chan->io + ATA_LBA1, 0);
+    outportb(chan->io + ATA_LBA2, 0);
+    outportb(chan->io + ATA_STATUS, ATA_CMD_IDENTIFY);
+    if (inportb(chan->io + ATA_STATUS) == 0) return false;     // nothing there
+    if (wait_not_busy(chan, ATA_TIMEOUT_MS) & ATA_SR_BSY) return false;
+    if (inportb(chan->io + ATA_LBA1) || inportb(chan->io + ATA_LBA2)) return false;   // ATAPI or SATA
+    if (!wait_drq(chan)) return false;
+    insw(chan->io + ATA_DATA, id, 256);
+    return true;
+}
+
+static void probe_channel(uint32 index)
+{
+    static const char *names[4] = { "hda", "hdb", "hdc", "hdd" };
+    ata_channel_t *chan = &channels[index];
+    uint16 id[256];
+    uint32 slave;
+    if (inportb(chan->io + ATA_STATUS) == 0xFF) return;         // floating bus
+    outportb(chan->ctrl, ctrl_bits(chan));
+    for (slave = 0; slave < 2; slave++) {
+        ata_drive_t *drive = &drives[index * 2 + slave];
+        char model[41];
+        if (!identify(chan, slave, id)) continue;
+        drive->chan = chan;
+        drive->slave = slave;
+        drive->lba48 = (id[83] & (1 << 10)) != 0;
+        drive->dma = chan->bm && (id[49] & (1 << 8));
+        drive->dev.sectors = drive->lba48 && !id[102] && !id[103] ? id[100] | ((uint32)id[101] << 16)
+                                                                   : id[60] | ((uint32)id[61] << 16);
+        if (drive->lba48 && (id[102] || id[103])) drive->dev.sectors = 0xFFFFFFFF;  // past 2 TiB, cut off
+        copy_model(model, &id[27], 20);
+        ksnprintf(drive->desc, sizeof(drive->desc), "%s, %s", model, drive->dma ? "dma" : "pio");
+        memcpy(drive->dev.name, names[index * 2 + slave], 4);
+        drive->dev.desc = drive->desc;
+        drive->dev.start = ata_start;
+        drive->dev.driver = drive;
+        chan->drives[slave] = drive;
+        blk_register(&drive->dev);
+        klog(KLOG_INFO, "ata: %s %s, %u MiB", drive->dev.name, drive->desc, drive->dev.sectors / 2048);
+    }
+    if (chan->drives[0] || chan->drives[1]) {
+        timer_setup(&chan->watchdog, watchdog, chan);
+        work_setup(&chan->restart_work, restart_parked, chan);
+        work_setup(&chan->polled_work, polled_worker, chan);
+        if (chan->bm) irq_register_handler(chan->irq, index ? secondary_irq : primary_irq);
+    }
+}
+
+/* Bus master registers of a compatibility-mode PCI IDE function, if any */
+static void find_bus_master()
+{
+    pci_addr_t addr;
+    uint32 i, bm;
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &addr)) return;
+    if (pci_read8(addr, PCI_PROG_IF) & 0x05) return;   // native mode, not a PIIX layout
+    if (!(pci_read8(addr, PCI_PROG_IF) & 0x80)) return; // no bus master
+    bm = pci_bar(addr, 4);
+    if (!bm || !(pci_read32(addr, PCI_BAR0 + 16) & PCI_BAR_IO)) return;
+    pci_enable(addr, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    for (i = 0; i < 2; i++) {
+        uint32 page = pmm_alloc_frames(0);
+        if (page == PMM_NO_FRAME) return;
+        channels[i].bm = bm + i * 8;
+        channels[i].prdt = (prd_t *)PHYS_TO_VIRT(page);
+        channels[i].prdt_phys = page;
+    }
+}
+
+void ata_init()
+{
+    find_bus_master();
+    probe_channel(0);
+    probe_channel(1);
+}
+
+const ata_stats_t *ata_stats()
+{
+    return &stats;
+}
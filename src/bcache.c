@@ -0,0 +1,275 @@
+//block buffer cache
+
+#include "../include/bcache.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/sched.h"
+#include "../include/spinlock.h"
+#include "../include/timer.h"
+#include "../include/workqueue.h"
+
+/*
+ * A fixed pool of page-sized buffers, found through a hash of (device,
+ * block) and kept on one LRU list. Eviction takes the least recently
+ * used buffer nobody holds that is clean and not under I/O, so a dirty
+ * buffer is only ever reused after it has been written back.
+ *
+ * Writes only mark a buffer dirty. Dirty buffers go out from bsync(),
+ * which the flush timer runs every BCACHE_FLUSH_MS, or when a miss
+ * finds nothing clean to evict. Everything dirty for a device is
+ * submitted as one chain, so neighbouring blocks leave as one transfer.
+ *
+ * A miss also queues reads for up to BCACHE_READAHEAD following blocks
+ * that are not cached yet, in the same chain as the block asked for; the
+ * block layer merges them into a single transfer and a sequential reader
+ * then finds the next blocks already there or on their way.
+ *
+ * Buffer flags change from interrupt context when I/O completes, so
+ * they are only changed with atomic operations. Everything else is under
+ * cache_lock. Waiting for I/O is on a single wait queue.
+ */
+
+#define BUF_AHEAD   0x10                    // read ahead and not asked for yet
+
+static buf_t bufs[BCACHE_BUFFERS];
+static buf_t *buckets[BCACHE_BUCKETS];
+static buf_t *lru_head, *lru_tail;
+static spinlock_t cache_lock = SPINLOCK_INIT;
+static wait_queue_t io_wait;
+static bcache_stats_t stats;
+static ktimer_t flush_timer;
+static work_t flush_work;
+static bool ready;
+
+static uint32 hash(blk_device_t *dev, uint32 block)
+{
+    return (((uint32)dev >> 4) ^ (block * 2654435761u)) & (BCACHE_BUCKETS - 1);
+}
+
+static buf_t *lookup(blk_device_t *dev, uint32 block)
+{
+    buf_t *b = buckets[hash(dev, block)];
+    while (b && (b->dev != dev || b->block != block)) b = b->hash_next;
+    return b;
+}
+
+static void unhash(buf_t *b)
+{
+    buf_t **link;
+    if (!b->dev) return;
+    for (link = &buckets[hash(b->dev, b->block)]; *link != b; link = &(*link)->hash_next);
+    *link = b->hash_next;
+}
+
+static void lru_remove(buf_t *b)
+{
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+}
+
+static void lru_push(buf_t *b)
+{
+    b->lru_prev = 0;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    else lru_tail = b;
+    lru_head = b;
+}
+
+static void touch(buf_t *b)
+{
+    lru_remove(b);
+    lru_push(b);
+}
+
+static buf_t *victim()
+{
+    buf_t *b;
+    for (b = lru_tail; b; b = b->lru_prev)
+        if (!b->refs && !(b->flags & (BUF_IO | BUF_DIRTY))) return b;
+    return 0;
+}
+
+/* Runs from the block layer, possibly in interrupt context */
+static void io_done(blk_request_t *req)
+{
+    buf_t *b = (buf_t *)req->private;
+    if (req->status != BLK_OK) __sync_fetch_and_or(&b->flags, req->write ? BUF_DIRTY : BUF_ERROR);
+    else if (!req->write) __sync_fetch_and_or(&b->flags, BUF_VALID);
+    __sync_fetch_and_and(&b->flags, ~BUF_IO);
+    wait_queue_wake_all(&io_wait);
+}
+
+static void wait_io(buf_t *b)
+{
+    uint32 flags = spin_lock_irqsave(&io_wait.lock);
+    while (b->flags & BUF_IO) wait_queue_sleep(&io_wait);
+    spin_unlock_irqrestore(&io_wait.lock, flags);
+}
+
+static void setup_request(buf_t *b, bool write)
+{
+    b->req.lba = b->block * BCACHE_SECTORS;
+    b->req.count = BCACHE_SECTORS;
+    b->req.buf = b->data;
+    b->req.write = write;
+    b->req.flush = false;
+    b->req.done = io_done;
+    b->req.private = b;
+    b->req.next = 0;
+}
+
+/* Caller holds cache_lock; b is unreferenced, clean and idle */
+static void assign(buf_t *b, blk_device_t *dev, uint32 block)
+{
+    if (b->dev) stats.evictions++;
+    unhash(b);
+    b->dev = dev;
+    b->block = block;
+    b->flags = BUF_IO;
+    b->hash_next = buckets[hash(dev, block)];
+    buckets[hash(dev, block)] = b;
+    touch(b);
+    setup_request(b, false);
+}
+
+static void flush_tick(void *arg)
+{
+    work_queue(&flush_work);
+}
+
+static void flush_worker(void *arg)
+{
+    bsync(false);
+    timer_add_ms(&flush_timer, BCACHE_FLUSH_MS);
+}
+
+void bcache_init()
+{
+    uint32 i, pool = pmm_alloc_frames(BCACHE_ORDER);
+    if (pool == PMM_NO_FRAME) return;
+    for (i = 0; i < BCACHE_BUFFERS; i++) {
+        bufs[i].data = (uint8 *)PHYS_TO_VIRT(pool + i * BCACHE_BLOCK);
+        lru_push(&bufs[i]);
+    }
+    timer_setup(&flush_timer, flush_tick, 0);
+    work_setup(&flush_work, flush_worker, 0);
+    timer_add_ms(&flush_timer, BCACHE_FLUSH_MS);
+    ready = true;
+}
+
+/* Queues read-ahead behind b, caller holds cache_lock */
+static void read_ahead(buf_t *b)
+{
+    blk_request_t *tail = &b->req;
+    uint32 i;
+    for (i = 1; i <= BCACHE_READAHEAD; i++) {
+        uint32 block = b->block + i;
+        buf_t *r;
+        if ((block + 1) * BCACHE_SECTORS > b->dev->sectors || lookup(b->dev, block)) break;
+        if (!(r = victim())) break;
+        assign(r, b->dev, block);
+        r->flags |= BUF_AHEAD;
+        tail->next = &r->req;
+        tail = &r->req;
+        stats.readahead++;
+    }
+}
+
+buf_t *bread(blk_device_t *dev, uint32 block)
+{
+    buf_t *b;
+    bool read = false;
+    uint32 flags;
+    if (!ready || (block + 1) * BCACHE_SECTORS > dev->sectors) return 0;
+
+    flags = spin_lock_irqsave(&cache_lock);
+    b = lookup(dev, block);
+    if (b) {
+        if (b->flags & BUF_AHEAD) {
+            __sync_fetch_and_and(&b->flags, ~BUF_AHEAD);
+            stats.readahead_hits++;
+        }
+        if (!(b->flags & (BUF_VALID | BUF_IO))) {       // an earlier read failed, try again
+            __sync_fetch_and_and(&b->flags, ~BUF_ERROR);
+            __sync_fetch_and_or(&b->flags, BUF_IO);
+            setup_request(b, false);
+            read = true;
+        }
+        stats.hits++;
+        b->refs++;
+        touch(b);
+    } else {
+        b = victim();
+        if (!b) {                                       // everything is dirty or held
+            spin_unlock_irqrestore(&cache_lock, flags);
+            bsync(true);
+            flags = spin_lock_irqsave(&cache_lock);
+            if ((b = lookup(dev, block)) || !(b = victim())) {
+                spin_unlock_irqrestore(&cache_lock, flags);
+                return b ? bread(dev, block) : 0;
+            }
+        }
+        stats.misses++;
+        assign(b, dev, block);
+        b->refs = 1;
+        read_ahead(b);
+        read = true;
+    }
+    spin_unlock_irqrestore(&cache_lock, flags);
+
+    if (read) blk_submit(dev, &b->req);
+    wait_io(b);
+    if (!(b->flags & BUF_VALID)) {
+        brelse(b);
+        return 0;
+    }
+    return b;
+}
+
+void bdirty(buf_t *b)
+{
+    __sync_fetch_and_or(&b->flags, BUF_DIRTY);
+}
+
+void brelse(buf_t *b)
+{
+    uint32 flags = spin_lock_irqsave(&cache_lock);
+    b->refs--;
+    spin_unlock_irqrestore(&cache_lock, flags);
+}
+
+/* Writes back everything dirty, a chain per device; wait for it or not */
+void bsync(bool wait)
+{
+    uint32 d, i, flags;
+    if (!ready) return;
+    for (d = 0; d < blk_count(); d++) {
+        blk_device_t *dev = blk_device(d);
+        blk_request_t *chain = 0;
+        flags = spin_lock_irqsave(&cache_lock);
+        for (i = 0; i < BCACHE_BUFFERS; i++) {
+            buf_t *b = &bufs[i];
+            if (b->dev != dev || (b->flags & (BUF_DIRTY | BUF_IO)) != BUF_DIRTY) continue;
+            __sync_fetch_and_or(&b->flags, BUF_IO);
+            __sync_fetch_and_and(&b->flags, ~BUF_DIRTY);
+            setup_request(b, true);
+            b->req.next = chain;
+            chain = &b->req;
+            stats.writebacks++;
+        }
+        spin_unlock_irqrestore(&cache_lock, flags);
+        if (!chain) continue;
+        blk_submit(dev, chain);                         // BUF_IO keeps them from eviction
+        if (!wait) continue;
+        for (i = 0; i < BCACHE_BUFFERS; i++)            // the queue has relinked the chain
+            if (bufs[i].dev == dev) wait_io(&bufs[i]);
+    }
+}
+
+const bcache_stats_t *bcache_stats()
+{
+    return &stats;
+}
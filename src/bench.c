@@ -0,0 +1,401 @@
+//microbenchmarks
+
+#include "../include/bench.h"
+#include "../include/apic.h"
+#include "../include/bcache.h"
+#include "../include/blk.h"
+#include "../include/clock.h"
+#include "../include/heap.h"
+#include "../include/isr.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/pmu.h"
+#include "../include/proc.h"
+#include "../include/sched.h"
+#include "../include/screen.h"
+#include "../include/serial.h"
+#include "../include/slab.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * Every benchmark runs BENCH_WARMUP untimed samples, then BENCH_SAMPLES
+ * timed ones. A sample is two rdtsc around run(batch), divided by batch,
+ * so the figures are TSC cycles per operation. The samples are sorted
+ * for the min, median, p99 and max. Interrupts stay on: timer ticks and
+ * other threads land in the tail, which is what the p99 is there to show.
+ *
+ * With hardware performance counters, the timed samples are also counted
+ * as a whole, and each row gets a line of counts per operation under it:
+ * core cycles next to the TSC's, instructions, LLC and branch misses.
+ * Benchmarks measured from user space get no counts.
+ *
+ * The thread is pinned from setup to teardown: the self-IPI and the
+ * yield partner are set up for the cpu it is on, and the counters are
+ * that cpu's too.
+ *
+ * The results go to the console as a table. When the serial port is up,
+ * each benchmark also gets one "BENCH key=value ..." line there, for
+ * scripts to scrape. The console echo is switched off while the console
+ * itself is measured, so those runs time the screen and not the port.
+ */
+
+#define COPY_MAX        (1024 * 1024)
+#define DISK_SPAN       1024                // blocks the uncached reads walk through
+
+static uint8 *src_buf, *dest_buf;
+static uint32 samples[BENCH_SAMPLES];
+static bool echo_was;
+
+static volatile uint32 ipis_seen;
+static uint32 self_apic_id;
+
+static kmem_cache_t *bench_cache;
+
+static volatile bool yield_stop;
+static volatile bool yield_done;
+
+static uint32 user_count;
+
+static blk_device_t *disk;
+static uint32 disk_frame, disk_block;
+
+static bool buffers_setup(uint32 size)
+{
+    src_buf = (uint8 *)kmalloc(COPY_MAX);
+    dest_buf = (uint8 *)kmalloc(COPY_MAX);
+    if (!src_buf || !dest_buf) {
+        kfree(src_buf);
+        kfree(dest_buf);
+        return false;
+    }
+    memory_set(src_buf, 0x5A, COPY_MAX);     // fault nothing in during the samples
+    memory_set(dest_buf, 0, COPY_MAX);
+    return true;
+}
+
+static void buffers_teardown()
+{
+    kfree(src_buf);
+    kfree(dest_buf);
+}
+
+static void copy_run(uint32 n, uint32 size)
+{
+    while (n--) memory_copy((char *)src_buf, (char *)dest_buf, size);
+}
+
+static void set_run(uint32 n, uint32 size)
+{
+    while (n--) memory_set(dest_buf, (uint8)n, size);
+}
+
+static bool console_setup(uint32 arg)
+{
+    echo_was = screen_set_echo(false);
+    return true;
+}
+
+static void console_teardown()
+{
+    screen_set_echo(echo_was);
+}
+
+static void printch_run(uint32 n, uint32 arg)
+{
+    while (n--) printch(n & 63 ? 'x' : '\n');
+}
+
+static void print_run(uint32 n, uint32 arg)
+{
+    while (n--) print("the quick brown fox jumps over the lazy dog\n");
+}
+
+static void scroll_run(uint32 n, uint32 arg)
+{
+    while (n--) scrollUp(1);
+}
+
+static void streql_run(uint32 n, uint32 arg)
+{
+    static volatile uint32 sink;
+    static char a[] = "0123456789abcdefghijklmnopqrstuv";
+    static char b[] = "0123456789abcdefghijklmnopqrstuv";
+    while (n--) sink += strEql(a, b);
+}
+
+static void startswith_run(uint32 n, uint32 arg)
+{
+    static volatile uint32 sink;
+    while (n--) sink += StartsWith("bootprof extra arguments", "bootprof");
+}
+
+static void kmalloc_run(uint32 n, uint32 size)
+{
+    while (n--) kfree(kmalloc(size));
+}
+
+static bool slab_setup(uint32 size)
+{
+    if (!bench_cache) bench_cache = kmem_cache_create("bench", size, 0);
+    return bench_cache != 0;
+}
+
+static void slab_run(uint32 n, uint32 arg)
+{
+    while (n--) kmem_cache_free(bench_cache, kmem_cache_alloc(bench_cache));
+}
+
+static void bench_ipi(registers_t *regs)
+{
+    ipis_seen++;
+}
+
+/* A self-IPI: ICR write, delivery, entry, handler, EOI and iret */
+static bool irq_setup(uint32 arg)
+{
+    if (!apic_active()) return false;
+    uint32 flags = interrupts_save();
+    self_apic_id = this_cpu()->apic_id;
+    interrupts_restore(flags);
+    isr_register_handler(IPI_BENCH, bench_ipi);
+    return true;
+}
+
+static void irq_run(uint32 n, uint32 arg)
+{
+    while (n--) {
+        uint32 want = ipis_seen + 1;
+        lapic_send_ipi(self_apic_id, IPI_BENCH);
+        while (ipis_seen != want) cpu_relax();
+    }
+}
+
+static void yield_partner(void *arg)
+{
+    while (!yield_stop) thread_yield();
+    yield_done = true;
+}
+
+/* A partner on this cpu that only yields back, so a yield is two switches */
+static bool yield_setup(uint32 arg)
+{
+    yield_stop = false;
+    yield_done = false;
+    uint32 flags = interrupts_save();
+    thread_t *partner = thread_create_on(this_cpu(), "bench", yield_partner, 0);
+    interrupts_restore(flags);
+    return partner != 0;
+}
+
+static void yield_run(uint32 n, uint32 arg)
+{
+    while (n--) thread_yield();
+}
+
+static void yield_teardown()
+{
+    yield_stop = true;
+    while (!yield_done) thread_yield();
+}
+
+/* The first disk, and a page of the direct map to read into */
+static bool disk_setup(uint32 arg)
+{
+    if (!(disk = blk_device(0)) || disk->sectors < DISK_SPAN * BCACHE_SECTORS) return false;
+    disk_frame = pmm_alloc_frame();
+    disk_block = 0;
+    return disk_frame != PMM_NO_FRAME;
+}
+
+static void disk_teardown()
+{
+    pmm_free_frame(disk_frame);
+}
+
+/* Each read is a block further on, so none comes out of the drive's cache twice in a row */
+static void disk_read_run(uint32 n, uint32 arg)
+{
+    while (n--) {
+        blk_rw(disk, disk_block * BCACHE_SECTORS, BCACHE_SECTORS, PHYS_TO_VIRT(disk_frame), false);
+        disk_block = (disk_block + 1) % DISK_SPAN;
+    }
+}
+
+static void bread_run(uint32 n, uint32 arg)
+{
+    while (n--) {
+        buf_t *b = bread(disk, 0);
+        if (b) brelse(b);
+    }
+}
+
+/* From SYS_BENCH, on the program's thread */
+void bench_user_samples(const uint32 *v, uint32 n)
+{
+    if (n > BENCH_SAMPLES) n = BENCH_SAMPLES;
+    memory_copy((char *)v, (char *)samples, n * sizeof(uint32));
+    user_count = n;
+}
+
+/* Runs a program from user/ that times the system calls itself */
+static bool user_setup(uint32 arg)
+{
+    static const char *programs[] = { "bin/sysbench", "bin/int80bench" };
+    process_t *p;
+    user_count = 0;
+    if (!(p = proc_spawn(programs[arg]))) return false;
+    return proc_wait(p) == 0 && user_count == BENCH_SAMPLES;
+}
+
+static const bench_t benches[] = {
+    { "memcpy-64", "memory_copy, 64 bytes", 1000, 64, buffers_setup, copy_run, buffers_teardown },
+    { "memcpy-4k", "memory_copy, 4 KiB", 100, 4096, buffers_setup, copy_run, buffers_teardown },
+    { "memcpy-64k", "memory_copy, 64 KiB", 4, 65536, buffers_setup, copy_run, buffers_teardown },
+    { "memcpy-1m", "memory_copy, 1 MiB, non-temporal", 1, COPY_MAX, buffers_setup, copy_run, buffers_teardown },
+    { "memset-4k", "memory_set, 4 KiB", 100, 4096, buffers_setup, set_run, buffers_teardown },
+    { "memset-1m", "memory_set, 1 MiB, non-temporal", 1, COPY_MAX, buffers_setup, set_run, buffers_teardown },
+    { "printch", "printch, one character", 256, 0, console_setup, printch_run, console_teardown },
+    { "print", "print, a 44 character line", 16, 0, console_setup, print_run, console_teardown },
+    { "scroll", "scrollUp, one line", 16, 0, console_setup, scroll_run, console_teardown },
+    { "streql", "strEql, equal 32 character strings", 1000, 0, 0, streql_run, 0 },
+    { "startswith", "StartsWith, a matching command", 1000, 0, 0, startswith_run, 0 },
+    { "kmalloc", "kmalloc and kfree, 64 bytes", 1000, 64, 0, kmalloc_run, 0 },
+    { "slab", "kmem_cache_alloc and free, 64 bytes", 1000, 64, slab_setup, slab_run, 0 },
+    { "irq", "self-IPI round trip", 100, 0, irq_setup, irq_run, 0 },
+    { "yield", "thread_yield to a partner and back", 100, 0, yield_setup, yield_run, yield_teardown },
+    { "disk-read", "blk_rw, a 4 KiB read from the first disk, uncached", 8, 0, disk_setup, disk_read_run, disk_teardown },
+    { "bread", "bread and brelse, a cached 4 KiB block", 100, 0, disk_setup, bread_run, disk_teardown },
+    { "syscall", "null system call from ring 3, the fast path", BENCH_SYSCALL_BATCH, 0, user_setup, 0, 0 },
+    { "int80", "null system call from ring 3, int 0x80", BENCH_SYSCALL_BATCH, 1, user_setup, 0, 0 },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+static void sort(uint32 *v, uint32 n)
+{
+    uint32 i, j;
+    for (i = 1; i < n; i++) {
+        uint32 x = v[i];
+        for (j = i; j && v[j - 1] > x; j--) v[j] = v[j - 1];
+        v[j] = x;
+    }
+}
+
+static uint32 sample(const bench_t *b)
+{
+    uint64 start = rdtsc();
+    b->run(b->batch, b->arg);
+    return (uint32)udiv64(rdtsc() - start, b->batch, 0);
+}
+
+static uint32 cycles_to_ns(uint32 cycles)
+{
+    return tsc_khz() ? (uint32)tsc_to_ns(cycles) : 0;
+}
+
+static bool measure(const bench_t *b, bench_result_t *r)
+{
+    thread_t *self = thread_current();
+    bool pinned = self->pinned;
+    pmu_counts_t start, end;
+    uint32 i;
+    self->pinned = true;
+    if (b->setup && !b->setup(b->arg)) {
+        self->pinned = pinned;
+        return false;
+    }
+    for (i = 0; b->run && i < BENCH_WARMUP; i++) sample(b);
+    pmu_read(&start);
+    for (i = 0; b->run && i < BENCH_SAMPLES; i++) samples[i] = sample(b);
+    pmu_read(&end);
+    if (b->teardown) b->teardown();
+    self->pinned = pinned;
+    r->counted = b->run && pmu_active();
+    pmu_delta(&start, &end, &r->pmc);
+    sort(samples, BENCH_SAMPLES);
+    r->min = samples[0];
+    r->median = samples[BENCH_SAMPLES / 2];
+    r->p99 = samples[BENCH_SAMPLES * 99 / 100];
+    r->max = samples[BENCH_SAMPLES - 1];
+    return true;
+}
+
+/* Counts per operation, in hundredths, for each event counted, then the
+   instructions per cycle; 0 for the ones there are no counts for */
+static void per_op(const bench_t *b, const bench_result_t *r, uint32 *v)
+{
+    uint32 i, ops = BENCH_SAMPLES * b->batch;
+    for (i = 0; i < PMU_EVENTS; i++) v[i] = (uint32)udiv64(r->pmc.v[i] * 100, ops, 0);
+    v[PMU_EVENTS] = v[PMU_CYCLES] ? (uint32)udiv64((uint64)v[PMU_INSTRUCTIONS] * 100, v[PMU_CYCLES], 0) : 0;
+}
+
+static void report(const bench_t *b, const bench_result_t *r)
+{
+    char line[256];
+    uint32 v[PMU_EVENTS + 1], i;
+    int len;
+    kprintf("\n%-12s%10u%10u%10u%10u%10u", b->name, r->min, r->median, r->p99, r->max, cycles_to_ns(r->median));
+    if (r->counted) {
+        per_op(b, r, v);
+        kprintf("\n  per op:");
+        for (i = 0; i < PMU_EVENTS; i++)
+            if (pmu_counting(i)) kprintf(" %u.%02u %s", v[i] / 100, v[i] % 100, pmu_event_name(i));
+        if (v[PMU_EVENTS]) kprintf(", %u.%02u ipc", v[PMU_EVENTS] / 100, v[PMU_EVENTS] % 100);
+    }
+    if (!serial_active()) return;
+    len = ksnprintf(line, sizeof(line), "BENCH name=%s batch=%u samples=%u min=%u median=%u p99=%u max=%u median_ns=%u tsc_khz=%u",
+                    b->name, b->batch, BENCH_SAMPLES, r->min, r->median, r->p99, r->max, cycles_to_ns(r->median), tsc_khz());
+    for (i = 0; r->counted && i <= PMU_EVENTS && len < (int)sizeof(line); i++) {
+        if (i < PMU_EVENTS && !pmu_counting(i)) continue;
+        if (i == PMU_EVENTS && !v[i]) continue;
+        len += ksnprintf(line + len, sizeof(line) - len, " %s=%u.%02u", i < PMU_EVENTS ? pmu_event_name(i) : "ipc", v[i] / 100, v[i] % 100);
+    }
+    if (len > (int)sizeof(line) - 2) len = sizeof(line) - 2;
+    line[len++] = '\n';
+    serial_write(line, len);
+}
+
+static void header()
+{
+    kprintf("\n%-12s%10s%10s%10s%10s%10s", "cycles/op", "min", "median", "p99", "max", "median ns");
+}
+
+static void run_one(const bench_t *b)
+{
+    bench_result_t r;
+    if (measure(b, &r)) report(b, &r);
+    else kprintf("\n%-12s  not available", b->name);
+}
+
+void bench_list()
+{
+    uint32 i;
+    kprintf("\nbench <name> or bench all:");
+    for (i = 0; i < BENCH_COUNT; i++) kprintf("\n  %-12s%s", benches[i].name, benches[i].what);
+    kprintf("\n");
+}
+
+bool bench_run(const char *name)
+{
+    uint32 i;
+    for (i = 0; i < BENCH_COUNT; i++) {
+        if (strcmp(benches[i].name, name)) continue;
+        header();
+        run_one(&benches[i]);
+        kprintf("\n");
+        return true;
+    }
+    return false;
+}
+
+void bench_all()
+{
+    uint32 i;
+    header();
+    for (i = 0; i < BENCH_COUNT; i++) run_one(&benches[i]);
+    kprintf("\n");
+}
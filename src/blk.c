@@ -0,0 +1,208 @@
+//block device layer
+
+#include "../include/blk.h"
+#include "../include/sched.h"
+#include "../include/string.h"
+
+/*
+ * Each device has one queue, kept in C-LOOK order: the requests at or
+ * past the sector the last transfer ended at, ascending, then the ones
+ * below it, ascending, for the next sweep. A stream of low sectors thus
+ * waits for the sweep to come round instead of keeping everything above
+ * it waiting forever.
+ *
+ * blk_submit takes a whole chain of requests and queues all of them
+ * before the driver is kicked, so a caller that issues several
+ * neighbouring blocks at once (the cache's read-ahead, a flush) has them
+ * all in the queue when the driver picks its next transfer. A request
+ * that is empty, longer than BLK_MAX_SECTORS or runs off the end of the
+ * device fails with BLK_ERROR on the spot, so drivers never see one.
+ * A flush goes to the back of the queue and is a transfer of its own;
+ * nothing queued after it is moved ahead of it.
+ *
+ * blk_next_transfer takes the head of the queue plus every request after
+ * it that starts where the previous one ended and goes the same way, up
+ * to BLK_MAX_SECTORS and BLK_MAX_SEGMENTS. The driver moves that as a
+ * single command, each request's buffer one scatter-gather segment, so
+ * the stats count the riders as merged.
+ *
+ * start is only ever called from one loop, so a driver that finishes a
+ * transfer before returning gets called again by the loop instead
+ * of from inside blk_complete, and the stack stays flat.
+ *
+ * Waiting is done by blk_rw only, on one wait queue for all devices;
+ * completions are rare enough next to the work they stand for that a
+ * spurious wakeup costs nothing worth a queue per request.
+ */
+
+static blk_device_t *devices[BLK_MAX_DEVICES];
+static uint32 ndevices;
+static wait_queue_t waiters;
+
+/* Caller holds dev->lock */
+static void run_queue(blk_device_t *dev)
+{
+    if (dev->running) return;           // the loop further up the stack carries on
+    dev->running = true;
+    while (!dev->busy && dev->queue) dev->start(dev);
+    dev->running = false;
+}
+
+void blk_register(blk_device_t *dev)
+{
+    if (ndevices == BLK_MAX_DEVICES) return;
+    spin_init(&dev->lock);
+    dev->queue = 0;
+    dev->position = 0;
+    dev->busy = false;
+    dev->running = false;
+    devices[ndevices++] = dev;
+}
+
+uint32 blk_count()
+{
+    return ndevices;
+}
+
+blk_device_t *blk_device(uint32 index)
+{
+    return index < ndevices ? devices[index] : 0;
+}
+
+blk_device_t *blk_find(const char *name)
+{
+    uint32 i;
+    for (i = 0; i < ndevices; i++)
+        if (!strcmp(devices[i]->name, name)) return devices[i];
+    return 0;
+}
+
+static bool valid(blk_device_t *dev, blk_request_t *req)
+{
+    if (req->flush) return true;
+    return req->count && req->count <= BLK_MAX_SECTORS && req->lba + req->count > req->lba &&
+           req->lba + req->count <= dev->sectors;
+}
+
+/* Whether a comes no later than b in the sweep from pos */
+static bool sweeps_before(uint32 pos, const blk_request_t *a, const blk_request_t *b)
+{
+    bool a_next = a->lba < pos, b_next = b->lba < pos;     // left for the next sweep
+    if (a_next != b_next) return b_next;
+    return a->lba <= b->lba;
+}
+
+void blk_submit(blk_device_t *dev, blk_request_t *reqs)
+{
+    bool wake = false;
+    uint32 flags = spin_lock_irqsave(&dev->lock);
+    while (reqs) {
+        blk_request_t *req = reqs, **link = &dev->queue, **p;
+        reqs = reqs->next;
+        dev->stats.requests++;
+        if (!valid(dev, req)) {
+            req->status = BLK_ERROR;
+            req->next = 0;
+            dev->stats.errors++;
+            if (req->done) req->done(req);
+            else wake = true;
+            continue;
+        }
+        req->status = BLK_PENDING;
+        for (p = &dev->queue; *p; p = &(*p)->next)
+            if ((*p)->flush) link = &(*p)->next;
+        while (*link && (req->flush || sweeps_before(dev->position, *link, req))) link = &(*link)->next;
+        req->next = *link;
+        *link = req;
+    }
+    run_queue(dev);
+    spin_unlock_irqrestore(&dev->lock, flags);
+    if (wake) wait_queue_wake_all(&waiters);
+}
+
+/* Caller holds dev->lock; returns the requests chained in sector order */
+blk_request_t *blk_next_transfer(blk_device_t *dev, uint32 *lba, uint32 *count)
+{
+    blk_request_t *first = dev->queue, *last = first;
+    uint32 sectors, segments = 1;
+    if (!first) return 0;
+    sectors = first->count;
+    while (!first->flush && last->next && segments < BLK_MAX_SEGMENTS) {
+        blk_request_t *next = last->next;
+        if (next->flush || next->lba != last->lba + last->count || next->write != first->write) break;
+        if (sectors + next->count > BLK_MAX_SECTORS) break;
+        sectors += next->count;
+        segments++;
+        last = next;
+    }
+    dev->queue = last->next;
+    last->next = 0;
+    if (!first->flush) dev->position = first->lba + sectors;
+    dev->stats.merged += segments - 1;
+    dev->stats.transfers++;
+    dev->stats.sectors += sectors;
+    *lba = first->lba;
+    *count = sectors;
+    return first;
+}
+
+/* Caller holds dev->lock */
+void blk_complete(blk_device_t *dev, blk_request_t *reqs, int status)
+{
+    bool wake = false;
+    if (status != BLK_OK) dev->stats.errors++;
+    while (reqs) {
+        blk_request_t *next = reqs->next;
+        reqs->status = status;
+        if (reqs->done) reqs->done(reqs);
+        else wake = true;
+        reqs = next;
+    }
+    dev->busy = false;
+    run_queue(dev);
+    if (wake) wait_queue_wake_all(&waiters);
+}
+
+void blk_restart(blk_device_t *dev)
+{
+    uint32 flags = spin_lock_irqsave(&dev->lock);
+    dev->busy = false;
+    run_queue(dev);
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+static int wait_request(blk_device_t *dev, blk_request_t *req)
+{
+    req->done = 0;
+    req->next = 0;
+    blk_submit(dev, req);
+    uint32 flags = spin_lock_irqsave(&waiters.lock);
+    while (req->status == BLK_PENDING) wait_queue_sleep(&waiters);
+    spin_unlock_irqrestore(&waiters.lock, flags);
+    return req->status;
+}
+
+/* Synchronous transfer, from a thread */
+int blk_rw(blk_device_t *dev, uint32 lba, uint32 count, void *buf, bool write)
+{
+    blk_request_t req;
+    req.lba = lba;
+    req.count = count;
+    req.buf = (uint8 *)buf;
+    req.write = write;
+    req.flush = false;
+    return wait_request(dev, &req);
+}
+
+/* Writes back the device's cache, from a thread; covers the writes that
+   completed before the call */
+int blk_flush(blk_device_t *dev)
+{
+    blk_request_t req;
+    req.lba = 0;
+    req.count = 0;
+    req.buf = 0;
+    req.write = true;
+    req.flush = true;
+    return wait_request(dev, &req);
+}
@@ -0,0 +1,34 @@
+//boot phase tracing
+
+#include "../include/bootprof.h"
+#include "../include/system.h"
+
+/*
+ * A mark is a rdtsc and two stores into a static array, so it can go
+ * anywhere from the first line of kmain on: nothing is allocated,
+ * printed or converted until bootprof is asked for. The slot is taken
+ * with an atomic add so marks from other cpus or threads cannot land
+ * on top of each other.
+ */
+
+static bootprof_mark_t marks[BOOTPROF_PHASES];
+static volatile uint32 count;
+
+void bootprof_mark(const char *name)
+{
+    uint64 now = rdtsc();
+    uint32 slot = __sync_fetch_and_add(&count, 1);
+    if (slot >= BOOTPROF_PHASES) return;
+    marks[slot].name = name;
+    marks[slot].tsc = now;
+}
+
+uint32 bootprof_count()
+{
+    return count < BOOTPROF_PHASES ? count : BOOTPROF_PHASES;
+}
+
+const bootprof_mark_t *bootprof_marks()
+{
+    return marks;
+}
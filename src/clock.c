@@ -0,0 +1,150 @@
+//PIT clock events and TSC clock source
+
+#include "../include/clock.h"
+#include "../include/isr.h"
+#include "../include/system.h"
+#include "../include/timer.h"
+#include "../include/util.h"
+#include "../include/klog.h"
+
+/*
+ * Reading the time never touches the PIT: the TSC is calibrated once
+ * against PIT channel 2 and ktime_ns() is a rdtsc plus a multiply and
+ * shift, with the nanoseconds per cycle folded into an 8.24 fixed-point
+ * factor (good down to a 4 MHz TSC). Ticks are derived from that clock.
+ *
+ * With a TSC the system is tickless: channel 0 runs in one-shot mode and
+ * is only armed for the earliest timer the wheel holds, capped at the
+ * longest count the PIT can do (about 55 ms). With no timer pending it
+ * stays silent. Without a TSC we fall back to a periodic HZ tick and
+ * count time in ticks.
+ */
+
+#define PIT_CHANNEL0    0x40
+#define PIT_CHANNEL2    0x42
+#define PIT_COMMAND     0x43
+#define PIT_GATE_PORT   0x61            // bit 0 gates channel 2, bit 5 is its output
+#define PIT_MAX_COUNT   0xFFFF
+
+#define CALIBRATE_MS    10
+#define MULT_SHIFT      24
+
+static volatile uint64 ticks;           // periodic fallback only
+static uint64 tsc_base;
+static uint32 tsc_khz_value;
+static uint32 ns_per_cycle_mult;        // ns = (cycles * mult) >> MULT_SHIFT
+static uint32 pit_per_ns_mult;          // pit counts = (ns * mult) >> 32
+static uint64 pit_max_ns;
+static uint64 armed_ns;                 // when the armed one-shot fires, CLOCK_NOT_ARMED if idle
+static bool have_tsc;
+
+static void pit_irq(registers_t *regs)
+{
+    if (have_tsc) armed_ns = CLOCK_NOT_ARMED;
+    else ticks++;
+    timer_tick();
+}
+
+/* Counts TSC cycles across a CALIBRATE_MS one-shot of PIT channel 2 */
+static uint32 calibrate_tsc_khz()
+{
+    uint32 count = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+    uint8 gate = (inportb(PIT_GATE_PORT) & ~0x02) | 0x01;    // speaker off, gate on
+    outportb(PIT_GATE_PORT, gate);
+    outportb(PIT_COMMAND, 0xB0);        // channel 2, lobyte/hibyte, mode 0
+    outportb(PIT_CHANNEL2, count & 0xFF);
+    outportb(PIT_CHANNEL2, count >> 8);
+    outportb(PIT_GATE_PORT, gate & ~0x01);      // restart the count on a rising gate
+    outportb(PIT_GATE_PORT, gate);
+
+    uint64 start = rdtsc();
+    while (!(inportb(PIT_GATE_PORT) & 0x20));
+    uint64 end = rdtsc();
+    return (uint32)(end - start) / CALIBRATE_MS;
+}
+
+void clock_init()
+{
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    have_tsc = (edx & CPUID_EDX_TSC) != 0;
+    if (have_tsc) {
+        tsc_khz_value = calibrate_tsc_khz();
+        if (!tsc_khz_value) have_tsc = false;
+    }
+    armed_ns = CLOCK_NOT_ARMED;
+    irq_register_handler(0, pit_irq);
+
+    if (have_tsc) {
+        ns_per_cycle_mult = (uint32)udiv64((uint64)NSEC_PER_MSEC << MULT_SHIFT, tsc_khz_value, 0);
+        pit_per_ns_mult = (uint32)udiv64((uint64)PIT_FREQUENCY << 32, 1000000000, 0);
+        pit_max_ns = udiv64((uint64)PIT_MAX_COUNT * 1000000000, PIT_FREQUENCY, 0);
+        tsc_base = rdtsc();
+        outportb(PIT_COMMAND, 0x30);    // channel 0, lobyte/hibyte, one-shot; stays quiet until armed
+        klog(KLOG_INFO, "clock: TSC at %u kHz, tickless", tsc_khz_value);
+        return;
+    }
+
+    uint16 divisor = PIT_FREQUENCY / HZ;
+    outportb(PIT_COMMAND, 0x34);        // channel 0, lobyte/hibyte, rate generator
+    outportb(PIT_CHANNEL0, divisor & 0xFF);
+    outportb(PIT_CHANNEL0, divisor >> 8);
+    klog(KLOG_INFO, "clock: no usable TSC, periodic %u Hz tick", HZ);
+}
+
+/* Makes sure an interrupt arrives by tick (CLOCK_NOT_ARMED: nothing to wait
+   for). Only ever moves the armed deadline earlier, the IRQ re-arms. */
+void clock_set_next_event(uint64 tick)
+{
+    if (!have_tsc || tick == CLOCK_NOT_ARMED) return;
+
+    uint64 now = ktime_ns();
+    uint64 when = tick * NSEC_PER_TICK;
+    uint64 delta = when > now ? when - now : 0;
+    if (delta > pit_max_ns) delta = pit_max_ns;
+    if (armed_ns != CLOCK_NOT_ARMED && armed_ns <= now + delta) return;
+
+    uint32 count = (uint32)mul_u64_u32_shr(delta, pit_per_ns_mult, 32);
+    if (count < 1) count = 1;
+    if (count > PIT_MAX_COUNT) count = PIT_MAX_COUNT;
+    armed_ns = now + delta;
+    outportb(PIT_COMMAND, 0x30);
+    outportb(PIT_CHANNEL0, count & 0xFF);
+    outportb(PIT_CHANNEL0, count >> 8);
+}
+
+uint64 tsc_to_ns(uint64 cycles)
+{
+    return mul_u64_u32_shr(cycles, ns_per_cycle_mult, MULT_SHIFT);
+}
+
+/* Nanoseconds since clock_init, tick resolution if the cpu has no TSC */
+uint64 ktime_ns()
+{
+    if (have_tsc) return tsc_to_ns(rdtsc() - tsc_base);
+    uint32 flags = interrupts_save();   // a 64 bit read is two loads
+    uint64 now = ticks;
+    interrupts_restore(flags);
+    return now * NSEC_PER_TICK;
+}
+
+uint64 clock_ticks()
+{
+    return udiv64(ktime_ns(), NSEC_PER_TICK, 0);
+}
+
+uint32 tsc_khz()
+{
+    return tsc_khz_value;
+}
+
+bool clock_tickless()
+{
+    return have_tsc;
+}
+
+void clock_delay_us(uint32 us)
+{
+    uint64 end = ktime_ns() + (uint64)us * NSEC_PER_USEC;
+    while (ktime_ns() < end) __asm__ __volatile__ ("pause");
+}
@@ -0,0 +1,49 @@
+//ELF executable loader
+
+#include "../include/elf.h"
+#include "../include/klog.h"
+
+/*
+ * Static 32 bit i386 executables only, no interpreter and no
+ * relocation. Each PT_LOAD segment becomes an area of the address space
+ * with the segment's permissions, backed by its bytes in the image and
+ * zero past filesz. Nothing is read here: the pages fill in as the
+ * program touches them, see vm.c.
+ */
+
+static bool bad(const char *why)
+{
+    klog(KLOG_WARN, "elf: %s", why);
+    return false;
+}
+
+bool elf_load(mm_t *mm, const uint8 *image, uint32 size, uint32 *entry, uint32 *end)
+{
+    const elf_header_t *eh = (const elf_header_t *)image;
+    uint32 i, top = 0;
+    if (size < sizeof(elf_header_t) || eh->magic != ELF_MAGIC) return bad("not an ELF image");
+    if (eh->class != ELF_CLASS32 || eh->data != ELF_DATA_LSB || eh->machine != ELF_MACHINE_386)
+        return bad("not a 32 bit i386 image");
+    if (eh->type != ELF_TYPE_EXEC) return bad("not an executable");
+    if (eh->phentsize != sizeof(elf_phdr_t) || eh->phoff > size ||
+        eh->phnum > (size - eh->phoff) / sizeof(elf_phdr_t))
+        return bad("bad program headers");
+
+    for (i = 0; i < eh->phnum; i++) {
+        const elf_phdr_t *ph = (const elf_phdr_t *)(image + eh->phoff) + i;
+        uint32 flags = 0;
+        if (ph->type != ELF_PT_LOAD || !ph->memsz) continue;
+        if (ph->filesz > ph->memsz || ph->offset > size || ph->filesz > size - ph->offset)
+            return bad("segment outside the image");
+        if (ph->flags & ELF_PF_R) flags |= VM_READ;
+        if (ph->flags & ELF_PF_W) flags |= VM_WRITE;
+        if (ph->flags & ELF_PF_X) flags |= VM_EXEC;
+        if (!vm_map(mm, ph->vaddr, ph->memsz, flags, image + ph->offset, ph->filesz))
+            return bad("segment overlaps another or the kernel");
+        if (ph->vaddr + ph->memsz > top) top = ph->vaddr + ph->memsz;
+    }
+    if (!vm_find(mm, eh->entry)) return bad("entry point outside the segments");
+    *entry = eh->entry;
+    *end = top;
+    return true;
+}
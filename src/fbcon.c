@@ -0,0 +1,271 @@
+//framebuffer console
+
+#include "../include/fbcon.h"
+#include "../include/font.h"
+#include "../include/heap.h"
+#include "../include/paging.h"
+#include "../include/util.h"
+#include "../include/klog.h"
+
+/*
+ * The console draws into a back buffer in RAM laid out exactly like the
+ * framebuffer, and only copies the rectangles that changed since the last
+ * flush. The framebuffer is mapped write-combining and never read, so a
+ * flush is a run of sequential stores the cpu can merge into bursts.
+ *
+ * A cell is drawn by copying a pre-rasterized glyph: the first time a
+ * (character, attribute) pair is seen its 8x16 pixels are expanded in the
+ * framebuffer's own pixel format into a small direct-mapped cache, after
+ * that it is FONT_HEIGHT row copies.
+ *
+ * Dirty areas are kept as cell rectangles. A change touching an existing
+ * rectangle grows it, otherwise it takes a new slot; when the slots run
+ * out everything folds into one bounding box. A scroll moves the back
+ * buffer in RAM and marks the whole screen, which is the only time a
+ * full-screen copy reaches the framebuffer.
+ *
+ * If the back buffer cannot be allocated the console draws straight into
+ * the framebuffer and flushing does nothing.
+ */
+
+#define GLYPH_VALID 0x10000
+
+typedef struct {
+    uint32 key;                         // cell | GLYPH_VALID
+    uint8 pixels[FONT_HEIGHT * FONT_WIDTH * 4];
+} glyph_t;
+
+typedef struct {
+    uint32 x0, y0, x1, y1;              // cells, x1 and y1 exclusive
+} rect_t;
+
+static const uint32 vga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+static bool active;
+static uint8 *front;
+static uint8 *back;
+static uint32 width, height, pitch, bpp, bytespp;
+static uint32 cols, rows;
+static uint16 *cells;
+static uint32 palette[16];
+static uint32 cur_x, cur_y;
+static bool cursor_shown;
+static glyph_t glyph_cache[FBCON_GLYPH_CACHE];
+static rect_t dirty[FBCON_DIRTY_RECTS];
+static uint32 ndirty;
+static fbcon_stats_t stats;
+
+static uint32 channel(uint32 value, uint8 pos, uint8 size)
+{
+    if (size > 8) size = 8;
+    return (value >> (8 - size)) << pos;
+}
+
+static uint32 pack(uint32 rgb, multiboot_info_t *mbi)
+{
+    return channel((rgb >> 16) & 0xFF, mbi->framebuffer_red_field_position, mbi->framebuffer_red_mask_size) |
+           channel((rgb >> 8) & 0xFF, mbi->framebuffer_green_field_position, mbi->framebuffer_green_mask_size) |
+           channel(rgb & 0xFF, mbi->framebuffer_blue_field_position, mbi->framebuffer_blue_mask_size);
+}
+
+static void store(uint8 *p, uint32 pixel)
+{
+    p[0] = pixel;
+    if (bytespp > 1) p[1] = pixel >> 8;
+    if (bytespp > 2) p[2] = pixel >> 16;
+    if (bytespp > 3) p[3] = pixel >> 24;
+}
+
+bool fbcon_init(multiboot_info_t *mbi)
+{
+    uint32 i;
+    if (!(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER)) return false;
+    if (mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB) return false;
+    if (mbi->framebuffer_addr >> 32) return false;
+    bpp = mbi->framebuffer_bpp;
+    if (bpp != 16 && bpp != 24 && bpp != 32) return false;
+
+    width = mbi->framebuffer_width;
+    height = mbi->framebuffer_height;
+    pitch = mbi->framebuffer_pitch;
+    bytespp = bpp / 8;
+    cols = width / FONT_WIDTH;
+    rows = height / FONT_HEIGHT;
+    if (rows > 255) rows = 255;                 // screen.c counts rows in a uint8
+    if (!cols || !rows) return false;
+
+    front = (uint8 *)ioremap((uint32)mbi->framebuffer_addr, pitch * height, PTE_WC);
+    if (!front) return false;
+    cells = (uint16 *)kzalloc(cols * rows * sizeof(uint16));
+    if (!cells) return false;
+    back = (uint8 *)kmalloc(pitch * height);
+    if (!back) back = front;
+
+    for (i = 0; i < 16; i++) palette[i] = pack(vga_palette[i], mbi);
+    for (i = 0; i < FBCON_GLYPH_CACHE; i++) glyph_cache[i].key = 0;
+    memory_set(back, 0, pitch * height);
+    if (back != front) memory_set(front, 0, pitch * height);
+    ndirty = 0;
+    active = true;
+    klog(KLOG_INFO, "fbcon: %ux%ux%u at 0x%08X, %ux%u cells%s", width, height, bpp,
+         (uint32)mbi->framebuffer_addr, cols, rows, back == front ? ", no back buffer" : "");
+    return true;
+}
+
+bool fbcon_active()
+{
+    return active;
+}
+
+uint32 fbcon_cols()
+{
+    return cols;
+}
+
+uint32 fbcon_rows()
+{
+    return rows;
+}
+
+void fbcon_mode(uint32 *w, uint32 *h, uint32 *depth)
+{
+    *w = width;
+    *h = height;
+    *depth = bpp;
+}
+
+const fbcon_stats_t *fbcon_stats()
+{
+    return &stats;
+}
+
+static const uint8 *glyph(uint16 cell)
+{
+    uint8 c = cell & 0xFF, attr = cell >> 8;
+    glyph_t *g = &glyph_cache[(attr * 37 + c) & (FBCON_GLYPH_CACHE - 1)];
+    if (g->key == (cell | GLYPH_VALID)) {
+        stats.glyph_hits++;
+        return g->pixels;
+    }
+
+    const uint8 *bits = font_glyph(c);
+    uint32 fg = palette[attr & 0x0F], bg = palette[attr >> 4];
+    uint8 *p = g->pixels;
+    uint32 x, y;
+    for (y = 0; y < FONT_HEIGHT; y++) {
+        uint8 line = bits[y / 2];
+        for (x = 0; x < FONT_WIDTH; x++, p += bytespp)
+            store(p, (line >> x) & 1 ? fg : bg);
+    }
+    g->key = cell | GLYPH_VALID;
+    stats.glyph_misses++;
+    return g->pixels;
+}
+
+static void rect_union(rect_t *r, const rect_t *o)
+{
+    if (o->x0 < r->x0) r->x0 = o->x0;
+    if (o->y0 < r->y0) r->y0 = o->y0;
+    if (o->x1 > r->x1) r->x1 = o->x1;
+    if (o->y1 > r->y1) r->y1 = o->y1;
+}
+
+static void mark_dirty(uint32 x0, uint32 y0, uint32 x1, uint32 y1)
+{
+    rect_t area = { x0, y0, x1, y1 };
+    uint32 i;
+    if (back == front) return;
+    for (i = 0; i < ndirty; i++) {
+        rect_t *r = &dirty[i];
+        if (x0 <= r->x1 && x1 >= r->x0 && y0 <= r->y1 && y1 >= r->y0) {     // overlaps or touches
+            rect_union(r, &area);
+            return;
+        }
+    }
+    if (ndirty == FBCON_DIRTY_RECTS) {
+        for (i = 1; i < ndirty; i++) rect_union(&dirty[0], &dirty[i]);
+        rect_union(&dirty[0], &area);
+        ndirty = 1;
+        return;
+    }
+    dirty[ndirty++] = area;
+}
+
+static void draw_cell(uint32 x, uint32 y, bool cursor)
+{
+    uint16 cell = cells[y * cols + x];
+    uint8 *dest = back + y * FONT_HEIGHT * pitch + x * FONT_WIDTH * bytespp;
+    const uint8 *src = glyph(cell);
+    uint32 line = FONT_WIDTH * bytespp;
+    uint32 i;
+    for (i = 0; i < FONT_HEIGHT; i++, src += line, dest += pitch)
+        memory_copy((char *)src, (char *)dest, line);
+    if (cursor) {                               // underline in the foreground colour
+        uint32 fg = palette[(cell >> 8) & 0x0F];
+        for (dest -= 2 * pitch; i > FONT_HEIGHT - 2; i--, dest += pitch) {
+            uint32 px;
+            for (px = 0; px < FONT_WIDTH; px++) store(dest + px * bytespp, fg);
+        }
+    }
+    mark_dirty(x, y, x + 1, y + 1);
+}
+
+void fbcon_putcell(uint32 x, uint32 y, uint16 cell)
+{
+    if (x >= cols || y >= rows) return;
+    cells[y * cols + x] = cell;
+    draw_cell(x, y, cursor_shown && x == cur_x && y == cur_y);
+}
+
+/* Out of range positions hide the cursor */
+void fbcon_cursor(uint32 x, uint32 y)
+{
+    if (cursor_shown && x == cur_x && y == cur_y) return;
+    if (cursor_shown) draw_cell(cur_x, cur_y, false);
+    cursor_shown = x < cols && y < rows;
+    cur_x = x;
+    cur_y = y;
+    if (cursor_shown) draw_cell(x, y, true);
+}
+
+/* Moves everything up one text row and blanks the bottom row */
+void fbcon_scroll(uint16 blank)
+{
+    uint32 row_bytes = FONT_HEIGHT * pitch;
+    uint32 i;
+    if (cursor_shown) {
+        cursor_shown = false;
+        draw_cell(cur_x, cur_y, false);
+    }
+    memory_copy((char *)(back + row_bytes), (char *)back, (rows - 1) * row_bytes);
+    memory_copy((char *)(cells + cols), (char *)cells, (rows - 1) * cols * sizeof(uint16));
+    for (i = 0; i < cols; i++) fbcon_putcell(i, rows - 1, blank);
+    mark_dirty(0, 0, cols, rows);
+    stats.scrolls++;
+}
+
+void fbcon_flush()
+{
+    uint32 i;
+    if (!ndirty) return;
+    for (i = 0; i < ndirty; i++) {
+        rect_t *r = &dirty[i];
+        uint32 offset = r->y0 * FONT_HEIGHT * pitch + r->x0 * FONT_WIDTH * bytespp;
+        uint32 bytes = (r->x1 - r->x0) * FONT_WIDTH * bytespp;
+        uint32 lines = (r->y1 - r->y0) * FONT_HEIGHT;
+        if (r->x0 == 0 && r->x1 == cols) {      // whole rows are one run
+            bytes = lines * pitch;
+            lines = 1;
+        }
+        for (; lines; lines--, offset += pitch) {
+            memory_copy((char *)(back + offset), (char *)(front + offset), bytes);
+            stats.bytes += bytes;
+        }
+        stats.rects++;
+    }
+    ndirty = 0;
+    stats.flushes++;
+}
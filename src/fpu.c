@@ -0,0 +1,96 @@
+//fpu and sse state
+
+#include "../include/fpu.h"
+#include "../include/isr.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+
+/*
+ * Every cpu runs with CR0.TS set until the current thread executes an
+ * x87 or SSE instruction, which raises #NM (vector 7). The handler
+ * clears TS and loads that thread's state, or a clean one on first use.
+ * A thread that never touches the FPU costs a context switch nothing
+ * beyond one test.
+ *
+ * A thread that did use it is saved with FXSAVE when it is switched out
+ * and TS goes back on. The save is eager so the thread can move to any
+ * cpu, but the restore stays lazy: the registers still hold the saved
+ * state until another thread traps, so if the same thread traps next on
+ * the same cpu it only needs TS cleared. fpu_owner records whose state
+ * the registers hold, thread->fpu_cpu where that thread last loaded it.
+ *
+ * CPUs without FXSR fall back to FNSAVE/FRSTOR, which leave the
+ * registers reinitialized after a save, so ownership is dropped there.
+ */
+
+static bool fxsr;
+static bool sse;
+
+static void save(thread_t *thread)
+{
+    if (fxsr) asm volatile("fxsave %0" : "=m"(thread->fpu_state));
+    else asm volatile("fnsave %0; fwait" : "=m"(thread->fpu_state));
+}
+
+static void restore(thread_t *thread)
+{
+    if (fxsr) asm volatile("fxrstor %0" : : "m"(thread->fpu_state));
+    else asm volatile("frstor %0" : : "m"(thread->fpu_state));
+}
+
+static void fpu_trap(registers_t *regs)
+{
+    cpu_t *cpu = this_cpu();
+    thread_t *thread = cpu->current;
+    asm volatile("clts");
+    cpu->fpu_live = true;
+    cpu->fpu_traps++;
+    if (!thread) return;                                    // before the scheduler, nothing to switch
+    if (cpu->fpu_owner == thread && thread->fpu_cpu == cpu) return;
+
+    if (thread->fpu_used) {
+        restore(thread);
+    } else {
+        uint32 mxcsr = MXCSR_DEFAULT;
+        asm volatile("fninit");
+        if (sse) asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+        thread->fpu_used = true;
+    }
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu;
+    cpu->fpu_loads++;
+}
+
+/* Called on every cpu, with interrupts off */
+void fpu_init()
+{
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_FPU)) return;
+    fxsr = (edx & CPUID_EDX_FXSR) != 0;
+    sse = fxsr && (edx & CPUID_EDX_SSE);
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if (fxsr) write_cr4(read_cr4() | CR4_OSFXSR | (sse ? CR4_OSXMMEXCPT : 0));
+    asm volatile("fninit");
+    write_cr0(read_cr0() | CR0_TS);
+    isr_register_handler(7, fpu_trap);
+}
+
+bool fpu_sse()
+{
+    return sse;
+}
+
+/* The scheduler calls this on prev's stack, before switching away */
+void fpu_switch_out(thread_t *prev)
+{
+    cpu_t *cpu = this_cpu();
+    if (!cpu->fpu_live) return;
+    if (cpu->fpu_owner == prev) {
+        save(prev);
+        if (!fxsr) cpu->fpu_owner = 0;
+    }
+    write_cr0(read_cr0() | CR0_TS);
+    cpu->fpu_live = false;
+}
@@ -0,0 +1,68 @@
+//per-cpu global descriptor tables
+
+#include "../include/gdt.h"
+#include "../include/smp.h"
+
+/*
+ * kernel.asm gets us into the higher half on a boot GDT with flat code
+ * and data segments. Every cpu then switches to its own copy built here:
+ * the same flat segments at the same selectors plus a small data segment
+ * over the cpu's cpu_t, so this_cpu() is a single %gs-relative load.
+ *
+ * The flat ring 3 segments follow, and a TSS per cpu. The scheduler
+ * points the TSS's esp0 at the top of a user thread's kernel stack when
+ * it switches to one, so a trap from ring 3 lands on that stack.
+ */
+
+static gdt_entry_t gdts[MAX_CPUS][GDT_ENTRIES] __attribute__((aligned(8)));
+static gdt_register_t gdt_regs[MAX_CPUS];
+static tss_t tss[MAX_CPUS];
+
+void gdt_set_entry(uint32 cpu, uint32 index, uint32 base, uint32 limit, uint8 access, uint8 flags)
+{
+    gdt_entry_t *e = &gdts[cpu][index];
+    e->limit_low = limit & 0xFFFF;
+    e->base_low = base & 0xFFFF;
+    e->base_mid = (base >> 16) & 0xFF;
+    e->access = access;
+    e->granularity = (flags << 4) | ((limit >> 16) & 0x0F);
+    e->base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_init_cpu(uint32 cpu, void *percpu, uint32 percpu_size)
+{
+    gdt_set_entry(cpu, 0, 0, 0, 0, 0);
+    gdt_set_entry(cpu, SEG_KERNEL_CODE >> 3, 0, 0xFFFFF, 0x9A, 0xC);   // ring 0 code, 4 KiB granular, 32 bit
+    gdt_set_entry(cpu, SEG_KERNEL_DATA >> 3, 0, 0xFFFFF, 0x92, 0xC);
+    gdt_set_entry(cpu, SEG_USER_CODE >> 3, 0, 0xFFFFF, 0xFA, 0xC);     // DPL 3
+    gdt_set_entry(cpu, SEG_USER_DATA >> 3, 0, 0xFFFFF, 0xF2, 0xC);
+    gdt_set_entry(cpu, SEG_PERCPU >> 3, (uint32)percpu, percpu_size - 1, 0x92, 0x4);   // byte granular
+    tss[cpu].ss0 = SEG_KERNEL_DATA;
+    tss[cpu].iomap_base = sizeof(tss_t);
+    gdt_set_entry(cpu, SEG_TSS >> 3, (uint32)&tss[cpu], sizeof(tss_t) - 1, 0x89, 0x0);  // available 32 bit TSS
+
+    gdt_regs[cpu].limit = sizeof(gdts[cpu]) - 1;
+    gdt_regs[cpu].base = (uint32)gdts[cpu];
+    __asm__ __volatile__ (
+        "lgdt (%0)\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "mov %2, %%ds\n\t"
+        "mov %2, %%es\n\t"
+        "mov %2, %%fs\n\t"
+        "mov %2, %%ss\n\t"
+        "mov %3, %%gs\n\t"
+        "ltr %w4"
+        : : "r" (&gdt_regs[cpu]), "i" (SEG_KERNEL_CODE), "r" (SEG_KERNEL_DATA), "r" (SEG_PERCPU), "r" (SEG_TSS)
+        : "memory");
+}
+
+void gdt_set_kernel_stack(uint32 cpu, uint32 esp0)
+{
+    tss[cpu].esp0 = esp0;
+}
+
+tss_t *gdt_tss(uint32 cpu)
+{
+    return &tss[cpu];
+}
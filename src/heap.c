@@ -0,0 +1,173 @@
+//kernel heap
+
+#include "../include/heap.h"
+#include "../include/pmm.h"
+#include "../include/paging.h"
+#include "../include/util.h"
+#include "../include/spinlock.h"
+
+/*
+ * Every small block starts with an 8 byte header recording its class and
+ * the size the caller asked for, so kfree finds the right list in O(1)
+ * and the stats can tell requested bytes from backing bytes. Freed blocks
+ * go on a per-class LIFO list and are never returned to the frame
+ * allocator.
+ *
+ * When a class list is empty, the block is carved from the class' current
+ * page; pages come from an arena reserved from the frame allocator in
+ * HEAP_ARENA_ORDER chunks, so the per-line allocations the shell makes
+ * do not reach pmm_alloc_frames().
+ *
+ * Large requests get whole buddy blocks with no header. Their pointers are
+ * page aligned while small payloads never are (they sit 8 bytes into a
+ * block of at least 16), which is how kfree tells the two apart.
+ *
+ * One lock covers the lists, carving state and stats.
+ */
+
+#define HEAP_MAGIC       0xF0E5
+#define HEAP_ARENA_ORDER 8              // 1 MiB of frames per arena refill
+
+typedef struct {
+    uint16 magic;
+    uint8 cls;
+    uint8 reserved;
+    uint32 size;
+} heap_header_t;
+
+typedef struct heap_free {
+    struct heap_free *next;
+} heap_free_t;
+
+static heap_free_t *free_lists[HEAP_CLASSES];
+static uint32 carve_next[HEAP_CLASSES];      // next uncarved block in the class page
+static uint32 carve_end[HEAP_CLASSES];
+static uint32 arena_next;
+static uint32 arena_end;
+static heap_stats_t stats;
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static uint32 size_to_class(uint32 size) {
+    if (size <= HEAP_MIN_CLASS) return 0;
+    return 32 - __builtin_clz(size - 1) - HEAP_MIN_SHIFT;      // bsr, no loop
+}
+
+static uint32 arena_page() {
+    if (arena_next == arena_end) {
+        uint32 chunk = pmm_alloc_frames(HEAP_ARENA_ORDER);
+        if (chunk == PMM_NO_FRAME) return 0;
+        arena_next = chunk;
+        arena_end = chunk + (PAGE_SIZE << HEAP_ARENA_ORDER);
+        stats.arena_bytes += PAGE_SIZE << HEAP_ARENA_ORDER;
+    }
+    uint32 page = (uint32)PHYS_TO_VIRT(arena_next);
+    arena_next += PAGE_SIZE;
+    return page;
+}
+
+static void *large_alloc(uint32 size) {
+    uint32 order = 0;
+    while ((PAGE_SIZE << order) < size) order++;
+    uint32 addr = pmm_alloc_frames(order);
+    if (addr == PMM_NO_FRAME) return 0;
+    stats.large_bytes += PAGE_SIZE << order;
+    stats.bytes_in_use += PAGE_SIZE << order;
+    stats.bytes_allocated += PAGE_SIZE << order;
+    stats.allocs++;
+    return PHYS_TO_VIRT(addr);
+}
+
+void heap_init() {
+    uint32 i;
+    for (i = 0; i < HEAP_CLASSES; i++) {
+        free_lists[i] = 0;
+        carve_next[i] = carve_end[i] = 0;
+    }
+    arena_next = arena_end = 0;
+    memory_set((uint8 *)&stats, 0, sizeof(stats));
+}
+
+static void *heap_alloc(uint32 size) {
+    uint32 need = size + sizeof(heap_header_t);
+    if (size == 0) return 0;
+    if (need > HEAP_MAX_CLASS) return large_alloc(size);
+
+    uint32 cls = size_to_class(need);
+    uint32 block_size = HEAP_MIN_CLASS << cls;
+    heap_header_t *h;
+    if (free_lists[cls]) {
+        h = (heap_header_t *)free_lists[cls];
+        free_lists[cls] = free_lists[cls]->next;
+        stats.class_free[cls]--;
+        stats.bytes_free_listed -= block_size;
+    } else {
+        if (carve_next[cls] == carve_end[cls]) {
+            uint32 page = arena_page();
+            if (!page) return 0;
+            carve_next[cls] = page;
+            carve_end[cls] = page + PAGE_SIZE;
+        }
+        h = (heap_header_t *)carve_next[cls];
+        carve_next[cls] += block_size;
+    }
+    h->magic = HEAP_MAGIC;
+    h->cls = cls;
+    h->size = size;
+    stats.class_in_use[cls]++;
+    stats.bytes_in_use += size;
+    stats.bytes_allocated += block_size;
+    stats.allocs++;
+    return h + 1;
+}
+
+void *kmalloc(uint32 size) {
+    uint32 flags = spin_lock_irqsave(&heap_lock);
+    void *ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
+void *kzalloc(uint32 size) {
+    void *ptr = kmalloc(size);
+    if (ptr) memory_set((uint8 *)ptr, 0, size);
+    return ptr;
+}
+
+static void heap_free(void *ptr) {
+    if (((uint32)ptr & (PAGE_SIZE - 1)) == 0) {
+        uint32 order = pmm_block_order(VIRT_TO_PHYS(ptr));
+        stats.large_bytes -= PAGE_SIZE << order;
+        stats.bytes_in_use -= PAGE_SIZE << order;
+        stats.bytes_allocated -= PAGE_SIZE << order;
+        stats.frees++;
+        pmm_free_frames(VIRT_TO_PHYS(ptr), order);
+        return;
+    }
+
+    heap_header_t *h = (heap_header_t *)ptr - 1;
+    if (h->magic != HEAP_MAGIC || h->cls >= HEAP_CLASSES) return;   // not ours, or freed twice
+    uint32 cls = h->cls;
+    uint32 block_size = HEAP_MIN_CLASS << cls;
+    h->magic = 0;
+    stats.class_in_use[cls]--;
+    stats.class_free[cls]++;
+    stats.bytes_in_use -= h->size;
+    stats.bytes_allocated -= block_size;
+    stats.bytes_free_listed += block_size;
+    stats.frees++;
+
+    heap_free_t *f = (heap_free_t *)h;
+    f->next = free_lists[cls];
+    free_lists[cls] = f;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+    uint32 flags = spin_lock_irqsave(&heap_lock);
+    heap_free(ptr);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+const heap_stats_t *heap_stats() {
+    return &stats;
+}
@@ -0,0 +1,55 @@
+//idle loop accounting
+
+#include "../include/idle.h"
+#include "../include/clock.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+
+/*
+ * Callers check their wait condition with interrupts off and only then
+ * come here, so a wakeup can not slip in between the check and the hlt
+ * (sti delays interrupts by one instruction). The first interrupt out of
+ * hlt calls idle_exit, which books the halted cycles before anything
+ * else runs. Each cpu keeps its own counters, the accessors sum them.
+ */
+
+static volatile bool in_idle[MAX_CPUS];
+static uint64 idle_start[MAX_CPUS];
+static uint64 idle_cycles[MAX_CPUS];
+static uint32 wakeups[MAX_CPUS];
+
+void cpu_idle()
+{
+    uint32 cpu = this_cpu()->id;
+    in_idle[cpu] = true;
+    if (tsc_khz()) idle_start[cpu] = rdtsc();
+    __asm__ __volatile__ ("sti; hlt");
+}
+
+/* Called at the top of every interrupt */
+void idle_exit()
+{
+    uint32 cpu = this_cpu()->id;
+    if (!in_idle[cpu]) return;
+    in_idle[cpu] = false;
+    if (tsc_khz()) idle_cycles[cpu] += rdtsc() - idle_start[cpu];
+    wakeups[cpu]++;
+}
+
+/* Halted time summed over all cpus */
+uint64 idle_ns()
+{
+    uint64 cycles = 0;
+    uint32 i;
+    uint32 flags = interrupts_save();
+    for (i = 0; i < cpu_count(); i++) cycles += idle_cycles[i];
+    interrupts_restore(flags);
+    return tsc_to_ns(cycles);
+}
+
+uint32 idle_wakeups()
+{
+    uint32 total = 0, i;
+    for (i = 0; i < cpu_count(); i++) total += wakeups[i];
+    return total;
+}
@@ -1,6 +1,9 @@
 #include "../include/idt.h"
 #include "../include/util.h"
 
+idt_gate_t idt[IDT_ENTRIES];
+idt_register_t idt_reg;
+
 void set_idt_gate(int n, uint32 handler) {
     idt[n].low_offset = low_16(handler);
     idt[n].sel = KERNEL_CS;
@@ -9,6 +12,12 @@ void set_idt_gate(int n, uint32 handler) {
     idt[n].high_offset = high_16(handler);
 }
 
+/* A trap gate ring 3 may call through, interrupts stay as they were */
+void set_idt_user_gate(int n, uint32 handler) {
+    set_idt_gate(n, handler);
+    idt[n].flags = 0xEF;
+}
+
 void set_idt() {
     idt_reg.base = (uint32) &idt;
     idt_reg.limit = IDT_ENTRIES * sizeof(idt_gate_t) - 1;
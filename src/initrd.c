@@ -0,0 +1,231 @@
+//initial ramdisk
+
+#include "../include/initrd.h"
+#include "../include/heap.h"
+#include "../include/klog.h"
+#include "../include/memory.h"
+#include "../include/paging.h"
+#include "../include/string.h"
+#include "../include/util.h"
+
+/*
+ * The initrd is a ustar archive that GRUB loads as a multiboot module
+ * (a module whose command line says "initrd", or else the first one).
+ * The module stays where GRUB put it, and the frame allocator already
+ * keeps it reserved. initrd_init() walks the headers once and builds an
+ * index: one initrd_file_t per member, with its data pointing straight
+ * into the archive, in a hash table keyed on the path. Open and read
+ * are then a hash, a chain walk and pointer arithmetic, with nothing
+ * copied.
+ *
+ * Only the names are copied, into one pool, because ustar splits long
+ * ones over the prefix and name fields and does not always terminate
+ * them. Members that are neither files nor directories are skipped.
+ */
+
+#define TAR_BLOCK       512
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];                          // "ustar" and a NUL, or a space for old GNU tar
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} __attribute__((packed)) tar_header_t;
+
+static const uint8 *archive;
+static uint32 archive_size;
+static initrd_file_t *files;
+static uint32 nfiles;
+static initrd_file_t **buckets;
+static uint32 nbuckets;
+
+static uint32 octal(const char *field, uint32 len)
+{
+    uint32 value = 0;
+    while (len && *field == ' ') field++, len--;
+    for (; len && *field >= '0' && *field <= '7'; field++, len--) value = value * 8 + (*field - '0');
+    return value;
+}
+
+static bool header_valid(const tar_header_t *h)
+{
+    const uint8 *p = (const uint8 *)h;
+    uint32 i, sum = 0;
+    if (memcmp(h->magic, "ustar", 5)) return false;
+    for (i = 0; i < TAR_BLOCK; i++)
+        sum += (i >= 148 && i < 156) ? ' ' : p[i];    // the checksum field counts as spaces
+    return sum == octal(h->checksum, sizeof(h->checksum));
+}
+
+static uint32 hash(const char *s, uint32 len)
+{
+    uint32 h = 2166136261u;                 // FNV-1a
+    while (len--) h = (h ^ (uint8)*s++) * 16777619u;
+    return h;
+}
+
+/* Strips "/", "./" and a trailing "/"; returns the length left */
+static const char *normalize(const char *path, uint32 *len)
+{
+    uint32 n;
+    for (;;) {
+        if (path[0] == '/') path++;
+        else if (path[0] == '.' && path[1] == '/') path += 2;
+        else break;
+    }
+    n = strlen(path);
+    while (n && path[n - 1] == '/') n--;
+    *len = n;
+    return path;
+}
+
+static uint32 field_len(const char *field, uint32 max)
+{
+    const char *end = (const char *)memchr(field, 0, max);
+    return end ? (uint32)(end - field) : max;
+}
+
+/* Calls fn for every member, returns false on a bad archive */
+static bool walk(bool (*fn)(const tar_header_t *h, const uint8 *data, uint32 size))
+{
+    uint32 offset = 0;
+    while (offset + TAR_BLOCK <= archive_size) {
+        const tar_header_t *h = (const tar_header_t *)(archive + offset);
+        if (!h->name[0]) return true;       // end of archive
+        if (!header_valid(h)) return false;
+        uint32 size = octal(h->size, sizeof(h->size));
+        if (offset + TAR_BLOCK + size > archive_size) return false;
+        if (!fn(h, archive + offset + TAR_BLOCK, size)) return false;
+        offset += TAR_BLOCK + ((size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+    }
+    return true;
+}
+
+static uint32 count_members;
+static uint32 count_name_bytes;
+
+static bool count(const tar_header_t *h, const uint8 *data, uint32 size)
+{
+    count_members++;
+    count_name_bytes += field_len(h->prefix, sizeof(h->prefix)) + 1 + field_len(h->name, sizeof(h->name)) + 1;
+    return true;
+}
+
+static char *name_pool;
+
+static bool add(const tar_header_t *h, const uint8 *data, uint32 size)
+{
+    uint32 prefix_len = field_len(h->prefix, sizeof(h->prefix));
+    uint32 name_len = field_len(h->name, sizeof(h->name));
+    char *name = name_pool;
+    uint32 len;
+    const char *path;
+    initrd_file_t *f;
+
+    if (h->type != '0' && h->type != 0 && h->type != '5') return true;
+    if (prefix_len) {
+        memcpy(name_pool, h->prefix, prefix_len);
+        name_pool[prefix_len] = '/';
+        name_pool += prefix_len + 1;
+    }
+    memcpy(name_pool, h->name, name_len);
+    name_pool[name_len] = 0;
+    name_pool += name_len + 1;
+
+    path = normalize(name, &len);
+    if (!len) return true;                  // the archive root
+    ((char *)path)[len] = 0;                // drop the trailing "/" of a directory
+    f = &files[nfiles++];
+    f->name = path;
+    f->data = data;
+    f->size = size;
+    f->type = h->type == '5' ? INITRD_DIR : INITRD_FILE;
+    f->next = buckets[hash(path, len) & (nbuckets - 1)];
+    buckets[hash(path, len) & (nbuckets - 1)] = f;
+    return true;
+}
+
+static bool mentions(const char *s, const char *word)
+{
+    uint32 len = strlen(word);
+    for (; *s; s++) if (!strncmp(s, word, len)) return true;
+    return false;
+}
+
+static multiboot_module_t *find_module(multiboot_info_t *mbi)
+{
+    multiboot_module_t *mods;
+    uint32 i;
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS) || !mbi->mods_count) return 0;
+    mods = (multiboot_module_t *)PHYS_TO_VIRT(mbi->mods_addr);
+    for (i = 0; i < mbi->mods_count; i++) {
+        if (!mods[i].string || mods[i].string >= DIRECT_MAP_SIZE) continue;
+        if (mentions((const char *)PHYS_TO_VIRT(mods[i].string), "initrd")) return &mods[i];
+    }
+    return &mods[0];
+}
+
+bool initrd_init(multiboot_info_t *mbi)
+{
+    multiboot_module_t *mod = find_module(mbi);
+    if (!mod || mod->mod_end <= mod->mod_start) return false;
+    archive_size = mod->mod_end - mod->mod_start;
+    if (mod->mod_end <= DIRECT_MAP_SIZE) archive = (const uint8 *)PHYS_TO_VIRT(mod->mod_start);
+    else archive = (const uint8 *)ioremap(mod->mod_start, archive_size, 0);
+    if (!archive) return false;
+
+    if (!walk(count) || !count_members) {
+        klog(KLOG_WARN, "initrd: module at 0x%08X is not a ustar archive", mod->mod_start);
+        return false;
+    }
+    for (nbuckets = 16; nbuckets < count_members * 2; nbuckets <<= 1);
+    files = (initrd_file_t *)kmalloc(count_members * sizeof(initrd_file_t));
+    buckets = (initrd_file_t **)kzalloc(nbuckets * sizeof(initrd_file_t *));
+    name_pool = (char *)kmalloc(count_name_bytes);
+    if (!files || !buckets || !name_pool) return false;
+    walk(add);
+    klog(KLOG_INFO, "initrd: %u entries, %u KiB at 0x%08X", nfiles, archive_size / 1024, mod->mod_start);
+    return true;
+}
+
+const initrd_file_t *initrd_lookup(const char *path)
+{
+    uint32 len;
+    const initrd_file_t *f;
+    if (!buckets) return 0;
+    path = normalize(path, &len);
+    for (f = buckets[hash(path, len) & (nbuckets - 1)]; f; f = f->next)
+        if (!strncmp(f->name, path, len) && !f->name[len]) return f;
+    return 0;
+}
+
+const void *initrd_data(const char *path, uint32 *size)
+{
+    const initrd_file_t *f = initrd_lookup(path);
+    if (!f || f->type != INITRD_FILE) return 0;
+    *size = f->size;
+    return f->data;
+}
+
+uint32 initrd_count()
+{
+    return nfiles;
+}
+
+const initrd_file_t *initrd_file(uint32 index)
+{
+    return index < nfiles ? &files[index] : 0;
+}
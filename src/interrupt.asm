@@ -0,0 +1,261 @@
+bits    32
+section         .text
+
+; Every vector gets a tiny stub that makes the stack look the same
+; (error code, vector number) and jumps to one of the common entries.
+; The common entries save a registers_t frame (see include/isr.h) and
+; pass a pointer to it to the C dispatcher. %gs holds the cpu's percpu
+; segment (see gdt.c) whenever the kernel runs; ring 3 has its own in
+; there, so it is saved with the frame and the percpu one loaded. %es
+; and %fs come back as %ds.
+
+extern isr_handler
+extern irq_handler
+extern apic_handler
+extern syscall_handler
+
+%macro ISR_NOERR 1
+global isr%1
+isr%1:
+        push    dword 0                 ;no error code, keep the frame uniform
+        push    dword %1
+        jmp     isr_common
+%endmacro
+
+%macro ISR_ERR 1
+global isr%1
+isr%1:
+        push    dword %1                ;cpu already pushed the error code
+        jmp     isr_common
+%endmacro
+
+%macro IRQ 2
+global irq%1
+irq%1:
+        push    dword 0
+        push    dword %2
+        jmp     irq_common
+%endmacro
+
+%macro APIC_VECTOR 2
+global %1
+%1:
+        push    dword 0
+        push    dword %2
+        jmp     apic_common
+%endmacro
+
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR   29
+ISR_ERR   30
+ISR_NOERR 31
+
+IRQ 0, 32
+IRQ 1, 33
+IRQ 2, 34
+IRQ 3, 35
+IRQ 4, 36
+IRQ 5, 37
+IRQ 6, 38
+IRQ 7, 39
+IRQ 8, 40
+IRQ 9, 41
+IRQ 10, 42
+IRQ 11, 43
+IRQ 12, 44
+IRQ 13, 45
+IRQ 14, 46
+IRQ 15, 47
+
+APIC_VECTOR ipi_reschedule, 0xF0
+APIC_VECTOR ipi_halt_entry, 0xF1
+APIC_VECTOR ipi_bench, 0xF2
+APIC_VECTOR ipi_profile, 0xF3
+APIC_VECTOR profile_timer, 0xF4
+
+; int 0x80, a trap gate ring 3 may use
+global syscall_entry
+syscall_entry:
+        push    dword 0
+        push    dword 0x80
+        jmp     syscall_common
+
+; SYSENTER lands here with interrupts off, on the kernel's segments and
+; on this cpu's entry stack, whose top word holds the address of its TSS
+; esp0, see syscall.c. SYSENTER leaves TF alone: the first instruction
+; saves the flags, TF and all, and TF is off by the end of the next
+; three; a single step that comes in between is dropped by the #DB
+; handler, and it and an NMI both have a real stack to land on. The
+; stub in the system call page put the return esp in ecx, the return
+; eip in edx and arguments 2 and 3 in esi and edi. This builds the frame
+; int 0x80 would have, so the same table and fork work, and returns
+; with SYSEXIT, or iret when the caller had TF set. A frame that was
+; replaced (exec) still says where to go.
+global sysenter_entry
+global sysenter_tf_off
+sysenter_entry:
+        pushfd                          ;the caller's flags
+        push    dword [esp]
+        and     dword [esp], ~0x100     ;TF
+        popfd
+sysenter_tf_off:
+        push    eax                     ;entry stack: eax, flags, &esp0
+        mov     eax, [esp + 8]
+        mov     eax, [eax]              ;top of the thread's kernel stack
+        sub     eax, 12
+        push    dword [esp + 4]
+        pop     dword [eax]             ;the frame's eflags
+        or      dword [eax], 0x200      ;the caller had interrupts on
+        xchg    eax, [esp]
+        pop     esp                     ;onto the kernel stack, eax restored
+        mov     [esp + 4], ecx          ;user esp
+        mov     dword [esp + 8], 0x23   ;user data
+        push    dword 0x1B              ;user code
+        push    edx
+        push    dword 1                 ;error code 1 marks a sysenter frame
+        push    dword 0x80
+        mov     ecx, esi
+        mov     edx, edi
+        pusha
+        cld
+        mov     ax, ds
+        push    eax
+        mov     ax, gs
+        push    eax
+        mov     ax, 0x10
+        mov     ds, ax
+        mov     es, ax
+        mov     fs, ax
+        mov     ax, 0x28
+        mov     gs, ax
+        sti
+        push    esp
+        call    syscall_handler
+        add     esp, 4
+        cli
+        pop     eax
+        mov     gs, ax
+        pop     eax
+        mov     ds, ax
+        mov     es, ax
+        mov     fs, ax
+        popa
+        test    dword [esp + 16], 0x100 ;single stepping, let iret put TF back
+        jnz     .iret
+        mov     edx, [esp + 8]          ;eip
+        mov     ecx, [esp + 20]         ;esp
+        sti                             ;takes effect after sysexit
+        sysexit
+.iret:
+        add     esp, 8
+        iret
+
+; The code of the system call page mapped into every process (syscall.c
+; copies one of these there). Both take eax, ebx, ecx and edx like
+; int 0x80 and preserve everything but eax.
+SYSCALL_PAGE    equ     0xBFFFF000
+
+global syscall_stub_int80
+global syscall_stub_int80_end
+syscall_stub_int80:
+        int     0x80
+        ret
+syscall_stub_int80_end:
+
+global syscall_stub_sysenter
+global syscall_stub_sysenter_end
+syscall_stub_sysenter:
+        push    esi
+        push    edi
+        push    ecx
+        push    edx
+        mov     esi, ecx
+        mov     edi, edx
+        mov     ecx, esp
+        mov     edx, SYSCALL_PAGE + (.back - syscall_stub_sysenter)
+        sysenter
+.back:
+        pop     edx
+        pop     ecx
+        pop     edi
+        pop     esi
+        ret
+syscall_stub_sysenter_end:
+
+; the local APIC never expects an EOI for its spurious vector
+global apic_spurious
+apic_spurious:
+        iret
+
+%macro COMMON_ENTRY 2
+%1:
+        pusha
+        cld                             ;C code and the string ops assume DF=0
+        mov     ax, ds
+        push    eax
+        mov     ax, gs
+        push    eax
+        mov     ax, 0x10                ;kernel data segment
+        mov     ds, ax
+        mov     es, ax
+        mov     fs, ax
+        mov     ax, 0x28                ;percpu segment
+        mov     gs, ax
+        push    esp                     ;registers_t *
+        call    %2
+        add     esp, 4
+        jmp     interrupt_return
+%endmacro
+
+COMMON_ENTRY isr_common, isr_handler
+COMMON_ENTRY irq_common, irq_handler
+COMMON_ENTRY apic_common, apic_handler
+COMMON_ENTRY syscall_common, syscall_handler
+
+interrupt_return:
+        pop     eax
+        mov     gs, ax                  ;reloaded from this cpu's GDT, wherever the frame was saved
+        pop     eax
+        mov     ds, ax
+        mov     es, ax
+        mov     fs, ax
+        popa
+        add     esp, 8                  ;vector number and error code
+        iret
+
+; void user_return(registers_t *regs)
+;
+; Leaves through a frame built by hand, the way into ring 3 for a new
+; process or a forked child. The frame is dead once iret has run.
+global user_return
+user_return:
+        mov     esp, [esp + 4]
+        jmp     interrupt_return
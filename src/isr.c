@@ -2,6 +2,20 @@
 #include "../include/idt.h"
 #include "../include/screen.h"
 #include "../include/util.h"
+#include "../include/kprintf.h"
+#include "../include/pic.h"
+#include "../include/system.h"
+#include "../include/idle.h"
+#include "../include/sched.h"
+#include "../include/apic.h"
+#include "../include/smp.h"
+#include "../include/proc.h"
+#include "../include/vm.h"
+#include "../include/ksyms.h"
+#include "../include/syscall.h"
+
+static isr_t interrupt_handlers[IDT_ENTRIES];
+static uint32 irq_counts[IRQ_COUNT];
 
 void isr_install() {
     set_idt_gate(0, (uint32)isr0);
@@ -37,176 +51,103 @@ void isr_install() {
     set_idt_gate(30, (uint32)isr30);
     set_idt_gate(31, (uint32)isr31);
 
+    // Remap the PICs so IRQ 0-15 land on vectors 32-47, clear of the exceptions
+    pic_remap(IRQ_BASE, IRQ_BASE + 8);
+    set_idt_gate(32, (uint32)irq0);
+    set_idt_gate(33, (uint32)irq1);
+    set_idt_gate(34, (uint32)irq2);
+    set_idt_gate(35, (uint32)irq3);
+    set_idt_gate(36, (uint32)irq4);
+    set_idt_gate(37, (uint32)irq5);
+    set_idt_gate(38, (uint32)irq6);
+    set_idt_gate(39, (uint32)irq7);
+    set_idt_gate(40, (uint32)irq8);
+    set_idt_gate(41, (uint32)irq9);
+    set_idt_gate(42, (uint32)irq10);
+    set_idt_gate(43, (uint32)irq11);
+    set_idt_gate(44, (uint32)irq12);
+    set_idt_gate(45, (uint32)irq13);
+    set_idt_gate(46, (uint32)irq14);
+    set_idt_gate(47, (uint32)irq15);
+
     set_idt(); // Load with ASM
 }
 
-/*Handlers*/
-void isr0()
-{
-    print(exception_messages[0]);
-    asm("hlt");    
-}
-void isr1()
-{
-    print(exception_messages[1]);    
-    asm("hlt");
-}
-void isr2()
-{
-    print(exception_messages[2]);    
-    asm("hlt");
-}
-void isr3()
-{
-    print(exception_messages[3]);    
-    asm("hlt");
-}
-void isr4()
-{
-    print(exception_messages[4]);    
-    asm("hlt");
-}
-void isr5()
-{
-    print(exception_messages[5]);    
-    asm("hlt");
-}
-void isr6()
-{
-    print(exception_messages[6]);    
-    asm("hlt");
-}
-void isr7()
-{
-    print(exception_messages[7]);    
-    asm("hlt");
-}
-void isr8()
-{
-    print(exception_messages[8]);    
-    asm("hlt");
-}
-void isr9()
-{
-    print(exception_messages[9]);    
-    asm("hlt");
-}
-void isr10()
-{
-    print(exception_messages[10]);    
-    asm("hlt");
-}
-void isr11()
-{
-    print(exception_messages[11]);    
-    asm("hlt");
-}
-void isr12()
-{
-    print(exception_messages[12]);    
-    asm("hlt");
-}
-void isr13()
-{
-    print(exception_messages[13]);    
-    asm("hlt");
-}
-void isr14()
-{
-    print(exception_messages[14]);    
-    asm("hlt");
-}
-void isr15()
-{
-    print(exception_messages[15]);    
-    asm("hlt");
-}
-void isr16()
-{
-    print(exception_messages[16]);    
-    asm("hlt");
-}
-void isr17()
-{
-    print(exception_messages[17]);    
-    asm("hlt");
-}
-void isr18()
-{
-    print(exception_messages[18]);    
-    asm("hlt");
-}
-void isr19()
-{
-    print(exception_messages[19]);    
-    asm("hlt");
-}
-void isr20()
-{
-    print(exception_messages[20]);    
-    asm("hlt");
-}
-void isr21()
-{
-    print(exception_messages[21]);    
-    asm("hlt");
-}
-void isr22()
-{
-    print(exception_messages[22]);    
-    asm("hlt");
-}
-void isr23()
-{
-    print(exception_messages[23]);    
-    asm("hlt");
-}
-void isr24()
-{
-    print(exception_messages[24]);    
-    asm("hlt");
-}
-void isr25()
-{
-    print(exception_messages[25]);    
-    asm("hlt");
+/* Page faults on user addresses may just be a page to fill in or copy.
+   An exception nobody claimed kills the process that caused it, and is
+   fatal anywhere else. */
+void isr_handler(registers_t *regs)
+{
+    if (interrupt_handlers[regs->int_no]) {
+        interrupt_handlers[regs->int_no](regs);
+        return;
+    }
+    if (regs->int_no == 14 && vm_fault(read_cr2(), regs->err_code)) return;
+    if (regs->int_no == 1 && syscall_debug_trap(regs)) return;
+    if (proc_current() && ((regs->cs & 3) || (regs->int_no == 14 && read_cr2() < USER_END))) {
+        proc_fault(regs);
+        return;
+    }
+    uint32 offset;
+    const char *func = ksym_lookup(regs->eip, &offset);
+    kprintf("\nException: %s eip 0x%08X error 0x%08X", regs->int_no < 32 ? exception_messages[regs->int_no] : "Unknown Interrupt",
+            regs->eip, regs->err_code);
+    if (func) kprintf(" in %s+0x%X", func, offset);
+    if (regs->int_no == 14) kprintf(" address 0x%08X", read_cr2());
+    smp_halt_others();
+    for (;;) asm("cli; hlt");
 }
-void isr26()
-{
-    print(exception_messages[26]);    
-    asm("hlt");
+
+/* Hardware interrupts: ack first so a handler that switches away does
+   not hold back lower-priority lines, then a single indirect call. */
+void irq_handler(registers_t *regs)
+{
+    uint8 irq = regs->int_no - IRQ_BASE;
+    idle_exit();
+    if (apic_active()) lapic_eoi();
+    else {
+        if ((irq == 7 || irq == 15) && pic_spurious(irq)) return;
+        pic_send_eoi(irq);
+    }
+    irq_counts[irq]++;
+    if (interrupt_handlers[regs->int_no]) interrupt_handlers[regs->int_no](regs);
+    if (sched_need_resched()) schedule();
 }
-void isr27()
+
+/* IPIs and other local APIC vectors, on any cpu */
+void apic_handler(registers_t *regs)
 {
-    print(exception_messages[27]);    
-    asm("hlt");
+    idle_exit();
+    lapic_eoi();
+    this_cpu()->ipis++;
+    if (interrupt_handlers[regs->int_no]) interrupt_handlers[regs->int_no](regs);
+    if (sched_need_resched()) schedule();
 }
-void isr28()
+
+void isr_register_handler(int n, isr_t handler)
 {
-    print(exception_messages[28]);    
-    asm("hlt");
+    interrupt_handlers[n] = handler;
 }
-void isr29()
+
+void irq_register_handler(int irq, isr_t handler)
 {
-    print(exception_messages[29]);    
-    asm("hlt");
+    interrupt_handlers[IRQ_BASE + irq] = handler;
+    if (apic_active()) ioapic_unmask(irq);
+    else pic_unmask(irq);
 }
-void isr30()
+
+void irq_unregister_handler(int irq)
 {
-    print(exception_messages[30]);    
-    asm("hlt");
+    if (apic_active()) ioapic_mask(irq);
+    else pic_mask(irq);
+    interrupt_handlers[IRQ_BASE + irq] = 0;
 }
-void isr31()
+
+uint32 irq_count(int irq)
 {
-    print(exception_messages[31]);    
-    asm("hlt");
+    return irq_counts[irq];
 }
 
-
-/*End Handlers*/
-
-
-
 /* To print the message which defines every exception */
 string exception_messages[] = {
     "Division By Zero",
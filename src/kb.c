@@ -1,309 +1,265 @@
 
 //keyboard driver
 
-
 #include "../include/kb.h"
+#include "../include/slab.h"
+#include "../include/isr.h"
+#include "../include/system.h"
+#include "../include/sched.h"
+#include "../include/workqueue.h"
+
+/*
+ * IRQ1 only moves scancodes from the controller into a single-producer,
+ * single-consumer ring; decoding happens on the reading side. The ring
+ * needs no lock: the handler is the only writer of ring_head, the reader
+ * the only writer of ring_tail, and each publishes its index only after
+ * the slot it covers is written or consumed. Waking the reader is left
+ * to deferred work, so a burst of scancodes costs one wakeup.
+ *
+ * Other drivers feed characters through kb_input() into a second ring
+ * of the same kind, which the reader drains ahead of the scancodes. The
+ * serial port is its only producer.
+ */
+
+#define KB_DATA_PORT    0x60
+#define KB_STATUS_PORT  0x64
+#define KB_KEYMAP_SIZE  0x58
+
+#define SC_LSHIFT       0x2A
+#define SC_RSHIFT       0x36
+#define SC_CAPSLOCK     0x3A
+#define SC_EXTENDED     0xE0
+#define SC_PAGE_UP      0x49            // after SC_EXTENDED
+#define SC_PAGE_DOWN    0x51
+#define SC_RELEASE      0x80
+
+#define MOD_SHIFT       1
+#define MOD_CAPS        2
+
+#define barrier() __asm__ __volatile__ ("" : : : "memory")
+
+/* Scancode set 1, US layout, indexed by [MOD_SHIFT | MOD_CAPS][scancode] */
+static const char keymap[4][KB_KEYMAP_SIZE] = {
+    {   /* plain */
+        0, 0, '1', '2', '3', '4', '5', '6',
+        '7', '8', '9', '0', '-', '=', '\b', '\t',
+        'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
+        'o', 'p', '[', ']', '\n', 0, 'a', 's',
+        'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',
+        '\'', '`', 0, '\\', 'z', 'x', 'c', 'v',
+        'b', 'n', 'm', ',', '.', '/', 0, '*',
+        0, ' ', 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, '-', 0, 0, 0, '+', 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {   /* shift */
+        0, 0, '!', '@', '#', '$', '%', '^',
+        '&', '*', '(', ')', '_', '+', '\b', '\t',
+        'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I',
+        'O', 'P', '{', '}', '\n', 0, 'A', 'S',
+        'D', 'F', 'G', 'H', 'J', 'K', 'L', ':',
+        '"', '~', 0, '|', 'Z', 'X', 'C', 'V',
+        'B', 'N', 'M', '<', '>', '?', 0, '*',
+        0, ' ', 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, '-', 0, 0, 0, '+', 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {   /* caps lock */
+        0, 0, '1', '2', '3', '4', '5', '6',
+        '7', '8', '9', '0', '-', '=', '\b', '\t',
+        'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I',
+        'O', 'P', '[', ']', '\n', 0, 'A', 'S',
+        'D', 'F', 'G', 'H', 'J', 'K', 'L', ';',
+        '\'', '`', 0, '\\', 'Z', 'X', 'C', 'V',
+        'B', 'N', 'M', ',', '.', '/', 0, '*',
+        0, ' ', 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, '-', 0, 0, 0, '+', 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    },
+    {   /* caps lock + shift */
+        0, 0, '!', '@', '#', '$', '%', '^',
+        '&', '*', '(', ')', '_', '+', '\b', '\t',
+        'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
+        'o', 'p', '{', '}', '\n', 0, 'a', 's',
+        'd', 'f', 'g', 'h', 'j', 'k', 'l', ':',
+        '"', '~', 0, '|', 'z', 'x', 'c', 'v',
+        'b', 'n', 'm', '<', '>', '?', 0, '*',
+        0, ' ', 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, '-', 0, 0, 0, '+', 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+    }
+};
+
+static volatile uint8 ring[KB_RING_SIZE];
+static volatile uint32 ring_head;       // written by the IRQ handler only
+static volatile uint32 ring_tail;       // written by the reader only
+static volatile char input[KB_RING_SIZE];
+static volatile uint32 input_head;      // written by kb_input only
+static volatile uint32 input_tail;
+static uint32 dropped;
+
+static uint8 modifiers;
+static bool extended;
+static kmem_cache_t *line_cache;
+static wait_queue_t readers;
+static work_t wake_work;
+
+static void keyboard_irq(registers_t *regs)
+{
+    while (inportb(KB_STATUS_PORT) & 0x1) {
+        uint8 scancode = inportb(KB_DATA_PORT);
+        uint32 head = ring_head;
+        if (head - ring_tail == KB_RING_SIZE) {
+            dropped++;
+            continue;
+        }
+        ring[head & (KB_RING_SIZE - 1)] = scancode;
+        barrier();
+        ring_head = head + 1;
+    }
+    work_queue(&wake_work);
+}
+
+static void wake_readers(void *arg)
+{
+    wait_queue_wake_all(&readers);
+}
+
+/* Queues a character as if it had been typed; one caller at a time */
+void kb_input(char c)
+{
+    uint32 head = input_head;
+    if (head - input_tail == KB_RING_SIZE) {
+        dropped++;
+        return;
+    }
+    input[head & (KB_RING_SIZE - 1)] = c;
+    barrier();
+    input_head = head + 1;
+    work_queue(&wake_work);
+}
+
+void kb_init()
+{
+    while (inportb(KB_STATUS_PORT) & 0x1) inportb(KB_DATA_PORT);      // stale bytes from the boot loader
+    work_setup(&wake_work, wake_readers, 0);
+    irq_register_handler(1, keyboard_irq);
+}
+
+static bool kb_empty()
+{
+    return ring_tail == ring_head && input_tail == input_head;
+}
+
+/* Blocks the reading thread until a scancode or character arrives; the
+   check runs under the wait queue lock, which the IRQ takes to wake us. */
+static void kb_wait()
+{
+    if (kb_empty()) {
+        syncCursor();                   // output leaves the cursor alone until someone types
+        uint32 flags = spin_lock_irqsave(&readers.lock);
+        while (kb_empty()) wait_queue_sleep(&readers);
+        spin_unlock_irqrestore(&readers.lock, flags);
+    }
+}
+
+static uint8 kb_next_scancode()
+{
+    uint32 tail = ring_tail;
+    uint8 scancode = ring[tail & (KB_RING_SIZE - 1)];
+    barrier();
+    ring_tail = tail + 1;
+    return scancode;
+}
+
+/* Blocks until a key producing a character is pressed */
+char kb_getchar()
+{
+    for (;;) {
+        kb_wait();
+        if (input_tail != input_head) {
+            uint32 tail = input_tail;
+            char c = input[tail & (KB_RING_SIZE - 1)];
+            barrier();
+            input_tail = tail + 1;
+            scrollViewLive();
+            return c;
+        }
+        uint8 scancode = kb_next_scancode();
+        if (scancode == SC_EXTENDED) {
+            extended = true;
+            continue;
+        }
+        if (extended) {                 // arrows, right ctrl/alt, ... produce nothing yet
+            extended = false;
+            if (modifiers & MOD_SHIFT) {
+                if (scancode == SC_PAGE_UP) scrollView(sh / 2);
+                if (scancode == SC_PAGE_DOWN) scrollView(-(sh / 2));
+            }
+            continue;
+        }
+        if (scancode & SC_RELEASE) {
+            scancode &= ~SC_RELEASE;
+            if (scancode == SC_LSHIFT || scancode == SC_RSHIFT) modifiers &= ~MOD_SHIFT;
+            continue;
+        }
+        if (scancode == SC_LSHIFT || scancode == SC_RSHIFT) {
+            modifiers |= MOD_SHIFT;
+            continue;
+        }
+        if (scancode == SC_CAPSLOCK) {
+            modifiers ^= MOD_CAPS;
+            continue;
+        }
+        if (scancode < KB_KEYMAP_SIZE && keymap[modifiers][scancode]) {
+            scrollViewLive();           // typing jumps back to the live screen
+            return keymap[modifiers][scancode];
+        }
+    }
+}
+
+uint32 kb_dropped()
+{
+    return dropped;
+}
+
 string readStr()
 {
-    char buff;
-    string buffstr = (string) malloc(200);
-    uint8 i = 0;
-    uint8 reading = 1;
-    while(reading)
+    if(!line_cache) line_cache = kmem_cache_create("line", KB_LINE_MAX, 0);
+    string buffstr = (string) kmem_cache_alloc(line_cache);
+    uint32 i = 0;
+    for(;;)
     {
-        if(inportb(0x64) & 0x1)                 
+        char c = kb_getchar();
+        if(c == '\n')
         {
-            switch(inportb(0x60))
-            { 
-        case 2:
-                printch('1');
-                buffstr[i] = '1';
-                i++;
-                break;
-        case 3:
-                printch('2');
-                buffstr[i] = '2';
-                i++;
-                break;
-        case 4:
-                printch('3');
-                buffstr[i] = '3';
-                i++;
-                break;
-        case 5:
-                printch('4');
-                buffstr[i] = '4';
-                i++;
-                break;
-        case 6:
-                printch('5');
-                buffstr[i] = '5';
-                i++;
-                break;
-        case 7:
-                printch('6');
-                buffstr[i] = '6';
-                i++;
-                break;
-        case 8:
-                printch('7');
-                buffstr[i] = '7';
-                i++;
-                break;
-        case 9:
-                printch('8');
-                buffstr[i] = '8';
-                i++;
-                break;
-        case 10:
-                printch('9');
-                buffstr[i] = '9';
-                i++;
-                break;
-        case 11:
-                printch('0');
-                buffstr[i] = '0';
-                i++;
-                break;
-        case 12:
-                printch('-');
-                buffstr[i] = '-';
-                i++;
-                break;
-        case 13:
-                printch('=');
-                buffstr[i] = '=';
-                i++;
-                break;
-        case 14:
-                printch('\b');
+            printch('\n');
+            break;
+        }
+        if(c == '\b')
+        {
+            if(i > 0)
+            {
                 i--;
-                if(i<0)
-                {
-                	i = 0;
-                }
-                buffstr[i+1] = 0;
-                buffstr[i] = 0;
-                break;
-        case 15:
-                printch('\t');          
-                buffstr[i] = '\t';
-                i++;
-                break;
-        case 16:
-                printch('q');
-                buffstr[i] = 'q';
-                i++;
-                break;
-        case 17:
-                printch('w');
-                buffstr[i] = 'w';
-                i++;
-                break;
-        case 18:
-                printch('e');
-                buffstr[i] = 'e';
-                i++;
-                break;
-        case 19:
-                printch('r');
-                buffstr[i] = 'r';
-                i++;
-                break;
-        case 20:
-                printch('t');
-                buffstr[i] = 't';
-                i++;
-                break;
-        case 21:
-                printch('y');
-                buffstr[i] = 'y';
-                i++;
-                break;
-        case 22:
-                printch('u');
-                buffstr[i] = 'u';
-                i++;
-                break;
-        case 23:
-                printch('i');
-                buffstr[i] = 'i';
-                i++;
-                break;
-        case 24:
-                printch('o');
-                buffstr[i] = 'o';
-                i++;
-                break;
-        case 25:
-                printch('p');
-                buffstr[i] = 'p';
-                i++;
-                break;
-        case 26:
-                printch('[');
-                buffstr[i] = '[';
-                i++;
-                break;
-        case 27:
-                printch(']');
-                buffstr[i] = ']';
-                i++;
-                break;
-        case 28:
-                printch('\n');
-                buffstr[i] = '\n';
-                  i++;
-               reading = 0;
-                break;
-        case 29:
-                printch('q');          
-                buffstr[i] = 'q';
-                i++;
-                break;
-        case 30:
-                printch('a');
-                buffstr[i] = 'a';
-                i++;
-                break;
-        case 31:
-                printch('s');
-                buffstr[i] = 's';
-                i++;
-                break;
-        case 32:
-                printch('d');
-                buffstr[i] = 'd';
-                i++;
-                break;
-        case 33:
-                printch('f');
-                buffstr[i] = 'f';
-                i++;
-                break;
-        case 34:
-                printch('g');
-                buffstr[i] = 'g';
-                i++;
-                break;
-        case 35:
-                printch('h');
-                buffstr[i] = 'h';
-                i++;
-                break;
-        case 36:
-                printch('j');
-                buffstr[i] = 'j';
-                i++;
-                break;
-        case 37:
-                printch('k');
-                buffstr[i] = 'k';
-                i++;
-                break;
-        case 38:
-                printch('l');
-                buffstr[i] = 'l';
-                i++;
-                break;
-        case 39:
-                printch(';');
-                buffstr[i] = ';';
-                i++;
-                break;
-        case 40:
-                printch((char)44);               
-                buffstr[i] = (char)44;
-                i++;
-                break;
-        case 41:
-                printch((char)44);               
-                buffstr[i] = (char)44;
-                i++;
-                break;
-        case 42:                                  
-                printch('q');
-                buffstr[i] = 'q';
-                i++;
-                break;
-        case 43:                                 
-                printch((char)92);
-                buffstr[i] = 'q';
-                i++;
-                break;
-        case 44:
-                printch('z');
-                buffstr[i] = 'z';
-                i++;
-                break;
-        case 45:
-                printch('x');
-                buffstr[i] = 'x';
-                i++;
-                break;
-        case 46:
-                printch('c');
-                buffstr[i] = 'c';
-                i++;
-                break;
-        case 47:
-                printch('v');
-                buffstr[i] = 'v';
-                i++;
-                break;                
-        case 48:
-                printch('b');
-                buffstr[i] = 'b';
-                i++;
-                break;               
-        case 49:
-                printch('n');
-                buffstr[i] = 'n';
-                i++;
-                break;                
-        case 50:
-                printch('m');
-                buffstr[i] = 'm';
-                i++;
-                break;               
-        case 51:
-                printch(',');
-                buffstr[i] = ',';
-                i++;
-                break;                
-        case 52:
-                printch('.');
-                buffstr[i] = '.';
-                i++;
-                break;            
-        case 53:
-                printch('/');
-                buffstr[i] = '/';
-                i++;
-                break;            
-        case 54:
-                printch('.');
-                buffstr[i] = '.';
-                i++;
-                break;            
-        case 55:
-                printch('/');
-                buffstr[i] = '/';
-                i++;
-                break;            
-        case 56:
-                printch(' ');           
-                buffstr[i] = ' ';
-                i++;
-                break;        
-        case 57:
-                printch(' ');
-                buffstr[i] = ' ';
-                i++;
-                break;
+                printch('\b');
             }
+            continue;
+        }
+        if(i < KB_LINE_MAX - 1)
+        {
+            printch(c);
+            buffstr[i++] = c;
         }
     }
-    buffstr[i-1] = 0;                
+    buffstr[i] = 0;
     return buffstr;
 }
+
+void freeStr(string str)
+{
+    kmem_cache_free(line_cache, str);
+}
@@ -1,13 +1,81 @@
 bits    32
+
+KERNEL_VIRTUAL_BASE equ 0xC0000000              ; keep in sync with include/paging.h
+KERNEL_PDE          equ (KERNEL_VIRTUAL_BASE >> 22)
+
 section         .text
         align   4
         dd      0x1BADB002
-        dd      0x00
-        dd      - (0x1BADB002+0x00)
+        dd      0x07                    ; page align modules, pass the memory map, set a video mode
+        dd      - (0x1BADB002+0x07)
+        dd      0, 0, 0, 0, 0           ; load addresses, unused without flag 16
+        dd      0                       ; linear framebuffer
+        dd      1024, 768, 32           ; preferred width, height, depth
         
 global start
+global boot_tsc
 extern kmain            ; this function is gonna be located in our c code(kernel.c)
 start:
         cli             ;clears the interrupts 
+        mov esi, eax    ;rdtsc overwrites the multiboot magic
+        rdtsc
+        mov [boot_tsc - KERNEL_VIRTUAL_BASE], eax       ;first bootprof timestamp
+        mov [boot_tsc - KERNEL_VIRTUAL_BASE + 4], edx
+        mov eax, esi
+        ; grub jumps here with paging off, so until the jump below every
+        ; address we touch has to be the physical one
+        mov ecx, (boot_page_directory - KERNEL_VIRTUAL_BASE)
+        mov cr3, ecx
+        mov ecx, cr4
+        or ecx, 0x00000010      ;PSE, 4 MiB pages
+        mov cr4, ecx
+        mov ecx, cr0
+        or ecx, 0x80010000      ;PG, WP: ring 0 honours read-only pages too (copy-on-write)
+        mov cr0, ecx
+        lea ecx, [higher_half]
+        jmp ecx
+
+higher_half:
+        lgdt [boot_gdt_ptr]     ;grub's gdt is about to be unmapped, use our own
+        jmp 0x08:reload_segments
+reload_segments:
+        mov cx, 0x10
+        mov ds, cx
+        mov es, cx
+        mov fs, cx
+        mov gs, cx
+        mov ss, cx
+        mov esp, stack_top      ;boot stack, grub does not promise us one
+        push ebx        ;multiboot info structure (physical address)
+        push eax        ;multiboot magic
         call kmain      ;send processor to continue execution from the kamin funtion in c code
         hlt             ; halt the cpu(pause it from executing from this address
+
+section         .data
+        align   4096
+; maps the first 4 MiB at 0 (so the instructions after enabling paging
+; still resolve) and at KERNEL_VIRTUAL_BASE, paging_init replaces it
+boot_page_directory:
+        dd      0x00000083
+        times   (KERNEL_PDE - 1) dd 0
+        dd      0x00000083
+        times   (1024 - KERNEL_PDE - 1) dd 0
+
+        align   8
+boot_tsc:
+        dq      0
+
+        align   8
+boot_gdt:
+        dq      0x0000000000000000      ;null
+        dq      0x00CF9A000000FFFF      ;0x08 kernel code, flat 4 GiB
+        dq      0x00CF92000000FFFF      ;0x10 kernel data, flat 4 GiB
+boot_gdt_ptr:
+        dw      boot_gdt_ptr - boot_gdt - 1
+        dd      boot_gdt
+
+section         .bss
+        align   16
+stack_bottom:
+        resb    16384
+stack_top:
@@ -2,17 +2,112 @@
 #include "../include/isr.h"
 #include "../include/idt.h"
 #include "../include/util.h"
+#include "../include/multiboot.h"
+#include "../include/pmm.h"
+#include "../include/heap.h"
+#include "../include/paging.h"
+#include "../include/clock.h"
+#include "../include/timer.h"
+#include "../include/sched.h"
+#include "../include/shell.h"
+#include "../include/smp.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/workqueue.h"
+#include "../include/fbcon.h"
+#include "../include/memory.h"
+#include "../include/fpu.h"
+#include "../include/klog.h"
+#include "../include/serial.h"
+#include "../include/bootprof.h"
+#include "../include/initrd.h"
+#include "../include/ata.h"
+#include "../include/bcache.h"
+#include "../include/syscall.h"
+#include "../include/pci.h"
+#include "../include/virtblk.h"
+#include "../include/virtnet.h"
+#include "../include/pmu.h"
 
-void kmain()
+static void shell_thread(void *arg)
 {
+	bootprof_mark("launch_shell");
+	launch_shell(1);
+}
+
+void kmain(uint32 magic, uint32 mbi_phys)
+{
+	multiboot_info_t *mbi;
 
+	bootprof_mark("start");
 	print("Launching.........");
 	#include "../include/shell.h"
+	if(magic != MULTIBOOT_BOOTLOADER_MAGIC)
+	{
+		print_colored("\nNot booted by a multiboot loader, no memory map.",12,0);
+		asm("hlt");
+	}
+	memory_init();
+	bootprof_mark("memory_init");
+	paging_init();
+	bootprof_mark("paging_init");
+	smp_init_bsp();
+	bootprof_mark("smp_init_bsp");
+	mbi = (multiboot_info_t *)PHYS_TO_VIRT(mbi_phys);
+	pmm_init(mbi);
+	bootprof_mark("pmm_init");
+	heap_init();
+	bootprof_mark("heap_init");
+	if(fbcon_init(mbi)) screen_attach_framebuffer();
+	bootprof_mark("fbcon_init");
+	initrd_init(mbi);
+	bootprof_mark("initrd_init");
 	isr_install();
+	bootprof_mark("isr_install");
+	syscall_init();
+	bootprof_mark("syscall_init");
+	fpu_init();
+	bootprof_mark("fpu_init");
+	acpi_init();
+	bootprof_mark("acpi_init");
+	apic_init();
+	bootprof_mark("apic_init");
+	pmu_init();
+	bootprof_mark("pmu_init");
+	kb_init();
+	bootprof_mark("kb_init");
+	serial_init();
+	bootprof_mark("serial_init");
+	timer_init();
+	bootprof_mark("timer_init");
+	clock_init();
+	bootprof_mark("clock_init");
+	sched_init();
+	bootprof_mark("sched_init");
+	interrupts_enable();
+	smp_init();
+	bootprof_mark("smp_init");
+	workqueue_init();
+	bootprof_mark("workqueue_init");
+	klog_init();
+	bootprof_mark("klog_init");
+	pci_init();
+	bootprof_mark("pci_init");
+	ata_init();
+	bootprof_mark("ata_init");
+	virtblk_init();
+	bootprof_mark("virtblk_init");
+	virtnet_init();
+	bootprof_mark("virtnet_init");
+	bcache_init();
+	bootprof_mark("bcache_init");
     
 	clearScreen();
 	print_colored("forest os.",2,0);
-	launch_shell(1);
+	bootprof_mark("clearScreen");
+	shell_init();
+	thread_create("shell", shell_thread, 0);
+	sched_idle_loop();
 
 	
 }
\ No newline at end of file
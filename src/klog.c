@@ -0,0 +1,185 @@
+//kernel log
+
+#include "../include/klog.h"
+#include "../include/kprintf.h"
+#include "../include/clock.h"
+#include "../include/screen.h"
+#include "../include/memory.h"
+#include "../include/smp.h"
+#include "../include/workqueue.h"
+#include "../include/util.h"
+
+/*
+ * The log is a ring of fixed-size records. A writer takes a sequence
+ * number with one atomic add, which is the whole reservation, and
+ * formats its message straight into that record. It then publishes the
+ * record by storing seq + 1. There is no lock on this path, so any cpu
+ * in any context, interrupt handlers included, can log. When the ring
+ * wraps, the oldest records are overwritten.
+ *
+ * Readers check the sequence before and after copying a record. A
+ * record still being written ends the read for now, and so does a slot
+ * that still holds the last lap's record: its writer has reserved it but
+ * not cleared it yet. Only a slot already holding a later record means
+ * the one wanted was overwritten, and is counted as dropped and skipped.
+ *
+ * Sinks are drained by a work item, which the writer queues after
+ * publishing; a queue that is already pending costs one test-and-set.
+ * Until klog_init() runs there are no workers, so records are drained
+ * on the spot. Only one cpu drains at a time and nobody waits for it:
+ * whoever finds the drain busy leaves, and the drainer looks at the head
+ * again after it lets go, so records published meanwhile are not left
+ * behind. A slow sink holds up nobody but the drainer, which runs with
+ * interrupts on.
+ *
+ * Sinks are only ever added, at the front of the list, so the drain can
+ * walk it without a lock. Logging works from smp_init_bsp() on.
+ */
+
+#define KLOG_CONSOLE_LEVEL KLOG_WARN
+
+static klog_record_t ring[KLOG_RECORDS];
+static volatile uint32 head;                // next sequence number to hand out
+static volatile uint32 draining;
+static work_t drain_work;
+static bool async;
+
+static void console_write(const char *line, uint32 len)
+{
+    print_local((string)line);          // the serial sink has its own copy
+}
+
+static klog_sink_t console_sink = { "console", console_write, KLOG_CONSOLE_LEVEL, 0, 0, 0 };
+static klog_sink_t *volatile sinks = &console_sink;
+
+uint32 klog_head()
+{
+    return head;
+}
+
+uint32 klog_oldest()
+{
+    uint32 now = head;
+    return now > KLOG_RECORDS ? now - KLOG_RECORDS : 0;
+}
+
+/* False if seq is not published yet or has been overwritten */
+bool klog_read(uint32 seq, klog_record_t *out)
+{
+    klog_record_t *record = &ring[seq & (KLOG_RECORDS - 1)];
+    if (record->seq != seq + 1) return false;
+    __sync_synchronize();
+    memcpy(out, record, sizeof(*out));
+    __sync_synchronize();
+    return record->seq == seq + 1;
+}
+
+uint32 klog_format(const klog_record_t *record, char *line, uint32 size)
+{
+    uint32 usec_rem;
+    uint64 usec = udiv64(record->ns, NSEC_PER_USEC, 0);
+    uint32 seconds = (uint32)udiv64(usec, 1000000, &usec_rem);
+    int len = ksnprintf(line, size, "[%5u.%06u] %.*s\n", seconds, usec_rem, record->len, record->text);
+    return (uint32)len < size ? (uint32)len : size - 1;
+}
+
+/* Whether seq's slot has yet to see seq published: mid-write, or still
+   an older record */
+static bool unpublished(uint32 seq)
+{
+    uint32 slot = ring[seq & (KLOG_RECORDS - 1)].seq;
+    return slot == 0 || (int32)(slot - (seq + 1)) < 0;
+}
+
+static void drain_sink(klog_sink_t *sink)
+{
+    klog_record_t record;
+    char line[KLOG_LINE];
+    uint32 oldest = klog_oldest();
+    if (sink->next < oldest) {
+        sink->dropped += oldest - sink->next;
+        sink->next = oldest;
+    }
+    while (sink->next != head) {
+        if (!klog_read(sink->next, &record)) {
+            if (unpublished(sink->next)) break;                     // its writer drains again
+            sink->dropped++;
+            sink->next++;
+            continue;
+        }
+        if (record.level <= sink->max_level) sink->write(line, klog_format(&record, line, sizeof(line)));
+        sink->next++;
+    }
+}
+
+static bool behind()
+{
+    klog_sink_t *sink;
+    for (sink = sinks; sink; sink = sink->next_sink)
+        if (sink->next != head && !unpublished(sink->next)) return true;
+    return false;
+}
+
+/* Delivers everything published so far to every sink, unless another cpu is at it */
+void klog_flush()
+{
+    klog_sink_t *sink;
+    do {
+        if (__sync_lock_test_and_set(&draining, 1)) return;
+        for (sink = sinks; sink; sink = sink->next_sink) drain_sink(sink);
+        __sync_lock_release(&draining);
+        __sync_synchronize();
+    } while (behind());
+}
+
+static void drain(void *arg)
+{
+    klog_flush();
+}
+
+void vklog(int level, const char *fmt, va_list args)
+{
+    uint32 seq = __sync_fetch_and_add(&head, 1);
+    klog_record_t *record = &ring[seq & (KLOG_RECORDS - 1)];
+    record->seq = 0;
+    __sync_synchronize();
+    record->level = level;
+    record->cpu = this_cpu()->id;
+    record->ns = ktime_ns();
+    int len = kvsnprintf(record->text, KLOG_TEXT, fmt, args);
+    record->len = len < KLOG_TEXT ? len : KLOG_TEXT - 1;
+    __sync_synchronize();
+    record->seq = seq + 1;
+
+    if (async) work_queue(&drain_work);
+    else klog_flush();
+}
+
+void klog(int level, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vklog(level, fmt, args);
+    va_end(args);
+}
+
+void klog_register_sink(klog_sink_t *sink)
+{
+    klog_sink_t *first;
+    sink->next = klog_oldest();
+    sink->dropped = 0;
+    do {
+        first = sinks;
+        sink->next_sink = first;
+    } while (!__sync_bool_compare_and_swap(&sinks, first, sink));
+    if (async) work_queue(&drain_work);
+    else klog_flush();
+}
+
+/* After workqueue_init(), from then on sinks are drained by a worker */
+void klog_init()
+{
+    work_setup(&drain_work, drain, 0);
+    async = true;
+    work_queue(&drain_work);
+}
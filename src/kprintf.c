@@ -0,0 +1,201 @@
+//formatted output
+
+#include "../include/kprintf.h"
+#include "../include/screen.h"
+#include "../include/util.h"
+
+/*
+ * Formatting never allocates: output goes into a buffer, the caller's
+ * for ksnprintf and one on kprintf's stack. When kprintf's buffer fills
+ * it is printed and reused, so a line normally reaches the console as a
+ * single print() under one lock instead of a call per piece.
+ *
+ * 64-bit values only take the udiv64 path when their high half is set.
+ */
+
+typedef struct out {
+    char *buf;
+    size_t size;                    // 0 for no buffer at all
+    size_t len;                     // in buf right now
+    size_t total;                   // everything produced
+    void (*flush)(struct out *out); // 0: truncate when full
+} out_t;
+
+static void emit(out_t *out, char c)
+{
+    out->total++;
+    if (out->len + 1 >= out->size) {
+        if (!out->flush) return;
+        out->flush(out);
+    }
+    out->buf[out->len++] = c;
+}
+
+static void emit_padding(out_t *out, char c, int count)
+{
+    while (count-- > 0) emit(out, c);
+}
+
+/* digits holds the number backwards */
+static void emit_field(out_t *out, const char *prefix, const char *digits, int ndigits, int width, bool left, bool zero)
+{
+    int plen = 0;
+    while (prefix[plen]) plen++;
+    int pad = width - plen - ndigits;
+    if (!left && !zero) emit_padding(out, ' ', pad);
+    while (*prefix) emit(out, *prefix++);
+    if (!left && zero) emit_padding(out, '0', pad);
+    while (ndigits--) emit(out, digits[ndigits]);
+    if (left) emit_padding(out, ' ', pad);
+}
+
+static int format_decimal(char *digits, uint64 value)
+{
+    int n = 0;
+    while (value >> 32) {
+        uint32 rem;
+        value = udiv64(value, 10, &rem);
+        digits[n++] = '0' + rem;
+    }
+    uint32 low = (uint32)value;
+    do {
+        digits[n++] = '0' + low % 10;
+        low /= 10;
+    } while (low);
+    return n;
+}
+
+static int format_hex(char *digits, uint64 value, bool upper)
+{
+    const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    int n = 0;
+    do {
+        digits[n++] = hex[value & 0xF];
+        value >>= 4;
+    } while (value);
+    return n;
+}
+
+static void format(out_t *out, const char *fmt, va_list args)
+{
+    char digits[24];
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            emit(out, *fmt);
+            continue;
+        }
+        bool left = false, zero = false;
+        int width = 0, precision = -1, longs = 0;
+        for (fmt++;; fmt++) {
+            if (*fmt == '-') left = true;
+            else if (*fmt == '0') zero = true;
+            else break;
+        }
+        if (*fmt == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                left = true;
+                width = -width;
+            }
+            fmt++;
+        }
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++) width = width * 10 + *fmt - '0';
+        if (*fmt == '.') {
+            precision = 0;
+            if (*++fmt == '*') {
+                precision = va_arg(args, int);
+                fmt++;
+            }
+            for (; *fmt >= '0' && *fmt <= '9'; fmt++) precision = precision * 10 + *fmt - '0';
+        }
+        for (; *fmt == 'l'; fmt++) longs++;
+
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int64 value = longs >= 2 ? va_arg(args, int64) : va_arg(args, int32);
+            bool negative = value < 0;
+            int n = format_decimal(digits, negative ? -(uint64)value : (uint64)value);
+            emit_field(out, negative ? "-" : "", digits, n, width, left, zero);
+            break;
+        }
+        case 'u': {
+            uint64 value = longs >= 2 ? va_arg(args, uint64) : va_arg(args, uint32);
+            emit_field(out, "", digits, format_decimal(digits, value), width, left, zero);
+            break;
+        }
+        case 'x':
+        case 'X': {
+            uint64 value = longs >= 2 ? va_arg(args, uint64) : va_arg(args, uint32);
+            emit_field(out, "", digits, format_hex(digits, value, *fmt == 'X'), width, left, zero);
+            break;
+        }
+        case 'p': {
+            int n = format_hex(digits, (uint32)va_arg(args, void *), false);
+            while (n < 8) digits[n++] = '0';
+            emit_field(out, "0x", digits, n, width, left, false);
+            break;
+        }
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            int len = 0;
+            if (!s) s = "(null)";
+            while (s[len] && (precision < 0 || len < precision)) len++;
+            if (!left) emit_padding(out, ' ', width - len);
+            for (int i = 0; i < len; i++) emit(out, s[i]);
+            if (left) emit_padding(out, ' ', width - len);
+            break;
+        }
+        case 'c':
+            if (!left) emit_padding(out, ' ', width - 1);
+            emit(out, (char)va_arg(args, int));
+            if (left) emit_padding(out, ' ', width - 1);
+            break;
+        case '%':
+            emit(out, '%');
+            break;
+        case 0:
+            return;
+        default:                        // unknown, show it as written
+            emit(out, '%');
+            emit(out, *fmt);
+            break;
+        }
+    }
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+    out_t out = { buf, size, 0, 0, 0 };
+    format(&out, fmt, args);
+    if (size) buf[out.len] = 0;
+    return out.total;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static void console_flush(out_t *out)
+{
+    out->buf[out->len] = 0;
+    print(out->buf);
+    out->len = 0;
+}
+
+int kprintf(const char *fmt, ...)
+{
+    char buf[KPRINTF_BUFFER];
+    out_t out = { buf, sizeof(buf), 0, 0, console_flush };
+    va_list args;
+    va_start(args, fmt);
+    format(&out, fmt, args);
+    va_end(args);
+    if (out.len) console_flush(&out);
+    return out.total;
+}
@@ -0,0 +1,31 @@
+# Turns `nm -n kernel.bin` into the kernel's symbol table, see ksyms.c.
+# Only code symbols, in address order; of several at one address the
+# first is kept. With no input it makes the empty table of the first link.
+
+BEGIN { n = 0; last = "" }
+
+NF == 3 && $2 ~ /^[tTwW]$/ && $1 != last {
+    addr[n] = $1
+    name[n] = $3
+    last = $1
+    n++
+}
+
+END {
+    print "; generated by src/ksyms.awk, do not edit"
+    print "section .ksyms progbits alloc noexec nowrite align=4"
+    print "global ksyms_count"
+    print "global ksyms_addrs"
+    print "global ksyms_names"
+    print "global ksyms_strings"
+    printf "ksyms_count:\n        dd      %d\n", n
+    print "ksyms_addrs:"
+    for (i = 0; i < n; i++) printf "        dd      0x%s\n", addr[i]
+    print "ksyms_names:"
+    for (i = off = 0; i < n; i++) {
+        printf "        dd      %d\n", off
+        off += length(name[i]) + 1
+    }
+    print "ksyms_strings:"
+    for (i = 0; i < n; i++) printf "        db      \"%s\", 0\n", name[i]
+}
@@ -0,0 +1,57 @@
+//kernel symbol table
+
+#include "../include/ksyms.h"
+
+/*
+ * The table is made at build time: kernel.bin is linked once with an
+ * empty table, src/ksyms.awk turns its code symbols from nm into
+ * obj/ksymtab.asm, and the second link puts that in .ksyms, behind
+ * everything else that is loaded, so no code address changes between
+ * the two. The makefile checks that.
+ *
+ * Two parallel arrays sorted by address, the second holding offsets
+ * into one pool of names: 8 bytes and the name per symbol, and a lookup
+ * is a binary search. Nothing here is written after the build.
+ */
+
+extern const uint32 ksyms_count;
+extern const uint32 ksyms_addrs[];
+extern const uint32 ksyms_names[];
+extern const char ksyms_strings[];
+extern const uint8 kernel_text_end[];
+
+uint32 ksym_count()
+{
+    return ksyms_count;
+}
+
+uint32 ksym_index(uint32 addr)
+{
+    uint32 lo = 0, hi = ksyms_count;
+    if (!hi || addr < ksyms_addrs[0] || addr >= (uint32)kernel_text_end) return KSYM_NONE;
+    while (hi - lo > 1) {                   // ksyms_addrs[lo] <= addr < ksyms_addrs[hi]
+        uint32 mid = (lo + hi) / 2;
+        if (ksyms_addrs[mid] <= addr) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+const char *ksym_name(uint32 index)
+{
+    return index < ksyms_count ? ksyms_strings + ksyms_names[index] : 0;
+}
+
+uint32 ksym_addr(uint32 index)
+{
+    return index < ksyms_count ? ksyms_addrs[index] : 0;
+}
+
+/* The name of the function addr is in and how far into it, or 0 */
+const char *ksym_lookup(uint32 addr, uint32 *offset)
+{
+    uint32 i = ksym_index(addr);
+    if (i == KSYM_NONE) return 0;
+    if (offset) *offset = addr - ksyms_addrs[i];
+    return ksym_name(i);
+}
@@ -0,0 +1,155 @@
+//bulk copy and fill
+
+#include "../include/memory.h"
+#include "../include/system.h"
+
+/*
+ * Everything below MEMORY_NT_THRESHOLD is string instructions: the
+ * destination is brought to a 4 byte boundary with movsb, the body goes
+ * 4 bytes at a time with rep movsd / rep stosd and the tail is bytes
+ * again. CPUs with ERMS (enhanced rep movsb) do the whole thing with
+ * one rep movsb / rep stosb, which the microcode runs a cache line at a
+ * time.
+ *
+ * Large operations on SSE2 CPUs use movnti, which writes a general
+ * purpose register straight to memory without pulling the line into the
+ * cache. It never touches XMM state, so kernel code can use it whatever
+ * thread's FPU registers are loaded. The loop stores whole 64 byte lines
+ * and fences once at the end.
+ *
+ * All of this relies on DF being clear, which the interrupt entry
+ * guarantees.
+ */
+
+#define CPUID_7_EBX_ERMS 0x00000200
+
+static bool erms;
+static bool nt;
+
+void memory_init()
+{
+    uint32 eax, ebx, ecx, edx;
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    uint32 max_leaf = eax;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    nt = (edx & (CPUID_EDX_SSE | CPUID_EDX_SSE2)) == (CPUID_EDX_SSE | CPUID_EDX_SSE2);
+    if (max_leaf >= 7) {
+        cpuid(7, &eax, &ebx, &ecx, &edx);
+        erms = (ebx & CPUID_7_EBX_ERMS) != 0;
+    }
+}
+
+const char *memory_variant()
+{
+    if (erms && nt) return "rep movsb (ERMS), movnti for large";
+    if (erms) return "rep movsb (ERMS)";
+    if (nt) return "rep movsd, movnti for large";
+    return "rep movsd";
+}
+
+static void copy_forward(uint8 *d, const uint8 *s, uint32 n)
+{
+    if (erms || n < 16) {
+        asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+        return;
+    }
+    uint32 head = -(uint32)d & 3;
+    uint32 words = (n - head) >> 2;
+    uint32 tail = (n - head) & 3;
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(head) : : "memory");
+    asm volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(tail) : : "memory");
+}
+
+static void copy_backward(uint8 *d, const uint8 *s, uint32 n)
+{
+    uint32 tail = n & 3, words = n >> 2;
+    d += n - 1;
+    s += n - 1;
+    asm volatile("std\n\trep movsb" : "+D"(d), "+S"(s), "+c"(tail) : : "memory");
+    d -= 3;
+    s -= 3;
+    asm volatile("rep movsl\n\tcld" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+}
+
+#define NT_COPY_PAIR(a, b) \
+    "movl " #a "(%1), %%eax\n\tmovl " #b "(%1), %%edx\n\t" \
+    "movnti %%eax, " #a "(%0)\n\tmovnti %%edx, " #b "(%0)\n\t"
+
+static void copy_nt(uint8 *d, const uint8 *s, uint32 n)
+{
+    uint32 head = -(uint32)d & 63;
+    copy_forward(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    uint32 lines = n >> 6;
+    asm volatile("1:\n\t"
+                 "prefetchnta 256(%1)\n\t"
+                 NT_COPY_PAIR(0, 4) NT_COPY_PAIR(8, 12) NT_COPY_PAIR(16, 20) NT_COPY_PAIR(24, 28)
+                 NT_COPY_PAIR(32, 36) NT_COPY_PAIR(40, 44) NT_COPY_PAIR(48, 52) NT_COPY_PAIR(56, 60)
+                 "addl $64, %1\n\t"
+                 "addl $64, %0\n\t"
+                 "decl %2\n\t"
+                 "jnz 1b\n\t"
+                 "sfence"
+                 : "+r"(d), "+r"(s), "+r"(lines) : : "eax", "edx", "memory");
+    copy_forward(d, s, n & 63);
+}
+
+#define NT_FILL_PAIR(a, b) "movnti %1, " #a "(%0)\n\tmovnti %1, " #b "(%0)\n\t"
+
+static void fill_nt(uint8 *d, uint32 pattern, uint32 n)
+{
+    uint32 head = -(uint32)d & 63;
+    uint32 lines = (n - head) >> 6;
+    uint32 tail = (n - head) & 63;
+    asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+    asm volatile("1:\n\t"
+                 NT_FILL_PAIR(0, 4) NT_FILL_PAIR(8, 12) NT_FILL_PAIR(16, 20) NT_FILL_PAIR(24, 28)
+                 NT_FILL_PAIR(32, 36) NT_FILL_PAIR(40, 44) NT_FILL_PAIR(48, 52) NT_FILL_PAIR(56, 60)
+                 "addl $64, %0\n\t"
+                 "decl %2\n\t"
+                 "jnz 1b\n\t"
+                 "sfence"
+                 : "+r"(d), "+r"(pattern), "+r"(lines) : : "memory");
+    asm volatile("rep stosb" : "+D"(d), "+c"(tail) : "a"(pattern) : "memory");
+}
+
+void *memcpy(void *dest, const void *src, uint32 n)
+{
+    if (nt && n >= MEMORY_NT_THRESHOLD) copy_nt((uint8 *)dest, (const uint8 *)src, n);
+    else copy_forward((uint8 *)dest, (const uint8 *)src, n);
+    return dest;
+}
+
+void *memmove(void *dest, const void *src, uint32 n)
+{
+    uint8 *d = (uint8 *)dest;
+    const uint8 *s = (const uint8 *)src;
+    if (d <= s || d >= s + n) return memcpy(dest, src, n);   // a forward copy never reads what it wrote
+    copy_backward(d, s, n);
+    return dest;
+}
+
+void *memset(void *dest, int c, uint32 n)
+{
+    uint8 *d = (uint8 *)dest;
+    uint32 pattern = (uint8)c * 0x01010101;
+    if (nt && n >= MEMORY_NT_THRESHOLD) {
+        fill_nt(d, pattern, n);
+        return dest;
+    }
+    if (erms || n < 16) {
+        asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(pattern) : "memory");
+        return dest;
+    }
+    uint32 head = -(uint32)d & 3;
+    uint32 words = (n - head) >> 2;
+    uint32 tail = (n - head) & 3;
+    asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+    asm volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+    asm volatile("rep stosb" : "+D"(d), "+c"(tail) : "a"(pattern) : "memory");
+    return dest;
+}
@@ -0,0 +1,150 @@
+//network interfaces
+
+#include "../include/net.h"
+#include "../include/clock.h"
+#include "../include/memory.h"
+#include "../include/sched.h"
+#include "../include/string.h"
+#include "../include/util.h"
+
+/*
+ * Not a network stack: a table of interfaces, frame counters, and just
+ * enough ARP to ask who has an address and time the answer, which is
+ * what the arping command uses to check a driver end to end. Addresses
+ * are host order here and big endian on the wire.
+ */
+
+#define ARP_REQUEST     1
+#define ARP_REPLY       2
+
+typedef struct {
+    uint8 dest[ETH_ALEN];
+    uint8 src[ETH_ALEN];
+    uint8 type[2];
+    uint8 htype[2];
+    uint8 ptype[2];
+    uint8 hlen;
+    uint8 plen;
+    uint8 op[2];
+    uint8 sha[ETH_ALEN];
+    uint8 spa[4];
+    uint8 tha[ETH_ALEN];
+    uint8 tpa[4];
+} __attribute__((packed)) arp_frame_t;
+
+static net_device_t *devices[NET_MAX_DEVICES];
+static uint32 ndevices;
+
+/* One arping at a time, answered from net_receive */
+static net_device_t *volatile arp_dev;
+static uint32 arp_ip;
+static uint8 arp_mac[ETH_ALEN];
+static volatile bool arp_answered;
+
+static void put16(uint8 *p, uint16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static uint16 get16(const uint8 *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void put32(uint8 *p, uint32 v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static uint32 get32(const uint8 *p)
+{
+    return ((uint32)get16(p) << 16) | get16(p + 2);
+}
+
+void net_register(net_device_t *dev)
+{
+    if (ndevices < NET_MAX_DEVICES) devices[ndevices++] = dev;
+}
+
+uint32 net_count()
+{
+    return ndevices;
+}
+
+net_device_t *net_device(uint32 index)
+{
+    return index < ndevices ? devices[index] : 0;
+}
+
+net_device_t *net_find(const char *name)
+{
+    uint32 i;
+    for (i = 0; i < ndevices; i++)
+        if (!strcmp(devices[i]->name, name)) return devices[i];
+    return 0;
+}
+
+bool net_send(net_device_t *dev, const void *frame, uint32 len)
+{
+    if (len < ETH_HLEN || len > ETH_FRAME_MAX || !dev->send(dev, frame, len)) {
+        dev->stats.tx_dropped++;
+        return false;
+    }
+    dev->stats.tx_packets++;
+    dev->stats.tx_bytes += len;
+    return true;
+}
+
+void net_flush(net_device_t *dev)
+{
+    dev->flush(dev);
+}
+
+void net_receive(net_device_t *dev, const uint8 *frame, uint32 len)
+{
+    const arp_frame_t *arp = (const arp_frame_t *)frame;
+    if (len < ETH_HLEN) {
+        dev->stats.rx_dropped++;
+        return;
+    }
+    dev->stats.rx_packets++;
+    dev->stats.rx_bytes += len;
+    if (len < sizeof(arp_frame_t) || get16(arp->type) != ETH_TYPE_ARP || get16(arp->op) != ARP_REPLY) return;
+    if (dev != arp_dev || get32(arp->spa) != arp_ip || arp_answered) return;
+    memcpy(arp_mac, arp->sha, ETH_ALEN);
+    arp_answered = true;
+}
+
+/* Who has dst_ip, asked as src_ip; the answer's MAC and round trip */
+bool net_arping(net_device_t *dev, uint32 src_ip, uint32 dst_ip, uint8 *mac, uint32 *us)
+{
+    arp_frame_t req;
+    uint64 start;
+    if (arp_dev) return false;
+    memory_set((uint8 *)&req, 0, sizeof(req));
+    memory_set(req.dest, 0xFF, ETH_ALEN);
+    memcpy(req.src, dev->mac, ETH_ALEN);
+    put16(req.type, ETH_TYPE_ARP);
+    put16(req.htype, 1);
+    put16(req.ptype, 0x0800);
+    req.hlen = ETH_ALEN;
+    req.plen = 4;
+    put16(req.op, ARP_REQUEST);
+    memcpy(req.sha, dev->mac, ETH_ALEN);
+    put32(req.spa, src_ip);
+    put32(req.tpa, dst_ip);
+
+    arp_ip = dst_ip;
+    arp_answered = false;
+    arp_dev = dev;
+    start = ktime_ns();
+    if (net_send(dev, &req, sizeof(req))) net_flush(dev);
+    while (!arp_answered && ktime_ns() - start < (uint64)NET_ARPING_MS * NSEC_PER_MSEC) thread_sleep_ms(1);
+    *us = (uint32)udiv64(ktime_ns() - start, NSEC_PER_USEC, 0);
+    arp_dev = 0;
+    if (!arp_answered) return false;
+    memcpy(mac, arp_mac, ETH_ALEN);
+    return true;
+}
@@ -0,0 +1,154 @@
+//paging
+
+#include "../include/paging.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * start (kernel.asm) enters the higher half on a boot directory that maps
+ * the first 4 MiB twice, at 0 and at KERNEL_VIRTUAL_BASE. paging_init
+ * replaces it with the kernel directory below: the whole direct map in
+ * 4 MiB PSE pages, global when the CPU supports it so the entries survive
+ * CR3 reloads, and nothing mapped at low addresses any more.
+ *
+ * Everything that needs 4 KiB granularity (MMIO, framebuffers, user pages)
+ * goes through map_page(), which allocates page tables from lowmem on
+ * demand and reaches them through the direct map. The page tables of the
+ * 4 KiB kernel area are in the kernel image instead, all of them, so a
+ * process's page directory can copy the kernel half at creation and see
+ * every later kernel mapping.
+ *
+ * A highmem frame has no address of its own in the kernel. kmap_atomic()
+ * maps it at one of the calling cpu's slots at the top of the kernel
+ * area, for as long as the caller keeps interrupts off.
+ */
+
+/*
+ * The PAT keeps its power-on layout except that entry 1, selected by PWT
+ * alone, becomes write-combining, so a framebuffer ioremap'd with PTE_WC
+ * gets its stores merged into bursts. Every cpu has to load the same
+ * table. Without a PAT, PWT still means write-through.
+ */
+#define MSR_PAT     0x277
+#define PAT_LAYOUT  0x0007010600070106ULL       // WB, WC, UC-, UC, WB, WC, UC-, UC
+
+#define VMAP_TABLES (1024 - PDE_INDEX(VMAP_START))
+#define KMAP_START  (VMAP_END - MAX_CPUS * KMAP_SLOTS * PAGE_SIZE)
+
+static uint32 kernel_pd[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32 vmap_tables[VMAP_TABLES][1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32 vmap_next = VMAP_START;
+static uint32 global_flag;
+
+void paging_init() {
+    uint32 eax, ebx, ecx, edx, i;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_EDX_PGE) global_flag = PTE_GLOBAL;
+
+    for (i = 0; i < 1024; i++) kernel_pd[i] = 0;
+    for (i = 0; i < (DIRECT_MAP_SIZE >> LARGE_PAGE_SHIFT); i++)
+        kernel_pd[PDE_INDEX(KERNEL_VIRTUAL_BASE) + i] =
+            (i << LARGE_PAGE_SHIFT) | PTE_PRESENT | PTE_WRITE | PTE_LARGE | global_flag;
+    for (i = 0; i < VMAP_TABLES; i++)
+        kernel_pd[PDE_INDEX(VMAP_START) + i] = VIRT_TO_PHYS(vmap_tables[i]) | PTE_PRESENT | PTE_WRITE;
+
+    if (global_flag) write_cr4(read_cr4() | CR4_PGE);
+    write_cr3(VIRT_TO_PHYS(kernel_pd));
+    pat_init();
+}
+
+void pat_init() {
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_PAT)) return;
+    asm volatile("wbinvd" ::: "memory");
+    write_msr(MSR_PAT, PAT_LAYOUT);
+    write_cr3(read_cr3());
+}
+
+uint32 *kernel_page_directory() {
+    return kernel_pd;
+}
+
+bool map_page(uint32 *dir, uint32 virt, uint32 phys, uint32 flags) {
+    uint32 *pde = &dir[PDE_INDEX(virt)];
+    if (!(*pde & PTE_PRESENT)) {
+        uint32 table = pmm_alloc_frame();
+        if (table == PMM_NO_FRAME) return false;
+        memory_set((uint8 *)PHYS_TO_VIRT(table), 0, PAGE_SIZE);
+        *pde = table | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+    }
+    if (*pde & PTE_LARGE) return false;
+    if (flags & PTE_USER) *pde |= PTE_USER;
+
+    uint32 *pt = (uint32 *)PHYS_TO_VIRT(*pde & PTE_FRAME);
+    pt[PTE_INDEX(virt)] = (phys & PTE_FRAME) | (flags & ~PTE_FRAME) | PTE_PRESENT;
+    invlpg(virt);
+    return true;
+}
+
+void unmap_page(uint32 *dir, uint32 virt) {
+    uint32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT) || (pde & PTE_LARGE)) return;
+    uint32 *pt = (uint32 *)PHYS_TO_VIRT(pde & PTE_FRAME);
+    pt[PTE_INDEX(virt)] = 0;
+    invlpg(virt);
+}
+
+/* Physical address behind virt, or 0 when it is not mapped */
+uint32 virt_to_phys(uint32 *dir, uint32 virt) {
+    uint32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT)) return 0;
+    if (pde & PTE_LARGE) return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    uint32 pte = ((uint32 *)PHYS_TO_VIRT(pde & PTE_FRAME))[PTE_INDEX(virt)];
+    if (!(pte & PTE_PRESENT)) return 0;
+    return (pte & PTE_FRAME) | (virt & (PAGE_SIZE - 1));
+}
+
+/* Maps a physical range (MMIO, framebuffer) into the kernel's 4 KiB area */
+void *ioremap(uint32 phys, uint32 size, uint32 flags) {
+    uint32 offset = phys & (PAGE_SIZE - 1);
+    uint32 pages = (offset + size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint32 i;
+    if (!pages || pages > (KMAP_START - vmap_next) >> PAGE_SHIFT) return 0;
+
+    uint32 virt = vmap_next;
+    vmap_next += pages << PAGE_SHIFT;
+    for (i = 0; i < pages; i++) {
+        if (!map_page(kernel_pd, virt + (i << PAGE_SHIFT), (phys & PTE_FRAME) + (i << PAGE_SHIFT),
+                      PTE_WRITE | global_flag | flags))
+            return 0;
+    }
+    return (void *)(virt + offset);
+}
+
+/* The page table entry for virt, or 0 when it has no page table */
+uint32 *page_entry(uint32 *dir, uint32 virt) {
+    uint32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PTE_PRESENT) || (pde & PTE_LARGE)) return 0;
+    return &((uint32 *)PHYS_TO_VIRT(pde & PTE_FRAME))[PTE_INDEX(virt)];
+}
+
+/* An empty user half over the shared kernel half, or 0 */
+uint32 *pagedir_create() {
+    uint32 frame = pmm_alloc_frame();
+    if (frame == PMM_NO_FRAME) return 0;
+    uint32 *dir = (uint32 *)PHYS_TO_VIRT(frame);
+    memory_set((uint8 *)dir, 0, PDE_INDEX(USER_END) * sizeof(uint32));
+    memory_copy((char *)&kernel_pd[PDE_INDEX(USER_END)], (char *)&dir[PDE_INDEX(USER_END)],
+                (1024 - PDE_INDEX(USER_END)) * sizeof(uint32));
+    return dir;
+}
+
+/* Kernel address for any frame; interrupts must stay off until kunmap_atomic */
+void *kmap_atomic(uint32 phys, uint32 slot) {
+    if (phys < DIRECT_MAP_SIZE) return PHYS_TO_VIRT(phys);
+    uint32 virt = KMAP_START + (this_cpu()->id * KMAP_SLOTS + slot) * PAGE_SIZE;
+    map_page(kernel_pd, virt, phys, PTE_WRITE);
+    return (void *)virt;
+}
+
+void kunmap_atomic(void *addr) {
+    if ((uint32)addr >= KMAP_START && (uint32)addr < VMAP_END) unmap_page(kernel_pd, (uint32)addr & PTE_FRAME);
+}
@@ -0,0 +1,217 @@
+//PCI configuration space
+
+#include "../include/pci.h"
+#include "../include/klog.h"
+#include "../include/spinlock.h"
+#include "../include/system.h"
+
+/*
+ * Configuration mechanism #1: a dword address goes to 0xCF8 and the
+ * register is read or written at 0xCFC. The two accesses are a pair, so
+ * one lock keeps cpus from interleaving them. Narrower accesses read the
+ * containing dword.
+ *
+ * Under a hypervisor every one of those accesses is a VM exit, so the
+ * bus is walked once, at boot: bus 0, then the secondary bus of every
+ * PCI-to-PCI bridge found on the way, and one more root bus for every
+ * extra function of the host bridge at 0:0.0. That touches the buses
+ * that exist instead of all 256. Drivers then match on the table.
+ */
+
+static spinlock_t pci_lock = SPINLOCK_INIT;
+static pci_device_t devices[PCI_MAX_DEVICES];
+static uint32 ndevices;
+static bool scanned;
+
+static const struct {
+    uint8 class_code;
+    uint8 subclass;                         // 0xFF: any
+    const char *name;
+} class_names[] = {
+    { 0x01, 0x01, "IDE controller" },
+    { 0x01, 0x06, "SATA controller" },
+    { 0x01, 0x00, "SCSI controller" },
+    { 0x01, 0xFF, "storage controller" },
+    { 0x02, 0x00, "ethernet controller" },
+    { 0x02, 0xFF, "network controller" },
+    { 0x03, 0xFF, "display controller" },
+    { 0x04, 0xFF, "multimedia controller" },
+    { 0x05, 0xFF, "memory controller" },
+    { 0x06, 0x00, "host bridge" },
+    { 0x06, 0x01, "ISA bridge" },
+    { 0x06, 0x04, "PCI bridge" },
+    { 0x06, 0xFF, "bridge" },
+    { 0x07, 0xFF, "communication controller" },
+    { 0x08, 0xFF, "system peripheral" },
+    { 0x0C, 0x03, "USB controller" },
+    { 0x0C, 0x05, "SMBus controller" },
+    { 0x0C, 0xFF, "serial bus controller" },
+    { 0xFF, 0xFF, "device" },
+};
+
+static uint32 address(pci_addr_t addr, uint8 offset)
+{
+    return 0x80000000 | ((uint32)addr.bus << 16) | ((uint32)addr.slot << 11) |
+           ((uint32)addr.func << 8) | (offset & 0xFC);
+}
+
+uint32 pci_read32(pci_addr_t addr, uint8 offset)
+{
+    uint32 flags = spin_lock_irqsave(&pci_lock);
+    outportl(PCI_CONFIG_ADDRESS, address(addr, offset));
+    uint32 value = inportl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return value;
+}
+
+uint16 pci_read16(pci_addr_t addr, uint8 offset)
+{
+    return pci_read32(addr, offset) >> ((offset & 2) * 8);
+}
+
+uint8 pci_read8(pci_addr_t addr, uint8 offset)
+{
+    return pci_read32(addr, offset) >> ((offset & 3) * 8);
+}
+
+void pci_write32(pci_addr_t addr, uint8 offset, uint32 value)
+{
+    uint32 flags = spin_lock_irqsave(&pci_lock);
+    outportl(PCI_CONFIG_ADDRESS, address(addr, offset));
+    outportl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+void pci_write16(pci_addr_t addr, uint8 offset, uint16 value)
+{
+    uint32 flags = spin_lock_irqsave(&pci_lock);
+    outportl(PCI_CONFIG_ADDRESS, address(addr, offset));
+    outportw(PCI_CONFIG_DATA + (offset & 2), value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+/* Sets bits in the command register, to turn on decoding or bus mastering */
+void pci_enable(pci_addr_t addr, uint16 command)
+{
+    pci_write16(addr, PCI_COMMAND, pci_read16(addr, PCI_COMMAND) | command);
+}
+
+static void scan_bus(uint32 bus, uint32 depth);
+
+static void add_function(pci_addr_t addr, uint32 depth)
+{
+    pci_device_t *dev;
+    uint32 id = pci_read32(addr, PCI_VENDOR_ID);
+    uint32 class_reg = pci_read32(addr, PCI_REVISION);
+    uint8 type = pci_read8(addr, PCI_HEADER_TYPE) & ~PCI_HEADER_MULTI;
+    if (ndevices == PCI_MAX_DEVICES) {
+        klog(KLOG_WARN, "pci: more than %u functions, %02x:%02x.%u left out", PCI_MAX_DEVICES, addr.bus, addr.slot, addr.func);
+        return;
+    }
+    dev = &devices[ndevices++];
+    dev->addr = addr;
+    dev->vendor = id & 0xFFFF;
+    dev->device = id >> 16;
+    dev->revision = class_reg & 0xFF;
+    dev->prog_if = (class_reg >> 8) & 0xFF;
+    dev->subclass = (class_reg >> 16) & 0xFF;
+    dev->class_code = class_reg >> 24;
+    dev->subsystem = type == 0 ? pci_read16(addr, PCI_SUBSYSTEM_ID) : 0;
+    dev->irq = pci_read8(addr, PCI_INTERRUPT_PIN) ? pci_read8(addr, PCI_INTERRUPT_LINE) : PCI_NO_IRQ;
+    if (dev->irq >= 16) dev->irq = PCI_NO_IRQ;             // 0xFF: the firmware did not route it
+    if (type == 1 && dev->class_code == PCI_CLASS_BRIDGE && dev->subclass == PCI_SUBCLASS_PCI) {
+        uint8 secondary = pci_read8(addr, PCI_SECONDARY_BUS);
+        if (secondary > addr.bus && depth < 8) scan_bus(secondary, depth + 1);
+    }
+}
+
+/* Functions 1-7 are only looked at on multi-function slots */
+static void scan_bus(uint32 bus, uint32 depth)
+{
+    pci_addr_t addr;
+    uint32 slot, func;
+    addr.bus = bus;
+    for (slot = 0; slot < 32; slot++) {
+        addr.slot = slot;
+        for (func = 0; func < 8; func++) {
+            addr.func = func;
+            if (pci_read16(addr, PCI_VENDOR_ID) == 0xFFFF) {
+                if (func == 0) break;
+                continue;
+            }
+            add_function(addr, depth);
+            if (func == 0 && !(pci_read8(addr, PCI_HEADER_TYPE) & PCI_HEADER_MULTI)) break;
+        }
+    }
+}
+
+void pci_init()
+{
+    pci_addr_t host = { 0, 0, 0 };
+    uint32 func;
+    if (scanned) return;
+    scanned = true;
+    if (pci_read16(host, PCI_VENDOR_ID) == 0xFFFF) {
+        klog(KLOG_INFO, "pci: no host bridge");
+        return;
+    }
+    scan_bus(0, 0);
+    if (pci_read8(host, PCI_HEADER_TYPE) & PCI_HEADER_MULTI) {
+        for (func = 1; func < 8; func++) {                  // more host bridges, one bus each
+            host.func = func;
+            if (pci_read16(host, PCI_VENDOR_ID) != 0xFFFF) scan_bus(func, 0);
+        }
+    }
+    klog(KLOG_INFO, "pci: %u functions", ndevices);
+}
+
+uint32 pci_count()
+{
+    return ndevices;
+}
+
+const pci_device_t *pci_device(uint32 index)
+{
+    return index < ndevices ? &devices[index] : 0;
+}
+
+/* The next function from *index on with this vendor and device id;
+   *index is left past it, so callers can loop over several */
+const pci_device_t *pci_find_device(uint16 vendor, uint16 device, uint32 *index)
+{
+    for (; *index < ndevices; (*index)++) {
+        if (devices[*index].vendor == vendor && devices[*index].device == device) return &devices[(*index)++];
+    }
+    return 0;
+}
+
+/* First function with this class and subclass */
+bool pci_find_class(uint8 class_code, uint8 subclass, pci_addr_t *out)
+{
+    uint32 i;
+    pci_init();
+    for (i = 0; i < ndevices; i++) {
+        if (devices[i].class_code == class_code && devices[i].subclass == subclass) {
+            *out = devices[i].addr;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pci_class_name(uint8 class_code, uint8 subclass)
+{
+    uint32 i;
+    for (i = 0; class_names[i].class_code != 0xFF; i++) {
+        if (class_names[i].class_code == class_code && (class_names[i].subclass == subclass || class_names[i].subclass == 0xFF))
+            return class_names[i].name;
+    }
+    return class_names[i].name;
+}
+
+/* A BAR's base address with the type bits masked off */
+uint32 pci_bar(pci_addr_t addr, uint32 index)
+{
+    uint32 bar = pci_read32(addr, PCI_BAR0 + index * 4);
+    return bar & PCI_BAR_IO ? bar & ~3 : bar & ~15;
+}
@@ -0,0 +1,85 @@
+//8259 programmable interrupt controller
+
+#include "../include/pic.h"
+#include "../include/system.h"
+
+/* Masks are cached so (un)masking a line costs one port write, no read */
+static uint8 master_mask = 0xFF;
+static uint8 slave_mask = 0xFF;
+
+static void io_wait()
+{
+    outportb(0x80, 0);
+}
+
+void pic_remap(uint8 master_offset, uint8 slave_offset)
+{
+    outportb(PIC1_COMMAND, 0x11);       // ICW1: init, ICW4 follows
+    io_wait();
+    outportb(PIC2_COMMAND, 0x11);
+    io_wait();
+    outportb(PIC1_DATA, master_offset); // ICW2: vector offsets
+    io_wait();
+    outportb(PIC2_DATA, slave_offset);
+    io_wait();
+    outportb(PIC1_DATA, 0x04);          // ICW3: slave on IRQ2
+    io_wait();
+    outportb(PIC2_DATA, 0x02);
+    io_wait();
+    outportb(PIC1_DATA, 0x01);          // ICW4: 8086 mode
+    io_wait();
+    outportb(PIC2_DATA, 0x01);
+    io_wait();
+
+    master_mask = 0xFB;                 // everything masked except the cascade
+    slave_mask = 0xFF;
+    outportb(PIC1_DATA, master_mask);
+    outportb(PIC2_DATA, slave_mask);
+}
+
+void pic_mask(uint8 irq)
+{
+    if (irq < 8) {
+        master_mask |= 1 << irq;
+        outportb(PIC1_DATA, master_mask);
+    } else {
+        slave_mask |= 1 << (irq - 8);
+        outportb(PIC2_DATA, slave_mask);
+    }
+}
+
+void pic_unmask(uint8 irq)
+{
+    if (irq < 8) {
+        master_mask &= ~(1 << irq);
+        outportb(PIC1_DATA, master_mask);
+    } else {
+        slave_mask &= ~(1 << (irq - 8));
+        outportb(PIC2_DATA, slave_mask);
+    }
+}
+
+/* Masks every line, for when the IO-APIC takes over */
+void pic_disable()
+{
+    master_mask = slave_mask = 0xFF;
+    outportb(PIC1_DATA, master_mask);
+    outportb(PIC2_DATA, slave_mask);
+}
+
+/* IRQ7/IRQ15 fire spuriously when a request goes away before it is acked;
+   the in-service register tells the two apart. Only called for those lines. */
+bool pic_spurious(uint8 irq)
+{
+    uint16 port = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outportb(port, 0x0B);               // OCW3: read ISR
+    if (inportb(port) & 0x80) return false;
+    if (irq == 15) outportb(PIC1_COMMAND, PIC_EOI);     // master did see the cascade
+    return true;
+}
+
+void pic_send_eoi(uint8 irq)
+{
+    if (irq >= 8) outportb(PIC2_COMMAND, PIC_EOI);
+    outportb(PIC1_COMMAND, PIC_EOI);
+}
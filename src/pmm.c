@@ -0,0 +1,357 @@
+//physical memory manager
+
+#include "../include/pmm.h"
+#include "../include/paging.h"
+#include "../include/util.h"
+#include "../include/spinlock.h"
+
+/*
+ * Physical frames are tracked twice:
+ *  - frame_bitmap holds one bit per 4 KiB frame, set when the frame is
+ *    allocated or reserved. pmm_frame_used() answers from it directly.
+ *  - a binary buddy allocator keeps free blocks of 2^order frames on
+ *    per-order doubly linked lists, so allocation and freeing only walk
+ *    PMM_MAX_ORDER levels instead of scanning the map.
+ * Both live in one array placed right after the kernel image (and any
+ * multiboot modules), sized from the highest usable address below 4 GiB.
+ *
+ * Free lists are split into two zones at the end of the kernel direct map.
+ * pmm_alloc_frames() only hands out lowmem, which the kernel can reach
+ * through PHYS_TO_VIRT; highmem frames are only useful to code that maps
+ * them itself, and are handed out by pmm_alloc_highmem_frame().
+ *
+ * A single lock covers the bitmap and the free lists after pmm_init.
+ *
+ * Frames mapped into user space may be shared copy-on-write between
+ * address spaces. Each allocated frame starts with one reference; every
+ * further mapping takes one with pmm_frame_get() and pmm_frame_put()
+ * frees the frame with the last.
+ */
+
+#define FRAME_NONE      0xFFFFFFFF
+#define FRAME_FREE_HEAD 0x01            // first frame of a block on a free list
+
+#define LOW_MEMORY_END  0x100000        // BIOS, VGA and real-mode area stay reserved
+#define MAX_FRAMES      0x100000        // 4 GiB worth of frames
+#define LOWMEM_FRAMES   (DIRECT_MAP_SIZE >> PAGE_SHIFT)
+
+#define ZONE_LOW        0
+#define ZONE_HIGH       1
+#define ZONES           2
+
+typedef struct {
+    uint32 next;
+    uint32 prev;
+    uint8 order;
+    uint8 flags;
+    uint16 refs;                        // mappings of a user frame, see pmm_frame_get()
+} frame_t;
+
+static uint32 *frame_bitmap;
+static frame_t *frames;
+static uint32 frame_count;              // frames covered by the bitmap
+static uint32 total_count;              // frames the memory map reports usable
+static uint32 free_count;
+static uint32 free_list[ZONES][PMM_MAX_ORDER + 1];
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static uint32 zone_of(uint32 frame) {
+    return frame >= LOWMEM_FRAMES ? ZONE_HIGH : ZONE_LOW;
+}
+
+static void bitmap_set_range(uint32 first, uint32 count) {
+    while (count && (first & 31)) {
+        frame_bitmap[first >> 5] |= 1 << (first & 31);
+        first++;
+        count--;
+    }
+    while (count >= 32) {
+        frame_bitmap[first >> 5] = 0xFFFFFFFF;
+        first += 32;
+        count -= 32;
+    }
+    while (count) {
+        frame_bitmap[first >> 5] |= 1 << (first & 31);
+        first++;
+        count--;
+    }
+}
+
+static void bitmap_clear_range(uint32 first, uint32 count) {
+    while (count && (first & 31)) {
+        frame_bitmap[first >> 5] &= ~(1 << (first & 31));
+        first++;
+        count--;
+    }
+    while (count >= 32) {
+        frame_bitmap[first >> 5] = 0;
+        first += 32;
+        count -= 32;
+    }
+    while (count) {
+        frame_bitmap[first >> 5] &= ~(1 << (first & 31));
+        first++;
+        count--;
+    }
+}
+
+static bool bitmap_test(uint32 frame) {
+    return (frame_bitmap[frame >> 5] >> (frame & 31)) & 1;
+}
+
+static void free_list_push(uint32 frame, uint32 order) {
+    uint32 *head = &free_list[zone_of(frame)][order];
+    frames[frame].order = order;
+    frames[frame].flags |= FRAME_FREE_HEAD;
+    frames[frame].prev = FRAME_NONE;
+    frames[frame].next = *head;
+    if (*head != FRAME_NONE) frames[*head].prev = frame;
+    *head = frame;
+}
+
+static void free_list_remove(uint32 frame) {
+    frame_t *f = &frames[frame];
+    if (f->prev != FRAME_NONE) frames[f->prev].next = f->next;
+    else free_list[zone_of(frame)][f->order] = f->next;
+    if (f->next != FRAME_NONE) frames[f->next].prev = f->prev;
+    f->flags &= ~FRAME_FREE_HEAD;
+}
+
+/* Clamp a memory map range to whole frames below 4 GiB */
+static bool range_to_frames(uint64 addr, uint64 len, uint32 *first, uint32 *last) {
+    uint64 end = addr + len;
+    if (addr >= 0x100000000ULL) return false;
+    if (end > 0x100000000ULL) end = 0x100000000ULL;
+    *first = (uint32)((addr + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    *last = (uint32)(end >> PAGE_SHIFT);
+    return *first < *last;
+}
+
+/* Calls fn for every usable region the boot loader reported */
+static void for_each_usable(multiboot_info_t *mbi, void (*fn)(uint32 first, uint32 last)) {
+    uint32 first, last;
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32 addr = mbi->mmap_addr;
+        while (addr < mbi->mmap_addr + mbi->mmap_length) {
+            multiboot_mmap_entry_t *e = (multiboot_mmap_entry_t *)PHYS_TO_VIRT(addr);
+            if (e->type == MULTIBOOT_MEMORY_AVAILABLE && range_to_frames(e->addr, e->len, &first, &last))
+                fn(first, last);
+            addr += e->size + sizeof(e->size);
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        if (range_to_frames(LOW_MEMORY_END, (uint64)mbi->mem_upper * 1024, &first, &last))
+            fn(first, last);
+    }
+}
+
+static void count_usable(uint32 first, uint32 last) {
+    total_count += last - first;
+    if (last > frame_count) frame_count = last;
+}
+
+static void mark_usable(uint32 first, uint32 last) {
+    bitmap_clear_range(first, last - first);
+}
+
+static uint32 placement_size;
+static uint32 placement_floor;
+static uint32 placement_addr;
+
+static void find_placement(uint32 first, uint32 last) {
+    uint32 floor = placement_floor >> PAGE_SHIFT;
+    uint32 pages = (placement_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (placement_addr) return;
+    if (first < floor) first = floor;
+    if (last > LOWMEM_FRAMES) last = LOWMEM_FRAMES;     // metadata is reached through the direct map
+    if (first < last && last - first >= pages) placement_addr = first << PAGE_SHIFT;
+}
+
+static void raise_floor(uint32 end) {
+    end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end > placement_floor) placement_floor = end;
+}
+
+static void reserve(uint32 start, uint32 end) {
+    uint32 first = start >> PAGE_SHIFT;
+    uint32 last = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (last > frame_count) last = frame_count;
+    if (first < last) bitmap_set_range(first, last - first);
+}
+
+/* Carve every run of free frames into the largest aligned buddy blocks */
+static void build_free_lists() {
+    uint32 frame = 0;
+    while (frame < frame_count) {
+        if (!(frame & 31) && frame_bitmap[frame >> 5] == 0xFFFFFFFF) {
+            frame += 32;
+            continue;
+        }
+        if (bitmap_test(frame)) {
+            frame++;
+            continue;
+        }
+        uint32 run = 0;
+        while (frame + run < frame_count && !bitmap_test(frame + run)) {
+            run++;
+            if (frame + run == LOWMEM_FRAMES) break;    // blocks never straddle the zones
+        }
+        while (run) {
+            uint32 order = PMM_MAX_ORDER;
+            while ((frame & ((1 << order) - 1)) || (1u << order) > run) order--;
+            free_list_push(frame, order);
+            free_count += 1 << order;
+            frame += 1 << order;
+            run -= 1 << order;
+        }
+    }
+}
+
+void pmm_init(multiboot_info_t *mbi) {
+    uint32 i;
+    uint32 mbi_phys = VIRT_TO_PHYS(mbi);
+    for (i = 0; i <= PMM_MAX_ORDER; i++) free_list[ZONE_LOW][i] = free_list[ZONE_HIGH][i] = FRAME_NONE;
+
+    for_each_usable(mbi, count_usable);
+    if (frame_count > MAX_FRAMES) frame_count = MAX_FRAMES;
+
+    /* Metadata must not land on the kernel, the modules or the boot info */
+    raise_floor(VIRT_TO_PHYS(kernel_end));
+    raise_floor(mbi_phys + sizeof(multiboot_info_t));
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) raise_floor(mbi->mmap_addr + mbi->mmap_length);
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        multiboot_module_t *mods = (multiboot_module_t *)PHYS_TO_VIRT(mbi->mods_addr);
+        raise_floor(mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+        for (i = 0; i < mbi->mods_count; i++) raise_floor(mods[i].mod_end);
+    }
+
+    uint32 bitmap_bytes = ((frame_count + 31) / 32) * 4;
+    placement_size = bitmap_bytes + frame_count * sizeof(frame_t);
+    for_each_usable(mbi, find_placement);
+    if (!placement_addr) {              // nothing usable: every allocation fails
+        frame_count = 0;
+        return;
+    }
+
+    frame_bitmap = (uint32 *)PHYS_TO_VIRT(placement_addr);
+    frames = (frame_t *)PHYS_TO_VIRT(placement_addr + bitmap_bytes);
+    memory_set((uint8 *)frame_bitmap, 0xFF, bitmap_bytes);
+    memory_set((uint8 *)frames, 0, frame_count * sizeof(frame_t));
+
+    for_each_usable(mbi, mark_usable);
+    reserve(0, LOW_MEMORY_END);
+    reserve(VIRT_TO_PHYS(kernel_start), VIRT_TO_PHYS(kernel_end));
+    reserve(placement_addr, placement_addr + placement_size);
+    reserve(mbi_phys, mbi_phys + sizeof(multiboot_info_t));
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) reserve(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        multiboot_module_t *mods = (multiboot_module_t *)PHYS_TO_VIRT(mbi->mods_addr);
+        reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+        for (i = 0; i < mbi->mods_count; i++) reserve(mods[i].mod_start, mods[i].mod_end);
+    }
+
+    build_free_lists();
+}
+
+static uint32 zone_alloc(uint32 zone, uint32 order) {
+    uint32 o = order;
+    if (order > PMM_MAX_ORDER) return PMM_NO_FRAME;
+    while (o <= PMM_MAX_ORDER && free_list[zone][o] == FRAME_NONE) o++;
+    if (o > PMM_MAX_ORDER) return PMM_NO_FRAME;
+
+    uint32 frame = free_list[zone][o];
+    free_list_remove(frame);
+    while (o > order) {                 // split, handing the upper halves back
+        o--;
+        free_list_push(frame + (1 << o), o);
+    }
+    frames[frame].order = order;        // remembered for pmm_block_order()
+    frames[frame].refs = 1;
+    bitmap_set_range(frame, 1 << order);
+    free_count -= 1 << order;
+    return frame << PAGE_SHIFT;
+}
+
+uint32 pmm_alloc_frames(uint32 order) {
+    uint32 flags = spin_lock_irqsave(&pmm_lock);
+    uint32 addr = zone_alloc(ZONE_LOW, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+/* For frames the caller maps itself (user pages): highmem first, then lowmem */
+uint32 pmm_alloc_highmem_frame() {
+    uint32 flags = spin_lock_irqsave(&pmm_lock);
+    uint32 addr = zone_alloc(ZONE_HIGH, 0);
+    if (addr == PMM_NO_FRAME) addr = zone_alloc(ZONE_LOW, 0);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+static void free_block(uint32 addr, uint32 order) {
+    uint32 frame = addr >> PAGE_SHIFT;
+    if (order > PMM_MAX_ORDER || frame >= frame_count || !bitmap_test(frame)) return;
+
+    bitmap_clear_range(frame, 1 << order);
+    free_count += 1 << order;
+    while (order < PMM_MAX_ORDER) {     // merge with the buddy while it is free
+        uint32 buddy = frame ^ (1 << order);
+        if (buddy >= frame_count) break;
+        if (!(frames[buddy].flags & FRAME_FREE_HEAD) || frames[buddy].order != order) break;
+        free_list_remove(buddy);
+        frame &= ~(1 << order);
+        order++;
+    }
+    free_list_push(frame, order);
+}
+
+void pmm_free_frames(uint32 addr, uint32 order) {
+    uint32 flags = spin_lock_irqsave(&pmm_lock);
+    free_block(addr, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint32 pmm_alloc_frame() {
+    return pmm_alloc_frames(0);
+}
+
+void pmm_free_frame(uint32 addr) {
+    pmm_free_frames(addr, 0);
+}
+
+/* Order an allocated block was handed out with, addr must be its first frame */
+uint32 pmm_block_order(uint32 addr) {
+    uint32 frame = addr >> PAGE_SHIFT;
+    if (frame >= frame_count) return 0;
+    return frames[frame].order;
+}
+
+void pmm_frame_get(uint32 addr) {
+    uint32 flags = spin_lock_irqsave(&pmm_lock);
+    frames[addr >> PAGE_SHIFT].refs++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/* Drops a reference to a single frame, freeing it with the last one */
+void pmm_frame_put(uint32 addr) {
+    uint32 flags = spin_lock_irqsave(&pmm_lock);
+    if (!--frames[addr >> PAGE_SHIFT].refs) free_block(addr, 0);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint32 pmm_frame_refs(uint32 addr) {
+    return frames[addr >> PAGE_SHIFT].refs;
+}
+
+bool pmm_frame_used(uint32 addr) {
+    uint32 frame = addr >> PAGE_SHIFT;
+    if (frame >= frame_count) return true;
+    return bitmap_test(frame);
+}
+
+uint32 pmm_total_frames() {
+    return total_count;
+}
+
+uint32 pmm_free_frames_count() {
+    return free_count;
+}
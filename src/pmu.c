@@ -0,0 +1,126 @@
+//hardware performance counters
+
+#include "../include/pmu.h"
+#include "../include/klog.h"
+#include "../include/system.h"
+
+/*
+ * Architectural performance monitoring, as CPUID leaf 0x0A describes it:
+ * a version, some general purpose counters of one width, and a bit for
+ * each architectural event the counters cannot count. Each event we
+ * want that the cpu has gets the next free counter, in PMU_* order, so
+ * with fewer counters than events the last ones are left out.
+ *
+ * The counters are programmed once per cpu, the same way on all of them,
+ * and left running in ring 0 and ring 3 from then on. Nothing takes
+ * them over, so a measurement is two pmu_read calls and a pmu_delta,
+ * with rdpmc and no MSR writes in between. They count per cpu: both
+ * reads have to happen on the same one.
+ *
+ * Fixed-function counters are not used, so cycles and instructions take
+ * general purpose counters too.
+ */
+
+#define NO_COUNTER  0xFF
+
+static const struct {
+    const char *name;
+    uint8 event;
+    uint8 umask;
+    uint8 bit;                              // in CPUID 0x0A EBX, set if not available
+} events[PMU_EVENTS] = {
+    [PMU_CYCLES] = { "cycles", 0x3C, 0x00, 0 },
+    [PMU_INSTRUCTIONS] = { "instructions", 0xC0, 0x00, 1 },
+    [PMU_LLC_MISSES] = { "llc-misses", 0x2E, 0x41, 4 },
+    [PMU_BRANCH_MISSES] = { "branch-misses", 0xC5, 0x00, 6 },
+};
+
+static uint8 counter[PMU_EVENTS];
+static uint32 version, counters, width;
+static uint64 mask;
+static bool active;
+
+void pmu_init()
+{
+    uint32 eax, ebx, ecx, edx, i, next = 0;
+    for (i = 0; i < PMU_EVENTS; i++) counter[i] = NO_COUNTER;
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_PERFMON) return;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_MSR)) return;
+    cpuid(CPUID_PERFMON, &eax, &ebx, &ecx, &edx);
+    version = eax & 0xFF;
+    counters = (eax >> 8) & 0xFF;
+    width = (eax >> 16) & 0xFF;
+    if (!version || !counters || !width) return;    // no PMU, or a hypervisor that hides it
+    mask = width >= 64 ? ~0ull : (1ull << width) - 1;
+
+    for (i = 0; i < PMU_EVENTS && next < counters; i++)
+        if (events[i].bit < eax >> 24 && !(ebx & (1u << events[i].bit))) counter[i] = next++;
+    if (!next) return;
+    active = true;
+    pmu_init_cpu();
+    klog(KLOG_INFO, "pmu: version %u, %u counters of %u bits, %u events counted", version, counters, width, next);
+}
+
+/* Programs this cpu's counters, on every cpu */
+void pmu_init_cpu()
+{
+    uint32 i, enable = 0;
+    if (!active) return;
+    for (i = 0; i < PMU_EVENTS; i++) {
+        uint32 c = counter[i];
+        if (c == NO_COUNTER) continue;
+        write_msr(MSR_PERFEVTSEL0 + c, 0);
+        write_msr(MSR_PMC0 + c, 0);
+        write_msr(MSR_PERFEVTSEL0 + c, events[i].event | (uint32)events[i].umask << 8 |
+                  PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN);
+        enable |= 1u << c;
+    }
+    if (version >= 2) write_msr(MSR_PERF_GLOBAL_CTRL, read_msr(MSR_PERF_GLOBAL_CTRL) | enable);
+}
+
+bool pmu_active()
+{
+    return active;
+}
+
+bool pmu_counting(uint32 event)
+{
+    return event < PMU_EVENTS && counter[event] != NO_COUNTER;
+}
+
+const char *pmu_event_name(uint32 event)
+{
+    return event < PMU_EVENTS ? events[event].name : "?";
+}
+
+uint32 pmu_version()
+{
+    return version;
+}
+
+uint32 pmu_counters()
+{
+    return counters;
+}
+
+uint32 pmu_width()
+{
+    return width;
+}
+
+/* This cpu's counts, raw */
+void pmu_read(pmu_counts_t *counts)
+{
+    uint32 i;
+    for (i = 0; i < PMU_EVENTS; i++)
+        counts->v[i] = counter[i] != NO_COUNTER ? rdpmc(counter[i]) : 0;
+}
+
+/* end - start per event, across a wrap of the counter width */
+void pmu_delta(const pmu_counts_t *start, const pmu_counts_t *end, pmu_counts_t *delta)
+{
+    uint32 i;
+    for (i = 0; i < PMU_EVENTS; i++) delta->v[i] = (end->v[i] - start->v[i]) & mask;
+}
@@ -0,0 +1,255 @@
+//user processes
+
+#include "../include/proc.h"
+#include "../include/elf.h"
+#include "../include/gdt.h"
+#include "../include/heap.h"
+#include "../include/initrd.h"
+#include "../include/klog.h"
+#include "../include/spinlock.h"
+#include "../include/syscall.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * A process is a thread that got an address space and went to ring 3.
+ * proc_start is what the thread runs: it takes on the address space and
+ * leaves through the hand-built frame in process_t, the new program's
+ * entry point or, for a forked child, a copy of the parent's system call
+ * frame with 0 where the parent gets the child's pid.
+ *
+ * exec builds the new address space completely before it drops the old
+ * one, so a failed exec returns to the old program with -1.
+ *
+ * An exiting process frees its address space itself, after moving to
+ * the kernel's. Its process_t stays as a zombie until the parent picks
+ * up the exit code; children it leaves behind are detached and free
+ * their own. Everyone waiting for an exit sleeps on one queue.
+ */
+
+static spinlock_t proc_lock = SPINLOCK_INIT;        // the list, parents, zombie and detached
+static process_t *procs;
+static uint32 next_pid = 1;
+static wait_queue_t exits;
+
+static void set_name(process_t *p, const char *path)
+{
+    const char *base = path;
+    uint32 i;
+    for (; *path; path++)
+        if (*path == '/') base = path + 1;
+    for (i = 0; i < THREAD_NAME_LEN - 1 && base[i]; i++) p->name[i] = base[i];
+    p->name[i] = 0;
+}
+
+static process_t *proc_alloc(process_t *parent)
+{
+    process_t *p = (process_t *)kzalloc(sizeof(process_t));
+    if (!p) return 0;
+    p->parent = parent;
+    uint32 flags = spin_lock_irqsave(&proc_lock);
+    p->pid = next_pid++;
+    p->next = procs;
+    procs = p;
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return p;
+}
+
+/* Caller holds proc_lock */
+static void proc_free(process_t *p)
+{
+    process_t **link = &procs;
+    while (*link != p) link = &(*link)->next;
+    *link = p->next;
+    kfree(p);
+}
+
+/* Lays out the program at path in mm and the frame that enters it */
+static bool load(mm_t *mm, const char *path, registers_t *regs)
+{
+    uint32 size, entry, end, stub;
+    const uint8 *image = (const uint8 *)initrd_data(path, &size);
+    if (!image || !elf_load(mm, image, size, &entry, &end)) return false;
+    if (!vm_map(mm, USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE, USER_STACK_PAGES * PAGE_SIZE,
+                VM_READ | VM_WRITE, 0, 0))
+        return false;
+    if (!vm_map(mm, SYSCALL_PAGE, PAGE_SIZE, VM_READ | VM_EXEC, syscall_page(&stub), stub)) return false;
+    mm->heap = vm_map(mm, (end + PAGE_SIZE - 1) & PTE_FRAME, 0, VM_READ | VM_WRITE, 0, 0);
+    if (!mm->heap) return false;
+
+    memory_set((uint8 *)regs, 0, sizeof(registers_t));
+    regs->gs = regs->ds = regs->ss = SEG_USER_DATA;
+    regs->cs = SEG_USER_CODE;
+    regs->eflags = EFLAGS_IF;
+    regs->eip = entry;
+    regs->useresp = USER_STACK_TOP;
+    return true;
+}
+
+static void proc_start(void *arg)
+{
+    process_t *p = (process_t *)arg;
+    thread_t *self = thread_current();
+    interrupts_disable();
+    self->mm = p->mm;
+    self->proc = p;
+    gdt_set_kernel_stack(this_cpu()->id, (uint32)self->stack + THREAD_STACK_SIZE);
+    mm_activate(p->mm);
+    user_return(&p->start);
+}
+
+/* Starts p's thread, or frees p and its address space */
+static bool launch(process_t *p)
+{
+    p->thread = thread_create(p->name, proc_start, p);
+    if (p->thread) return true;
+    mm_destroy(p->mm);
+    uint32 flags = spin_lock_irqsave(&proc_lock);
+    proc_free(p);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return false;
+}
+
+process_t *proc_spawn(const char *path)
+{
+    process_t *p;
+    mm_t *mm = mm_create();
+    if (!mm) return 0;
+    if (!(p = proc_alloc(0))) {
+        mm_destroy(mm);
+        return 0;
+    }
+    p->mm = mm;
+    set_name(p, path);
+    if (!load(mm, path, &p->start)) {
+        klog(KLOG_WARN, "proc: cannot run %s", path);
+        mm_destroy(mm);
+        p->mm = 0;
+        uint32 flags = spin_lock_irqsave(&proc_lock);
+        proc_free(p);
+        spin_unlock_irqrestore(&proc_lock, flags);
+        return 0;
+    }
+    return launch(p) ? p : 0;
+}
+
+/* Sleeps until child exits, frees it and returns its exit code */
+int proc_wait(process_t *child)
+{
+    int code;
+    uint32 flags = spin_lock_irqsave(&exits.lock);
+    while (!child->zombie) wait_queue_sleep(&exits);
+    spin_unlock_irqrestore(&exits.lock, flags);
+    code = child->exit_code;
+    flags = spin_lock_irqsave(&proc_lock);
+    proc_free(child);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return code;
+}
+
+/* Waits for one of the caller's children; -1 if pid is not one */
+int proc_wait_pid(uint32 pid)
+{
+    process_t *self = proc_current(), *p;
+    uint32 flags = spin_lock_irqsave(&proc_lock);
+    for (p = procs; p && (p->pid != pid || p->parent != self); p = p->next);
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return p ? proc_wait(p) : -1;
+}
+
+int proc_fork(registers_t *regs)
+{
+    process_t *self = proc_current(), *child;
+    mm_t *mm = mm_clone(self->mm);
+    if (!mm) return -1;
+    if (!(child = proc_alloc(self))) {
+        mm_destroy(mm);
+        return -1;
+    }
+    child->mm = mm;
+    memory_copy(self->name, child->name, THREAD_NAME_LEN);
+    child->start = *regs;
+    child->start.eax = 0;
+    return launch(child) ? (int)child->pid : -1;
+}
+
+int proc_exec(registers_t *regs, const char *path)
+{
+    process_t *self = proc_current();
+    thread_t *thread = thread_current();
+    registers_t frame;
+    mm_t *old, *mm = mm_create();
+    if (!mm) return -1;
+    if (!load(mm, path, &frame)) {
+        mm_destroy(mm);
+        return -1;
+    }
+    uint32 flags = interrupts_save();
+    old = self->mm;
+    self->mm = thread->mm = mm;
+    mm_activate(mm);
+    interrupts_restore(flags);
+    mm_destroy(old);
+    set_name(self, path);
+    memory_copy(self->name, thread->name, THREAD_NAME_LEN);
+    *regs = frame;
+    return 0;
+}
+
+void proc_exit(int code)
+{
+    thread_t *thread = thread_current();
+    process_t *self = thread->proc, **link, *p;
+    mm_t *mm = thread->mm;
+
+    interrupts_disable();
+    thread->mm = 0;
+    thread->proc = 0;
+    mm_activate(0);
+    interrupts_enable();
+    mm_destroy(mm);
+
+    uint32 flags = spin_lock_irqsave(&proc_lock);
+    self->mm = 0;
+    self->thread = 0;
+    for (link = &procs; (p = *link);) {
+        if (p->parent != self) {
+            link = &p->next;
+            continue;
+        }
+        p->parent = 0;
+        p->detached = true;
+        if (p->zombie) {
+            *link = p->next;
+            kfree(p);
+        } else {
+            link = &p->next;
+        }
+    }
+    if (self->detached) {
+        proc_free(self);
+        spin_unlock_irqrestore(&proc_lock, flags);
+    } else {
+        self->exit_code = code;
+        __sync_synchronize();
+        self->zombie = true;                // the parent may free it from here on
+        spin_unlock_irqrestore(&proc_lock, flags);
+        wait_queue_wake_all(&exits);
+    }
+    thread_exit();
+}
+
+/* An exception the process caused and nothing fixed up kills it */
+void proc_fault(registers_t *regs)
+{
+    process_t *self = proc_current();
+    klog(KLOG_WARN, "%s[%u]: %s at 0x%08X, killed", self->name, self->pid,
+         regs->int_no < 32 ? exception_messages[regs->int_no] : "Unknown Interrupt", regs->eip);
+    proc_exit(PROC_KILLED + regs->int_no);
+}
+
+process_t *proc_current()
+{
+    thread_t *thread = thread_current();
+    return thread ? thread->proc : 0;
+}
@@ -0,0 +1,165 @@
+//sampling profiler
+
+#include "../include/profile.h"
+#include "../include/apic.h"
+#include "../include/clock.h"
+#include "../include/heap.h"
+#include "../include/isr.h"
+#include "../include/kprintf.h"
+#include "../include/ksyms.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * Each tick stores the interrupted eip in the cpu's own buffer, so
+ * recording takes no lock and shares no cache line. A full buffer
+ * counts drops instead of wrapping, to keep the start of a run; ticks
+ * that land in ring 3 are only counted. Nothing is resolved while
+ * sampling: perf top maps the eips to functions through the kernel's
+ * symbol table afterwards and counts hits per function.
+ *
+ * In timer mode every cpu runs its local APIC timer at PROFILE_HZ; as an
+ * ordinary interrupt it never fires with interrupts off, so cli regions
+ * are blamed on whatever runs right after them. In NMI mode only the
+ * starting cpu's timer runs, and each of its ticks sends an NMI to all
+ * the others, which is taken whatever they are doing. The starting cpu
+ * itself is still sampled by its timer tick, as in timer mode, so its
+ * cli regions are not seen: an NMI it sent itself would only land in
+ * the tick handler. NMIs that arrive when we did not ask for them are
+ * only counted.
+ */
+
+static volatile bool running;
+static bool nmi_mode;
+static bool handlers_set;
+static uint64 start_ns, stop_ns;
+static uint32 stray_nmis;
+
+static void record(registers_t *regs)
+{
+    cpu_t *cpu = this_cpu();
+    if (regs->cs & 3) cpu->prof_user++;
+    else if (cpu->prof_samples && cpu->prof_count < PROFILE_SAMPLES) cpu->prof_samples[cpu->prof_count++] = regs->eip;
+    else cpu->prof_dropped++;
+}
+
+static void tick(registers_t *regs)
+{
+    if (!running) return;
+    if (nmi_mode) lapic_send_nmi_others();
+    record(regs);
+}
+
+static void nmi_tick(registers_t *regs)
+{
+    if (running && nmi_mode) record(regs);
+    else stray_nmis++;
+}
+
+/* On the other cpus, when a run starts or stops */
+static void ipi(registers_t *regs)
+{
+    if (running && !nmi_mode) lapic_timer_start(PROFILE_TIMER, PROFILE_HZ);
+    else lapic_timer_stop();
+}
+
+bool profile_start(bool nmi)
+{
+    uint32 i, flags;
+    bool ok;
+    if (running || !apic_active()) return false;
+    for (i = 0; i < cpu_count(); i++) {
+        cpu_t *cpu = cpu_get(i);
+        if (!cpu->prof_samples) cpu->prof_samples = (uint32 *)kmalloc(PROFILE_SAMPLES * sizeof(uint32));
+        if (!cpu->prof_samples) return false;
+        cpu->prof_count = cpu->prof_user = cpu->prof_dropped = 0;
+    }
+    if (!handlers_set) {
+        isr_register_handler(PROFILE_TIMER, tick);
+        isr_register_handler(IPI_PROFILE, ipi);
+        isr_register_handler(2, nmi_tick);
+        handlers_set = true;
+    }
+
+    nmi_mode = nmi;
+    running = true;
+    start_ns = ktime_ns();
+    flags = interrupts_save();                  // stay on this cpu until the timer runs
+    ok = lapic_timer_start(PROFILE_TIMER, PROFILE_HZ);
+    interrupts_restore(flags);
+    if (!ok) {
+        running = false;
+        return false;
+    }
+    if (!nmi && cpu_count() > 1) lapic_send_ipi_others(IPI_PROFILE);
+    return true;
+}
+
+/* Stops every cpu's timer: we may have moved since the start */
+void profile_stop()
+{
+    uint32 flags;
+    if (!running) return;
+    running = false;
+    stop_ns = ktime_ns();
+    flags = interrupts_save();
+    lapic_timer_stop();
+    interrupts_restore(flags);
+    if (cpu_count() > 1) lapic_send_ipi_others(IPI_PROFILE);
+}
+
+bool profile_running()
+{
+    return running;
+}
+
+/* The n functions with the most samples, over all cpus */
+void profile_top(uint32 n)
+{
+    uint32 nsyms = ksym_count(), total = 0, user = 0, dropped = 0, unknown = 0, i, j;
+    uint32 *hits;
+    if (!nsyms) {
+        kprintf("\nNo symbol table in this kernel\n");
+        return;
+    }
+    hits = (uint32 *)kzalloc(nsyms * sizeof(uint32));
+    if (!hits) {
+        kprintf("\nOut of memory\n");
+        return;
+    }
+    for (i = 0; i < cpu_count(); i++) {
+        cpu_t *cpu = cpu_get(i);
+        uint32 count = cpu->prof_count;
+        if (!cpu->prof_samples) continue;
+        for (j = 0; j < count; j++) {
+            uint32 sym = ksym_index(cpu->prof_samples[j]);
+            if (sym == KSYM_NONE) unknown++;
+            else hits[sym]++;
+        }
+        total += count;
+        user += cpu->prof_user;
+        dropped += cpu->prof_dropped;
+    }
+
+    kprintf("\n%u kernel samples over %u ms (%s), %u in user space, %u dropped, %u stray NMIs",
+            total, (uint32)udiv64((running ? ktime_ns() : stop_ns) - start_ns, NSEC_PER_MSEC, 0), nmi_mode ? "nmi" : "timer",
+            user, dropped, stray_nmis);
+    if (!total) {
+        kprintf("\n");
+        kfree(hits);
+        return;
+    }
+    kprintf("\n   share  samples  function");
+    for (i = 0; i < n; i++) {
+        uint32 best = 0;
+        for (j = 1; j < nsyms; j++)
+            if (hits[j] > hits[best]) best = j;
+        if (!hits[best]) break;
+        kprintf("\n  %3u.%u%%  %7u  %s", hits[best] * 100 / total, hits[best] * 1000 / total % 10, hits[best], ksym_name(best));
+        hits[best] = 0;
+    }
+    if (unknown) kprintf("\n  %3u.%u%%  %7u  [outside the kernel's code]", unknown * 100 / total, unknown * 1000 / total % 10, unknown);
+    kprintf("\n");
+    kfree(hits);
+}
@@ -0,0 +1,418 @@
+//kernel threads and the scheduler
+
+#include "../include/sched.h"
+#include "../include/slab.h"
+#include "../include/paging.h"
+#include "../include/clock.h"
+#include "../include/idle.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/system.h"
+#include "../include/util.h"
+#include "../include/vm.h"
+
+/*
+ * Every cpu runs round robin over its own FIFO run queue under its own
+ * ticket lock: schedule() appends the outgoing thread at the tail and
+ * takes the head, both O(1), and cpus never contend unless one steals.
+ * Each cpu's boot context becomes its idle thread; it is never queued
+ * and only runs when the queue is empty. An idle cpu first steals a
+ * queued thread from a busy cpu and only then halts through cpu_idle().
+ *
+ * Preemption never switches from inside a handler. Slice timers and
+ * wakeups only set the cpu's need_resched (with an IPI if it is another
+ * cpu) and the interrupt exit path calls schedule(). A cpu's slice
+ * timer is only armed while another thread waits in its queue.
+ *
+ * A thread switched away from stays on_cpu until the next thread has
+ * left its stack (finish_switch), and stealers skip it until then, so
+ * no two cpus ever run on one stack. Threads that exit park on the
+ * zombie list and an idle thread reaps them once they are off the cpu.
+ * FPU registers are only saved for a thread that used them in its
+ * slice, see fpu.c.
+ *
+ * A thread with a user address space gets its page directory loaded and
+ * the TSS pointed at its kernel stack when it is switched to. Kernel
+ * threads run on the kernel's directory rather than keeping whichever
+ * one was loaded, so no cpu is left on an address space that has been
+ * freed.
+ */
+
+static kmem_cache_t *thread_cache;
+static spinlock_t threads_lock = SPINLOCK_INIT;     // all_threads, zombies, next_id
+static thread_t *zombies;
+static thread_t *all_threads;
+static uint32 next_id;
+
+static void rq_push(cpu_t *cpu, thread_t *thread)
+{
+    thread->next = 0;
+    if (cpu->run_tail) cpu->run_tail->next = thread;
+    else cpu->run_head = thread;
+    cpu->run_tail = thread;
+    cpu->nr_running++;
+}
+
+static thread_t *rq_pop(cpu_t *cpu)
+{
+    thread_t *thread = cpu->run_head;
+    if (thread) {
+        cpu->run_head = thread->next;
+        if (!cpu->run_head) cpu->run_tail = 0;
+        cpu->nr_running--;
+    }
+    return thread;
+}
+
+/* Unlinks the first queued thread that is unpinned and fully off its old cpu */
+static thread_t *rq_take_stealable(cpu_t *cpu)
+{
+    thread_t *prev = 0, *thread = cpu->run_head;
+    while (thread && (thread->on_cpu || thread->pinned)) {
+        prev = thread;
+        thread = thread->next;
+    }
+    if (!thread) return 0;
+    if (prev) prev->next = thread->next;
+    else cpu->run_head = thread->next;
+    if (cpu->run_tail == thread) cpu->run_tail = prev;
+    cpu->nr_running--;
+    return thread;
+}
+
+static void slice_expired(void *arg)
+{
+    smp_send_reschedule((cpu_t *)arg);
+}
+
+static void sleep_expired(void *arg)
+{
+    thread_wakeup((thread_t *)arg);
+}
+
+static void set_name(thread_t *thread, const char *name)
+{
+    uint32 i;
+    for (i = 0; i < THREAD_NAME_LEN - 1 && name[i]; i++) thread->name[i] = name[i];
+    thread->name[i] = 0;
+}
+
+static void track_thread(thread_t *thread)
+{
+    uint32 flags = spin_lock_irqsave(&threads_lock);
+    thread->id = next_id++;
+    thread->all_next = all_threads;
+    all_threads = thread;
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+/* Turns the calling cpu's boot context into its idle thread */
+void sched_init_cpu()
+{
+    cpu_t *cpu = this_cpu();
+    thread_t *idle = (thread_t *)kmem_cache_alloc(thread_cache);
+    memory_set((uint8 *)idle, 0, sizeof(thread_t));
+    set_name(idle, "idle");
+    idle->state = THREAD_RUNNING;
+    idle->cpu = cpu;
+    idle->on_cpu = true;
+    idle->switched_in = ktime_ns();
+    timer_setup(&idle->sleep_timer, sleep_expired, idle);
+    spin_init(&cpu->rq_lock);
+    timer_setup(&cpu->slice_timer, slice_expired, cpu);
+    track_thread(idle);
+    cpu->idle = idle;
+    cpu->current = idle;
+}
+
+void sched_init()
+{
+    thread_cache = kmem_cache_create("thread", sizeof(thread_t), 0);
+    sched_init_cpu();
+}
+
+/* Runs on the new thread's stack right after a switch: the previous
+   thread is finally off its stack and may run elsewhere */
+static void finish_switch()
+{
+    cpu_t *cpu = this_cpu();
+    __sync_synchronize();
+    cpu->prev->on_cpu = false;
+    cpu->prev = 0;
+}
+
+/* First code a new thread runs, entered from switch_context's ret */
+static void thread_start()
+{
+    finish_switch();
+    interrupts_enable();
+    thread_t *self = thread_current();
+    self->fn(self->arg);
+    thread_exit();
+}
+
+static thread_t *create(cpu_t *cpu, bool pinned, const char *name, thread_fn_t fn, void *arg)
+{
+    thread_t *thread = (thread_t *)kmem_cache_alloc(thread_cache);
+    if (!thread) return 0;
+    uint32 stack = pmm_alloc_frames(THREAD_STACK_ORDER);
+    if (stack == PMM_NO_FRAME) {
+        kmem_cache_free(thread_cache, thread);
+        return 0;
+    }
+    memory_set((uint8 *)thread, 0, sizeof(thread_t));
+    thread->stack = (uint8 *)PHYS_TO_VIRT(stack);
+    thread->fn = fn;
+    thread->arg = arg;
+    thread->cpu = cpu;
+    thread->pinned = pinned;
+    set_name(thread, name);
+    timer_setup(&thread->sleep_timer, sleep_expired, thread);
+
+    /* What switch_context pops: edi, esi, ebx, ebp, then returns into thread_start */
+    uint32 *sp = (uint32 *)(thread->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // thread_start never returns
+    *--sp = (uint32)thread_start;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    thread->esp = (uint32)sp;
+
+    track_thread(thread);
+    thread->state = THREAD_BLOCKED;
+    thread_wakeup(thread);
+    return thread;
+}
+
+/* Starts on the calling cpu; idle cpus may steal it from there */
+thread_t *thread_create(const char *name, thread_fn_t fn, void *arg)
+{
+    return create(this_cpu(), false, name, fn, arg);
+}
+
+/* For per-cpu threads: runs on cpu only */
+thread_t *thread_create_on(cpu_t *cpu, const char *name, thread_fn_t fn, void *arg)
+{
+    return create(cpu, true, name, fn, arg);
+}
+
+void schedule()
+{
+    uint32 flags = interrupts_save();
+    cpu_t *cpu = this_cpu();
+    if (!cpu->current) {
+        interrupts_restore(flags);
+        return;
+    }
+    spin_lock(&cpu->rq_lock);
+    cpu->need_resched = false;
+    thread_t *prev = cpu->current;
+    if (prev->state == THREAD_RUNNING && prev != cpu->idle) {
+        prev->state = THREAD_READY;
+        rq_push(cpu, prev);
+    }
+    thread_t *next = rq_pop(cpu);
+    if (!next) next = cpu->idle;
+
+    if (cpu->run_head && next != cpu->idle) timer_add_ms(&cpu->slice_timer, SCHED_SLICE_MS);
+    else if (timer_pending(&cpu->slice_timer)) timer_cancel(&cpu->slice_timer);
+
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        spin_unlock(&cpu->rq_lock);
+        interrupts_restore(flags);
+        return;
+    }
+    if (prev->state == THREAD_RUNNING) prev->state = THREAD_READY;     // the idle thread
+    uint64 now = ktime_ns();
+    prev->runtime_ns += now - prev->switched_in;
+    next->switched_in = now;
+    next->switches++;
+    next->state = THREAD_RUNNING;
+    next->on_cpu = true;
+    next->cpu = cpu;
+    cpu->switches++;
+    cpu->current = next;
+    cpu->prev = prev;
+    spin_unlock(&cpu->rq_lock);
+
+    fpu_switch_out(prev);
+    if (next->mm) gdt_set_kernel_stack(cpu->id, (uint32)next->stack + THREAD_STACK_SIZE);
+    mm_activate(next->mm);
+    switch_context(&prev->esp, next->esp);
+    finish_switch();                    // possibly on another cpu by now
+    interrupts_restore(flags);
+}
+
+/* Gets a cpu to look at its queue: wake it if idle, otherwise an idle
+   cpu to steal the work, otherwise start slicing */
+static void kick(cpu_t *cpu)
+{
+    uint32 i;
+    __sync_synchronize();               // queue push before the idling reads
+    if (cpu->current == cpu->idle) {
+        smp_send_reschedule(cpu);
+        return;
+    }
+    for (i = 0; i < cpu_count(); i++) {
+        cpu_t *other = cpu_get(i);
+        if (other != cpu && other->online && other->idling) {
+            smp_send_reschedule(other);
+            return;
+        }
+    }
+    if (!timer_pending(&cpu->slice_timer)) timer_add_ms(&cpu->slice_timer, SCHED_SLICE_MS);
+}
+
+/* Makes a blocked thread runnable on the cpu it last ran on; safe from
+   interrupt handlers and from any cpu */
+void thread_wakeup(thread_t *thread)
+{
+    cpu_t *cpu = thread->cpu;
+    bool queued = false;
+    uint32 flags = spin_lock_irqsave(&cpu->rq_lock);
+    if (thread->state == THREAD_BLOCKED) {
+        thread->state = THREAD_READY;
+        rq_push(cpu, thread);
+        queued = true;
+    }
+    spin_unlock_irqrestore(&cpu->rq_lock, flags);
+    if (queued) kick(cpu);
+}
+
+void thread_yield()
+{
+    schedule();
+}
+
+void thread_sleep_ms(uint32 ms)
+{
+    uint32 flags = interrupts_save();
+    thread_t *self = thread_current();
+    self->state = THREAD_BLOCKED;
+    timer_add_ms(&self->sleep_timer, ms);
+    schedule();
+    interrupts_restore(flags);
+}
+
+void thread_exit()
+{
+    interrupts_disable();
+    thread_t *self = thread_current();
+    timer_cancel(&self->sleep_timer);
+    spin_lock(&threads_lock);
+    self->state = THREAD_DEAD;
+    self->next = zombies;
+    zombies = self;
+    spin_unlock(&threads_lock);
+    schedule();
+    for (;;);                           // never scheduled again
+}
+
+/* Call with wq->lock held and interrupts off (spin_lock_irqsave), after
+   checking the condition under it; returns with the lock held again. A
+   waker takes the same lock, so no wakeup is lost in between. */
+void wait_queue_sleep(wait_queue_t *wq)
+{
+    thread_t *self = thread_current();
+    self->state = THREAD_BLOCKED;
+    self->next = 0;
+    if (wq->tail) wq->tail->next = self;
+    else wq->head = self;
+    wq->tail = self;
+    spin_unlock(&wq->lock);
+    schedule();
+    spin_lock(&wq->lock);
+}
+
+void wait_queue_wake_all(wait_queue_t *wq)
+{
+    uint32 flags = spin_lock_irqsave(&wq->lock);
+    thread_t *thread = wq->head;
+    wq->head = wq->tail = 0;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    while (thread) {
+        thread_t *next = thread->next;
+        thread_wakeup(thread);
+        thread = next;
+    }
+}
+
+static void reap_zombies()
+{
+    thread_t **z, *dead;
+    spin_lock(&threads_lock);
+    z = &zombies;
+    while ((dead = *z)) {
+        if (dead->on_cpu) {             // still leaving its stack
+            z = &dead->next;
+            continue;
+        }
+        thread_t **link = &all_threads;
+        *z = dead->next;
+        while (*link != dead) link = &(*link)->all_next;
+        *link = dead->all_next;
+        pmm_free_frames(VIRT_TO_PHYS(dead->stack), THREAD_STACK_ORDER);
+        kmem_cache_free(thread_cache, dead);
+    }
+    spin_unlock(&threads_lock);
+}
+
+/* Moves one waiting thread from the busiest other cpu onto this one */
+static bool steal_work(cpu_t *cpu)
+{
+    cpu_t *victim = 0;
+    uint32 i, best = 0;
+    for (i = 0; i < cpu_count(); i++) {
+        cpu_t *other = cpu_get(i);
+        if (other != cpu && other->nr_running > best) {
+            best = other->nr_running;
+            victim = other;
+        }
+    }
+    if (!victim) return false;
+
+    spin_lock(&victim->rq_lock);
+    thread_t *thread = rq_take_stealable(victim);
+    spin_unlock(&victim->rq_lock);
+    if (!thread) return false;
+
+    spin_lock(&cpu->rq_lock);
+    thread->cpu = cpu;
+    rq_push(cpu, thread);
+    cpu->steals++;
+    spin_unlock(&cpu->rq_lock);
+    return true;
+}
+
+/* What every cpu's boot context turns into once it is up */
+void sched_idle_loop()
+{
+    cpu_t *cpu = this_cpu();
+    for (;;) {
+        interrupts_disable();
+        cpu->idling = true;
+        __sync_synchronize();           // pairs with kick()
+        reap_zombies();
+        if (!cpu->nr_running && !steal_work(cpu)) cpu_idle();
+        else interrupts_enable();
+        cpu->idling = false;
+        schedule();
+    }
+}
+
+bool sched_need_resched()
+{
+    return this_cpu()->need_resched;
+}
+
+thread_t *thread_current()
+{
+    return this_cpu()->current;
+}
+
+thread_t *thread_first()
+{
+    return all_threads;
+}
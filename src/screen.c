@@ -1,46 +1,167 @@
 #include "../include/screen.h"
+#include "../include/paging.h"
+#include "../include/spinlock.h"
+#include "../include/fbcon.h"
+#include "../include/serial.h"
 int cursorX = 0, cursorY = 0;
 const uint8 sw = 80,sh = 25,sd = 2; 
 int color = 0x0F;
+
+/*
+ * Output writes whole cells (character and attribute in one 16 bit store)
+ * straight into VGA memory and never touches the CRTC. Every port write
+ * is a VM exit under a hypervisor, so the hardware cursor is only moved
+ * by updateCursor() when its position actually changed, and the console
+ * calls it lazily: once before the keyboard waits for input, or from
+ * clearScreen(). One lock per print call keeps cpus from interleaving.
+ *
+ * Scrolling moves the CRTC start address instead of the text: the screen
+ * is a window of rows into a ring that fills most of the 32 KiB of text
+ * memory, and a scroll only advances the window and blanks one row. When
+ * the window reaches the end of the ring the visible rows are copied back
+ * to its start in one go. The new start address is sent once per print
+ * call. Lines leaving the top are kept in an in-memory scrollback that
+ * Shift+PgUp/PgDn page through on a spare page past the ring.
+ *
+ * Once screen_attach_framebuffer() ran, cells go to fbcon instead and the
+ * console takes the framebuffer's size in cells. fbcon scrolls its own
+ * back buffer, is flushed where the text console would send the start
+ * address, and draws the cursor when updateCursor() moves it. There is no
+ * scrollback on the framebuffer.
+ *
+ * After screen_attach_serial() every print is echoed to the serial port
+ * once the console lock is dropped, so a writer that has to wait for the
+ * port does not hold up the screen. print_local() skips the echo, for
+ * text the port gets by another way.
+ */
+#define TEXT_COLS         80                                                          // sw
+#define TEXT_ROWS         25                                                          // sh
+#define VGA_ROWS          (16384 / TEXT_COLS)                                         // 32 KiB of cells
+#define VIEW_ROW          (VGA_ROWS - TEXT_ROWS)                                      // scrollback page
+#define RING_ROWS         VIEW_ROW
+#define SCROLLBACK_LINES  512
+
+static uint16 *const vga = (uint16 *)PHYS_TO_VIRT(0xb8000);
+static int hw_cursor = -1;                                                              // position the CRTC last got
+static int hw_start = -1;
+static uint32 top_row;                                                                  // ring row shown as screen row 0
+static uint16 history[SCROLLBACK_LINES][TEXT_COLS];
+static uint32 history_head, history_count;
+static uint32 view_back;                                                                // lines paged back, 0 is live
+static spinlock_t console_lock = SPINLOCK_INIT;
+static bool fb;
+static uint32 cols = TEXT_COLS, rows = TEXT_ROWS;
+static bool echo;
+
+static uint16 *row(uint32 y)
+{
+        return vga + (top_row + y) * TEXT_COLS;
+}
+
+static void copy_cells(uint16 *dest, const uint16 *src, uint32 cells)
+{
+        uint32 *d = (uint32 *)dest;
+        const uint32 *s = (const uint32 *)src;
+        cells /= 2;
+        while(cells--) *d++ = *s++;
+}
+
+static void setCell(uint32 x, uint32 y, uint16 cell)
+{
+        if(fb) fbcon_putcell(x, y, cell);
+        else row(y)[x] = cell;
+}
+
 void clearLine(uint8 from,uint8 to)
 {
-        uint16 i = sw * from * sd;
-        string vidmem=(string)0xb8000;
-        for(i;i<(sw*to*sd);i++)
+        uint16 i;
+        uint16 blank = color << 8;
+        for(;from < to;from++)
         {
-                vidmem[(i / 2)*2 + 1 ] = color ;
-                vidmem[(i / 2)*2 ] = 0;
+                for(i = 0;i < cols;i++) setCell(i, from, blank);
         }
 }
+
+static void setStart(uint32 start)
+{
+        if(start == hw_start) return;
+        outportb(0x3D4, 0x0C);                                                          // CRT Control Register: Start Address High
+        outportb(0x3D5, start >> 8);
+        outportb(0x3D4, 0x0D);                                                          // Start Address Low
+        outportb(0x3D5, start);
+        hw_start = start;
+}
+
+/* Shows what was written: the start address, or a framebuffer flush */
+static void syncScreen()
+{
+        if(fb) fbcon_flush();
+        else if(!view_back) setStart(top_row * TEXT_COLS);
+}
+
 void updateCursor()
 {
     unsigned temp;
 
-    temp = cursorY * sw + cursorX-1;                                                      // Position = (y * width) +  x
+    if(fb)
+    {
+        temp = cursorY * cols + cursorX-1;
+        fbcon_cursor(temp % cols, temp / cols);                                           // cursorX 0 wraps back, as on VGA
+        fbcon_flush();
+        return;
+    }
+    syncScreen();
+    temp = (top_row + cursorY) * sw + cursorX-1;                                          // Position = (y * width) +  x
+    if(temp == hw_cursor) return;
 
-    outportb(0x3D4, 14);                                                                // CRT Control Register: Select Cursor Location
-    outportb(0x3D5, temp >> 8);                                                         // Send the high byte across the bus
+    if((temp >> 8) != ((unsigned)hw_cursor >> 8) || hw_cursor < 0)
+    {
+        outportb(0x3D4, 14);                                                            // CRT Control Register: Select Cursor Location
+        outportb(0x3D5, temp >> 8);                                                     // Send the high byte across the bus
+    }
     outportb(0x3D4, 15);                                                                // CRT Control Register: Select Send Low byte
     outportb(0x3D5, temp);                                                              // Send the Low byte of the cursor location
+    hw_cursor = temp;
 }
 void clearScreen()
 {
-        clearLine(0,sh-1);
+        uint32 flags = spin_lock_irqsave(&console_lock);
+        top_row = 0;
+        view_back = 0;
+        clearLine(0,rows-1);
         cursorX = 0;
         cursorY = 0;
         updateCursor();
+        spin_unlock_irqrestore(&console_lock, flags);
 }
 
-void scrollUp(uint8 lineNumber)
+static void scrollOne()
 {
-        string vidmem = (string)0xb8000;
-        uint16 i = 0;
-        clearLine(0,lineNumber-1);                                            //updated
-        for (i;i<sw*(sh-1)*2;i++)
+        if(fb)
+        {
+                fbcon_scroll(color << 8);
+                return;
+        }
+        copy_cells(history[history_head], row(0), TEXT_COLS);
+        history_head = (history_head + 1) % SCROLLBACK_LINES;
+        if(history_count < SCROLLBACK_LINES) history_count++;
+
+        if(top_row + sh >= RING_ROWS)
+        {
+                copy_cells(vga, row(1), (sh - 1) * TEXT_COLS);                        // wrap: the one bulk copy
+                top_row = 0;
+        }
+        else
         {
-                vidmem[i] = vidmem[i+sw*2*lineNumber];
+                top_row++;
         }
-        clearLine(sh-1-lineNumber,sh-1);
+        clearLine(sh-1,sh);
+}
+
+void scrollUp(uint8 lineNumber)
+{
+        uint8 i;
+        for(i = 0;i < lineNumber;i++) scrollOne();
         if((cursorY - lineNumber) < 0 ) 
         {
                 cursorY = 0;
@@ -50,28 +171,67 @@ void scrollUp(uint8 lineNumber)
         {
                 cursorY -= lineNumber;
         }
-        updateCursor();
+}
+
+/* Draws the scrollback window view_back lines above the live screen */
+static void drawView()
+{
+        uint32 i;
+        for(i = 0;i < TEXT_ROWS;i++)
+        {
+                uint16 *dest = vga + (VIEW_ROW + i) * TEXT_COLS;
+                uint32 line = history_count + i - view_back;                          // history first, then the live rows
+                if(line < history_count)
+                        copy_cells(dest, history[(history_head + SCROLLBACK_LINES - history_count + line) % SCROLLBACK_LINES], TEXT_COLS);
+                else
+                        copy_cells(dest, row(line - history_count), TEXT_COLS);
+        }
+        setStart(VIEW_ROW * TEXT_COLS);
+}
+
+/* Pages the display back (lines > 0) or forward through the scrollback */
+void scrollView(int lines)
+{
+        uint32 flags = spin_lock_irqsave(&console_lock);
+        if(fb)
+        {
+                spin_unlock_irqrestore(&console_lock, flags);
+                return;
+        }
+        int back = (int)view_back + lines;
+        if(back < 0) back = 0;
+        if(back > (int)history_count) back = history_count;
+        view_back = back;
+        if(view_back) drawView();
+        else syncScreen();
+        spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/* Back to the live screen, if paged back */
+void scrollViewLive()
+{
+        if(view_back) scrollView(-(int)view_back);
 }
 
 
 void newLineCheck()
 {
-        if(cursorY >=sh-1)
+        if(cursorY >=rows-1)
         {
                 scrollUp(1);
         }
 }
 
-void printch(char c)
+/* One character, no locking and no CRTC access */
+static void put(char c)
 {
-    string vidmem = (string) 0xb8000;     
     switch(c)
     {
         case (0x08):
                 if(cursorX > 0) 
                 {
 	                cursorX--;									
-                        vidmem[(cursorY * sw + cursorX)*sd]=0;	     //(0xF0 & color)                          
+                        setCell(cursorX, cursorY, color << 8);
 	        }
 	        break;
         case (0x09):
@@ -85,33 +245,51 @@ void printch(char c)
                 cursorY++;
                 break;
         default:
-                vidmem [((cursorY * sw + cursorX))*sd] = c;
-                vidmem [((cursorY * sw + cursorX))*sd+1] = color;
+                setCell(cursorX, cursorY, (uint8)c | (color << 8));
                 cursorX++; 
                 break;
 	
     }
-    if(cursorX >= sw)                                                                   
+    if(cursorX >= cols)                                                                   
     {
         cursorX = 0;                                                                
         cursorY++;                                                                    
     }
-    updateCursor();
     newLineCheck();
 }
 
-void print (string ch)
-{       
-        ch[-1] = "\n";
-        uint16 i = 0;
-        uint8 length = strlength(ch);  
-                 
-        for(i;i<length;i++)
+void printch(char c)
+{
+    uint32 flags = spin_lock_irqsave(&console_lock);
+    put(c);
+    syncScreen();
+    spin_unlock_irqrestore(&console_lock, flags);
+    if(echo) serial_write(&c, 1);
+}
+
+/* Moves the hardware cursor to where output stopped, if it moved */
+void syncCursor()
+{
+    uint32 flags = spin_lock_irqsave(&console_lock);
+    updateCursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void print_local (string ch)
+{
+        uint32 flags = spin_lock_irqsave(&console_lock);
+        while(*ch)
         {
-                printch(ch[i]);
+                put(*ch++);
         }
+        syncScreen();
+        spin_unlock_irqrestore(&console_lock, flags);
+}
 
-        
+void print (string ch)
+{       
+        print_local(ch);
+        if(echo) serial_write(ch, strlen(ch));
 }
 void printl (string ch)
 {       
@@ -131,8 +309,47 @@ void set_screen_color_from_color_code(int color_code)
 }
 void print_colored(string ch,int text_color,int bg_color)
 {
+	uint32 flags = spin_lock_irqsave(&console_lock);
+	string start = ch;
 	int current_color = color;
 	set_screen_color(text_color,bg_color);
-	print(ch);
+	while(*ch)
+	{
+		put(*ch++);
+	}
 	set_screen_color_from_color_code(current_color);
+	syncScreen();
+	spin_unlock_irqrestore(&console_lock, flags);
+	if(echo) serial_write(start, strlen(start));
+}
+
+/* Moves the console onto fbcon, carrying over what is on the text screen */
+void screen_attach_framebuffer()
+{
+        uint32 flags = spin_lock_irqsave(&console_lock);
+        uint32 x, y;
+        for(y = 0;y < TEXT_ROWS && y < fbcon_rows();y++)
+                for(x = 0;x < TEXT_COLS && x < fbcon_cols();x++)
+                        fbcon_putcell(x, y, row(y)[x]);
+        fb = true;
+        cols = fbcon_cols();
+        rows = fbcon_rows();
+        view_back = 0;
+        if(cursorY >= rows) cursorY = rows - 1;
+        updateCursor();
+        spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/* Echoes console output to the serial port from now on */
+void screen_attach_serial()
+{
+        echo = true;
+}
+
+/* Turns the serial echo off or back on, returns what it was */
+bool screen_set_echo(bool on)
+{
+        bool was = echo;
+        echo = on && serial_active();
+        return was;
 }
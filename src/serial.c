@@ -0,0 +1,225 @@
+//16550 serial port driver
+
+#include "../include/serial.h"
+#include "../include/isr.h"
+#include "../include/kb.h"
+#include "../include/klog.h"
+#include "../include/sched.h"
+#include "../include/screen.h"
+#include "../include/spinlock.h"
+#include "../include/system.h"
+
+/*
+ * COM1 runs at SERIAL_BAUD, 8N1, with both 16 byte FIFOs on. Nothing
+ * here waits on the line status register: writers copy into a ring and
+ * the transmitter-empty interrupt refills the FIFO from it, a FIFO load
+ * at a time. Only a writer that finds the transmitter idle loads the
+ * FIFO itself. The idle transmitter is the one case that raises no
+ * interrupt, and then the holding register is known to be empty.
+ *
+ * A writer facing a full ring sleeps until the interrupt has made room,
+ * if it came in with interrupts on. Otherwise it is an interrupt handler
+ * or holds a lock, and the bytes that do not fit are dropped and
+ * counted. Everything else is buffered, so a log burst costs the CPU
+ * the copy into the ring.
+ *
+ * Received characters are handed to the keyboard driver's input, so the
+ * shell reads the serial line and the keyboard alike. Once the port is
+ * up the console echoes to it and it becomes a log sink for every level,
+ * replaying the boot log. Together that is enough to drive the shell
+ * from a script under "make run-headless".
+ */
+
+#define UART_DATA       0                   // RBR / THR, DLL with DLAB
+#define UART_IER        1                   // DLM with DLAB
+#define UART_IIR        2                   // FCR on write
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_MSR        6
+#define UART_SCRATCH    7
+
+#define IER_RX          0x01
+#define IER_THRE        0x02
+#define IER_LINE        0x04
+#define IIR_NONE        0x01
+#define IIR_ID          0x0E
+#define IIR_LINE        0x06
+#define IIR_RX          0x04
+#define IIR_RX_TIMEOUT  0x0C
+#define IIR_THRE        0x02
+#define IIR_FIFO        0xC0                // both set on a working 16550A
+#define FCR_ENABLE      0x07                // enable, clear RX and TX
+#define FCR_TRIGGER_14  0xC0                // RX interrupt at 14 bytes, or on timeout
+#define LCR_8N1         0x03
+#define LCR_DLAB        0x80
+#define MCR_NORMAL      0x0B                // DTR, RTS, OUT2 (gates the IRQ line)
+#define MCR_LOOPBACK    0x1E
+#define LSR_DATA        0x01
+#define LSR_ERRORS      0x0E
+#define UART_CLOCK      115200
+#define UART_FIFO       16
+
+static bool active;
+static uint16 port = SERIAL_COM1;
+static spinlock_t uart_lock = SPINLOCK_INIT;
+static char tx_ring[SERIAL_TX_RING];
+static volatile uint32 tx_head;             // advanced by writers under uart_lock
+static volatile uint32 tx_tail;             // advanced as bytes enter the FIFO
+static bool tx_busy;                        // a transmitter-empty interrupt is on its way
+static volatile uint32 tx_sleepers;
+static wait_queue_t tx_waiters;
+static serial_stats_t stats;
+
+static klog_sink_t serial_sink = { "serial", serial_write, KLOG_DEBUG, 0, 0, 0 };
+
+static uint32 tx_space()
+{
+    return SERIAL_TX_RING - (tx_head - tx_tail);
+}
+
+/* Caller holds uart_lock and knows the holding register is empty */
+static void fill_fifo()
+{
+    uint32 n = tx_head - tx_tail;
+    if (n > stats.fifo) n = stats.fifo;
+    stats.tx_bytes += n;
+    for (; n; n--, tx_tail++)
+        outportb(port + UART_DATA, tx_ring[tx_tail & (SERIAL_TX_RING - 1)]);
+}
+
+/* Caller holds uart_lock */
+static void kick()
+{
+    if (tx_busy || tx_head == tx_tail) return;
+    fill_fifo();
+    tx_busy = true;
+    stats.tx_kicks++;
+}
+
+static void receive()
+{
+    uint8 lsr;
+    while ((lsr = inportb(port + UART_LSR)) & LSR_DATA) {
+        char c = inportb(port + UART_DATA);
+        if (lsr & LSR_ERRORS) stats.rx_errors++;
+        if (c == '\r') c = '\n';            // terminals send CR for Enter, DEL for backspace
+        else if (c == 0x7F) c = '\b';
+        stats.rx_bytes++;
+        kb_input(c);
+    }
+}
+
+static void serial_irq(registers_t *regs)
+{
+    uint8 iir;
+    spin_lock(&uart_lock);
+    stats.irqs++;
+    while (!((iir = inportb(port + UART_IIR)) & IIR_NONE)) {
+        switch (iir & IIR_ID) {
+        case IIR_LINE:
+            inportb(port + UART_LSR);
+            stats.rx_errors++;
+            break;
+        case IIR_RX:
+        case IIR_RX_TIMEOUT:
+            receive();
+            break;
+        case IIR_THRE:
+            if (tx_head == tx_tail) tx_busy = false;
+            else fill_fifo();
+            break;
+        default:
+            inportb(port + UART_MSR);
+            break;
+        }
+    }
+    spin_unlock(&uart_lock);
+    __sync_synchronize();                   // tx_tail out before tx_sleepers is read
+    if (tx_sleepers) wait_queue_wake_all(&tx_waiters);
+}
+
+/* Sleeps until the ring has room for n bytes; the IRQ wakes us under the
+   wait queue lock, which is held from the check to going to sleep. */
+static void wait_for_space(uint32 n)
+{
+    uint32 flags = spin_lock_irqsave(&tx_waiters.lock);
+    __sync_fetch_and_add(&tx_sleepers, 1);
+    stats.tx_waits++;
+    while (tx_space() < n) wait_queue_sleep(&tx_waiters);
+    __sync_fetch_and_sub(&tx_sleepers, 1);
+    spin_unlock_irqrestore(&tx_waiters.lock, flags);
+}
+
+void serial_write(const char *s, uint32 len)
+{
+    if (!active) return;
+    uint32 flags = spin_lock_irqsave(&uart_lock);
+    bool can_sleep = flags & EFLAGS_IF;
+    while (len) {
+        const char *bytes = *s == '\n' ? "\r\n" : *s == '\b' ? "\b \b" : s;
+        uint32 n = *s == '\n' ? 2 : *s == '\b' ? 3 : 1;
+        if (tx_space() < n) {
+            kick();
+            if (can_sleep) {
+                spin_unlock_irqrestore(&uart_lock, flags);
+                wait_for_space(n);
+                flags = spin_lock_irqsave(&uart_lock);
+                continue;
+            }
+            stats.tx_dropped += n;
+        } else {
+            for (; n; n--) tx_ring[tx_head++ & (SERIAL_TX_RING - 1)] = *bytes++;
+        }
+        s++;
+        len--;
+    }
+    kick();
+    spin_unlock_irqrestore(&uart_lock, flags);
+}
+
+/* The scratch register and a loopback byte tell a UART from an empty port */
+static bool probe()
+{
+    uint32 spins;
+    outportb(port + UART_SCRATCH, 0x5A);
+    if (inportb(port + UART_SCRATCH) != 0x5A) return false;
+    outportb(port + UART_MCR, MCR_LOOPBACK);
+    outportb(port + UART_DATA, 0xAE);
+    for (spins = 0; spins < 100000 && !(inportb(port + UART_LSR) & LSR_DATA); spins++) cpu_relax();
+    return spins < 100000 && inportb(port + UART_DATA) == 0xAE;
+}
+
+bool serial_init()
+{
+    uint32 divisor = UART_CLOCK / SERIAL_BAUD;
+    outportb(port + UART_IER, 0);
+    outportb(port + UART_LCR, LCR_DLAB);
+    outportb(port + UART_DATA, divisor & 0xFF);
+    outportb(port + UART_IER, divisor >> 8);
+    outportb(port + UART_LCR, LCR_8N1);
+    outportb(port + UART_IIR, FCR_ENABLE | FCR_TRIGGER_14);
+    stats.fifo = (inportb(port + UART_IIR) & IIR_FIFO) == IIR_FIFO ? UART_FIFO : 1;
+    if (!probe()) return false;
+
+    outportb(port + UART_MCR, MCR_NORMAL);
+    while (inportb(port + UART_LSR) & LSR_DATA) inportb(port + UART_DATA);
+    irq_register_handler(SERIAL_IRQ, serial_irq);
+    outportb(port + UART_IER, IER_RX | IER_THRE | IER_LINE);
+    active = true;
+
+    screen_attach_serial();
+    klog_register_sink(&serial_sink);
+    klog(KLOG_INFO, "serial: 16550 at 0x%03X, %u baud, %u byte fifo", port, SERIAL_BAUD, stats.fifo);
+    return true;
+}
+
+bool serial_active()
+{
+    return active;
+}
+
+const serial_stats_t *serial_stats()
+{
+    return &stats;
+}
@@ -1,4 +1,33 @@
 #include "../include/shell.h"
+#include "../include/heap.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/isr.h"
+#include "../include/clock.h"
+#include "../include/timer.h"
+#include "../include/idle.h"
+#include "../include/sched.h"
+#include "../include/workqueue.h"
+#include "../include/fbcon.h"
+#include "../include/memory.h"
+#include "../include/kprintf.h"
+#include "../include/klog.h"
+#include "../include/serial.h"
+#include "../include/bootprof.h"
+#include "../include/bench.h"
+#include "../include/spinlock.h"
+#include "../include/initrd.h"
+#include "../include/ata.h"
+#include "../include/bcache.h"
+#include "../include/blk.h"
+#include "../include/proc.h"
+#include "../include/vm.h"
+#include "../include/syscall.h"
+#include "../include/profile.h"
+#include "../include/pci.h"
+#include "../include/virtio.h"
+#include "../include/net.h"
+#include "../include/pmu.h"
 	string kernel = (string )"Alder";
 	string errorcode = (string) "0xFFFFFF";
 	string countinue = (string) "yes";
@@ -6,41 +35,652 @@
 	int counter = 0;
 	int critical = 0;
 	int loggedin = 0;
+
+/*
+ * Commands live in a fixed table and are found through a hash of their
+ * name, so dispatch costs one hash and a short chain walk however many
+ * commands there are. Entries are never removed, and a new one is only
+ * linked into its chain once it is filled in, so lookups take no lock.
+ */
+static shell_command_t commands[SHELL_MAX_COMMANDS];
+static shell_command_t *buckets[SHELL_HASH_BUCKETS];
+static uint32 ncommands;
+static spinlock_t commands_lock = SPINLOCK_INIT;
+static int depth;
 	
-void launch_shell(int n)
+void meminfo(int argc, char **argv)
 {
-	int counter = 0;
-	string ch = (string) malloc(200); // util.h
-	if(countinue == "no"){return;}
-	do
+	const heap_stats_t *hs = heap_stats();
+	kprintf("\nFrames free: %u of %u (4 KiB)", pmm_free_frames_count(), pmm_total_frames());
+	kprintf("\nHeap in use: %u bytes, backed by %u bytes", hs->bytes_in_use, hs->bytes_allocated);
+	kprintf("\nHeap free lists: %u bytes, arena %u bytes", hs->bytes_free_listed, hs->arena_bytes);
+	kprintf("\nLarge blocks: %u bytes", hs->large_bytes);
+	if(hs->bytes_allocated)
+		kprintf("\nInternal fragmentation: %u%%", (hs->bytes_allocated - hs->bytes_in_use) * 100 / hs->bytes_allocated);
+	kprintf("\nAllocations: %u, frees: %u", hs->allocs, hs->frees);
+	kprintf("\nBulk copy: %s\n", memory_variant());
+}
+
+void slabinfo(int argc, char **argv)
+{
+	kmem_cache_t *cache = kmem_cache_first();
+	kprintf("\n%-16s%8s%8s%6s%7s%6s", "name", "active", "total", "size", "slabs", "hit%");
+	while(cache)
+	{
+		kprintf("\n%-16s%8u%8u%6u%7u%6u", cache->name, cache->active_objects, cache->total_objects,
+			cache->object_size, cache->slabs, cache->allocs ? cache->hits * 100 / cache->allocs : 0);
+		cache = cache->next_cache;
+	}
+	kprintf("\n");
+}
+
+void irqstat(int argc, char **argv)
 {
-			if(countinue == "no"){return;}
+	int irq;
+	kprintf("\n%3s%12s", "IRQ", "count");
+	for(irq = 0;irq < IRQ_COUNT;irq++)
+	{
+		if(!irq_count(irq)) continue;
+		kprintf("\n%3d%12u", irq, irq_count(irq));
+	}
+	kprintf("\n");
+}
+
+void uptime(int argc, char **argv)
+{
+	uint32 rem;
+	uint64 ms = udiv64(ktime_ns(), NSEC_PER_MSEC, 0);
+	uint32 seconds = (uint32)udiv64(ms, 1000, &rem);
+	kprintf("\nUp %u.%03u s, %llu ticks at %u Hz", seconds, rem, clock_ticks(), HZ);
+	kprintf("\nTSC %u kHz, %u timers pending\n", tsc_khz(), timer_pending_count());
+}
+
+static uint32 percent(uint64 part, uint64 whole)
+{
+	if(!whole) return 0;
+	return (uint32)udiv64(part * 100, whole, 0);
+}
+
+void idle(int argc, char **argv)
+{
+	static uint64 last_now, last_idle;
+	static uint32 last_wakeups, last_irqs;
+	uint64 now = ktime_ns();
+	uint64 idle_time = idle_ns();
+	kprintf("\nIdle %u%% since boot, %u%% since last asked", percent(idle_time, now * cpu_count()),
+		percent(idle_time - last_idle, (now - last_now) * cpu_count()));
+	kprintf("\nWakeups: %u, timer IRQs: %u %s\n", idle_wakeups() - last_wakeups, irq_count(0) - last_irqs,
+		clock_tickless() ? "(tickless)" : "(periodic)");
+	last_now = now;
+	last_idle = idle_time;
+	last_wakeups = idle_wakeups();
+	last_irqs = irq_count(0);
+}
+
+void ps(int argc, char **argv)
+{
+	static const char *states[] = {"run", "ready", "block", "dead"};
+	thread_t *thread = thread_first();
+	kprintf("\n%4s%5s%7s%10s%8s  %s", "id", "cpu", "state", "switches", "cpu ms", "name");
+	while(thread)
+	{
+		kprintf("\n%4u%5u%7s%10u%8u  %s", thread->id, thread->cpu->id, states[thread->state], thread->switches,
+			(uint32)udiv64(thread->runtime_ns, NSEC_PER_MSEC, 0), thread->name);
+		thread = thread->all_next;
+	}
+	kprintf("\n");
+}
+
+void cpus(int argc, char **argv)
+{
+	uint32 i;
+	kprintf("\n%3s%6s%8s%10s%8s%8s%11s%11s", "cpu", "apic", "queued", "switches", "steals", "ipis", "fpu traps", "fpu loads");
+	for(i = 0;i < cpu_count();i++)
+	{
+		cpu_t *cpu = cpu_get(i);
+		kprintf("\n%3u%6u%8u%10u%8u%8u%11u%11u", cpu->id, cpu->apic_id, cpu->nr_running, cpu->switches,
+			cpu->steals, cpu->ipis, cpu->fpu_traps, cpu->fpu_loads);
+	}
+	kprintf("\n");
+}
+
+void workq(int argc, char **argv)
+{
+	uint32 i;
+	kprintf("\n%3s%8s%8s%8s%9s", "cpu", "queued", "merged", "runs", "batches");
+	for(i = 0;i < cpu_count();i++)
+	{
+		const workqueue_stats_t *ws = workqueue_stats(i);
+		kprintf("\n%3u%8u%8u%8u%9u", i, ws->queued, ws->coalesced, ws->runs, ws->batches);
+	}
+	kprintf("\n");
+}
+
+void fbinfo(int argc, char **argv)
+{
+	uint32 w, h, bpp;
+	const fbcon_stats_t *fs = fbcon_stats();
+	if(!fbcon_active())
+	{
+		kprintf("\nNo framebuffer, VGA text console\n");
+		return;
+	}
+	fbcon_mode(&w, &h, &bpp);
+	kprintf("\nMode: %ux%ux%u, %ux%u cells", w, h, bpp, fbcon_cols(), fbcon_rows());
+	kprintf("\nGlyph cache hits: %u, misses: %u", fs->glyph_hits, fs->glyph_misses);
+	kprintf("\nFlushes: %u, rects: %u, %u KiB", fs->flushes, fs->rects, fs->bytes / 1024);
+	kprintf("\nScrolls: %u\n", fs->scrolls);
+}
+
+void dmesg(int argc, char **argv)
+{
+	klog_record_t record;
+	char line[KLOG_LINE];
+	uint32 seq, head = klog_head();
+	kprintf("\n");
+	for(seq = klog_oldest();seq != head;seq++)
+	{
+		if(!klog_read(seq, &record)) continue;
+		klog_format(&record, line, sizeof(line));
+		print(line);
+	}
+}
+
+void serial(int argc, char **argv)
+{
+	const serial_stats_t *ss = serial_stats();
+	if(!serial_active())
+	{
+		kprintf("\nNo serial port\n");
+		return;
+	}
+	kprintf("\nCOM1: %u baud, %u byte fifo, %u irqs", SERIAL_BAUD, ss->fifo, ss->irqs);
+	kprintf("\nSent: %u bytes, %u kicks, %u waits, %u dropped", ss->tx_bytes, ss->tx_kicks, ss->tx_waits, ss->tx_dropped);
+	kprintf("\nReceived: %u bytes, %u errors\n", ss->rx_bytes, ss->rx_errors);
+}
+
+void bootprof(int argc, char **argv)
+{
+	const bootprof_mark_t *marks = bootprof_marks();
+	uint32 i, count = bootprof_count();
+	uint64 prev = boot_tsc;
+	if(!tsc_khz())
+	{
+		kprintf("\nNo calibrated TSC, boot phases cannot be timed\n");
+		return;
+	}
+	kprintf("\n%-16s%10s%10s", "phase", "us", "total us");
+	for(i = 0;i < count;i++)
+	{
+		uint32 us = (uint32)udiv64(tsc_to_ns(marks[i].tsc - prev), NSEC_PER_USEC, 0);
+		uint32 total = (uint32)udiv64(tsc_to_ns(marks[i].tsc - boot_tsc), NSEC_PER_USEC, 0);
+		kprintf("\n%-16s%10u%10u", marks[i].name, us, total);
+		prev = marks[i].tsc;
+	}
+	kprintf("\n");
+}
+
+void bench(int argc, char **argv)
+{
+	if(argc < 2) bench_list();
+	else if(strEql(argv[1], "all")) bench_all();
+	else if(!bench_run(argv[1])) kprintf("\nNo benchmark called %s\n", argv[1]);
+}
+
+void perf(int argc, char **argv)
+{
+	if(argc < 2 || strEql(argv[1], "top")) profile_top(argc > 2 ? (uint32)str_to_int(argv[2]) : PROFILE_TOP);
+	else if(strEql(argv[1], "start"))
+	{
+		bool nmi = argc > 2 && strEql(argv[2], "nmi");
+		if(profile_running()) kprintf("\nThe profiler is already running\n");
+		else if(!profile_start(nmi)) kprintf("\nCannot start the profiler, it needs a local APIC and the TSC\n");
+		else kprintf("\nSampling at %u Hz from the %s\n", PROFILE_HZ, nmi ? "timer through NMIs" : "timer");
+	}
+	else if(strEql(argv[1], "stop")) profile_stop();
+	else kprintf("\nperf start [nmi], perf stop or perf top [count]\n");
+}
+
+/* pmc shows the counters, pmc <command> counts what the command does */
+void pmc(int argc, char **argv)
+{
+	pmu_counts_t start, end, delta;
+	thread_t *self = thread_current();
+	shell_command_t *cmd;
+	bool pinned;
+	uint32 i, cpu, flags;
+	if(!pmu_active())
+	{
+		kprintf("\nNo architectural performance counters\n");
+		return;
+	}
+	if(argc < 2)
+	{
+		flags = interrupts_save();
+		pmu_read(&end);
+		cpu = this_cpu()->id;
+		interrupts_restore(flags);
+		kprintf("\nPerfmon version %u, %u counters of %u bits, on cpu %u:", pmu_version(), pmu_counters(), pmu_width(), cpu);
+		for(i = 0; i < PMU_EVENTS; i++)
+		{
+			if(pmu_counting(i)) kprintf("\n  %-14s%llu", pmu_event_name(i), end.v[i]);
+			else kprintf("\n  %-14snot counted", pmu_event_name(i));
+		}
+		kprintf("\n");
+		return;
+	}
+	if(!(cmd = shell_lookup(argv[1])) || cmd->fn == pmc)
+	{
+		kprintf("\nNo command called %s\n", argv[1]);
+		return;
+	}
+	pinned = self->pinned;
+	self->pinned = true;                                    // the counters are this cpu's
+	pmu_read(&start);
+	cmd->fn(argc - 1, argv + 1);
+	pmu_read(&end);
+	self->pinned = pinned;
+	pmu_delta(&start, &end, &delta);
+	kprintf("\n");
+	for(i = 0; i < PMU_EVENTS; i++)
+	{
+		if(pmu_counting(i)) kprintf("\n%-14s%llu", pmu_event_name(i), delta.v[i]);
+	}
+	kprintf("\n");
+}
+
+void ls(int argc, char **argv)
+{
+	char *dir = argc > 1 ? argv[1] : "";
+	uint32 i, len;
+	const initrd_file_t *f;
+	if(!initrd_count())
+	{
+		kprintf("\nNo initrd\n");
+		return;
+	}
+	while(*dir == '/') dir++;
+	len = strlen(dir);
+	while(len && dir[len - 1] == '/') dir[--len] = 0;
+	f = len ? initrd_lookup(dir) : 0;
+	if(f && f->type == INITRD_FILE)
+	{
+		kprintf("\n%8u  %s\n", f->size, f->name);
+		return;
+	}
+	kprintf("\n");
+	for(i = 0;(f = initrd_file(i));i++)
+	{
+		const char *name = f->name;
+		if(len)
+		{
+			if(strncmp(name, dir, len) || name[len] != '/') continue;
+			name += len + 1;
+		}
+		if(strchr(name, '/')) continue;                 // deeper down
+		if(f->type == INITRD_DIR) kprintf("%8s  %s/\n", "", name);
+		else kprintf("%8u  %s\n", f->size, name);
+	}
+}
+
+void cat(int argc, char **argv)
+{
+	uint32 size;
+	const char *data;
+	if(argc < 2)
+	{
+		kprintf("\ncat <file>\n");
+		return;
+	}
+	data = (const char *)initrd_data(argv[1], &size);
+	if(!data)
+	{
+		kprintf("\nNo file %s\n", argv[1]);
+		return;
+	}
+	kprintf("\n%.*s", (int)size, data);
+}
+
+void disks(int argc, char **argv)
+{
+	const ata_stats_t *as = ata_stats();
+	const bcache_stats_t *cs = bcache_stats();
+	uint32 i;
+	blk_device_t *dev;
+	if(!blk_count())
+	{
+		kprintf("\nNo disks\n");
+		return;
+	}
+	for(i = 0;(dev = blk_device(i));i++)
+	{
+		kprintf("\n%-6s%8u MiB  %s", dev->name, dev->sectors / 2048, dev->desc);
+		kprintf("\n      %u requests, %u merged, %u transfers, %u sectors, %u errors", dev->stats.requests, dev->stats.merged, dev->stats.transfers, dev->stats.sectors, dev->stats.errors);
+	}
+	kprintf("\nATA: %u dma, %u pio, %u flushes, %u timeouts, %u resets, %u deferred", as->dma_transfers, as->pio_transfers,
+	        as->flushes, as->timeouts, as->resets, as->deferred);
+	kprintf("\nCache: %u hits, %u misses, %u read ahead, %u read ahead hits", cs->hits, cs->misses, cs->readahead, cs->readahead_hits);
+	kprintf("\n       %u written back, %u evicted\n", cs->writebacks, cs->evictions);
+}
+
+/* dd <disk> <block> <count> [write]: blocks through the cache, timed; write
+   fills each with its block number and syncs */
+void dd(int argc, char **argv)
+{
+	blk_device_t *dev;
+	uint32 first, count, done, us;
+	bool write;
+	uint64 start;
+	if(argc < 4)
+	{
+		kprintf("\ndd <disk> <block> <count> [write]\n");
+		return;
+	}
+	if(!(dev = blk_find(argv[1])))
+	{
+		kprintf("\nNo disk called %s\n", argv[1]);
+		return;
+	}
+	first = (uint32)str_to_int(argv[2]);
+	count = (uint32)str_to_int(argv[3]);
+	write = argc > 4 && strEql(argv[4], "write");
+	start = ktime_ns();
+	for(done = 0; done < count; done++)
+	{
+		buf_t *b = bread(dev, first + done);
+		if(!b) break;
+		if(write)
+		{
+			memory_set(b->data, (uint8)(first + done), BCACHE_BLOCK);
+			bdirty(b);
+		}
+		brelse(b);
+	}
+	if(write) bsync(true);
+	us = (uint32)udiv64(ktime_ns() - start, NSEC_PER_USEC, 0);
+	kprintf("\n%u blocks %s in %u us, %u KiB/s", done, write ? "written" : "read", us,
+	        us ? (uint32)udiv64((uint64)done * (BCACHE_BLOCK / 1024) * 1000000, us, 0) : 0);
+	if(done < count) kprintf(", block %u failed", first + done);
+	kprintf("\n");
+}
+
+void lspci(int argc, char **argv)
+{
+	const pci_device_t *dev;
+	uint32 i;
+	if(!pci_count())
+	{
+		kprintf("\nNo PCI devices\n");
+		return;
+	}
+	for(i = 0;(dev = pci_device(i));i++)
+	{
+		kprintf("\n%02x:%02x.%u  %04x:%04x  %02x%02x  %s", dev->addr.bus, dev->addr.slot, dev->addr.func, dev->vendor, dev->device,
+		        dev->class_code, dev->subclass, pci_class_name(dev->class_code, dev->subclass));
+		if(dev->irq != PCI_NO_IRQ) kprintf(", irq %u", dev->irq);
+	}
+	kprintf("\n");
+}
+
+void virtio_cmd(int argc, char **argv)
+{
+	virtio_dev_t *dev;
+	uint32 i, q;
+	if(!virtio_count())
+	{
+		kprintf("\nNo virtio devices\n");
+		return;
+	}
+	for(i = 0;(dev = virtio_device(i));i++)
+	{
+		kprintf("\n%-6s%u interrupts, features 0x%08x", dev->name, dev->interrupts, dev->features);
+		for(q = 0; q < dev->nqueues; q++)
+		{
+			const virtq_stats_t *vs = &dev->queues[q]->stats;
+			kprintf("\n  queue %u: %u added, %u kicks, %u notified, %u completed", q, vs->adds, vs->kicks, vs->notifies, vs->completions);
+		}
+	}
+	kprintf("\n%u interrupts no device claimed\n", virtio_spurious());
+}
+
+void nics(int argc, char **argv)
+{
+	net_device_t *dev;
+	uint32 i;
+	if(!net_count())
+	{
+		kprintf("\nNo network interfaces\n");
+		return;
+	}
+	for(i = 0;(dev = net_device(i));i++)
+	{
+		kprintf("\n%-6s%02x:%02x:%02x:%02x:%02x:%02x  %s", dev->name, dev->mac[0], dev->mac[1], dev->mac[2], dev->mac[3], dev->mac[4], dev->mac[5], dev->desc);
+		kprintf("\n      rx %u packets, %u bytes, %u dropped", dev->stats.rx_packets, dev->stats.rx_bytes, dev->stats.rx_dropped);
+		kprintf("\n      tx %u packets, %u bytes, %u dropped", dev->stats.tx_packets, dev->stats.tx_bytes, dev->stats.tx_dropped);
+	}
+	kprintf("\n");
+}
+
+/* Dotted quad to a host order address, 0 if it is not one */
+static uint32 parse_ip(const char *s)
+{
+	uint32 ip = 0, part, parts;
+	for(parts = 0; parts < 4; parts++)
+	{
+		if(*s < '0' || *s > '9') return 0;
+		for(part = 0; *s >= '0' && *s <= '9'; s++) part = part * 10 + (*s - '0');
+		if(part > 255 || (parts < 3 && *s++ != '.')) return 0;
+		ip = (ip << 8) | part;
+	}
+	return *s ? 0 : ip;
+}
+
+void arping(int argc, char **argv)
+{
+	net_device_t *dev = argc > 1 ? net_find(argv[1]) : net_device(0);
+	uint32 src = argc > 3 ? parse_ip(argv[3]) : 0x0A00020F;         // QEMU user networking: 10.0.2.15 asks 10.0.2.2
+	uint32 dst = argc > 2 ? parse_ip(argv[2]) : 0x0A000202;
+	uint32 us;
+	uint8 mac[ETH_ALEN];
+	if(!dev || !src || !dst)
+	{
+		kprintf("\narping [interface] [address] [source address]\n");
+		return;
+	}
+	if(!net_arping(dev, src, dst, mac, &us)) kprintf("\nNo answer from %u.%u.%u.%u on %s\n", dst >> 24, (dst >> 16) & 0xFF, (dst >> 8) & 0xFF, dst & 0xFF, dev->name);
+	else kprintf("\n%u.%u.%u.%u is at %02x:%02x:%02x:%02x:%02x:%02x, %u us\n", dst >> 24, (dst >> 16) & 0xFF, (dst >> 8) & 0xFF, dst & 0xFF,
+	             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], us);
+}
+
+void sync(int argc, char **argv)
+{
+	uint32 i;
+	bsync(true);
+	for(i = 0; i < blk_count(); i++)
+	{
+		if(blk_flush(blk_device(i)) != BLK_OK) kprintf("\n%s: cache flush failed\n", blk_device(i)->name);
+	}
+}
+
+void run(int argc, char **argv)
+{
+	process_t *p;
+	if(argc < 2)
+	{
+		kprintf("\nrun <program>\n");
+		return;
+	}
+	p = proc_spawn(argv[1]);
+	if(!p)
+	{
+		kprintf("\nCannot run %s\n", argv[1]);
+		return;
+	}
+	kprintf("\n");
+	kprintf("\n%s exited with %d\n", argv[1], proc_wait(p));
+}
+
+void vmstat(int argc, char **argv)
+{
+	const vm_stats_t *vs = vm_stats();
+	kprintf("\nPage faults: %u, %u zero filled, %u from file, %u bad", vs->faults, vs->zero_fills, vs->file_fills, vs->bad_faults);
+	kprintf("\nCopy-on-write: %u copied, %u reused\n", vs->cow_copies, vs->cow_reuses);
+}
+
+void syscalls_cmd(int argc, char **argv)
+{
+	const syscall_stats_t *ss = syscall_stats();
+	uint32 i;
+	kprintf("\nEntry: %s", syscall_fast() ? "sysenter, int 0x80 kept" : "int 0x80 only");
+	kprintf("\nCalls: %u through sysenter, %u through int 0x80, %u bad", ss->sysenter, ss->int80, ss->bad);
+	for(i = 0; i < SYSCALL_COUNT; i++)
+	{
+		if(ss->calls[i]) kprintf("\n  %-8s%u", syscall_name(i), ss->calls[i]);
+	}
+	kprintf("\n");
+}
+
+void whoami_cmd(int argc, char **argv)
+{
+	printl(whoami);
+}
+
+void about(int argc, char **argv)
+{
+	printl("F O R E S T  O S");
+	print("Kernel version: ");print(kernel);print("\n");
+	print("Who am i: \n");print(whoami);
+}
+
+void help(int argc, char **argv)
+{
+	uint32 i;
+	kprintf("\n");
+	for(i = 0;i < ncommands;i++) kprintf("%-12s%s\n", commands[i].name, commands[i].help);
+}
+
+void shell_nested(int argc, char **argv)
+{
+	if(depth >= SHELL_MAX_DEPTH)
+	{
+		print("\nShells are nested too deep.\n");
+		return;
+	}
+	print("\nYou are allready in cmd. A new nested shell is opened\n");
+	depth++;
+}
+
+void shell_exit(int argc, char **argv)
+{
+	depth--;
+}
+
+void crash_cmd(int argc, char **argv)
+{
+	crash();
+}
+
+static uint32 hash(const char *name)
+{
+	uint32 h = 2166136261u;                                 // FNV-1a
+	while(*name) h = (h ^ (uint8)*name++) * 16777619u;
+	return h;
+}
+
+bool shell_register(const char *name, shell_fn_t fn, const char *help)
+{
+	shell_command_t *cmd;
+	uint32 flags = spin_lock_irqsave(&commands_lock);
+	if(ncommands == SHELL_MAX_COMMANDS || shell_lookup(name))
+	{
+		spin_unlock_irqrestore(&commands_lock, flags);
+		return false;
+	}
+	cmd = &commands[ncommands];
+	cmd->name = name;
+	cmd->fn = fn;
+	cmd->help = help;
+	cmd->next = buckets[hash(name) & (SHELL_HASH_BUCKETS - 1)];
+	__sync_synchronize();                                   // lookups and help take no lock, fill it in first
+	buckets[hash(name) & (SHELL_HASH_BUCKETS - 1)] = cmd;
+	ncommands++;
+	spin_unlock_irqrestore(&commands_lock, flags);
+	return true;
+}
+
+shell_command_t *shell_lookup(const char *name)
+{
+	shell_command_t *cmd = buckets[hash(name) & (SHELL_HASH_BUCKETS - 1)];
+	while(cmd && strcmp(cmd->name, name)) cmd = cmd->next;
+	return cmd;
+}
+
+void shell_init()
+{
+	shell_register("help", help, "list the commands");
+	shell_register("shell", shell_nested, "open a nested shell");
+	shell_register("exit", shell_exit, "leave this shell");
+	shell_register("whoami", whoami_cmd, "print the user name");
+	shell_register("about", about, "kernel name and version");
+	shell_register("meminfo", meminfo, "frame and heap usage");
+	shell_register("slabinfo", slabinfo, "slab caches");
+	shell_register("irqstat", irqstat, "interrupt counts");
+	shell_register("uptime", uptime, "time since boot");
+	shell_register("idle", idle, "idle time per cpu");
+	shell_register("ps", ps, "threads");
+	shell_register("cpus", cpus, "per cpu counters");
+	shell_register("workq", workq, "deferred work counters");
+	shell_register("fbinfo", fbinfo, "framebuffer console");
+	shell_register("dmesg", dmesg, "kernel log");
+	shell_register("serial", serial, "serial port counters");
+	shell_register("bootprof", bootprof, "boot phase timings");
+	shell_register("bench", bench, "microbenchmarks, bench <name> or all");
+	shell_register("perf", perf, "sampling profiler, perf start [nmi], stop or top [count]");
+	shell_register("pmc", pmc, "performance counters, or pmc <command> to count one");
+	shell_register("ls", ls, "list an initrd directory");
+	shell_register("cat", cat, "print an initrd file");
+	shell_register("disks", disks, "block devices and cache counters");
+	shell_register("dd", dd, "read or write disk blocks through the cache, dd <disk> <block> <count> [write]");
+	shell_register("sync", sync, "write back dirty cached blocks and flush the disks");
+	shell_register("run", run, "run a program from the initrd");
+	shell_register("vmstat", vmstat, "user page fault counters");
+	shell_register("syscalls", syscalls_cmd, "system call entry path and counts");
+	shell_register("lspci", lspci, "PCI functions found at boot");
+	shell_register("virtio", virtio_cmd, "virtio devices and their queue counters");
+	shell_register("nics", nics, "network interfaces and counters");
+	shell_register("arping", arping, "ARP round trip, arping [interface] [address] [source]");
+	shell_register("crash", crash_cmd, "stop the shell");
+}
+
+/*
+ * Nested shells do not recurse: "shell" and "exit" move depth and this
+ * one loop keeps reading, until exit takes depth below the level it was
+ * started at.
+ */
+void launch_shell(int n)
+{
+	char *argv[SHELL_MAX_ARGS];
+	int argc;
+	string ch = 0;
+	shell_command_t *cmd;
+	depth = n;
+	while(depth >= n && countinue != "no")
+	{
 		print_colored("\nforest>",9,0);
-	
-		    ch = readStr(); 
-		    if(StartsWith(ch,"shell"))
-		    {
-		            print("\nYou are allready in cmd. A new recursive shell is opened\n");
-					launch_shell(n+1);
-			}else if(StartsWith(ch,"whoami"))
-		    {
-		            printl(whoami);
-		    }else if(StartsWith(ch,"about"))
-		    {
-		            printl("F O R E S T  O S");
-					print("Kernel version: ");print(kernel);print("\n");
-					print("Who am i: \n");print(whoami);
-
-
-		    }else if(StartsWith(ch,"crash"))
-		    {
-		           
-				   crash();
-				  
-		    }else{
-				print("Not a command.");
-			}
-	} while (!strEql(ch,"exit"));
+		freeStr(ch);
+		ch = readStr();
+		argc = tokenize(ch, argv, SHELL_MAX_ARGS);
+		if(argc == 0) continue;
+		if(argc < 0)
+		{
+			print("Too many arguments.");
+			continue;
+		}
+		cmd = shell_lookup(argv[0]);
+		if(cmd) cmd->fn(argc, argv);
+		else print("Not a command.");
+	}
+	freeStr(ch);
 }
 
 void crash(){
@@ -0,0 +1,166 @@
+//slab object caches
+
+#include "../include/slab.h"
+#include "../include/heap.h"
+#include "../include/pmm.h"
+#include "../include/paging.h"
+#include "../include/util.h"
+
+/*
+ * A slab is one naturally aligned buddy block holding a slab_t header,
+ * padded to a cache line, followed by equally sized objects. Because the
+ * block is aligned to its own size, the slab of any object is found by
+ * masking the object address.
+ *
+ * Frees first land on the cache's hot array and the next allocation pops
+ * the most recently freed object, which is likely still in the CPU cache.
+ * Only when the hot array overflows does its older half go back to the
+ * slab free lists. One empty slab per cache is kept around so a cache
+ * hovering at a slab boundary does not bounce frames in and out of pmm.
+ * Each cache has its own lock, so unrelated caches never contend.
+ */
+
+#define SLAB_MIN_OBJECTS 8
+
+static kmem_cache_t *caches;
+
+static void slab_list_push(slab_t **head, slab_t *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_remove(slab_t **head, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static slab_t *slab_of(kmem_cache_t *cache, void *obj) {
+    return (slab_t *)((uint32)obj & ~((PAGE_SIZE << cache->order) - 1));
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32 size, uint32 align) {
+    uint32 i;
+    if (!align) align = CACHE_LINE_SIZE;
+    if (align < sizeof(void *)) align = sizeof(void *);     // free link lives in the object
+    if (size < sizeof(void *)) size = sizeof(void *);
+
+    kmem_cache_t *cache = (kmem_cache_t *)kzalloc(sizeof(kmem_cache_t));
+    if (!cache) return 0;
+    for (i = 0; i < SLAB_NAME_LEN - 1 && name[i]; i++) cache->name[i] = name[i];
+
+    cache->object_size = (size + align - 1) & ~(align - 1);
+    cache->first_offset = (sizeof(slab_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    cache->first_offset = (cache->first_offset + align - 1) & ~(align - 1);
+    while (cache->order < PMM_MAX_ORDER &&
+           ((PAGE_SIZE << cache->order) - cache->first_offset) / cache->object_size < SLAB_MIN_OBJECTS)
+        cache->order++;
+    cache->objects_per_slab = ((PAGE_SIZE << cache->order) - cache->first_offset) / cache->object_size;
+    if (!cache->objects_per_slab) {
+        kfree(cache);
+        return 0;
+    }
+
+    kmem_cache_t **tail = &caches;
+    while (*tail) tail = &(*tail)->next_cache;
+    *tail = cache;
+    return cache;
+}
+
+static slab_t *cache_grow(kmem_cache_t *cache) {
+    uint32 addr = pmm_alloc_frames(cache->order);
+    if (addr == PMM_NO_FRAME) return 0;
+
+    addr = (uint32)PHYS_TO_VIRT(addr);
+    slab_t *slab = (slab_t *)addr;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = 0;
+    uint32 i = cache->objects_per_slab;
+    while (i--) {                       // thread the list so the lowest address comes out first
+        void **obj = (void **)(addr + cache->first_offset + i * cache->object_size);
+        *obj = slab->free;
+        slab->free = obj;
+    }
+    cache->slabs++;
+    cache->grows++;
+    cache->total_objects += cache->objects_per_slab;
+    slab_list_push(&cache->partial, slab);
+    return slab;
+}
+
+static void *cache_alloc(kmem_cache_t *cache) {
+    cache->allocs++;
+    if (cache->hot_count) {
+        cache->hits++;
+        cache->active_objects++;
+        return cache->hot[--cache->hot_count];
+    }
+
+    slab_t *slab = cache->partial;
+    if (!slab && cache->empty) {
+        slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    if (!slab) slab = cache_grow(cache);
+    if (!slab) return 0;
+
+    void **obj = (void **)slab->free;
+    slab->free = *obj;
+    slab->inuse++;
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    cache->active_objects++;
+    return obj;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint32 flags = spin_lock_irqsave(&cache->lock);
+    void *obj = cache_alloc(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+static void slab_put(kmem_cache_t *cache, void *obj) {
+    slab_t *slab = slab_of(cache, obj);
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    if (slab->inuse) return;
+
+    slab_list_remove(&cache->partial, slab);
+    if (!cache->empty) {
+        slab_list_push(&cache->empty, slab);
+        return;
+    }
+    cache->slabs--;
+    cache->total_objects -= cache->objects_per_slab;
+    pmm_free_frames(VIRT_TO_PHYS(slab), cache->order);
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    uint32 i;
+    if (!obj) return;
+    uint32 flags = spin_lock_irqsave(&cache->lock);
+    cache->active_objects--;
+    if (cache->hot_count == SLAB_HOT_OBJECTS) {
+        for (i = 0; i < SLAB_HOT_OBJECTS / 2; i++) slab_put(cache, cache->hot[i]);
+        for (i = 0; i < SLAB_HOT_OBJECTS / 2; i++) cache->hot[i] = cache->hot[i + SLAB_HOT_OBJECTS / 2];
+        cache->hot_count -= SLAB_HOT_OBJECTS / 2;
+    }
+    cache->hot[cache->hot_count++] = obj;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+kmem_cache_t *kmem_cache_first() {
+    return caches;
+}
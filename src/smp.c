@@ -0,0 +1,130 @@
+//multiprocessor bring-up and per-cpu data
+
+#include "../include/smp.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/idt.h"
+#include "../include/klog.h"
+#include "../include/paging.h"
+#include "../include/pmu.h"
+#include "../include/sched.h"
+#include "../include/syscall.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * The BSP gets its per-cpu segment before anything touches this_cpu().
+ * After the scheduler is up, smp_init starts the APs listed in the MADT
+ * one at a time: it copies the real mode trampoline (smpboot.asm) below
+ * 1 MiB, hands it a fresh stack, and waits for the AP to mark itself
+ * online from ap_main. That first context becomes the AP's idle thread,
+ * which steals work from the other run queues.
+ *
+ * The trampoline turns paging on while running at its physical address,
+ * so the low 4 MiB are identity mapped for as long as APs are starting.
+ */
+
+typedef struct {
+    uint32 cr3;
+    uint32 cr4;
+    uint32 stack;
+} smp_trampoline_params_t;
+
+extern uint8 smp_trampoline_start[];
+extern uint8 smp_trampoline_end[];
+extern uint8 smp_trampoline_params[];
+
+static cpu_t cpus[MAX_CPUS];
+static uint32 ncpus = 1;
+static cpu_t *volatile booting;
+
+void smp_init_bsp()
+{
+    cpus[0].self = &cpus[0];
+    cpus[0].id = 0;
+    cpus[0].online = true;
+    gdt_init_cpu(0, &cpus[0], sizeof(cpu_t));
+}
+
+cpu_t *this_cpu()
+{
+    cpu_t *cpu;
+    __asm__ __volatile__ ("movl %%gs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+/* First C code on an AP, still on the trampoline's GDT */
+void ap_main()
+{
+    cpu_t *cpu = booting;
+    gdt_init_cpu(cpu->id, cpu, sizeof(cpu_t));
+    pat_init();
+    set_idt();
+    fpu_init();
+    lapic_init();
+    sched_init_cpu();
+    syscall_init_cpu();
+    pmu_init_cpu();
+    cpu->online = true;
+    sched_idle_loop();
+}
+
+void smp_init()
+{
+    const acpi_madt_info_t *madt = acpi_madt();
+    uint32 *dir = kernel_page_directory();
+    uint32 i;
+    if (!apic_active()) return;
+    cpus[0].apic_id = lapic_id();
+
+    uint32 size = smp_trampoline_end - smp_trampoline_start;
+    memory_copy((char *)smp_trampoline_start, (char *)PHYS_TO_VIRT(AP_TRAMPOLINE), size);
+    smp_trampoline_params_t *params = (smp_trampoline_params_t *)
+        PHYS_TO_VIRT(AP_TRAMPOLINE + (smp_trampoline_params - smp_trampoline_start));
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4();
+    dir[0] = PTE_PRESENT | PTE_WRITE | PTE_LARGE;
+
+    for (i = 0; i < madt->cpu_count && ncpus < MAX_CPUS; i++) {
+        if (madt->cpu_apic_ids[i] == cpus[0].apic_id) continue;
+        uint32 stack = pmm_alloc_frames(THREAD_STACK_ORDER);
+        if (stack == PMM_NO_FRAME) break;
+        cpu_t *cpu = &cpus[ncpus];
+        cpu->self = cpu;
+        cpu->id = ncpus;
+        cpu->apic_id = madt->cpu_apic_ids[i];
+        params->stack = (uint32)PHYS_TO_VIRT(stack) + THREAD_STACK_SIZE;
+        booting = cpu;
+        if (!lapic_start_ap(cpu->apic_id, AP_TRAMPOLINE, &cpu->online))
+            break;                      // a late riser would still use the stack and the slot
+        ncpus++;
+    }
+
+    dir[0] = 0;
+    write_cr3(read_cr3());
+    klog(KLOG_INFO, "smp: %u of %u cpus online", ncpus, madt->cpu_count);
+}
+
+cpu_t *cpu_get(uint32 id)
+{
+    return &cpus[id];
+}
+
+uint32 cpu_count()
+{
+    return ncpus;
+}
+
+/* Makes cpu go through schedule() at its next interrupt exit, now if remote */
+void smp_send_reschedule(cpu_t *cpu)
+{
+    cpu->need_resched = true;
+    if (cpu != this_cpu()) lapic_send_ipi(cpu->apic_id, IPI_RESCHEDULE);
+}
+
+void smp_halt_others()
+{
+    if (ncpus > 1) lapic_send_ipi_others(IPI_HALT);
+}
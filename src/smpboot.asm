@@ -0,0 +1,67 @@
+bits    16
+section         .text
+
+; Application processor entry. smp_init copies smp_trampoline_start ..
+; smp_trampoline_end to AP_TRAMPOLINE (include/smp.h) and points the
+; STARTUP IPI at it, so the code runs from that copy in real mode with
+; cs:ip = 0x0700:0000 and every address below has to be the copy's.
+; It switches to protected mode on a temporary GDT, turns on paging with
+; the kernel's directory (smp_init maps the low 4 MiB for the switch),
+; and calls ap_main on the stack smp_init left in the parameters.
+
+TRAMPOLINE_BASE equ 0x7000              ; keep in sync with AP_TRAMPOLINE
+%define T(x) ((x) - smp_trampoline_start + TRAMPOLINE_BASE)
+
+extern ap_main
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+        align   16
+smp_trampoline_start:
+        cli
+        cld
+        xor     ax, ax
+        mov     ds, ax
+        o32 lgdt [T(tramp_gdt_ptr)]
+        mov     eax, cr0
+        or      eax, 0x00000001         ;PE
+        mov     cr0, eax
+        jmp     dword 0x08:T(tramp_protected)
+
+bits    32
+tramp_protected:
+        mov     ax, 0x10
+        mov     ds, ax
+        mov     es, ax
+        mov     ss, ax
+        mov     eax, [T(tramp_cr4)]     ;PSE (and PGE) as on the BSP
+        mov     cr4, eax
+        mov     eax, [T(tramp_cr3)]
+        mov     cr3, eax
+        mov     eax, cr0
+        or      eax, 0x80010000         ;PG, WP as on the BSP
+        mov     cr0, eax
+        mov     esp, [T(tramp_stack)]
+        mov     eax, ap_main            ;absolute, in the higher half
+        call    eax
+.halt:
+        cli
+        hlt
+        jmp     .halt
+
+        align   8
+tramp_gdt:
+        dq      0x0000000000000000
+        dq      0x00CF9A000000FFFF      ;0x08 code, flat 4 GiB
+        dq      0x00CF92000000FFFF      ;0x10 data, flat 4 GiB
+tramp_gdt_ptr:
+        dw      tramp_gdt_ptr - tramp_gdt - 1
+        dd      T(tramp_gdt)
+
+; filled in by smp_init for each AP, see smp_trampoline_params_t
+smp_trampoline_params:
+tramp_cr3:      dd      0
+tramp_cr4:      dd      0
+tramp_stack:    dd      0
+smp_trampoline_end:
@@ -0,0 +1,47 @@
+//ticket spinlocks
+
+#include "../include/spinlock.h"
+#include "../include/system.h"
+
+void spin_init(spinlock_t *lock)
+{
+    lock->owner = 0;
+    lock->next = 0;
+}
+
+void spin_lock(spinlock_t *lock)
+{
+    uint16 ticket = __sync_fetch_and_add(&lock->next, 1);
+    while (lock->owner != ticket) cpu_relax();
+    __sync_synchronize();
+}
+
+/* Takes the lock only if nobody holds or waits for it */
+bool spin_trylock(spinlock_t *lock)
+{
+    uint16 owner = lock->owner;
+    uint32 old = ((uint32)owner << 16) | owner;      // next == owner: free
+    uint32 new = ((uint32)(uint16)(owner + 1) << 16) | owner;
+    return __sync_bool_compare_and_swap((volatile uint32 *)lock, old, new);
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+    __sync_synchronize();
+    lock->owner++;
+}
+
+/* Interrupts stay off while the lock is held, so a handler on the same
+   cpu can never spin on a lock its own cpu holds */
+uint32 spin_lock_irqsave(spinlock_t *lock)
+{
+    uint32 flags = interrupts_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, uint32 flags)
+{
+    spin_unlock(lock);
+    interrupts_restore(flags);
+}
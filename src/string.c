@@ -1,25 +1,100 @@
 #include "../include/string.h"
-uint16 strlength(string ch)
+
+/*
+ * The scans read a 32 bit word at a time and use the has-zero-byte trick,
+ * (v - 0x01010101) & ~v & 0x80808080, which is non-zero exactly when one
+ * of the four bytes of v is zero; v ^ (c * 0x01010101) turns "a byte
+ * equal to c" into "a zero byte". Word reads are aligned whenever they
+ * could run past the end of the string, so they never cross into the
+ * next page. Only the bytes before alignment and the word holding the
+ * end are looked at one by one.
+ *
+ * There is no SSE version: kernel code may run in interrupt context with
+ * a thread's XMM registers live, and strings here are too short for the
+ * save and restore to pay off.
+ */
+
+#define ONES  0x01010101
+#define HIGHS 0x80808080
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
+typedef uint32 __attribute__((may_alias)) word_t;
+
+size_t strlen(const char *s)
 {
-        uint16 i = 0;           //Changed counter to 0
-        while(ch[i++]);  
-        return i-1;               //Changed counter to i instead of i--
+        const char *p = s;
+        const word_t *w;
+        for(;(uint32)p & 3;p++) if(!*p) return p - s;
+        for(w = (const word_t *)p;!HAS_ZERO(*w);w++);
+        for(p = (const char *)w;*p;p++);
+        return p - s;
 }
 
-
-uint8 strEql(string ch1,string ch2)                     
+int strncmp(const char *s1, const char *s2, size_t n)
 {
-        uint8 result = 1;
-        uint8 size = strlength(ch1);
-        if(size != strlength(ch2)) result =0;
-        else 
+        if((((uint32)s1 ^ (uint32)s2) & 3) == 0)                 // same alignment, words can be compared
         {
-        uint8 i = 0;
-        for(i;i<=size;i++)
+                for(;n && ((uint32)s1 & 3);s1++, s2++, n--)
+                        if(*s1 != *s2 || !*s1) return (uint8)*s1 - (uint8)*s2;
+                for(;n >= 4;s1 += 4, s2 += 4, n -= 4)
+                {
+                        word_t w = *(const word_t *)s1;
+                        if(w != *(const word_t *)s2 || HAS_ZERO(w)) break;
+                }
+        }
+        for(;n;s1++, s2++, n--)
+                if(*s1 != *s2 || !*s1) return (uint8)*s1 - (uint8)*s2;
+        return 0;
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+        return strncmp(s1, s2, (size_t)-1);
+}
+
+void *memchr(const void *s, int c, size_t n)
+{
+        const uint8 *p = (const uint8 *)s;
+        uint32 pattern = (uint8)c * ONES;
+        for(;n && ((uint32)p & 3);p++, n--) if(*p == (uint8)c) return (void *)p;
+        for(;n >= 4;p += 4, n -= 4)
+                if(HAS_ZERO(*(const word_t *)p ^ pattern)) break;
+        for(;n;p++, n--) if(*p == (uint8)c) return (void *)p;
+        return 0;
+}
+
+char *strchr(const char *s, int c)
+{
+        const word_t *w;
+        uint32 pattern = (uint8)c * ONES;
+        for(;(uint32)s & 3;s++)
         {
-                if(ch1[i] != ch2[i]) result = 0;
+                if(*s == (char)c) return (char *)s;
+                if(!*s) return 0;
         }
+        for(w = (const word_t *)s;!HAS_ZERO(*w) && !HAS_ZERO(*w ^ pattern);w++);
+        for(s = (const char *)w;;s++)
+        {
+                if(*s == (char)c) return (char *)s;
+                if(!*s) return 0;
         }
-        return result;
 }
 
+/* Unaligned word loads are fine on x86 and stay inside the n bytes */
+int memcmp(const void *a, const void *b, size_t n)
+{
+        const uint8 *p = (const uint8 *)a, *q = (const uint8 *)b;
+        for(;n >= 4 && *(const word_t *)p == *(const word_t *)q;p += 4, q += 4, n -= 4);
+        for(;n;p++, q++, n--) if(*p != *q) return *p - *q;
+        return 0;
+}
+
+uint16 strlength(string ch)
+{
+        return strlen(ch);
+}
+
+uint8 strEql(string ch1,string ch2)
+{
+        return strcmp(ch1, ch2) == 0;
+}
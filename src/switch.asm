@@ -0,0 +1,27 @@
+bits    32
+section         .text
+
+; void switch_context(uint32 *save_esp, uint32 next_esp)
+;
+; Saves the callee-saved registers on the current stack, parks the stack
+; pointer in *save_esp and resumes the thread whose stack is next_esp.
+; Everything else (eflags, caller-saved registers) is saved by the C
+; caller or by the interrupt frame further up the stack. A new thread's
+; stack is laid out by thread_create to look like it was switched away
+; from just before entering thread_start.
+
+global switch_context
+switch_context:
+        mov     eax, [esp + 4]
+        mov     edx, [esp + 8]
+        push    ebp
+        push    ebx
+        push    esi
+        push    edi
+        mov     [eax], esp
+        mov     esp, edx
+        pop     edi
+        pop     esi
+        pop     ebx
+        pop     ebp
+        ret
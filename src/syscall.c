@@ -0,0 +1,225 @@
+//system calls
+
+#include "../include/syscall.h"
+#include "../include/bench.h"
+#include "../include/gdt.h"
+#include "../include/idt.h"
+#include "../include/kprintf.h"
+#include "../include/proc.h"
+#include "../include/sched.h"
+#include "../include/smp.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * Two ways in, one table. int 0x80 is a trap gate, so a system call runs
+ * with interrupts on like the code that made it. SYSENTER is several
+ * times cheaper: no gate or descriptor checks, and SYSEXIT instead of
+ * iret. It comes in on a fixed stack pointer, so SYSENTER_ESP points at
+ * a small per-cpu entry stack whose top word is the address of the TSS's
+ * esp0 field, and the entry loads the real stack from there; the
+ * scheduler keeps esp0 current anyway. SYSENTER does not clear TF, so a
+ * #DB or an NMI can come in on the entry stack before the entry has
+ * moved off it, which is why it is a stack and not just the pointer.
+ *
+ * SYSEXIT needs the return address and stack in registers, so programs
+ * do not execute SYSENTER themselves but call the stub in the system
+ * call page, which every process has mapped at SYSCALL_PAGE. Which stub
+ * goes there is decided once at boot, so programs never need to know.
+ *
+ * Arguments pointing into user space are checked against the caller's
+ * areas before use. The pages behind them may still have to fault in,
+ * which the page fault handler does for the kernel as well. The counters
+ * are per call and not locked, like the IRQ counts.
+ */
+
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+#define CPUID_EDX_SEP       0x00000800
+#define EFLAGS_TF           0x00000100
+#define ENTRY_STACK_WORDS   512                 // room for an NMI handler
+
+typedef int (*syscall_fn_t)(registers_t *regs);
+
+static bool fast;
+static uint32 entry_stacks[MAX_CPUS][ENTRY_STACK_WORDS] __attribute__((aligned(16)));
+static uint8 page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static uint32 page_size;
+static syscall_stats_t stats;
+
+static const char *names[SYSCALL_COUNT] = {
+    "exit", "write", "fork", "exec", "wait", "getpid", "yield", "sleep", "brk", "null", "bench",
+};
+
+static int sys_exit(registers_t *regs)
+{
+    proc_exit((int)regs->ebx);
+    return 0;
+}
+
+static int sys_write(registers_t *regs)
+{
+    process_t *self = proc_current();
+    if (!vm_check(self->mm, regs->ebx, regs->ecx, false)) return -1;
+    kprintf("%.*s", (int)regs->ecx, (const char *)regs->ebx);
+    return (int)regs->ecx;
+}
+
+static int sys_fork(registers_t *regs)
+{
+    return proc_fork(regs);
+}
+
+/* Copies a NUL terminated user string of at most max - 1 characters */
+static bool user_string(mm_t *mm, uint32 addr, char *out, uint32 max)
+{
+    uint32 i;
+    for (i = 0; i < max; i++, addr++) {
+        if ((!i || !(addr & (PAGE_SIZE - 1))) && !vm_check(mm, addr, 1, false)) return false;
+        if (!(out[i] = *(const char *)addr)) return true;
+    }
+    return false;
+}
+
+static int sys_exec(registers_t *regs)
+{
+    char path[PROC_PATH_MAX];
+    if (!user_string(proc_current()->mm, regs->ebx, path, sizeof(path))) return -1;
+    return proc_exec(regs, path);
+}
+
+static int sys_wait(registers_t *regs)
+{
+    return proc_wait_pid(regs->ebx);
+}
+
+static int sys_getpid(registers_t *regs)
+{
+    return (int)proc_current()->pid;
+}
+
+static int sys_yield(registers_t *regs)
+{
+    thread_yield();
+    return 0;
+}
+
+static int sys_sleep(registers_t *regs)
+{
+    thread_sleep_ms(regs->ebx);
+    return 0;
+}
+
+static int sys_brk(registers_t *regs)
+{
+    return (int)vm_brk(proc_current()->mm, regs->ebx);
+}
+
+static int sys_null(registers_t *regs)
+{
+    return 0;
+}
+
+static int sys_bench(registers_t *regs)
+{
+    if (regs->ecx > BENCH_SAMPLES || !vm_check(proc_current()->mm, regs->ebx, regs->ecx * sizeof(uint32), false))
+        return -1;
+    bench_user_samples((const uint32 *)regs->ebx, regs->ecx);
+    return 0;
+}
+
+static const syscall_fn_t syscalls[SYSCALL_COUNT] = {
+    [SYS_EXIT] = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_FORK] = sys_fork,
+    [SYS_EXEC] = sys_exec,
+    [SYS_WAIT] = sys_wait,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_YIELD] = sys_yield,
+    [SYS_SLEEP] = sys_sleep,
+    [SYS_BRK] = sys_brk,
+    [SYS_NULL] = sys_null,
+    [SYS_BENCH] = sys_bench,
+};
+
+/* The Pentium Pro reports SEP without having it */
+static bool has_sysenter()
+{
+    uint32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP) || !(edx & CPUID_EDX_MSR)) return false;
+    return !(((eax >> 8) & 0xF) == 6 && ((eax >> 4) & 0xF) < 3 && (eax & 0xF) < 3);
+}
+
+void syscall_init()
+{
+    const uint8 *stub = syscall_stub_int80, *end = syscall_stub_int80_end;
+    set_idt_user_gate(SYSCALL_VECTOR, (uint32)syscall_entry);
+    fast = has_sysenter();
+    if (fast) {
+        stub = syscall_stub_sysenter;
+        end = syscall_stub_sysenter_end;
+    }
+    page_size = end - stub;
+    memory_copy((char *)stub, (char *)page, page_size);
+    syscall_init_cpu();
+}
+
+/* SYSENTER's MSRs, on every cpu */
+void syscall_init_cpu()
+{
+    uint32 id = this_cpu()->id;
+    uint32 *top = &entry_stacks[id][ENTRY_STACK_WORDS - 1];
+    if (!fast) return;
+    *top = (uint32)&gdt_tss(id)->esp0;
+    write_msr(MSR_SYSENTER_CS, SEG_KERNEL_CODE);
+    write_msr(MSR_SYSENTER_ESP, (uint32)top);
+    write_msr(MSR_SYSENTER_EIP, (uint32)sysenter_entry);
+}
+
+void syscall_handler(registers_t *regs)
+{
+    uint32 n = regs->eax;
+    if (regs->err_code) stats.sysenter++;
+    else stats.int80++;
+    if (n < SYSCALL_COUNT && proc_current()) {
+        stats.calls[n]++;
+        regs->eax = syscalls[n](regs);
+    } else {
+        stats.bad++;
+        regs->eax = (uint32)-1;
+    }
+    if (sched_need_resched()) schedule();
+}
+
+/* A single step from a caller with TF set, taken in sysenter_entry before
+   it turned TF off: drop it, the caller's TF is already saved */
+bool syscall_debug_trap(registers_t *regs)
+{
+    if ((regs->cs & 3) || regs->eip < (uint32)sysenter_entry || regs->eip > (uint32)sysenter_tf_off) return false;
+    regs->eflags &= ~EFLAGS_TF;
+    return true;
+}
+
+bool syscall_fast()
+{
+    return fast;
+}
+
+/* What processes get mapped at SYSCALL_PAGE */
+const uint8 *syscall_page(uint32 *size)
+{
+    *size = page_size;
+    return page;
+}
+
+const char *syscall_name(uint32 n)
+{
+    return n < SYSCALL_COUNT ? names[n] : "?";
+}
+
+const syscall_stats_t *syscall_stats()
+{
+    return &stats;
+}
@@ -10,3 +10,155 @@ void outportb (uint16 _port, uint8 _data)
 {
 	__asm__ __volatile__ ("outb %1, %0" : : "dN" (_port), "a" (_data));
 }
+
+uint16 inportw (uint16 _port)
+{
+	uint16 rv;
+	__asm__ __volatile__ ("inw %1, %0" : "=a" (rv) : "dN" (_port));
+	return rv;
+}
+
+void outportw (uint16 _port, uint16 _data)
+{
+	__asm__ __volatile__ ("outw %1, %0" : : "dN" (_port), "a" (_data));
+}
+
+uint32 inportl (uint16 _port)
+{
+	uint32 rv;
+	__asm__ __volatile__ ("inl %1, %0" : "=a" (rv) : "dN" (_port));
+	return rv;
+}
+
+void outportl (uint16 _port, uint32 _data)
+{
+	__asm__ __volatile__ ("outl %1, %0" : : "dN" (_port), "a" (_data));
+}
+
+/* One rep ins/outs moves the whole buffer, count is in words or dwords */
+void insw (uint16 _port, void *buf, uint32 count)
+{
+	__asm__ __volatile__ ("rep insw" : "+D" (buf), "+c" (count) : "d" (_port) : "memory");
+}
+
+void outsw (uint16 _port, const void *buf, uint32 count)
+{
+	__asm__ __volatile__ ("rep outsw" : "+S" (buf), "+c" (count) : "d" (_port) : "memory");
+}
+
+void insl (uint16 _port, void *buf, uint32 count)
+{
+	__asm__ __volatile__ ("rep insl" : "+D" (buf), "+c" (count) : "d" (_port) : "memory");
+}
+
+void outsl (uint16 _port, const void *buf, uint32 count)
+{
+	__asm__ __volatile__ ("rep outsl" : "+S" (buf), "+c" (count) : "d" (_port) : "memory");
+}
+
+void cpuid(uint32 leaf, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx)
+{
+	__asm__ __volatile__ ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (0));
+}
+
+uint32 read_cr0()
+{
+	uint32 value;
+	__asm__ __volatile__ ("mov %%cr0, %0" : "=r" (value));
+	return value;
+}
+
+void write_cr0(uint32 value)
+{
+	__asm__ __volatile__ ("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+uint32 read_cr2()
+{
+	uint32 value;
+	__asm__ __volatile__ ("mov %%cr2, %0" : "=r" (value));
+	return value;
+}
+
+uint32 read_cr3()
+{
+	uint32 value;
+	__asm__ __volatile__ ("mov %%cr3, %0" : "=r" (value));
+	return value;
+}
+
+void write_cr3(uint32 value)
+{
+	__asm__ __volatile__ ("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+uint32 read_cr4()
+{
+	uint32 value;
+	__asm__ __volatile__ ("mov %%cr4, %0" : "=r" (value));
+	return value;
+}
+
+void write_cr4(uint32 value)
+{
+	__asm__ __volatile__ ("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+void invlpg(uint32 addr)
+{
+	__asm__ __volatile__ ("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+uint64 rdtsc()
+{
+	uint64 value;
+	__asm__ __volatile__ ("rdtsc" : "=A" (value));
+	return value;
+}
+
+uint64 rdpmc(uint32 counter)
+{
+	uint64 value;
+	__asm__ __volatile__ ("rdpmc" : "=A" (value) : "c" (counter));
+	return value;
+}
+
+uint64 read_msr(uint32 msr)
+{
+	uint64 value;
+	__asm__ __volatile__ ("rdmsr" : "=A" (value) : "c" (msr));
+	return value;
+}
+
+void write_msr(uint32 msr, uint64 value)
+{
+	__asm__ __volatile__ ("wrmsr" : : "c" (msr), "A" (value) : "memory");
+}
+
+void cpu_relax()
+{
+	__asm__ __volatile__ ("pause" : : : "memory");
+}
+
+void interrupts_enable()
+{
+	__asm__ __volatile__ ("sti" : : : "memory");
+}
+
+void interrupts_disable()
+{
+	__asm__ __volatile__ ("cli" : : : "memory");
+}
+
+/* Disables interrupts and returns the previous EFLAGS for interrupts_restore */
+uint32 interrupts_save()
+{
+	uint32 flags;
+	__asm__ __volatile__ ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+	return flags;
+}
+
+void interrupts_restore(uint32 flags)
+{
+	__asm__ __volatile__ ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
@@ -0,0 +1,209 @@
+//hierarchical timer wheel
+
+#include "../include/timer.h"
+#include "../include/clock.h"
+#include "../include/system.h"
+#include "../include/spinlock.h"
+#include "../include/util.h"
+
+/*
+ * Five levels of slots in the classic layout: 256 one-tick slots, then
+ * four levels of 64 slots, each slot spanning the whole level below. A
+ * timer is filed under the coarsest level that still tells it apart from
+ * "now", so timer_add and timer_cancel are a list insert/unlink. Each time
+ * the first level wraps, the next slot of the level above is cascaded
+ * down, so a timer is moved at most four times before it fires.
+ *
+ * The clock is tickless, so timer_tick can be hours late or run many
+ * ticks at once. A bitmap of the occupied first-level slots lets it skip
+ * empty runs in one step (never across a first-level wrap, which still
+ * has to cascade), and timer_next_expiry tells the clock when the wheel
+ * next needs attention. An empty wheel is simply resynced to "now".
+ *
+ * One lock covers the wheel. It is dropped around each callback, which
+ * may re-add its own timer or wake a thread.
+ */
+
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+
+static ktimer_t *tv1[TVR_SIZE];
+static ktimer_t *tvn[TVN_LEVELS][TVN_SIZE];
+static uint32 tv1_bits[TVR_SIZE / 32];  // occupied tv1 slots
+static uint64 wheel_clock;              // next tick the wheel will process
+static uint32 pending_count;
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+static bool in_tv1(ktimer_t **slot) {
+    return slot >= tv1 && slot < tv1 + TVR_SIZE;
+}
+
+/* First occupied tv1 slot in [from, TVR_SIZE), TVR_SIZE if there is none */
+static uint32 tv1_find(uint32 from) {
+    uint32 word = from >> 5;
+    uint32 bits = tv1_bits[word] & (0xFFFFFFFF << (from & 31));
+    for (;;) {
+        if (bits) return (word << 5) + __builtin_ctz(bits);
+        if (++word == TVR_SIZE / 32) return TVR_SIZE;
+        bits = tv1_bits[word];
+    }
+}
+
+static void slot_insert(ktimer_t **slot, ktimer_t *timer) {
+    timer->slot = slot;
+    timer->prev = 0;
+    timer->next = *slot;
+    if (*slot) (*slot)->prev = timer;
+    *slot = timer;
+    if (in_tv1(slot)) {
+        uint32 index = slot - tv1;
+        tv1_bits[index >> 5] |= 1 << (index & 31);
+    }
+}
+
+static void slot_unlink(ktimer_t *timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else *timer->slot = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    if (!*timer->slot && in_tv1(timer->slot)) {
+        uint32 index = timer->slot - tv1;
+        tv1_bits[index >> 5] &= ~(1 << (index & 31));
+    }
+    timer->slot = 0;
+}
+
+static ktimer_t **slot_for(uint64 expires) {
+    if (expires < wheel_clock) expires = wheel_clock;      // already due: run on the next tick
+    uint64 delta = expires - wheel_clock;
+    if (delta < TVR_SIZE) return &tv1[expires & TVR_MASK];
+
+    uint32 level;
+    for (level = 0; level < TVN_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TVR_BITS + (level + 1) * TVN_BITS)))
+            return &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    /* Far future: clamp into the last level, cascading re-files it */
+    uint64 max_delta = (1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1;
+    if (delta > max_delta) expires = wheel_clock + max_delta;
+    return &tvn[TVN_LEVELS - 1][(expires >> (TVR_BITS + (TVN_LEVELS - 1) * TVN_BITS)) & TVN_MASK];
+}
+
+/* Re-files every timer of one upper-level slot; returns the slot index */
+static uint32 cascade(uint32 level) {
+    uint32 index = (wheel_clock >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+    ktimer_t *timer = tvn[level][index];
+    tvn[level][index] = 0;
+    while (timer) {
+        ktimer_t *next = timer->next;
+        slot_insert(slot_for(timer->expires), timer);
+        timer = next;
+    }
+    return index;
+}
+
+void timer_init() {
+    uint32 i, level;
+    for (i = 0; i < TVR_SIZE; i++) tv1[i] = 0;
+    for (i = 0; i < TVR_SIZE / 32; i++) tv1_bits[i] = 0;
+    for (level = 0; level < TVN_LEVELS; level++)
+        for (i = 0; i < TVN_SIZE; i++) tvn[level][i] = 0;
+    wheel_clock = clock_ticks();
+    pending_count = 0;
+}
+
+void timer_setup(ktimer_t *timer, timer_fn_t fn, void *arg) {
+    timer->next = timer->prev = 0;
+    timer->slot = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+/* (Re)arms timer to fire at tick expires */
+void timer_add(ktimer_t *timer, uint64 expires) {
+    uint32 flags = spin_lock_irqsave(&wheel_lock);
+    if (timer->slot) slot_unlink(timer);
+    else {
+        uint64 now = clock_ticks();
+        if (!pending_count && wheel_clock < now) wheel_clock = now;    // idle wheel, catch up
+        pending_count++;
+    }
+    timer->expires = expires;
+    slot_insert(slot_for(expires), timer);
+    clock_set_next_event(timer_next_expiry());
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+void timer_add_ms(ktimer_t *timer, uint32 ms) {
+    timer_add(timer, clock_ticks() + udiv64((uint64)ms * HZ + 999, 1000, 0));
+}
+
+void timer_cancel(ktimer_t *timer) {
+    uint32 flags = spin_lock_irqsave(&wheel_lock);
+    if (timer->slot) {
+        slot_unlink(timer);
+        pending_count--;
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+bool timer_pending(ktimer_t *timer) {
+    return timer->slot != 0;
+}
+
+/* Called from the clock interrupt; runs everything due up to the current tick.
+   A cancelled timer only leaves a spurious wakeup behind, so cancel never
+   reprograms the clock. */
+void timer_tick() {
+    uint64 now = clock_ticks();
+    uint32 flags = spin_lock_irqsave(&wheel_lock);
+    if (!pending_count && wheel_clock <= now) wheel_clock = now + 1;
+    while (wheel_clock <= now) {
+        uint32 index = wheel_clock & TVR_MASK;
+        uint32 level = 0;
+        if (!index) {
+            while (level < TVN_LEVELS && !cascade(level)) level++;
+        }
+        if (!tv1[index]) {
+            /* Jump to the next occupied slot, the next wrap or past now */
+            uint64 next = wheel_clock - index + tv1_find(index);
+            wheel_clock = next <= now ? next : now + 1;
+            continue;
+        }
+        /* Detach the slot first so callbacks re-adding themselves land on a later tick */
+        ktimer_t *work = tv1[index];
+        ktimer_t *timer;
+        tv1[index] = 0;
+        tv1_bits[index >> 5] &= ~(1 << (index & 31));
+        for (timer = work; timer; timer = timer->next) timer->slot = &work;
+        wheel_clock++;
+        while ((timer = work)) {
+            timer_fn_t fn = timer->fn;
+            void *arg = timer->arg;
+            slot_unlink(timer);
+            pending_count--;
+            spin_unlock(&wheel_lock);
+            fn(arg);
+            spin_lock(&wheel_lock);
+        }
+    }
+    clock_set_next_event(timer_next_expiry());
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+/* Tick the wheel next has work at: the first occupied tv1 slot before the
+   next wrap, otherwise the wrap itself so the upper levels cascade. Only
+   stable under the wheel lock. */
+uint64 timer_next_expiry() {
+    if (!pending_count) return CLOCK_NOT_ARMED;
+    uint32 index = wheel_clock & TVR_MASK;
+    return wheel_clock - index + tv1_find(index);
+}
+
+uint32 timer_pending_count() {
+    return pending_count;
+}
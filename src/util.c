@@ -1,15 +1,15 @@
 #include "../include/util.h"
+#include "../include/string.h"
+#include "../include/heap.h"
+#include "../include/memory.h"
 
+/* Note the (source, dest) order, these predate memcpy and friends */
 void memory_copy(char *source, char *dest, int nbytes) {
-    int i;
-    for (i = 0; i < nbytes; i++) {
-        *(dest + i) = *(source + i);             //    dest[i] = source[i]
-    }
+    if (nbytes > 0) memmove(dest, source, nbytes);
 }
 
 void memory_set(uint8 *dest, uint8 val, uint32 len) {
-    uint8 *temp = (uint8 *)dest;
-    for ( ; len != 0; len--) *temp++ = val;
+    memset(dest, val, len);
 }
 
 /**
@@ -33,7 +33,7 @@ string int_to_string(int n)
 {
 	string ch = malloc(50);
 	int_to_ascii(n,ch);
-	int len = strlength(ch);
+	int len = strlen(ch);
 	int i = 0;
 	int j = len - 1;
 	while(i<(len/2 + len%2))
@@ -46,31 +46,34 @@ string int_to_string(int n)
 	}
 	return ch;
 }
-int strncmp( const char * s1, const char * s2, size_t n )
+/* 64 by 32 bit division as two divl steps, so no __udivdi3 is needed */
+uint64 udiv64(uint64 n, uint32 d, uint32 *rem)
 {
-    while ( n && *s1 && ( *s1 == *s2 ) )
-    {
-        ++s1;
-        ++s2;
-        --n;
-    }
-    if ( n == 0 )
-    {
-        return 0;
-    }
-    else
-    {
-        return ( *(unsigned char *)s1 - *(unsigned char *)s2 );
-    }
+    uint32 high = (uint32)(n >> 32);
+    uint32 low = (uint32)n;
+    uint32 q_high = high / d;
+    uint32 r = high % d;
+    uint32 q_low;
+    __asm__ ("divl %4" : "=a" (q_low), "=d" (r) : "a" (low), "d" (r), "rm" (d));
+    if (rem) *rem = r;
+    return ((uint64)q_high << 32) | q_low;
+}
+
+/* (a * mul) >> shift for shift <= 32, keeping the high bits of the 96 bit product */
+uint64 mul_u64_u32_shr(uint64 a, uint32 mul, uint32 shift)
+{
+    uint64 low = (uint64)(uint32)a * mul;
+    uint64 high = (uint64)(uint32)(a >> 32) * mul;
+    return (high << (32 - shift)) + (low >> shift);
 }
 
 int str_to_int(string ch)
 {
 	int n = 0;
 	int p = 1;
-	int strlen = strlength(ch);
+	int len = strlen(ch);
 	int i;
-	for (i = strlen-1;i>=0;i--)
+	for (i = len-1;i>=0;i--)
 	{
 		n += ((int)(ch[i] - '0')) * p;
 		p *= 10;
@@ -79,37 +82,33 @@ int str_to_int(string ch)
 }
 void * malloc(int nbytes)
 {
-	char variable[nbytes];
-	return &variable;
+	return kmalloc(nbytes);
+}
+void free(void *ptr)
+{
+	kfree(ptr);
 }
 
+/* One pass, stops at the first mismatch */
 bool StartsWith(const char *a, const char *b)
 {
-   if(strncmp(a, b, strlength(b)) == 0) return 1;
-   return 0;
+   while(*b) if(*a++ != *b++) return 0;
+   return 1;
 }
 
 
-char **split(char *string, const char delimiter) {
-    int length = 0, count = 0, i = 0, j = 0;
-    while(*(string++)) {
-        if (*string == delimiter) count++;
-        length++;
+/* Splits line at spaces in place, filling argv with up to max - 1 words and
+   a terminating 0. Returns the word count, -1 if there were too many. */
+int tokenize(char *line, char **argv, int max) {
+    int argc = 0;
+    for (;;) {
+        while (*line == ' ' || *line == '\t') line++;
+        if (!*line) break;
+        if (argc == max - 1) return -1;
+        argv[argc++] = line;
+        while (*line && *line != ' ' && *line != '\t') line++;
+        if (*line) *line++ = 0;
     }
-    string -= (length + 1); // string was incremented one more than length
-    char **array = (char **)malloc(sizeof(char *) * (length + 1));
-    char ** base = array;
-    for(i = 0; i < (count + 1); i++) {
-        j = 0;
-        while(string[j] != delimiter) j++;
-        j++;
-        *array = (char *)malloc(sizeof(char) * j);
-        memory_copy(*array, string, (j-1));
-        (*array)[j-1] = '\0';
-        string += j;
-        array++;
-    }
-    *array = '\0';
-    return base;  
+    argv[argc] = 0;
+    return argc;
 }
-
@@ -0,0 +1,169 @@
+//virtio block driver
+
+#include "../include/virtblk.h"
+#include "../include/blk.h"
+#include "../include/heap.h"
+#include "../include/klog.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/virtio.h"
+
+/*
+ * Each virtio-blk function becomes a block device, vda and on. A
+ * transfer from the block layer is one virtio request: a header, a
+ * descriptor per merged request, and the status byte, in one chain.
+ *
+ * Unlike an IDE channel the device takes many requests at once, so
+ * start does not stop at one transfer: it takes everything queued that
+ * fits in the ring and publishes it with a single kick, and only marks
+ * the device busy when the ring or the slots run out. The completion
+ * interrupt takes everything the device has finished, then asks for the
+ * next interrupt only once half of what is still in flight is done, so
+ * a deep queue costs a fraction of an interrupt per request while a
+ * lone request still gets its interrupt straight away.
+ *
+ * A flush is a header and a status byte. A device without
+ * VIRTIO_BLK_F_FLUSH writes through, so there it succeeds on the spot.
+ *
+ * The ring is only touched under the block device's lock.
+ */
+
+typedef struct virtblk_slot {
+    struct {
+        uint32 type;
+        uint32 reserved;
+        uint64 sector;
+    } __attribute__((packed)) header;
+    volatile uint8 status;
+    blk_request_t *reqs;
+    struct virtblk_slot *next;              // free list
+} virtblk_slot_t;
+
+typedef struct {
+    virtio_dev_t vdev;
+    blk_device_t dev;
+    virtq_t *vq;
+    virtblk_slot_t *free;
+    uint32 in_flight;
+    bool read_only;
+    char desc[48];
+} virtblk_t;
+
+static uint32 ndisks;
+
+/* Called by the block layer with the device lock held */
+static void virtblk_start(blk_device_t *dev)
+{
+    virtblk_t *vb = (virtblk_t *)dev->driver;
+    virtq_buf_t bufs[BLK_MAX_SEGMENTS + 2];
+    while (dev->queue) {
+        virtblk_slot_t *slot = vb->free;
+        blk_request_t *reqs, *req;
+        uint32 lba, count, n = 1;
+        if (!slot || vb->vq->num_free < BLK_MAX_SEGMENTS + 2) {
+            dev->busy = true;                   // the next completion restarts us
+            break;
+        }
+        reqs = blk_next_transfer(dev, &lba, &count);
+        if (reqs->flush && !(vb->vdev.features & VIRTIO_BLK_F_FLUSH)) {
+            blk_complete(dev, reqs, BLK_OK);
+            continue;
+        }
+        if (reqs->write && !reqs->flush && vb->read_only) {
+            blk_complete(dev, reqs, BLK_ERROR);
+            continue;
+        }
+        vb->free = slot->next;
+        slot->header.type = reqs->flush ? VIRTIO_BLK_T_FLUSH : reqs->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        slot->header.reserved = 0;
+        slot->header.sector = lba;
+        slot->status = 0xFF;
+        slot->reqs = reqs;
+        bufs[0].addr = VIRT_TO_PHYS(&slot->header);
+        bufs[0].len = sizeof(slot->header);
+        for (req = reqs; req && !req->flush; req = req->next, n++) {
+            bufs[n].addr = VIRT_TO_PHYS(req->buf);
+            bufs[n].len = req->count * BLK_SECTOR_SIZE;
+        }
+        bufs[n].addr = VIRT_TO_PHYS(&slot->status);
+        bufs[n].len = 1;
+        if (reqs->write) virtq_add(vb->vq, bufs, n, 1, slot);
+        else virtq_add(vb->vq, bufs, 1, n, slot);
+        vb->in_flight++;
+    }
+    virtq_kick(vb->vq);
+}
+
+static void virtblk_interrupt(virtio_dev_t *vdev, uint8 isr)
+{
+    virtblk_t *vb = (virtblk_t *)vdev->driver;
+    virtblk_slot_t *slot;
+    if (!(isr & VIRTIO_ISR_QUEUE)) return;
+    spin_lock(&vb->dev.lock);
+    do {
+        while ((slot = (virtblk_slot_t *)virtq_get(vb->vq, 0))) {
+            blk_request_t *reqs = slot->reqs;
+            int status = slot->status == VIRTIO_BLK_S_OK ? BLK_OK : BLK_ERROR;
+            vb->in_flight--;
+            slot->next = vb->free;
+            vb->free = slot;
+            blk_complete(&vb->dev, reqs, status);       // may start more
+        }
+    } while (virtq_enable_interrupt(vb->vq, vb->in_flight ? (vb->in_flight - 1) / 2 : 0));
+    spin_unlock(&vb->dev.lock);
+}
+
+static void probe(const pci_device_t *pci)
+{
+    virtblk_t *vb = (virtblk_t *)kzalloc(sizeof(virtblk_t));
+    virtblk_slot_t *slots;
+    uint32 page, i;
+    if (!vb) return;
+    if (!virtio_setup(&vb->vdev, pci, VIRTIO_F_EVENT_IDX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH)) {
+        klog(KLOG_WARN, "virtio-blk: %02x:%02x.%u has no legacy interface or no IRQ", pci->addr.bus, pci->addr.slot, pci->addr.func);
+        kfree(vb);
+        return;
+    }
+    if ((vb->vdev.features & VIRTIO_BLK_F_SEG_MAX) && virtio_config32(&vb->vdev, VIRTIO_BLK_SEG_MAX) < BLK_MAX_SEGMENTS) {
+        klog(KLOG_WARN, "virtio-blk: takes fewer than %u segments", BLK_MAX_SEGMENTS);
+        goto fail;
+    }
+    vb->vq = virtq_create(&vb->vdev, 0);
+    page = pmm_alloc_frames(0);
+    if (!vb->vq || vb->vq->size < BLK_MAX_SEGMENTS + 2 || page == PMM_NO_FRAME) goto fail;
+    slots = (virtblk_slot_t *)PHYS_TO_VIRT(page);
+    for (i = 0; i < PAGE_SIZE / sizeof(virtblk_slot_t) && i < vb->vq->size / 3; i++) {
+        slots[i].next = vb->free;
+        vb->free = &slots[i];
+    }
+
+    vb->read_only = (vb->vdev.features & VIRTIO_BLK_F_RO) != 0;
+    vb->dev.sectors = virtio_config32(&vb->vdev, VIRTIO_BLK_CAPACITY + 4) ? 0xFFFFFFFF   // past 2 TiB, cut off
+                                                                           : virtio_config32(&vb->vdev, VIRTIO_BLK_CAPACITY);
+    ksnprintf(vb->dev.name, sizeof(vb->dev.name), "vd%c", 'a' + ndisks++);
+    memcpy(vb->vdev.name, vb->dev.name, sizeof(vb->vdev.name));
+    ksnprintf(vb->desc, sizeof(vb->desc), "virtio, %u-entry ring%s%s", vb->vq->size,
+              vb->vdev.event_idx ? ", event idx" : "", vb->read_only ? ", read only" : "");
+    vb->dev.desc = vb->desc;
+    vb->dev.start = virtblk_start;
+    vb->dev.driver = vb;
+    vb->vdev.interrupt = virtblk_interrupt;
+    vb->vdev.driver = vb;
+    virtio_ready(&vb->vdev);
+    virtq_enable_interrupt(vb->vq, 0);
+    blk_register(&vb->dev);
+    klog(KLOG_INFO, "virtio-blk: %s %s, %u MiB, irq %u", vb->dev.name, vb->desc, vb->dev.sectors / 2048, pci->irq);
+    return;
+fail:
+    virtio_fail(&vb->vdev);
+    klog(KLOG_WARN, "virtio-blk: %02x:%02x.%u not usable", pci->addr.bus, pci->addr.slot, pci->addr.func);
+}
+
+void virtblk_init()
+{
+    const pci_device_t *pci;
+    uint32 index = 0;
+    while ((pci = pci_find_device(VIRTIO_VENDOR, VIRTIO_DEVICE_BLK, &index))) probe(pci);
+}
@@ -0,0 +1,235 @@
+//virtio over legacy PCI
+
+#include "../include/virtio.h"
+#include "../include/heap.h"
+#include "../include/isr.h"
+#include "../include/klog.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * The legacy (0.9.5) transport: an I/O BAR with the feature words, queue
+ * registers, status, the interrupt status and the device config, which
+ * QEMU gives every transitional device. Queues are split virtqueues at
+ * the size the device asks for.
+ *
+ * What costs under a hypervisor is exits: every port access, and every
+ * interrupt. So buffers are added to the available ring without telling
+ * the device, and virtq_kick publishes the whole batch by writing the
+ * index once and notifies at most once. With VIRTIO_F_EVENT_IDX it does
+ * not notify at all unless the device asked to hear about an entry in
+ * the batch (avail_event), which it does not while it is still working
+ * through the ring. The other way round, used_event tells the device
+ * after how many more completions we want an interrupt, which is how
+ * the drivers coalesce them; without event idx there is only the on/off
+ * flag.
+ *
+ * PCI interrupts are level triggered and may be shared, so every device
+ * on a line has its ISR register read, which also lowers the line.
+ */
+
+static virtio_dev_t *lines[16];
+static virtio_dev_t *devices[VIRTIO_MAX_DEVICES];
+static uint32 ndevices;
+static uint32 spurious;
+
+static void virtio_irq(registers_t *regs)
+{
+    virtio_dev_t *dev;
+    bool claimed = false;
+    for (dev = lines[regs->int_no - IRQ_BASE]; dev; dev = dev->next) {
+        uint8 isr = inportb(dev->io + VIRTIO_ISR);
+        if (!isr) continue;
+        claimed = true;
+        dev->interrupts++;
+        dev->interrupt(dev, isr);
+    }
+    if (!claimed) spurious++;
+}
+
+/* Resets the device and agrees on whatever of features it offers */
+bool virtio_setup(virtio_dev_t *dev, const pci_device_t *pci, uint32 features)
+{
+    if (!(pci_read32(pci->addr, PCI_BAR0) & PCI_BAR_IO) || pci->irq == PCI_NO_IRQ) return false;
+    dev->pci = pci;
+    dev->io = pci_bar(pci->addr, 0);
+    dev->next = 0;
+    dev->nqueues = 0;
+    dev->interrupts = 0;
+    pci_enable(pci->addr, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    outportb(dev->io + VIRTIO_STATUS, 0);
+    outportb(dev->io + VIRTIO_STATUS, VIRTIO_STATUS_ACK);
+    outportb(dev->io + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    dev->features = inportl(dev->io + VIRTIO_HOST_FEATURES) & features;
+    outportl(dev->io + VIRTIO_GUEST_FEATURES, dev->features);
+    dev->event_idx = (dev->features & VIRTIO_F_EVENT_IDX) != 0;
+    return true;
+}
+
+/* Queues are set up and interrupt is set: let the device go */
+void virtio_ready(virtio_dev_t *dev)
+{
+    uint8 irq = dev->pci->irq;
+    uint32 flags = interrupts_save();
+    if (ndevices < VIRTIO_MAX_DEVICES) devices[ndevices++] = dev;
+    dev->next = lines[irq];
+    lines[irq] = dev;
+    if (!dev->next) irq_register_handler(irq, virtio_irq);
+    interrupts_restore(flags);
+    outportb(dev->io + VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_dev_t *dev)
+{
+    outportb(dev->io + VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+}
+
+uint8 virtio_config8(virtio_dev_t *dev, uint32 offset)
+{
+    return inportb(dev->io + VIRTIO_CONFIG + offset);
+}
+
+uint32 virtio_config32(virtio_dev_t *dev, uint32 offset)
+{
+    return inportl(dev->io + VIRTIO_CONFIG + offset);
+}
+
+/* Interrupts no device on the line owned up to */
+uint32 virtio_spurious()
+{
+    return spurious;
+}
+
+uint32 virtio_count()
+{
+    return ndevices;
+}
+
+virtio_dev_t *virtio_device(uint32 index)
+{
+    return index < ndevices ? devices[index] : 0;
+}
+
+virtq_t *virtq_create(virtio_dev_t *dev, uint16 index)
+{
+    virtq_t *vq;
+    uint32 size, used_offset, bytes, i;
+    uint8 *mem;
+    if (dev->nqueues == VIRTIO_MAX_QUEUES) return 0;
+    outportw(dev->io + VIRTIO_QUEUE_SELECT, index);
+    size = inportw(dev->io + VIRTIO_QUEUE_SIZE);
+    if (!size || size > VIRTQ_MAX_SIZE || (size & (size - 1)) || inportl(dev->io + VIRTIO_QUEUE_PFN)) return 0;
+    used_offset = (size * sizeof(virtq_desc_t) + 6 + size * 2 + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+    bytes = used_offset + ((6 + size * sizeof(virtq_used_elem_t) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1));
+
+    vq = (virtq_t *)kzalloc(sizeof(virtq_t));
+    if (!vq) return 0;
+    vq->cookies = (void **)kzalloc(size * sizeof(void *));
+    while ((PAGE_SIZE << vq->order) < bytes) vq->order++;
+    vq->phys = vq->cookies ? pmm_alloc_frames(vq->order) : PMM_NO_FRAME;
+    if (vq->phys == PMM_NO_FRAME) {
+        kfree(vq->cookies);
+        kfree(vq);
+        return 0;
+    }
+    mem = (uint8 *)PHYS_TO_VIRT(vq->phys);
+    memory_set(mem, 0, bytes);
+    vq->dev = dev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (virtq_desc_t *)mem;
+    vq->avail = (volatile virtq_avail_t *)(mem + size * sizeof(virtq_desc_t));
+    vq->used = (volatile virtq_used_t *)(mem + used_offset);
+    vq->used_event = (volatile uint16 *)((uint8 *)vq->avail + 4 + size * 2);
+    vq->avail_event = (volatile uint16 *)&vq->used->ring[size];
+    for (i = 0; i < size; i++) vq->desc[i].next = i + 1;
+    vq->num_free = size;
+    outportl(dev->io + VIRTIO_QUEUE_PFN, vq->phys >> PAGE_SHIFT);
+    dev->queues[dev->nqueues++] = vq;
+    return vq;
+}
+
+/* Chains out device-readable buffers, then in writable ones, under one
+   head; the device sees it at the next kick. Returns the head or -1. */
+int virtq_add(virtq_t *vq, const virtq_buf_t *bufs, uint32 out, uint32 in, void *cookie)
+{
+    uint32 n = out + in, k;
+    uint16 head = vq->free_head, i = head;
+    if (!n || n > vq->num_free) return -1;
+    for (k = 0; k < n; k++) {
+        virtq_desc_t *d = &vq->desc[i];
+        d->addr = bufs[k].addr;
+        d->len = bufs[k].len;
+        d->flags = (k >= out ? VIRTQ_DESC_WRITE : 0) | (k + 1 < n ? VIRTQ_DESC_NEXT : 0);
+        i = d->next;
+    }
+    vq->free_head = i;
+    vq->num_free -= n;
+    vq->cookies[head] = cookie;
+    vq->avail->ring[vq->avail_idx & (vq->size - 1)] = head;
+    vq->avail_idx++;
+    vq->stats.adds++;
+    return head;
+}
+
+/* Publishes everything added since the last kick, and notifies the
+   device if it wants to be */
+void virtq_kick(virtq_t *vq)
+{
+    uint16 old = vq->kicked_idx, now = vq->avail_idx;
+    bool notify;
+    if (old == now) return;
+    __sync_synchronize();                   // the ring entries before the index
+    vq->avail->idx = now;
+    vq->kicked_idx = now;
+    __sync_synchronize();                   // the index out before we read what the device wants
+    if (vq->dev->event_idx) notify = (uint16)(now - *vq->avail_event - 1) < (uint16)(now - old);
+    else notify = !(vq->used->flags & VIRTQ_USED_NO_NOTIFY);
+    vq->stats.kicks++;
+    if (!notify) return;
+    outportw(vq->dev->io + VIRTIO_QUEUE_NOTIFY, vq->index);
+    vq->stats.notifies++;
+}
+
+/* The next completed chain's cookie, its descriptors freed; 0 if none */
+void *virtq_get(virtq_t *vq, uint32 *len)
+{
+    uint16 id, last, n = 1;
+    void *cookie;
+    if (vq->last_used == vq->used->idx) return 0;
+    __sync_synchronize();                   // the index before the entry it covers
+    id = vq->used->ring[vq->last_used & (vq->size - 1)].id;
+    if (len) *len = vq->used->ring[vq->last_used & (vq->size - 1)].len;
+    vq->last_used++;
+    for (last = id; vq->desc[last].flags & VIRTQ_DESC_NEXT; last = vq->desc[last].next) n++;
+    vq->desc[last].next = vq->free_head;
+    vq->free_head = id;
+    vq->num_free += n;
+    cookie = vq->cookies[id];
+    vq->cookies[id] = 0;
+    vq->stats.completions++;
+    return cookie;
+}
+
+/* Asks for an interrupt once after more completions past the ones taken
+   (always the next one without event idx). True if the device already
+   got there, and the caller has to look again itself. */
+bool virtq_enable_interrupt(virtq_t *vq, uint16 after)
+{
+    if (vq->dev->event_idx) *vq->used_event = vq->last_used + after;
+    else {
+        vq->avail->flags &= ~VIRTQ_AVAIL_NO_INTERRUPT;
+        after = 0;
+    }
+    __sync_synchronize();                   // used_event out before used->idx is read
+    return (uint16)(vq->used->idx - vq->last_used) > after;
+}
+
+/* A hint: the device may still interrupt once for what it is finishing */
+void virtq_disable_interrupt(virtq_t *vq)
+{
+    if (vq->dev->event_idx) *vq->used_event = vq->last_used - 1;    // a wrap away
+    else vq->avail->flags |= VIRTQ_AVAIL_NO_INTERRUPT;
+}
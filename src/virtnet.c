@@ -0,0 +1,180 @@
+//virtio network driver
+
+#include "../include/virtnet.h"
+#include "../include/heap.h"
+#include "../include/klog.h"
+#include "../include/kprintf.h"
+#include "../include/memory.h"
+#include "../include/net.h"
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+#include "../include/util.h"
+#include "../include/virtio.h"
+#include "../include/workqueue.h"
+
+/*
+ * Each virtio-net function becomes an interface, eth0 and on, with one
+ * receive and one transmit queue. Frames are copied into and out of
+ * fixed 2 KiB slots, the virtio header in the first 16 bytes of the slot
+ * and the frame after it, a two-descriptor chain each.
+ *
+ * Receive works like NAPI: the interrupt turns further receive
+ * interrupts off and queues the receive work, which takes up to
+ * VIRTNET_RX_BUDGET frames, puts their slots back in the ring with one
+ * kick for the lot, and only turns the interrupt back on once the ring
+ * is empty. A burst of frames costs one interrupt.
+ *
+ * Transmit is batched by the caller: send only adds to the ring and
+ * flush kicks once. Transmit interrupts stay off; finished slots are
+ * taken back when send runs out of them.
+ */
+
+typedef struct {
+    virtio_dev_t vdev;
+    net_device_t net;
+    virtq_t *rx;
+    virtq_t *tx;
+    spinlock_t rx_lock;
+    spinlock_t tx_lock;
+    work_t rx_work;
+    uint8 *tx_free[VIRTNET_BUFFERS];
+    uint32 ntx_free;
+    char desc[48];
+} virtnet_t;
+
+static const uint8 default_mac[ETH_ALEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };     // QEMU's, if the device has none
+static uint32 nnics;
+
+static void add_rx(virtnet_t *vn, uint8 *slot)
+{
+    virtq_buf_t bufs[2];
+    bufs[0].addr = VIRT_TO_PHYS(slot);
+    bufs[0].len = VIRTNET_HDR_LEN;
+    bufs[1].addr = VIRT_TO_PHYS(slot + 16);
+    bufs[1].len = VIRTNET_SLOT - 16;
+    virtq_add(vn->rx, bufs, 0, 2, slot);
+}
+
+static void rx_worker(void *arg)
+{
+    virtnet_t *vn = (virtnet_t *)arg;
+    uint32 flags = spin_lock_irqsave(&vn->rx_lock), n, len;
+    uint8 *slot;
+    do {
+        for (n = 0; n < VIRTNET_RX_BUDGET && (slot = (uint8 *)virtq_get(vn->rx, &len)); n++) {
+            if (len > VIRTNET_HDR_LEN) net_receive(&vn->net, slot + 16, len - VIRTNET_HDR_LEN);
+            else vn->net.stats.rx_dropped++;
+            add_rx(vn, slot);
+        }
+        virtq_kick(vn->rx);
+        if (n == VIRTNET_RX_BUDGET) {           // more to come, give others a turn first
+            spin_unlock_irqrestore(&vn->rx_lock, flags);
+            work_queue(&vn->rx_work);
+            return;
+        }
+    } while (virtq_enable_interrupt(vn->rx, 0));
+    spin_unlock_irqrestore(&vn->rx_lock, flags);
+}
+
+static void virtnet_interrupt(virtio_dev_t *vdev, uint8 isr)
+{
+    virtnet_t *vn = (virtnet_t *)vdev->driver;
+    if (!(isr & VIRTIO_ISR_QUEUE)) return;
+    spin_lock(&vn->rx_lock);
+    virtq_disable_interrupt(vn->rx);
+    spin_unlock(&vn->rx_lock);
+    work_queue(&vn->rx_work);
+}
+
+static bool virtnet_send(net_device_t *dev, const void *frame, uint32 len)
+{
+    virtnet_t *vn = (virtnet_t *)dev->driver;
+    virtq_buf_t bufs[2];
+    uint32 flags = spin_lock_irqsave(&vn->tx_lock);
+    uint8 *slot;
+    if (!vn->ntx_free) {
+        while ((slot = (uint8 *)virtq_get(vn->tx, 0))) vn->tx_free[vn->ntx_free++] = slot;
+    }
+    if (!vn->ntx_free) {
+        spin_unlock_irqrestore(&vn->tx_lock, flags);
+        return false;
+    }
+    slot = vn->tx_free[--vn->ntx_free];
+    memcpy(slot + 16, frame, len);
+    bufs[0].addr = VIRT_TO_PHYS(slot);
+    bufs[0].len = VIRTNET_HDR_LEN;
+    bufs[1].addr = VIRT_TO_PHYS(slot + 16);
+    bufs[1].len = len;
+    virtq_add(vn->tx, bufs, 2, 0, slot);
+    spin_unlock_irqrestore(&vn->tx_lock, flags);
+    return true;
+}
+
+static void virtnet_flush(net_device_t *dev)
+{
+    virtnet_t *vn = (virtnet_t *)dev->driver;
+    uint32 flags = spin_lock_irqsave(&vn->tx_lock);
+    virtq_kick(vn->tx);
+    spin_unlock_irqrestore(&vn->tx_lock, flags);
+}
+
+static void probe(const pci_device_t *pci)
+{
+    virtnet_t *vn = (virtnet_t *)kzalloc(sizeof(virtnet_t));
+    uint32 nrx, ntx, order = 0, pool, i;
+    uint8 *slots;
+    if (!vn) return;
+    if (!virtio_setup(&vn->vdev, pci, VIRTIO_F_EVENT_IDX | VIRTIO_NET_F_MAC)) {
+        klog(KLOG_WARN, "virtio-net: %02x:%02x.%u has no legacy interface or no IRQ", pci->addr.bus, pci->addr.slot, pci->addr.func);
+        kfree(vn);
+        return;
+    }
+    vn->rx = virtq_create(&vn->vdev, 0);
+    vn->tx = virtq_create(&vn->vdev, 1);
+    if (!vn->rx || !vn->tx) goto fail;
+    nrx = vn->rx->size / 2 < VIRTNET_BUFFERS ? vn->rx->size / 2 : VIRTNET_BUFFERS;
+    ntx = vn->tx->size / 2 < VIRTNET_BUFFERS ? vn->tx->size / 2 : VIRTNET_BUFFERS;
+    while ((PAGE_SIZE << order) < (nrx + ntx) * VIRTNET_SLOT) order++;
+    pool = pmm_alloc_frames(order);
+    if (pool == PMM_NO_FRAME) goto fail;
+    slots = (uint8 *)PHYS_TO_VIRT(pool);
+    memory_set(slots, 0, (nrx + ntx) * VIRTNET_SLOT);          // the headers stay zero
+    for (i = 0; i < nrx; i++) add_rx(vn, slots + i * VIRTNET_SLOT);
+    for (i = 0; i < ntx; i++) vn->tx_free[vn->ntx_free++] = slots + (nrx + i) * VIRTNET_SLOT;
+
+    memcpy(vn->net.mac, default_mac, ETH_ALEN);
+    vn->net.mac[ETH_ALEN - 1] += nnics;
+    for (i = 0; i < ETH_ALEN && (vn->vdev.features & VIRTIO_NET_F_MAC); i++) vn->net.mac[i] = virtio_config8(&vn->vdev, i);
+    ksnprintf(vn->net.name, sizeof(vn->net.name), "eth%u", nnics++);
+    memcpy(vn->vdev.name, vn->net.name, sizeof(vn->vdev.name));
+    ksnprintf(vn->desc, sizeof(vn->desc), "virtio, %u/%u-entry rings%s", vn->rx->size, vn->tx->size,
+              vn->vdev.event_idx ? ", event idx" : "");
+    vn->net.desc = vn->desc;
+    vn->net.send = virtnet_send;
+    vn->net.flush = virtnet_flush;
+    vn->net.driver = vn;
+    spin_init(&vn->rx_lock);
+    spin_init(&vn->tx_lock);
+    work_setup(&vn->rx_work, rx_worker, vn);
+    vn->vdev.interrupt = virtnet_interrupt;
+    vn->vdev.driver = vn;
+    virtio_ready(&vn->vdev);
+    virtq_disable_interrupt(vn->tx);
+    virtq_enable_interrupt(vn->rx, 0);
+    virtq_kick(vn->rx);
+    net_register(&vn->net);
+    klog(KLOG_INFO, "virtio-net: %s %02x:%02x:%02x:%02x:%02x:%02x, %s, irq %u", vn->net.name, vn->net.mac[0], vn->net.mac[1],
+         vn->net.mac[2], vn->net.mac[3], vn->net.mac[4], vn->net.mac[5], vn->desc, pci->irq);
+    return;
+fail:
+    virtio_fail(&vn->vdev);
+    klog(KLOG_WARN, "virtio-net: %02x:%02x.%u not usable", pci->addr.bus, pci->addr.slot, pci->addr.func);
+}
+
+void virtnet_init()
+{
+    const pci_device_t *pci;
+    uint32 index = 0;
+    while ((pci = pci_find_device(VIRTIO_VENDOR, VIRTIO_DEVICE_NET, &index))) probe(pci);
+}
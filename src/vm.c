@@ -0,0 +1,269 @@
+//user address spaces
+
+#include "../include/vm.h"
+#include "../include/heap.h"
+#include "../include/pmm.h"
+#include "../include/sched.h"
+#include "../include/system.h"
+#include "../include/util.h"
+
+/*
+ * An address space is a page directory and a sorted list of areas. Only
+ * the areas are set up front: a page gets its frame the first time it
+ * is touched, from the page fault handler, so starting a program costs
+ * a directory and a few areas however big it is, and memory use follows
+ * what it touches. Frames come from highmem first and are reached
+ * through kmap_atomic() for the fill.
+ *
+ * mm_clone shares every present page with the copy, both sides read
+ * only, and takes a frame reference for the copy. The first write on
+ * either side faults: a frame that still has other references is copied,
+ * the last one left with it is made writable again in place.
+ *
+ * Each address space belongs to one thread, the faults and the system
+ * calls that change it all run on that thread, so it has no lock. The
+ * fault handler runs with interrupts off, which is what kmap_atomic()
+ * wants.
+ */
+
+static vm_stats_t stats;
+
+static void put_areas(vm_area_t *area)
+{
+    while (area) {
+        vm_area_t *next = area->next;
+        kfree(area);
+        area = next;
+    }
+}
+
+mm_t *mm_create()
+{
+    mm_t *mm = (mm_t *)kzalloc(sizeof(mm_t));
+    if (!mm) return 0;
+    mm->dir = pagedir_create();
+    if (!mm->dir) {
+        kfree(mm);
+        return 0;
+    }
+    return mm;
+}
+
+/* Drops the frames behind the user pages of dir and its page tables */
+static void put_pages(uint32 *dir)
+{
+    uint32 i, j;
+    for (i = 0; i < PDE_INDEX(USER_END); i++) {
+        if (!(dir[i] & PTE_PRESENT)) continue;
+        uint32 *pt = (uint32 *)PHYS_TO_VIRT(dir[i] & PTE_FRAME);
+        for (j = 0; j < 1024; j++)
+            if (pt[j] & PTE_PRESENT) pmm_frame_put(pt[j] & PTE_FRAME);
+        pmm_free_frame(dir[i] & PTE_FRAME);
+    }
+}
+
+/* Nobody may be running on mm any more */
+void mm_destroy(mm_t *mm)
+{
+    put_pages(mm->dir);
+    pmm_free_frame(VIRT_TO_PHYS(mm->dir));
+    put_areas(mm->areas);
+    kfree(mm);
+}
+
+/* Copy-on-write copy of mm, which must be the current address space */
+mm_t *mm_clone(mm_t *mm)
+{
+    mm_t *copy = mm_create();
+    vm_area_t *area, **tail;
+    uint32 i, j;
+    if (!copy) return 0;
+
+    for (area = mm->areas, tail = &copy->areas; area; area = area->next, tail = &(*tail)->next) {
+        *tail = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+        if (!*tail) {
+            mm_destroy(copy);
+            return 0;
+        }
+        **tail = *area;
+        (*tail)->next = 0;
+        if (area == mm->heap) copy->heap = *tail;
+    }
+
+    for (i = 0; i < PDE_INDEX(USER_END); i++) {
+        if (!(mm->dir[i] & PTE_PRESENT)) continue;
+        uint32 table = pmm_alloc_frame();
+        if (table == PMM_NO_FRAME) {
+            mm_destroy(copy);
+            write_cr3(read_cr3());          // some of ours may be read only already
+            return 0;
+        }
+        uint32 *from = (uint32 *)PHYS_TO_VIRT(mm->dir[i] & PTE_FRAME);
+        uint32 *to = (uint32 *)PHYS_TO_VIRT(table);
+        for (j = 0; j < 1024; j++) {
+            if (from[j] & PTE_PRESENT) {
+                from[j] &= ~PTE_WRITE;
+                pmm_frame_get(from[j] & PTE_FRAME);
+            }
+            to[j] = from[j];
+        }
+        copy->dir[i] = table | (mm->dir[i] & ~PTE_FRAME);
+    }
+    copy->pages = mm->pages;
+    write_cr3(read_cr3());                  // our pages just went read only
+    return copy;
+}
+
+/* Loads mm's page directory, or the kernel's for 0 */
+void mm_activate(mm_t *mm)
+{
+    uint32 dir = VIRT_TO_PHYS(mm ? mm->dir : kernel_page_directory());
+    if (read_cr3() != dir) write_cr3(dir);
+}
+
+vm_area_t *vm_find(mm_t *mm, uint32 addr)
+{
+    vm_area_t *area;
+    for (area = mm->areas; area && area->start <= addr; area = area->next)
+        if (addr < area->end) return area;
+    return 0;
+}
+
+/* A new area over [start, start + size) rounded out to pages, or 0 */
+vm_area_t *vm_map(mm_t *mm, uint32 start, uint32 size, uint32 flags, const uint8 *file, uint32 file_size)
+{
+    uint32 first = start & PTE_FRAME;
+    uint32 end = (start + size + PAGE_SIZE - 1) & PTE_FRAME;
+    vm_area_t **link = &mm->areas, *area;
+    if (start + size < start || start + size > USER_END || file_size > size) return 0;
+    while (*link && (*link)->end <= first) link = &(*link)->next;
+    if (*link && (*link)->start < end) return 0;                // overlaps
+
+    area = (vm_area_t *)kmalloc(sizeof(vm_area_t));
+    if (!area) return 0;
+    area->start = first;
+    area->end = end;
+    area->flags = flags;
+    area->file = file;
+    area->file_start = start;
+    area->file_size = file ? file_size : 0;
+    area->next = *link;
+    *link = area;
+    return area;
+}
+
+/* Whether [addr, addr + len) is all mapped readable, and writable too if asked */
+bool vm_check(mm_t *mm, uint32 addr, uint32 len, bool write)
+{
+    uint32 want = VM_READ | (write ? VM_WRITE : 0);
+    if (addr + len < addr || addr + len > USER_END) return false;
+    while (len) {
+        vm_area_t *area = vm_find(mm, addr);
+        if (!area || (area->flags & want) != want) return false;
+        if (addr + len <= area->end) return true;
+        len -= area->end - addr;
+        addr = area->end;
+    }
+    return true;
+}
+
+/* Moves the end of the heap; returns the new end, or the old one if it cannot */
+uint32 vm_brk(mm_t *mm, uint32 end)
+{
+    vm_area_t *heap = mm->heap;
+    uint32 top, page;
+    if (!heap) return 0;
+    if (end < heap->start) return heap->end;                    // brk(0) asks where it is
+    top = (end + PAGE_SIZE - 1) & PTE_FRAME;
+    if (top > heap->end && (top > USER_END || (heap->next && top > heap->next->start))) return heap->end;
+    for (page = top; page < heap->end; page += PAGE_SIZE) {     // shrinking: let go of the pages
+        uint32 *pte = page_entry(mm->dir, page);
+        if (!pte || !(*pte & PTE_PRESENT)) continue;
+        pmm_frame_put(*pte & PTE_FRAME);
+        *pte = 0;
+        invlpg(page);
+        mm->pages--;
+    }
+    heap->end = top;
+    return top;
+}
+
+/* Zeroes frame and copies in the part of area's file that covers page */
+static void fill(vm_area_t *area, uint32 page, uint32 frame)
+{
+    uint8 *data = (uint8 *)kmap_atomic(frame, 0);
+    uint32 from = page, to = page + PAGE_SIZE;
+    memory_set(data, 0, PAGE_SIZE);
+    if (from < area->file_start) from = area->file_start;
+    if (to > area->file_start + area->file_size) to = area->file_start + area->file_size;
+    if (from < to) {
+        memory_copy((char *)area->file + (from - area->file_start), (char *)data + (from - page), to - from);
+        stats.file_fills++;
+    } else {
+        stats.zero_fills++;
+    }
+    kunmap_atomic(data);
+}
+
+/* Write to a shared read-only page */
+static bool copy_on_write(mm_t *mm, uint32 page, uint32 *pte)
+{
+    uint32 old = *pte & PTE_FRAME;
+    if (pmm_frame_refs(old) == 1) {
+        *pte |= PTE_WRITE;
+        invlpg(page);
+        stats.cow_reuses++;
+        return true;
+    }
+    uint32 frame = pmm_alloc_highmem_frame();
+    if (frame == PMM_NO_FRAME) return false;
+    uint8 *to = (uint8 *)kmap_atomic(frame, 0);
+    uint8 *from = (uint8 *)kmap_atomic(old, 1);
+    memory_copy((char *)from, (char *)to, PAGE_SIZE);
+    kunmap_atomic(from);
+    kunmap_atomic(to);
+    *pte = frame | (*pte & ~PTE_FRAME) | PTE_WRITE;
+    invlpg(page);
+    pmm_frame_put(old);
+    stats.cow_copies++;
+    return true;
+}
+
+/* The page fault handler's part for user addresses; false if the access
+   is bad or memory ran out, and the page fault is the caller's problem */
+bool vm_fault(uint32 addr, uint32 error)
+{
+    thread_t *self = thread_current();
+    mm_t *mm = self ? self->mm : 0;
+    uint32 page = addr & PTE_FRAME;
+    vm_area_t *area;
+    uint32 *pte;
+    stats.faults++;
+    if (!mm || addr >= USER_END || !(area = vm_find(mm, addr))) goto bad;
+    if ((error & PF_WRITE) && !(area->flags & VM_WRITE)) goto bad;
+
+    pte = page_entry(mm->dir, page);
+    if (error & PF_PRESENT) {
+        if (!(error & PF_WRITE) || !pte || !(*pte & PTE_PRESENT)) goto bad;
+        if (copy_on_write(mm, page, pte)) return true;
+        goto bad;
+    }
+    if (pte && (*pte & PTE_PRESENT)) return true;       // another fault got there first
+    uint32 frame = pmm_alloc_highmem_frame();
+    if (frame == PMM_NO_FRAME) goto bad;
+    fill(area, page, frame);
+    if (!map_page(mm->dir, page, frame, PTE_USER | (area->flags & VM_WRITE ? PTE_WRITE : 0))) {
+        pmm_frame_put(frame);
+        goto bad;
+    }
+    mm->pages++;
+    return true;
+bad:
+    stats.bad_faults++;
+    return false;
+}
+
+const vm_stats_t *vm_stats()
+{
+    return &stats;
+}
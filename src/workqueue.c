@@ -0,0 +1,104 @@
+//deferred work
+
+#include "../include/workqueue.h"
+#include "../include/sched.h"
+#include "../include/system.h"
+
+/*
+ * Interrupt handlers push work items onto a per-cpu list with a single
+ * compare-and-swap, no lock and no loop that depends on the consumer.
+ * The cpu's worker thread takes the whole list with one exchange, so
+ * however many items arrived since its last pass run as one batch, in
+ * the order they were queued. An item already waiting is not queued
+ * again; queueing it twice before it runs costs one run.
+ *
+ * Only the push that turns an empty list non-empty wakes the worker,
+ * through a wait queue whose lock the worker holds while it decides to
+ * sleep.
+ */
+
+typedef struct {
+    work_t *volatile head;
+    wait_queue_t wait;
+    thread_t *worker;
+    workqueue_stats_t stats;
+} worklist_t;
+
+static worklist_t lists[MAX_CPUS];
+
+void work_setup(work_t *work, work_fn_t fn, void *arg)
+{
+    work->next = 0;
+    work->fn = fn;
+    work->arg = arg;
+    work->pending = 0;
+}
+
+/* False if the item was still pending and has been merged */
+bool work_queue_on(cpu_t *cpu, work_t *work)
+{
+    worklist_t *list = &lists[cpu->id];
+    if (__sync_lock_test_and_set(&work->pending, 1)) {
+        __sync_fetch_and_add(&list->stats.coalesced, 1);
+        return false;
+    }
+    work_t *head;
+    do {
+        head = list->head;
+        work->next = head;
+    } while (!__sync_bool_compare_and_swap(&list->head, head, work));
+    __sync_fetch_and_add(&list->stats.queued, 1);
+    if (!head) wait_queue_wake_all(&list->wait);
+    return true;
+}
+
+bool work_queue(work_t *work)
+{
+    uint32 flags = interrupts_save();   // stay on this cpu while picking its list
+    bool queued = work_queue_on(this_cpu(), work);
+    interrupts_restore(flags);
+    return queued;
+}
+
+static void worker_thread(void *arg)
+{
+    worklist_t *list = (worklist_t *)arg;
+    for (;;) {
+        uint32 flags = spin_lock_irqsave(&list->wait.lock);
+        while (!list->head) wait_queue_sleep(&list->wait);
+        spin_unlock_irqrestore(&list->wait.lock, flags);
+
+        work_t *batch = __sync_lock_test_and_set(&list->head, 0);
+        work_t *fifo = 0;
+        while (batch) {                 // pushed newest first, run oldest first
+            work_t *next = batch->next;
+            batch->next = fifo;
+            fifo = batch;
+            batch = next;
+        }
+        list->stats.batches++;
+        while (fifo) {
+            work_t *work = fifo;
+            fifo = work->next;
+            __sync_lock_release(&work->pending);    // may be queued again from inside fn
+            list->stats.runs++;
+            work->fn(work->arg);
+        }
+    }
+}
+
+/* One pinned worker per online cpu, call after smp_init */
+void workqueue_init()
+{
+    uint32 i;
+    for (i = 0; i < cpu_count(); i++) {
+        cpu_t *cpu = cpu_get(i);
+        if (!cpu->online) continue;
+        lists[i].worker = thread_create_on(cpu, "worker", worker_thread, &lists[i]);
+    }
+}
+
+const workqueue_stats_t *workqueue_stats(uint32 cpu)
+{
+    return &lists[cpu].stats;
+}
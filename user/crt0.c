@@ -0,0 +1,8 @@
+//user program entry
+
+#include "user.h"
+
+void _start()
+{
+    exit(main());
+}
@@ -0,0 +1,40 @@
+//fork, copy-on-write and exec
+
+#include "user.h"
+
+static volatile uint32 value = 1;
+
+int main()
+{
+    int pid, code;
+    pid = fork();
+    if (pid < 0) {
+        puts("fork failed\n");
+        return 1;
+    }
+    if (!pid) {
+        value = 2;                          // a copy of the page, the parent keeps 1
+        puts("child: value ");
+        putu(value);
+        puts("\n");
+        return 7;
+    }
+    code = wait(pid);
+    puts("parent: child exited with ");
+    putu(code);
+    puts(", value ");
+    putu(value);
+    puts(value == 1 ? ", copy-on-write ok\n" : ", copy-on-write BROKEN\n");
+
+    pid = fork();
+    if (!pid) {
+        exec("bin/hello");
+        puts("exec failed\n");
+        return 1;
+    }
+    code = wait(pid);
+    puts("parent: hello exited with ");
+    putu(code);
+    puts("\n");
+    return 0;
+}
@@ -0,0 +1,24 @@
+//hello, from ring 3
+
+#include "user.h"
+
+static volatile char bss[64 * 1024];                 // zero filled, page by page, when touched
+static const char msg[] = "hello from ring 3, pid ";
+
+int main()
+{
+    uint32 i, heap, sum = 0;
+    puts(msg);
+    putu(getpid());
+
+    for (i = 0; i < sizeof(bss); i += 4096) sum += bss[i];     // all zero
+    for (i = 0; i < sizeof(bss); i += 4096) bss[i] = 1;
+    heap = brk(0);
+    if (brk(heap + 3 * 4096) < heap + 3 * 4096) {
+        puts("\nbrk failed\n");
+        return 1;
+    }
+    for (i = 0; i < 3 * 4096; i++) ((char *)heap)[i] = (char)i;
+    puts("\nbss and heap ok\n");
+    return sum;
+}
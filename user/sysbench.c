@@ -0,0 +1,29 @@
+//null system call latency, for the bench command
+
+#include "user.h"
+#include "../include/bench.h"
+
+/*
+ * Built twice: through the system call page, and with INT80 through the
+ * gate. Samples are timed here, in ring 3, so they include the way back,
+ * and go to the kernel with SYS_BENCH, which does the statistics.
+ */
+
+#ifdef INT80
+#define null() syscall3_int80(SYS_NULL, 0, 0, 0)
+#else
+#define null() syscall3(SYS_NULL, 0, 0, 0)
+#endif
+
+static uint32 samples[BENCH_SAMPLES];
+
+int main()
+{
+    uint32 i, j;
+    for (i = 0; i < BENCH_WARMUP + BENCH_SAMPLES; i++) {
+        uint32 start = rdtsc32();
+        for (j = 0; j < BENCH_SYSCALL_BATCH; j++) null();
+        if (i >= BENCH_WARMUP) samples[i - BENCH_WARMUP] = (rdtsc32() - start) / BENCH_SYSCALL_BATCH;
+    }
+    return syscall3(SYS_BENCH, (uint32)samples, BENCH_SAMPLES, 0);
+}
@@ -0,0 +1,63 @@
+#ifndef USER_H
+#define USER_H
+
+/* System call wrappers and a few helpers for programs in user/. Calls go
+   through the system call page, which picks SYSENTER or int 0x80. */
+
+#include "../include/syscall.h"
+
+static inline int syscall3(int n, uint32 a, uint32 b, uint32 c)
+{
+    int ret;
+    __asm__ __volatile__ ("call *%5" : "=a" (ret) : "a" (n), "b" (a), "c" (b), "d" (c), "r" (SYSCALL_PAGE) : "memory");
+    return ret;
+}
+
+/* The slow way in, whatever the page holds */
+static inline int syscall3_int80(int n, uint32 a, uint32 b, uint32 c)
+{
+    int ret;
+    __asm__ __volatile__ ("int $0x80" : "=a" (ret) : "a" (n), "b" (a), "c" (b), "d" (c) : "memory");
+    return ret;
+}
+
+static inline uint32 rdtsc32()
+{
+    uint32 lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return lo;
+}
+
+static inline void exit(int code) { syscall3(SYS_EXIT, code, 0, 0); for (;;); }
+static inline int write(const char *buf, uint32 len) { return syscall3(SYS_WRITE, (uint32)buf, len, 0); }
+static inline int fork() { return syscall3(SYS_FORK, 0, 0, 0); }
+static inline int exec(const char *path) { return syscall3(SYS_EXEC, (uint32)path, 0, 0); }
+static inline int wait(int pid) { return syscall3(SYS_WAIT, pid, 0, 0); }
+static inline int getpid() { return syscall3(SYS_GETPID, 0, 0, 0); }
+static inline void yield() { syscall3(SYS_YIELD, 0, 0, 0); }
+static inline void sleep_ms(uint32 ms) { syscall3(SYS_SLEEP, ms, 0, 0); }
+static inline uint32 brk(uint32 end) { return (uint32)syscall3(SYS_BRK, end, 0, 0); }
+
+static inline uint32 strlen(const char *s)
+{
+    uint32 n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static inline void puts(const char *s)
+{
+    write(s, strlen(s));
+}
+
+static inline void putu(uint32 v)
+{
+    char buf[12];
+    int i = sizeof(buf);
+    do buf[--i] = '0' + v % 10; while (v /= 10);
+    write(buf + i, sizeof(buf) - i);
+}
+
+int main();
+
+#endif